@@ -1,5 +1,6 @@
 #include "drvAsynSlsDetPort.h"
 #include "slsDetDriver.h"
+#include "slsDetAffinity.h"
 
 #include <iocsh.h>
 #include <epicsExit.h>
@@ -50,6 +51,11 @@ static void exitHandler(void *drvPvt) {
 #define SlsSetClockDividerString  "SLS_SET_SPEED"
 #define SlsGetGainModeString      "SLS_GET_GAIN"
 #define SlsSetGainModeString      "SLS_SET_GAIN"
+/* Port driver storage cell parameters (Jungfrau burst mode) */
+#define SlsGetStorageCellsString     "SLS_GET_STORAGE_CELLS"
+#define SlsSetStorageCellsString     "SLS_SET_STORAGE_CELLS"
+#define SlsGetStorageCellStartString "SLS_GET_STORAGE_CELL_START"
+#define SlsSetStorageCellStartString "SLS_SET_STORAGE_CELL_START"
 
 #define sizeofArray(arr) sizeof(arr) / sizeof(arr[0])
 
@@ -205,6 +211,10 @@ SlsDet::SlsDet(const char *portName, const std::vector<std::string>& hostnames,
   createParam(SlsSetClockDividerString,   asynParamInt32,   &_setClockDividerValue);
   createParam(SlsGetGainModeString,       asynParamInt32,   &_getGainModeValue);
   createParam(SlsSetGainModeString,       asynParamInt32,   &_setGainModeValue);
+  createParam(SlsGetStorageCellsString,   asynParamInt32,   &_getStorageCellsValue);
+  createParam(SlsSetStorageCellsString,   asynParamInt32,   &_setStorageCellsValue);
+  createParam(SlsGetStorageCellStartString, asynParamInt32, &_getStorageCellStartValue);
+  createParam(SlsSetStorageCellStartString, asynParamInt32, &_setStorageCellStartValue);
 
   /* Initialize the SlsInit parameter */
   for (int addr=0; addr<(int)_dets.size(); addr++) {
@@ -633,6 +643,10 @@ asynStatus SlsDet::readInt32(asynUser *pasynUser, epicsInt32 *value)
     status = readDetector(pasynUser, SlsDetMessage::ReadClockDivider);
   } else if (function == _getGainModeValue) {
     status = readDetector(pasynUser, SlsDetMessage::ReadGainMode);
+  } else if (function == _getStorageCellsValue) {
+    status = readDetector(pasynUser, SlsDetMessage::ReadStorageCells);
+  } else if (function == _getStorageCellStartValue) {
+    status = readDetector(pasynUser, SlsDetMessage::ReadStorageCellStart);
   } else { // Other functions we call the base class method
     return asynPortDriver::readInt32(pasynUser, value);
   }
@@ -674,6 +688,10 @@ asynStatus SlsDet::writeInt32(asynUser *pasynUser, epicsInt32 value)
     status = writeDetector(pasynUser, SlsDetMessage::WriteClockDivider, value);
   } else if (function == _setGainModeValue) {
     status = writeDetector(pasynUser, SlsDetMessage::WriteGainMode, value);
+  } else if (function == _setStorageCellsValue) {
+    status = writeDetector(pasynUser, SlsDetMessage::WriteStorageCells, value);
+  } else if (function == _setStorageCellStartValue) {
+    status = writeDetector(pasynUser, SlsDetMessage::WriteStorageCellStart, value);
   } else if (function == _detEnabledValue) {
     setIntegerParam(addr, function, value);
     callParamCallbacks(addr);
@@ -822,9 +840,48 @@ static void configCallFunc(const iocshArgBuf *args)
   SlsDetConfigure(args[0].sval, args[1].sval, args[2].ival, args[3].dval);
 }
 
+static const iocshArg affinityArg0 = { "Port name",    iocshArgString};
+static const iocshArg affinityArg1 = { "Thread class", iocshArgString};
+static const iocshArg affinityArg2 = { "Cores",        iocshArgString};
+static const iocshArg * const affinityArgs[] = {&affinityArg0,
+                                                &affinityArg1,
+                                                &affinityArg2};
+static const iocshFuncDef affinityFuncDef = {"slsDetSetAffinity", 3, affinityArgs};
+static void affinityCallFunc(const iocshArgBuf *args)
+{
+  if (!slsDetSetAffinity(args[0].sval, args[1].sval, args[2].sval)) {
+    printf("slsDetSetAffinity: invalid thread class %s or cores %s, the classes are "
+           "control, receive, process, write and all\n",
+           args[1].sval ? args[1].sval : "", args[2].sval ? args[2].sval : "");
+  }
+}
+
+static const iocshArg numaArg0 = { "Port name",              iocshArgString};
+static const iocshArg numaArg1 = { "NUMA node or interface", iocshArgString};
+static const iocshArg * const numaArgs[] = {&numaArg0,
+                                            &numaArg1};
+static const iocshFuncDef numaFuncDef = {"slsDetSetNumaNode", 2, numaArgs};
+static void numaCallFunc(const iocshArgBuf *args)
+{
+  if (!slsDetSetNumaNode(args[0].sval, args[1].sval)) {
+    printf("slsDetSetNumaNode: no NUMA node found for %s\n", args[1].sval ? args[1].sval : "");
+  }
+}
+
+static const iocshArg placementArg0 = { "Port name", iocshArgString};
+static const iocshArg * const placementArgs[] = {&placementArg0};
+static const iocshFuncDef placementFuncDef = {"slsDetAffinityReport", 1, placementArgs};
+static void placementCallFunc(const iocshArgBuf *args)
+{
+  slsDetAffinityReport(stdout, (args[0].sval && args[0].sval[0]) ? args[0].sval : NULL);
+}
+
 void drvSlsDetRegister(void)
 {
   iocshRegister(&configFuncDef,configCallFunc);
+  iocshRegister(&affinityFuncDef,affinityCallFunc);
+  iocshRegister(&numaFuncDef,numaCallFunc);
+  iocshRegister(&placementFuncDef,placementCallFunc);
 }
 
 extern "C" {
@@ -106,6 +106,10 @@ protected:
   int _setClockDividerValue;
   int _getGainModeValue;
   int _setGainModeValue;
+  int _getStorageCellsValue;
+  int _setStorageCellsValue;
+  int _getStorageCellStartValue;
+  int _setStorageCellStartValue;
 
 private:
   typedef std::vector<SlsDetDriver*> SlsDetList;
@@ -0,0 +1,3600 @@
+#include "drvSlsJungfrau.h"
+#include "slsDetAssembler.h"
+#include "slsDetFramePool.h"
+#include "slsDetFrameQueue.h"
+#include "slsDetEventBuilder.h"
+#include "slsDetPacketLoss.h"
+#include "slsDetConverter.h"
+#include "slsDetPedestal.h"
+#include "slsDetDrift.h"
+#include "slsDetQuantizer.h"
+#include "slsDetGeometry.h"
+#include "slsDetPublisher.h"
+#include "slsDetShmRing.h"
+#include "slsDetWriter.h"
+#include "slsDetCompressor.h"
+#include "slsDetBitshuffle.h"
+#include "slsDetReplay.h"
+#include "slsDetUdpReceiver.h"
+#include "slsDetCapture.h"
+#include "slsDetAffinity.h"
+#ifdef WITH_HDF5
+#include "slsDetHdf5Writer.h"
+#endif
+
+#include <sls_detector_defs.h>
+#include <sls_receiver_defs.h>
+#include <slsReceiverUsers.h>
+#include <asynInt32SyncIO.h>
+#include <iocsh.h>
+#include <epicsExit.h>
+#include <epicsString.h>
+#include <epicsAtomic.h>
+
+#include <epicsExport.h>
+
+#include <cstring>
+#include <cstdlib>
+
+static const char *driverName = "SlsJungfrau";
+
+static void exitHandler(void *drvPvt) {
+  SlsJungfrau *pPvt = (SlsJungfrau *)drvPvt;
+  pPvt->shutdown();
+}
+
+/* The TCP port the slsReceiver listens on by default */
+#define DEFAULT_RX_TCP_PORT (DEFAULT_PORTNO + 2)
+/* Messages the stream of a module can queue, a header and the data for each frame */
+#define STREAM_HWM 64
+/* Endpoints of modules whose UDP packets the driver receives itself */
+#define UDP_SCHEME "udp://"
+/* Receive buffer asked for on the UDP socket of each module, about 100 frames */
+#define UDP_SOCKET_BUFFER (128 * 1024 * 1024)
+/* Time in us the UDP receivers busy poll the device for, 0 to sleep until packets come */
+#define UDP_BUSY_POLL 0
+/* Seconds without a packet that end an acquisition of the UDP receivers */
+#define UDP_IDLE_TIME 5.0
+/* Default number of frames the assembler keeps in flight and how long it waits for them */
+#define DEFAULT_ASM_REORDER_WINDOW 4
+#define DEFAULT_ASM_TIMEOUT 0.5
+/* Default photon energy in keV for the photon output of the converter */
+#define DEFAULT_PHOTON_ENERGY 12.4
+/* Defaults of the pedestal run */
+#define DEFAULT_PED_FRAMES 1000
+#define DEFAULT_PED_SETTLE_FRAMES 100
+#define DEFAULT_PED_TIMEOUT 60.0
+/* Timeout of the gain settings written to the detector control port */
+#define PED_CONTROL_TIMEOUT 5.0
+/* How often a running pedestal stage updates its progress */
+#define PED_POLL_TIME 0.5
+#define PED_THREAD_TMO 5.0
+/* How often the packet loss parameters are refreshed while frames arrive */
+#define LOSS_UPDATE_PERIOD 1.0
+/* Default weight of a dark frame in the pedestal moving average */
+#define DEFAULT_DRIFT_ALPHA 0.01
+/* How often the drift parameters are refreshed while dark frames arrive */
+#define DRIFT_UPDATE_PERIOD 1.0
+/* Defaults of the preview publisher, clear of the slsReceiver streaming ports */
+#define DEFAULT_PUB_ENDPOINT "tcp://*:31001"
+#define DEFAULT_PUB_MAX_RATE 10.0
+#define DEFAULT_PUB_HWM 2
+/* Frames in the shared memory ring, and how often its readers are looked at */
+#define DEFAULT_SHM_SLOTS 16
+#define SHM_UPDATE_PERIOD 1.0
+/* Default number of frames waiting for the writer */
+#define DEFAULT_WRITE_QUEUE_DEPTH 8
+/* Default number of frames waiting to be processed, and how often the queues are looked at */
+#define DEFAULT_PROC_QUEUE_DEPTH 16
+#define DEFAULT_QUEUE_DECIMATE 2
+#define QUEUE_UPDATE_PERIOD 1.0
+/* Defaults of the event builder: pulses kept, and how long a frame waits for its pulse */
+#define DEFAULT_EVT_PULSES 4096
+#define DEFAULT_EVT_WINDOW 0.5
+#define EVT_UPDATE_PERIOD 1.0
+/* The storage cell the Jungfrau firmware starts a burst with by default */
+#define DEFAULT_CELL_START 15
+/* The Jungfrau firmware puts the storage cell of a frame in bits 8-11 of the debug word */
+#define SLS_CELL_SHIFT 8
+#define SLS_CELL_MASK 0xf
+/* With CellSplit the images of cell n go to address SLS_CELL_ADDR + n, address 0
+ * is left to the images of no cell in particular */
+#define SLS_CELL_ADDR 1
+/* Defaults of the HDF5 writer, zlib's fastest level keeps up best with the detector */
+#define DEFAULT_WRITE_FRAMES_PER_CHUNK 1
+#define DEFAULT_WRITE_THREADS 4
+#define DEFAULT_DEFLATE_LEVEL 1
+/* How long a writer setting waits in seconds for the frames still in the writer */
+#define WRITER_RELEASE_TIMEOUT 1.0
+/* Default rate of the replay in frames/s, 0 for as fast as the IOC takes them */
+#define DEFAULT_REPLAY_RATE 0.0
+/* How often the replay and latency parameters are refreshed while frames arrive */
+#define REPLAY_UPDATE_PERIOD 1.0
+/* Default size in MB of a packet capture file and how often its counters are updated */
+#define DEFAULT_CAPTURE_FILE_SIZE 1024
+#define CAPTURE_UPDATE_PERIOD 1.0
+/* How often the status thread pushes the counters of the frames to the parameters */
+#define STATUS_UPDATE_PERIOD 1.0
+/* How often the writer parameters are refreshed while frames are written */
+#define WRITE_UPDATE_PERIOD 1.0
+/* Default photon threshold of the photon counting writer, rounding to the nearest photon */
+#define DEFAULT_WRITE_PHOTON_THRESHOLD 0.5
+
+/* Port driver receiver parameters */
+#define SlsNumModulesString       "SLS_NUM_MODULES"
+#define SlsRxTcpPortString        "SLS_RX_TCP_PORT"
+#define SlsRxStatusString         "SLS_RX_STATUS"
+#define SlsRxFramesCaughtString   "SLS_RX_FRAMES_CAUGHT"
+#define SlsRxFrameNumberString    "SLS_RX_FRAME_NUMBER"
+#define SlsRxTimestampString      "SLS_RX_TIMESTAMP"
+#define SlsRxBunchIdString        "SLS_RX_BUNCH_ID"
+#define SlsRxPacketsCaughtString  "SLS_RX_PACKETS_CAUGHT"
+#define SlsRxDroppedString        "SLS_RX_DROPPED"
+/* Port driver packet loss parameters */
+#define SlsRxFramesIncompleteString "SLS_RX_FRAMES_INCOMPLETE"
+#define SlsRxFramesMissedString     "SLS_RX_FRAMES_MISSED"
+#define SlsRxPacketsLostString      "SLS_RX_PACKETS_LOST"
+#define SlsRxLossRateString         "SLS_RX_LOSS_RATE"
+#define SlsRxBurstHistString        "SLS_RX_BURST_HIST"
+#define SlsRxWorstFramesString      "SLS_RX_WORST_FRAMES"
+#define SlsRxWorstLostString        "SLS_RX_WORST_LOST"
+#define SlsRxLossResetString        "SLS_RX_LOSS_RESET"
+/* Port driver stream subscriber parameters */
+#define SlsRxStreamEndpointString   "SLS_RX_STREAM_ENDPOINT"
+#define SlsRxStreamCoreString       "SLS_RX_STREAM_CORE"
+#define SlsRxStreamBadString        "SLS_RX_STREAM_BAD"
+#define SlsRxUdpLateString          "SLS_RX_UDP_LATE"
+#define SlsRxUdpMovedString         "SLS_RX_UDP_MOVED"
+#define SlsRxUdpSocketBufferString  "SLS_RX_UDP_SOCKET_BUFFER"
+/* Port driver assembler parameters */
+#define SlsAsmEnableString        "SLS_ASM_ENABLE"
+#define SlsAsmReorderWindowString "SLS_ASM_REORDER_WINDOW"
+#define SlsAsmTimeoutString       "SLS_ASM_TIMEOUT"
+#define SlsAsmCompleteString      "SLS_ASM_COMPLETE"
+#define SlsAsmIncompleteString    "SLS_ASM_INCOMPLETE"
+#define SlsAsmLateString          "SLS_ASM_LATE"
+#define SlsAsmNoBufferString      "SLS_ASM_NO_BUFFER"
+#define SlsAsmMissingMaskString   "SLS_ASM_MISSING_MASK"
+#define SlsPoolFramesString       "SLS_POOL_FRAMES"
+#define SlsPoolUsedString         "SLS_POOL_USED"
+#define SlsPoolHighWaterString    "SLS_POOL_HIGH_WATER"
+#define SlsPoolFailuresString     "SLS_POOL_FAILURES"
+#define SlsPoolPagesString        "SLS_POOL_PAGES"
+#define SlsPoolLockedString       "SLS_POOL_LOCKED"
+/* Port driver geometry parameters */
+#define SlsGeomGapPixelsString    "SLS_GEOM_GAP_PIXELS"
+#define SlsGeomFlipXString        "SLS_GEOM_FLIP_X"
+#define SlsGeomFlipYString        "SLS_GEOM_FLIP_Y"
+/* Port driver conversion parameters */
+#define SlsConvEnableString       "SLS_CONV_ENABLE"
+#define SlsConvOutputString       "SLS_CONV_OUTPUT"
+#define SlsConvPhotonEnergyString "SLS_CONV_PHOTON_ENERGY"
+#define SlsConvCalFileString      "SLS_CONV_CAL_FILE"
+#define SlsConvCalMessageString   "SLS_CONV_CAL_MESSAGE"
+#define SlsConvThreadsString      "SLS_CONV_THREADS"
+#define SlsConvKernelString       "SLS_CONV_KERNEL"
+#define SlsConvTimeString         "SLS_CONV_TIME"
+/* Port driver pedestal run parameters */
+#define SlsPedStartString         "SLS_PED_START"
+#define SlsPedStateString         "SLS_PED_STATE"
+#define SlsPedMessageString       "SLS_PED_MESSAGE"
+#define SlsPedFramesString        "SLS_PED_FRAMES"
+#define SlsPedSettleFramesString  "SLS_PED_SETTLE_FRAMES"
+#define SlsPedTimeoutString       "SLS_PED_TIMEOUT"
+#define SlsPedSetting0String      "SLS_PED_SETTING0"
+#define SlsPedSetting1String      "SLS_PED_SETTING1"
+#define SlsPedSetting2String      "SLS_PED_SETTING2"
+#define SlsPedControlPortString   "SLS_PED_CONTROL_PORT"
+#define SlsPedFileString          "SLS_PED_FILE"
+#define SlsPedProgressString      "SLS_PED_PROGRESS"
+/* Port driver pedestal drift parameters */
+#define SlsDriftEnableString      "SLS_DRIFT_ENABLE"
+#define SlsDriftModeString        "SLS_DRIFT_MODE"
+#define SlsDriftModulusString     "SLS_DRIFT_MODULUS"
+#define SlsDriftOffsetString      "SLS_DRIFT_OFFSET"
+#define SlsDriftBunchMaskString   "SLS_DRIFT_BUNCH_MASK"
+#define SlsDriftBunchValueString  "SLS_DRIFT_BUNCH_VALUE"
+#define SlsDriftAlphaString       "SLS_DRIFT_ALPHA"
+#define SlsDriftFramesString      "SLS_DRIFT_FRAMES"
+#define SlsDriftSkippedString     "SLS_DRIFT_SKIPPED"
+#define SlsDriftMeanShiftString   "SLS_DRIFT_MEAN_SHIFT"
+#define SlsDriftMaxShiftString    "SLS_DRIFT_MAX_SHIFT"
+#define SlsDriftResetString       "SLS_DRIFT_RESET"
+/* Port driver preview publisher parameters */
+#define SlsPubEnableString        "SLS_PUB_ENABLE"
+#define SlsPubEndpointString      "SLS_PUB_ENDPOINT"
+#define SlsPubSourceString        "SLS_PUB_SOURCE"
+#define SlsPubEveryString         "SLS_PUB_EVERY"
+#define SlsPubMaxRateString       "SLS_PUB_MAX_RATE"
+#define SlsPubHighWaterMarkString "SLS_PUB_HWM"
+#define SlsPubSentString          "SLS_PUB_SENT"
+#define SlsPubDecimatedString     "SLS_PUB_DECIMATED"
+#define SlsPubDroppedString       "SLS_PUB_DROPPED"
+#define SlsPubMessageString       "SLS_PUB_MESSAGE"
+/* Port driver shared memory ring parameters */
+#define SlsShmEnableString        "SLS_SHM_ENABLE"
+#define SlsShmNameString          "SLS_SHM_NAME"
+#define SlsShmSlotsString         "SLS_SHM_SLOTS"
+#define SlsShmSourceString        "SLS_SHM_SOURCE"
+#define SlsShmWrittenString       "SLS_SHM_WRITTEN"
+#define SlsShmReadersString       "SLS_SHM_READERS"
+#define SlsShmLagString           "SLS_SHM_LAG"
+#define SlsShmLostString          "SLS_SHM_LOST"
+#define SlsShmMessageString       "SLS_SHM_MESSAGE"
+/* Port driver writer parameters */
+#define SlsWriteEnableString        "SLS_WRITE_ENABLE"
+#define SlsWriteFormatString        "SLS_WRITE_FORMAT"
+#define SlsWritePathString          "SLS_WRITE_PATH"
+#define SlsWriteNameString          "SLS_WRITE_NAME"
+#define SlsWriteIndexString         "SLS_WRITE_INDEX"
+#define SlsWriteFramesPerFileString "SLS_WRITE_FRAMES_PER_FILE"
+#define SlsWriteQueueDepthString    "SLS_WRITE_QUEUE_DEPTH"
+#define SlsWriteCompressionString   "SLS_WRITE_COMPRESSION"
+#define SlsWriteFramesPerChunkString "SLS_WRITE_FRAMES_PER_CHUNK"
+#define SlsWriteThreadsString       "SLS_WRITE_THREADS"
+#define SlsWriteDirectString        "SLS_WRITE_DIRECT"
+#define SlsWriteDirectActiveString  "SLS_WRITE_DIRECT_ACTIVE"
+#define SlsWriteFramesString        "SLS_WRITE_FRAMES"
+#define SlsWriteDroppedString       "SLS_WRITE_DROPPED"
+#define SlsWriteFailedString        "SLS_WRITE_FAILED"
+#define SlsWriteRateString          "SLS_WRITE_RATE"
+#define SlsWriteLatencyString       "SLS_WRITE_LATENCY"
+#define SlsWriteMaxLatencyString    "SLS_WRITE_MAX_LATENCY"
+#define SlsWriteStatusString        "SLS_WRITE_STATUS"
+#define SlsWriteCompressRatioString "SLS_WRITE_COMPRESS_RATIO"
+#define SlsWriteThreadRateString    "SLS_WRITE_THREAD_RATE"
+#define SlsWriteThreadRatioString   "SLS_WRITE_THREAD_RATIO"
+#define SlsWritePhotonsString       "SLS_WRITE_PHOTONS"
+#define SlsWritePhotonThresholdString "SLS_WRITE_PHOTON_THRESHOLD"
+#define SlsWritePhotonCountString   "SLS_WRITE_PHOTON_COUNT"
+#define SlsWritePhotonErrorString   "SLS_WRITE_PHOTON_ERROR"
+#define SlsWritePhotonMaxErrorString "SLS_WRITE_PHOTON_MAX_ERROR"
+#define SlsWritePhotonMeanErrorString "SLS_WRITE_PHOTON_MEAN_ERROR"
+#define SlsWritePhotonDroppedString "SLS_WRITE_PHOTON_DROPPED"
+#define SlsWritePolicyString        "SLS_WRITE_POLICY"
+#define SlsWriteDecimateString      "SLS_WRITE_DECIMATE"
+#define SlsWritePriorityString      "SLS_WRITE_PRIORITY"
+#define SlsWriteQueueUsedString     "SLS_WRITE_QUEUE_USED"
+#define SlsWriteQueueHighWaterString "SLS_WRITE_QUEUE_HIGH_WATER"
+/* Port driver replay parameters */
+#define SlsReplayString             "SLS_REPLAY"
+#define SlsReplayPathString         "SLS_REPLAY_PATH"
+#define SlsReplayNameString         "SLS_REPLAY_NAME"
+#define SlsReplayIndexString        "SLS_REPLAY_INDEX"
+#define SlsReplayRateString         "SLS_REPLAY_RATE"
+#define SlsReplayLoopsString        "SLS_REPLAY_LOOPS"
+#define SlsReplayFramesString       "SLS_REPLAY_FRAMES"
+#define SlsReplayFrameRateString    "SLS_REPLAY_FRAME_RATE"
+#define SlsReplayThroughputString   "SLS_REPLAY_THROUGHPUT"
+#define SlsReplayBehindString       "SLS_REPLAY_BEHIND"
+#define SlsReplayStatusString       "SLS_REPLAY_STATUS"
+/* Port driver packet capture parameters */
+#define SlsCaptureString            "SLS_CAPTURE"
+#define SlsCaptureInterfaceString   "SLS_CAPTURE_INTERFACE"
+#define SlsCapturePortString        "SLS_CAPTURE_PORT"
+#define SlsCapturePathString        "SLS_CAPTURE_PATH"
+#define SlsCaptureNameString        "SLS_CAPTURE_NAME"
+#define SlsCaptureFileSizeString    "SLS_CAPTURE_FILE_SIZE"
+#define SlsCapturePacketsString     "SLS_CAPTURE_PACKETS"
+#define SlsCaptureRateString        "SLS_CAPTURE_RATE"
+#define SlsCaptureDroppedString     "SLS_CAPTURE_DROPPED"
+#define SlsCaptureFilesString       "SLS_CAPTURE_FILES"
+#define SlsCaptureStatusString      "SLS_CAPTURE_STATUS"
+/* Port driver pipeline latency parameters */
+#define SlsLatencyAssemblyString    "SLS_LATENCY_ASSEMBLY"
+#define SlsLatencyProcessString     "SLS_LATENCY_PROCESS"
+#define SlsLatencyTotalString       "SLS_LATENCY_TOTAL"
+#define SlsLatencyMaxString         "SLS_LATENCY_MAX"
+/* Port driver process queue parameters */
+#define SlsProcQueueDepthString     "SLS_PROC_QUEUE_DEPTH"
+#define SlsProcPolicyString         "SLS_PROC_POLICY"
+#define SlsProcDecimateString       "SLS_PROC_DECIMATE"
+#define SlsProcUsedString           "SLS_PROC_USED"
+#define SlsProcHighWaterString      "SLS_PROC_HIGH_WATER"
+#define SlsProcDroppedString        "SLS_PROC_DROPPED"
+#define SlsProcDecimatedString      "SLS_PROC_DECIMATED"
+#define SlsProcShedString           "SLS_PROC_SHED"
+/* Port driver event builder parameters */
+#define SlsEvtEnableString          "SLS_EVT_ENABLE"
+#define SlsEvtPulseIdString         "SLS_EVT_PULSE_ID"
+#define SlsEvtTimeEventString       "SLS_EVT_TIME_EVENT"
+#define SlsEvtWindowString          "SLS_EVT_WINDOW"
+#define SlsEvtPulsesString          "SLS_EVT_PULSES"
+#define SlsEvtMatchedString         "SLS_EVT_MATCHED"
+#define SlsEvtUnmatchedString       "SLS_EVT_UNMATCHED"
+#define SlsEvtLateString            "SLS_EVT_LATE"
+#define SlsEvtPendingString         "SLS_EVT_PENDING"
+#define SlsEvtDriftString           "SLS_EVT_DRIFT"
+#define SlsEvtJitterString          "SLS_EVT_JITTER"
+#define SlsEvtLockedString          "SLS_EVT_LOCKED"
+/* Port driver storage cell parameters */
+#define SlsCellsString              "SLS_CELLS"
+#define SlsCellStartString          "SLS_CELL_START"
+#define SlsCellSourceString         "SLS_CELL_SOURCE"
+#define SlsCellSplitString          "SLS_CELL_SPLIT"
+#define SlsCellMessageString        "SLS_CELL_MESSAGE"
+#define SlsCellTablesString         "SLS_CELL_TABLES"
+/* The parameters of the SlsDet control port the pedestal run uses */
+#define SlsCtrlSetGainString      "SLS_SET_GAIN"
+#define SlsCtrlGetGainString      "SLS_GET_GAIN"
+#define SlsCtrlSetStorageCellsString     "SLS_SET_STORAGE_CELLS"
+#define SlsCtrlSetStorageCellStartString "SLS_SET_STORAGE_CELL_START"
+
+/* Receiver status values */
+enum RxStatus { RX_DOWN=0, RX_IDLE=1, RX_RUNNING=2 };
+
+/* Pedestal run states */
+enum PedState { PED_IDLE=0, PED_SETTING_GAIN=1, PED_GAIN0=2, PED_GAIN1=3, PED_GAIN2=4,
+                PED_SAVING=5, PED_DONE=6, PED_FAILED=7, PED_ABORTED=8 };
+
+/* What the preview publisher sends */
+enum PubSource { PUB_ASSEMBLED=0, PUB_PROCESSED=1 };
+
+/* Which outputs win when the frames back up behind the processing */
+enum WritePriority { WRITE_BEST_EFFORT=0, WRITE_CRITICAL=1 };
+
+/* Where the storage cell of a frame is taken from */
+enum CellSource { CELL_HEADER=0, CELL_FRAME_NUMBER=1 };
+
+/* Fills cellList with the storage cells a burst of cells goes through,
+ * or with cell 0 alone outside burst mode, returning how many there are */
+static int cellsInUse(int cells, int cellStart, int *cellList)
+{
+  if (cells <= 1) {
+    cellList[0] = 0;
+    return 1;
+  }
+  for (int k=0; k<cells; k++) {
+    cellList[k] = (cellStart + k) % SLS_MAX_CELLS;
+  }
+  return cells;
+}
+
+/* Puts the storage cell in place of the %d in the pattern of a calibration
+ * file name, returning false if there is none */
+static bool cellFileName(char *name, size_t size, const char *pattern, int cell)
+{
+  const char *mark = std::strstr(pattern, "%d");
+
+  if (!mark) return false;
+  epicsSnprintf(name, size, "%.*s%d%s", (int) (mark - pattern), pattern, cell, mark + 2);
+  return true;
+}
+
+/** Hands the frames of the process stage back to the driver */
+class SlsJungfrauProcess : public SlsDetFrameSink {
+public:
+  SlsJungfrauProcess(SlsJungfrau *driver) : _driver(driver) {}
+  virtual void frameReady(SlsDetFrame *frame) { _driver->processFrame(frame); }
+
+private:
+  SlsJungfrau *_driver;
+};
+
+/* Trampolines for the slsReceiverUsers callbacks */
+static int startAcquisitionCallback(char *filePath, char *fileName, uint64_t fileIndex,
+                                    uint32_t dataSize, void *arg)
+{
+  SlsJungfrau::SlsJungfrauModule *mod = (SlsJungfrau::SlsJungfrauModule *) arg;
+  return mod->driver->startAcquisition(mod->module, filePath, fileName, fileIndex, dataSize);
+}
+
+static void acquisitionFinishedCallback(uint64_t framesCaught, void *arg)
+{
+  SlsJungfrau::SlsJungfrauModule *mod = (SlsJungfrau::SlsJungfrauModule *) arg;
+  mod->driver->acquisitionFinished(mod->module, framesCaught);
+}
+
+static void rawDataReadyCallback(char *header, char *data, uint32_t dataSize, void *arg)
+{
+  SlsJungfrau::SlsJungfrauModule *mod = (SlsJungfrau::SlsJungfrauModule *) arg;
+  mod->driver->rawDataReady(mod->module, header, data, dataSize);
+}
+
+/* Copies entry n of a list separated by spaces or commas, returning false past its end */
+static bool listEntry(const char *list, int n, char *entry, size_t size)
+{
+  const char *start;
+  size_t len;
+
+  if (!list) return false;
+  for (int index=0; ; index++) {
+    list += std::strspn(list, " \t,");
+    if (!*list) return false;
+    start = list;
+    list += std::strcspn(list, " \t,");
+    if (index == n) {
+      len = list - start;
+      if (len >= size) len = size - 1;
+      std::memcpy(entry, start, len);
+      entry[len] = '\0';
+      return true;
+    }
+  }
+}
+
+/* Hand the published buffers back once ZeroMQ is done with them */
+static void releaseFrame(void *data, void *hint)
+{
+  ((SlsDetFrame *) hint)->release();
+}
+
+static void releaseArray(void *data, void *hint)
+{
+  ((NDArray *) hint)->release();
+}
+
+/** Constructor for the SlsJungfrau class
+  */
+SlsJungfrau::SlsJungfrau(const char *portName, int numModules, int numModulesX, int gapPixels, int rxTcpPort,
+                         const char *streams, const char *cores, int numBuffers, int numConvThreads,
+                         size_t maxMemory, int priority, int stackSize)
+  : ADDriver(portName, numModules > SLS_CELL_ADDR + SLS_MAX_CELLS ? numModules : SLS_CELL_ADDR + SLS_MAX_CELLS,
+      0, 0, maxMemory,
+      0, 0,                 /* No interfaces beyond those set in ADDriver.cpp */
+      ASYN_MULTIDEVICE, 1,  /* ASYN_CANBLOCK=0, ASYN_MULTIDEVICE=1, autoConnect=1 */
+      priority, stackSize),
+    _numModules(numModules),
+    _rxTcpPort(rxTcpPort),
+    _modules(numModules),
+    _assembler(NULL),
+    _converter(NULL),
+    _pedestal(NULL),
+    _drift(NULL),
+    _quantizer(NULL),
+    _publisher(NULL),
+    _shmRing(NULL),
+    _procSink(NULL),
+    _procStage(NULL),
+    _procShed(0),
+    _eventBuilder(NULL),
+    _eventEnable(false),
+    _cells(1),
+    _cellStart(DEFAULT_CELL_START),
+    _cellSource(CELL_HEADER),
+    _cellsChanged(false),
+    _writer(NULL),
+    _writing(false),
+    _writeCritical(true),
+    _writePhotonEnergy(0.),
+    _writerUsers(0),
+    _writeProcLost(0),
+    _replay(NULL),
+    _capture(NULL),
+    _rxAcquire(0),
+    _rxCallbacks(0),
+    _rxAssemble(0),
+    _rxPedestal(0),
+    _procConvEnable(0),
+    _procConvOutput(0),
+    _procCellSplit(0),
+    _procDriftEnable(0),
+    _procPedState(0),
+    _procPubSource(0),
+    _procShmSource(0),
+    _procPhotonEnergy(0.),
+    _procPhotonThreshold(0.),
+    _latencyFrames(0),
+    _latencyAssembly(0.),
+    _latencyProcess(0.),
+    _latencyTotal(0.),
+    _latencyMax(0.),
+    _convTime(0.),
+    _pedRunning(true),
+    _pedRequested(false),
+    _pedAbort(false),
+    _pedThread(*this, "slsJungfrauPed", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityLow),
+    _statusRunning(true),
+    _status(this),
+    _statusThread(_status, "slsJungfrauStat", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityLow)
+{
+  char shmName[MAX_FILENAME_LEN];
+  static const char *functionName = "SlsJungfrau";
+
+  /* Create an EPICS exit handler */
+  epicsAtExit(exitHandler, this);
+
+  createParam(SlsNumModulesString,      asynParamInt32,   &_numModulesValue);
+  createParam(SlsRxTcpPortString,       asynParamInt32,   &_rxTcpPortValue);
+  createParam(SlsRxStatusString,        asynParamInt32,   &_rxStatusValue);
+  createParam(SlsRxFramesCaughtString,  asynParamFloat64, &_rxFramesCaughtValue);
+  createParam(SlsRxFrameNumberString,   asynParamFloat64, &_rxFrameNumberValue);
+  createParam(SlsRxTimestampString,     asynParamFloat64, &_rxTimestampValue);
+  createParam(SlsRxBunchIdString,       asynParamFloat64, &_rxBunchIdValue);
+  createParam(SlsRxPacketsCaughtString, asynParamInt32,   &_rxPacketsCaughtValue);
+  createParam(SlsRxDroppedString,       asynParamFloat64, &_rxDroppedValue);
+  createParam(SlsRxFramesIncompleteString, asynParamFloat64,      &_rxFramesIncompleteValue);
+  createParam(SlsRxFramesMissedString,     asynParamFloat64,      &_rxFramesMissedValue);
+  createParam(SlsRxPacketsLostString,      asynParamFloat64,      &_rxPacketsLostValue);
+  createParam(SlsRxLossRateString,         asynParamFloat64,      &_rxLossRateValue);
+  createParam(SlsRxBurstHistString,        asynParamInt32Array,   &_rxBurstHistValue);
+  createParam(SlsRxWorstFramesString,      asynParamFloat64Array, &_rxWorstFramesValue);
+  createParam(SlsRxWorstLostString,        asynParamInt32Array,   &_rxWorstLostValue);
+  createParam(SlsRxLossResetString,        asynParamInt32,        &_rxLossResetValue);
+  createParam(SlsRxStreamEndpointString,   asynParamOctet,        &_rxStreamEndpointValue);
+  createParam(SlsRxStreamCoreString,       asynParamInt32,        &_rxStreamCoreValue);
+  createParam(SlsRxStreamBadString,        asynParamFloat64,      &_rxStreamBadValue);
+  createParam(SlsRxUdpLateString,          asynParamFloat64,      &_rxUdpLateValue);
+  createParam(SlsRxUdpMovedString,         asynParamFloat64,      &_rxUdpMovedValue);
+  createParam(SlsRxUdpSocketBufferString,  asynParamInt32,        &_rxUdpSocketBufferValue);
+  createParam(SlsAsmEnableString,        asynParamInt32,   &_asmEnableValue);
+  createParam(SlsAsmReorderWindowString, asynParamInt32,   &_asmReorderWindowValue);
+  createParam(SlsAsmTimeoutString,       asynParamFloat64, &_asmTimeoutValue);
+  createParam(SlsAsmCompleteString,      asynParamFloat64, &_asmCompleteValue);
+  createParam(SlsAsmIncompleteString,    asynParamFloat64, &_asmIncompleteValue);
+  createParam(SlsAsmLateString,          asynParamFloat64, &_asmLateValue);
+  createParam(SlsAsmNoBufferString,      asynParamFloat64, &_asmNoBufferValue);
+  createParam(SlsAsmMissingMaskString,   asynParamFloat64, &_asmMissingMaskValue);
+  createParam(SlsPoolFramesString,       asynParamInt32,   &_poolFramesValue);
+  createParam(SlsPoolUsedString,         asynParamInt32,   &_poolUsedValue);
+  createParam(SlsPoolHighWaterString,    asynParamInt32,   &_poolHighWaterValue);
+  createParam(SlsPoolFailuresString,     asynParamFloat64, &_poolFailuresValue);
+  createParam(SlsPoolPagesString,        asynParamInt32,   &_poolPagesValue);
+  createParam(SlsPoolLockedString,       asynParamInt32,   &_poolLockedValue);
+  createParam(SlsGeomGapPixelsString,    asynParamInt32,   &_geomGapPixelsValue);
+  createParam(SlsGeomFlipXString,        asynParamInt32,   &_geomFlipXValue);
+  createParam(SlsGeomFlipYString,        asynParamInt32,   &_geomFlipYValue);
+  createParam(SlsConvEnableString,       asynParamInt32,   &_convEnableValue);
+  createParam(SlsConvOutputString,       asynParamInt32,   &_convOutputValue);
+  createParam(SlsConvPhotonEnergyString, asynParamFloat64, &_convPhotonEnergyValue);
+  createParam(SlsConvCalFileString,      asynParamOctet,   &_convCalFileValue);
+  createParam(SlsConvCalMessageString,   asynParamOctet,   &_convCalMessageValue);
+  createParam(SlsConvThreadsString,      asynParamInt32,   &_convThreadsValue);
+  createParam(SlsConvKernelString,       asynParamOctet,   &_convKernelValue);
+  createParam(SlsConvTimeString,         asynParamFloat64, &_convTimeValue);
+  createParam(SlsPedStartString,         asynParamInt32,   &_pedStartValue);
+  createParam(SlsPedStateString,         asynParamInt32,   &_pedStateValue);
+  createParam(SlsPedMessageString,       asynParamOctet,   &_pedMessageValue);
+  createParam(SlsPedFramesString,        asynParamInt32,   &_pedFramesValue);
+  createParam(SlsPedSettleFramesString,  asynParamInt32,   &_pedSettleFramesValue);
+  createParam(SlsPedTimeoutString,       asynParamFloat64, &_pedTimeoutValue);
+  createParam(SlsPedSetting0String,      asynParamInt32,   &_pedSetting0Value);
+  createParam(SlsPedSetting1String,      asynParamInt32,   &_pedSetting1Value);
+  createParam(SlsPedSetting2String,      asynParamInt32,   &_pedSetting2Value);
+  createParam(SlsPedControlPortString,   asynParamOctet,   &_pedControlPortValue);
+  createParam(SlsPedFileString,          asynParamOctet,   &_pedFileValue);
+  createParam(SlsPedProgressString,      asynParamInt32,   &_pedProgressValue);
+  createParam(SlsDriftEnableString,      asynParamInt32,   &_driftEnableValue);
+  createParam(SlsDriftModeString,        asynParamInt32,   &_driftModeValue);
+  createParam(SlsDriftModulusString,     asynParamInt32,   &_driftModulusValue);
+  createParam(SlsDriftOffsetString,      asynParamInt32,   &_driftOffsetValue);
+  createParam(SlsDriftBunchMaskString,   asynParamInt32,   &_driftBunchMaskValue);
+  createParam(SlsDriftBunchValueString,  asynParamInt32,   &_driftBunchValueValue);
+  createParam(SlsDriftAlphaString,       asynParamFloat64, &_driftAlphaValue);
+  createParam(SlsDriftFramesString,      asynParamFloat64, &_driftFramesValue);
+  createParam(SlsDriftSkippedString,     asynParamFloat64, &_driftSkippedValue);
+  createParam(SlsDriftMeanShiftString,   asynParamFloat64, &_driftMeanShiftValue);
+  createParam(SlsDriftMaxShiftString,    asynParamFloat64, &_driftMaxShiftValue);
+  createParam(SlsDriftResetString,       asynParamInt32,   &_driftResetValue);
+  createParam(SlsPubEnableString,        asynParamInt32,   &_pubEnableValue);
+  createParam(SlsPubEndpointString,      asynParamOctet,   &_pubEndpointValue);
+  createParam(SlsPubSourceString,        asynParamInt32,   &_pubSourceValue);
+  createParam(SlsPubEveryString,         asynParamInt32,   &_pubEveryValue);
+  createParam(SlsPubMaxRateString,       asynParamFloat64, &_pubMaxRateValue);
+  createParam(SlsPubHighWaterMarkString, asynParamInt32,   &_pubHighWaterMarkValue);
+  createParam(SlsPubSentString,          asynParamFloat64, &_pubSentValue);
+  createParam(SlsPubDecimatedString,     asynParamFloat64, &_pubDecimatedValue);
+  createParam(SlsPubDroppedString,       asynParamFloat64, &_pubDroppedValue);
+  createParam(SlsPubMessageString,       asynParamOctet,   &_pubMessageValue);
+  createParam(SlsShmEnableString,        asynParamInt32,   &_shmEnableValue);
+  createParam(SlsShmNameString,          asynParamOctet,   &_shmNameValue);
+  createParam(SlsShmSlotsString,         asynParamInt32,   &_shmSlotsValue);
+  createParam(SlsShmSourceString,        asynParamInt32,   &_shmSourceValue);
+  createParam(SlsShmWrittenString,       asynParamFloat64, &_shmWrittenValue);
+  createParam(SlsShmReadersString,       asynParamInt32,   &_shmReadersValue);
+  createParam(SlsShmLagString,           asynParamInt32,   &_shmLagValue);
+  createParam(SlsShmLostString,          asynParamFloat64, &_shmLostValue);
+  createParam(SlsShmMessageString,       asynParamOctet,   &_shmMessageValue);
+  createParam(SlsWriteEnableString,        asynParamInt32,   &_writeEnableValue);
+  createParam(SlsWriteFormatString,        asynParamInt32,   &_writeFormatValue);
+  createParam(SlsWritePathString,          asynParamOctet,   &_writePathValue);
+  createParam(SlsWriteNameString,          asynParamOctet,   &_writeNameValue);
+  createParam(SlsWriteIndexString,         asynParamInt32,   &_writeIndexValue);
+  createParam(SlsWriteFramesPerFileString, asynParamInt32,   &_writeFramesPerFileValue);
+  createParam(SlsWriteQueueDepthString,    asynParamInt32,   &_writeQueueDepthValue);
+  createParam(SlsWriteCompressionString,   asynParamInt32,   &_writeCompressionValue);
+  createParam(SlsWriteFramesPerChunkString, asynParamInt32,  &_writeFramesPerChunkValue);
+  createParam(SlsWriteThreadsString,       asynParamInt32,   &_writeThreadsValue);
+  createParam(SlsWriteDirectString,        asynParamInt32,   &_writeDirectValue);
+  createParam(SlsWriteDirectActiveString,  asynParamInt32,   &_writeDirectActiveValue);
+  createParam(SlsWriteFramesString,        asynParamFloat64, &_writeFramesValue);
+  createParam(SlsWriteDroppedString,       asynParamFloat64, &_writeDroppedValue);
+  createParam(SlsWriteFailedString,        asynParamFloat64, &_writeFailedValue);
+  createParam(SlsWriteRateString,          asynParamFloat64, &_writeRateValue);
+  createParam(SlsWriteLatencyString,       asynParamFloat64, &_writeLatencyValue);
+  createParam(SlsWriteMaxLatencyString,    asynParamFloat64, &_writeMaxLatencyValue);
+  createParam(SlsWriteStatusString,        asynParamOctet,   &_writeStatusValue);
+  createParam(SlsWriteCompressRatioString, asynParamFloat64, &_writeCompressRatioValue);
+  createParam(SlsWriteThreadRateString,    asynParamFloat64Array, &_writeThreadRateValue);
+  createParam(SlsWriteThreadRatioString,   asynParamFloat64Array, &_writeThreadRatioValue);
+  createParam(SlsWritePhotonsString,       asynParamInt32,   &_writePhotonsValue);
+  createParam(SlsWritePhotonThresholdString, asynParamFloat64, &_writePhotonThresholdValue);
+  createParam(SlsWritePhotonCountString,   asynParamFloat64, &_writePhotonCountValue);
+  createParam(SlsWritePhotonErrorString,   asynParamFloat64, &_writePhotonErrorValue);
+  createParam(SlsWritePhotonMaxErrorString, asynParamFloat64, &_writePhotonMaxErrorValue);
+  createParam(SlsWritePhotonMeanErrorString, asynParamFloat64, &_writePhotonMeanErrorValue);
+  createParam(SlsWritePhotonDroppedString, asynParamFloat64, &_writePhotonDroppedValue);
+  createParam(SlsWritePolicyString,        asynParamInt32,   &_writePolicyValue);
+  createParam(SlsWriteDecimateString,      asynParamInt32,   &_writeDecimateValue);
+  createParam(SlsWritePriorityString,      asynParamInt32,   &_writePriorityValue);
+  createParam(SlsWriteQueueUsedString,     asynParamInt32,   &_writeQueueUsedValue);
+  createParam(SlsWriteQueueHighWaterString, asynParamInt32,  &_writeQueueHighWaterValue);
+  createParam(SlsReplayString,             asynParamInt32,   &_replayValue);
+  createParam(SlsReplayPathString,         asynParamOctet,   &_replayPathValue);
+  createParam(SlsReplayNameString,         asynParamOctet,   &_replayNameValue);
+  createParam(SlsReplayIndexString,        asynParamInt32,   &_replayIndexValue);
+  createParam(SlsReplayRateString,         asynParamFloat64, &_replayRateValue);
+  createParam(SlsReplayLoopsString,        asynParamInt32,   &_replayLoopsValue);
+  createParam(SlsReplayFramesString,       asynParamFloat64, &_replayFramesValue);
+  createParam(SlsReplayFrameRateString,    asynParamFloat64, &_replayFrameRateValue);
+  createParam(SlsReplayThroughputString,   asynParamFloat64, &_replayThroughputValue);
+  createParam(SlsReplayBehindString,       asynParamFloat64, &_replayBehindValue);
+  createParam(SlsReplayStatusString,       asynParamOctet,   &_replayStatusValue);
+  createParam(SlsCaptureString,            asynParamInt32,   &_captureValue);
+  createParam(SlsCaptureInterfaceString,   asynParamOctet,   &_captureInterfaceValue);
+  createParam(SlsCapturePortString,        asynParamInt32,   &_capturePortValue);
+  createParam(SlsCapturePathString,        asynParamOctet,   &_capturePathValue);
+  createParam(SlsCaptureNameString,        asynParamOctet,   &_captureNameValue);
+  createParam(SlsCaptureFileSizeString,    asynParamInt32,   &_captureFileSizeValue);
+  createParam(SlsCapturePacketsString,     asynParamFloat64, &_capturePacketsValue);
+  createParam(SlsCaptureRateString,        asynParamFloat64, &_captureRateValue);
+  createParam(SlsCaptureDroppedString,     asynParamFloat64, &_captureDroppedValue);
+  createParam(SlsCaptureFilesString,       asynParamInt32,   &_captureFilesValue);
+  createParam(SlsCaptureStatusString,      asynParamOctet,   &_captureStatusValue);
+  createParam(SlsLatencyAssemblyString,    asynParamFloat64, &_latencyAssemblyValue);
+  createParam(SlsLatencyProcessString,     asynParamFloat64, &_latencyProcessValue);
+  createParam(SlsLatencyTotalString,       asynParamFloat64, &_latencyTotalValue);
+  createParam(SlsLatencyMaxString,         asynParamFloat64, &_latencyMaxValue);
+  createParam(SlsProcQueueDepthString,     asynParamInt32,   &_procQueueDepthValue);
+  createParam(SlsProcPolicyString,         asynParamInt32,   &_procPolicyValue);
+  createParam(SlsProcDecimateString,       asynParamInt32,   &_procDecimateValue);
+  createParam(SlsProcUsedString,           asynParamInt32,   &_procUsedValue);
+  createParam(SlsProcHighWaterString,      asynParamInt32,   &_procHighWaterValue);
+  createParam(SlsProcDroppedString,        asynParamFloat64, &_procDroppedValue);
+  createParam(SlsProcDecimatedString,      asynParamFloat64, &_procDecimatedValue);
+  createParam(SlsProcShedString,           asynParamFloat64, &_procShedValue);
+  createParam(SlsEvtEnableString,          asynParamInt32,   &_evtEnableValue);
+  createParam(SlsEvtPulseIdString,         asynParamFloat64, &_evtPulseIdValue);
+  createParam(SlsEvtTimeEventString,       asynParamInt32,   &_evtTimeEventValue);
+  createParam(SlsEvtWindowString,          asynParamFloat64, &_evtWindowValue);
+  createParam(SlsEvtPulsesString,          asynParamInt32,   &_evtPulsesValue);
+  createParam(SlsEvtMatchedString,         asynParamFloat64, &_evtMatchedValue);
+  createParam(SlsEvtUnmatchedString,       asynParamFloat64, &_evtUnmatchedValue);
+  createParam(SlsEvtLateString,            asynParamFloat64, &_evtLateValue);
+  createParam(SlsEvtPendingString,         asynParamInt32,   &_evtPendingValue);
+  createParam(SlsEvtDriftString,           asynParamFloat64, &_evtDriftValue);
+  createParam(SlsEvtJitterString,          asynParamFloat64, &_evtJitterValue);
+  createParam(SlsEvtLockedString,          asynParamInt32,   &_evtLockedValue);
+  createParam(SlsCellsString,              asynParamInt32,   &_cellsValue);
+  createParam(SlsCellStartString,          asynParamInt32,   &_cellStartValue);
+  createParam(SlsCellSourceString,         asynParamInt32,   &_cellSourceValue);
+  createParam(SlsCellSplitString,          asynParamInt32,   &_cellSplitValue);
+  createParam(SlsCellMessageString,        asynParamOctet,   &_cellMessageValue);
+  createParam(SlsCellTablesString,         asynParamInt32,   &_cellTablesValue);
+
+  /* The assembler copies every module into one full detector buffer */
+  SlsDetGeometry *geometry = NULL;
+  try {
+    geometry = new SlsDetGeometry(_numModules, numModulesX, JUNGFRAU_MODULE_COLS, JUNGFRAU_MODULE_ROWS,
+                                  JUNGFRAU_CHIP_COLS, JUNGFRAU_CHIP_ROWS, (SlsGapMode) gapPixels);
+    _assembler = new SlsDetAssembler(this, geometry, JUNGFRAU_PIXEL_BYTES, numBuffers,
+                                     DEFAULT_ASM_REORDER_WINDOW, DEFAULT_ASM_TIMEOUT, this->portName);
+  } catch (...) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to create the frame assembler\n",
+              driverName, functionName, this->portName);
+    /* The geometry belongs to the assembler once it exists */
+    if (!_assembler) delete geometry;
+    _assembler = NULL;
+  }
+
+  /* The conversion runs on the assembled images */
+  if (_assembler) {
+    try {
+      _converter = new SlsDetConverter(_assembler->sizeX(), _assembler->sizeY(), numConvThreads,
+                                       this->portName);
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the frame converter\n",
+                driverName, functionName, this->portName);
+      _converter = NULL;
+    }
+  }
+
+  /* The pedestal run feeds the converter so it needs one */
+  if (_converter) {
+    try {
+      _pedestal = new SlsDetPedestal(_converter->sizeX(), _converter->sizeY());
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the pedestal accumulator\n",
+                driverName, functionName, this->portName);
+      _pedestal = NULL;
+    }
+    try {
+      _drift = new SlsDetDriftTracker(_converter);
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the pedestal drift tracker\n",
+                driverName, functionName, this->portName);
+      _drift = NULL;
+    }
+    try {
+      _quantizer = new SlsDetQuantizer(_converter, _assembler->pool(), _assembler->geometry());
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the photon quantizer\n",
+                driverName, functionName, this->portName);
+      _quantizer = NULL;
+    }
+  }
+
+  /* Live viewers only ever see the assembled images */
+  if (_assembler) {
+    try {
+      _publisher = new SlsDetPublisher();
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the preview publisher\n",
+                driverName, functionName, this->portName);
+      _publisher = NULL;
+    }
+    try {
+      _shmRing = new SlsDetShmRing();
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the shared memory ring\n",
+                driverName, functionName, this->portName);
+      _shmRing = NULL;
+    }
+  }
+
+  /* The conversion and the plugins run off the receive threads, behind a queue */
+  if (_assembler) {
+    try {
+      _procSink = new SlsJungfrauProcess(this);
+      _procStage = new SlsDetFrameStage(_procSink, DEFAULT_PROC_QUEUE_DEPTH, SlsQueueDropNewest,
+                                        "slsJungfrauProc", SlsThreadProcess, this->portName);
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the process stage, frames are processed as they come\n",
+                driverName, functionName, this->portName);
+      _procStage = NULL;
+    }
+  }
+
+  /* The event builder sits in front of the processing, after the writer */
+  if (_procSink) {
+    try {
+      _eventBuilder = new SlsDetEventBuilder(_procStage ? (SlsDetFrameSink *) _procStage : _procSink,
+                                             DEFAULT_EVT_PULSES, _assembler->pool()->numFrames() / 2,
+                                             DEFAULT_EVT_WINDOW, this->portName);
+    } catch (...) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to create the event builder\n",
+                driverName, functionName, this->portName);
+      _eventBuilder = NULL;
+    }
+  }
+
+  /* Set the areaDetector parameters that describe the detector */
+  setStringParam(ADManufacturer, "PSI");
+  setStringParam(ADModel, "Jungfrau");
+  if (_assembler) {
+    setIntegerParam(ADMaxSizeX, _assembler->sizeX());
+    setIntegerParam(ADMaxSizeY, _assembler->sizeY());
+    setIntegerParam(ADSizeX, _assembler->sizeX());
+    setIntegerParam(ADSizeY, _assembler->sizeY());
+    setIntegerParam(NDArraySizeX, _assembler->sizeX());
+    setIntegerParam(NDArraySizeY, _assembler->sizeY());
+    setIntegerParam(NDArraySize, _assembler->pool()->frameSize());
+  } else {
+    setIntegerParam(ADMaxSizeX, JUNGFRAU_MODULE_COLS);
+    setIntegerParam(ADMaxSizeY, JUNGFRAU_MODULE_ROWS);
+    setIntegerParam(ADSizeX, JUNGFRAU_MODULE_COLS);
+    setIntegerParam(ADSizeY, JUNGFRAU_MODULE_ROWS);
+    setIntegerParam(NDArraySizeX, JUNGFRAU_MODULE_COLS);
+    setIntegerParam(NDArraySizeY, JUNGFRAU_MODULE_ROWS);
+    setIntegerParam(NDArraySize, JUNGFRAU_MODULE_BYTES);
+  }
+  setIntegerParam(ADStatus, ADStatusIdle);
+  setIntegerParam(_numModulesValue, _numModules);
+  setIntegerParam(_asmEnableValue, _assembler ? 1 : 0);
+  setIntegerParam(_asmReorderWindowValue, DEFAULT_ASM_REORDER_WINDOW);
+  setDoubleParam(_asmTimeoutValue, DEFAULT_ASM_TIMEOUT);
+  setDoubleParam(_asmCompleteValue, 0.0);
+  setDoubleParam(_asmIncompleteValue, 0.0);
+  setDoubleParam(_asmLateValue, 0.0);
+  setDoubleParam(_asmNoBufferValue, 0.0);
+  setDoubleParam(_asmMissingMaskValue, 0.0);
+  setIntegerParam(_poolFramesValue, 0);
+  setIntegerParam(_poolUsedValue, 0);
+  setIntegerParam(_poolHighWaterValue, 0);
+  setDoubleParam(_poolFailuresValue, 0.0);
+  setIntegerParam(_poolPagesValue, SlsPoolPagesNormal);
+  setIntegerParam(_poolLockedValue, 0);
+  updatePoolParams();
+  setIntegerParam(_geomGapPixelsValue, _assembler ? _assembler->geometry()->gapMode() : SlsGapNone);
+  setIntegerParam(_convEnableValue, 0);
+  setIntegerParam(_convOutputValue, SlsConvertEnergy);
+  setDoubleParam(_convPhotonEnergyValue, DEFAULT_PHOTON_ENERGY);
+  setStringParam(_convCalFileValue, "");
+  setStringParam(_convCalMessageValue, _converter ? "No calibration loaded" : "Conversion unavailable");
+  setIntegerParam(_convThreadsValue, _converter ? _converter->numThreads() : 0);
+  setStringParam(_convKernelValue, SlsDetConverter::kernelName());
+  setDoubleParam(_convTimeValue, 0.0);
+  updateDataType();
+  setIntegerParam(_pedStartValue, 0);
+  setIntegerParam(_pedStateValue, PED_IDLE);
+  setStringParam(_pedMessageValue, _pedestal ? "Idle" : "Pedestal run unavailable");
+  setIntegerParam(_pedFramesValue, DEFAULT_PED_FRAMES);
+  setIntegerParam(_pedSettleFramesValue, DEFAULT_PED_SETTLE_FRAMES);
+  setDoubleParam(_pedTimeoutValue, DEFAULT_PED_TIMEOUT);
+  setIntegerParam(_pedSetting0Value, slsDetectorDefs::DYNAMICGAIN);
+  setIntegerParam(_pedSetting1Value, slsDetectorDefs::FORCESWITCHG1);
+  setIntegerParam(_pedSetting2Value, slsDetectorDefs::FORCESWITCHG2);
+  setStringParam(_pedControlPortValue, "");
+  setStringParam(_pedFileValue, "");
+  setIntegerParam(_pedProgressValue, 0);
+  setIntegerParam(_driftEnableValue, 0);
+  setIntegerParam(_driftModeValue, SlsDarkFrameNumber);
+  setIntegerParam(_driftModulusValue, 0);
+  setIntegerParam(_driftOffsetValue, 0);
+  setIntegerParam(_driftBunchMaskValue, 0);
+  setIntegerParam(_driftBunchValueValue, 0);
+  setDoubleParam(_driftAlphaValue, DEFAULT_DRIFT_ALPHA);
+  setIntegerParam(_driftResetValue, 0);
+  updateDriftSelect();
+  epicsTimeGetCurrent(&_driftLastUpdate);
+  updateDriftParams(true);
+  setIntegerParam(_pubEnableValue, 0);
+  setStringParam(_pubEndpointValue, DEFAULT_PUB_ENDPOINT);
+  setIntegerParam(_pubSourceValue, PUB_PROCESSED);
+  setIntegerParam(_pubEveryValue, 1);
+  setDoubleParam(_pubMaxRateValue, DEFAULT_PUB_MAX_RATE);
+  setIntegerParam(_pubHighWaterMarkValue, DEFAULT_PUB_HWM);
+  openPublisher();
+  /* The ring is named after the port unless told otherwise */
+  epicsSnprintf(shmName, sizeof(shmName), "/%s", this->portName);
+  setIntegerParam(_shmEnableValue, 0);
+  setStringParam(_shmNameValue, shmName);
+  setIntegerParam(_shmSlotsValue, DEFAULT_SHM_SLOTS);
+  setIntegerParam(_shmSourceValue, PUB_PROCESSED);
+  epicsTimeGetCurrent(&_shmLastUpdate);
+  openShmRing();
+  setIntegerParam(_writeEnableValue, 0);
+  setIntegerParam(_writeFormatValue, slsReceiverDefs::BINARY);
+  setStringParam(_writePathValue, "");
+  setStringParam(_writeNameValue, "run");
+  setIntegerParam(_writeIndexValue, 0);
+  setIntegerParam(_writeFramesPerFileValue, JFRAU_MAX_FRAMES_PER_FILE);
+  setIntegerParam(_writeQueueDepthValue, DEFAULT_WRITE_QUEUE_DEPTH);
+  setIntegerParam(_writeDirectValue, 1);
+  setIntegerParam(_writeCompressionValue, SlsCompressNone);
+  setIntegerParam(_writeFramesPerChunkValue, DEFAULT_WRITE_FRAMES_PER_CHUNK);
+  setIntegerParam(_writeThreadsValue, DEFAULT_WRITE_THREADS);
+  setIntegerParam(_writePhotonsValue, 0);
+  setDoubleParam(_writePhotonThresholdValue, DEFAULT_WRITE_PHOTON_THRESHOLD);
+  setIntegerParam(_writePolicyValue, SlsQueueDropNewest);
+  setIntegerParam(_writeDecimateValue, DEFAULT_QUEUE_DECIMATE);
+  setIntegerParam(_writePriorityValue, WRITE_CRITICAL);
+  setIntegerParam(_writeQueueUsedValue, 0);
+  setIntegerParam(_writeQueueHighWaterValue, 0);
+  epicsTimeGetCurrent(&_writeLastUpdate);
+  /* The writer takes the assembled frames straight from the pool */
+  if (_assembler) {
+    createWriter();
+  } else {
+    setIntegerParam(_writeQueueDepthValue, 0);
+    setStringParam(_writeStatusValue, "Writer unavailable");
+    updateWriterParams(true);
+  }
+  setIntegerParam(_procQueueDepthValue, _procStage ? DEFAULT_PROC_QUEUE_DEPTH : 0);
+  setIntegerParam(_procPolicyValue, SlsQueueDropNewest);
+  setIntegerParam(_procDecimateValue, DEFAULT_QUEUE_DECIMATE);
+  epicsTimeGetCurrent(&_queueLastUpdate);
+  updateQueueParams(true);
+  setIntegerParam(_evtEnableValue, 0);
+  setDoubleParam(_evtPulseIdValue, 0.0);
+  setIntegerParam(_evtTimeEventValue, epicsTimeEventCurrentTime);
+  setDoubleParam(_evtWindowValue, DEFAULT_EVT_WINDOW);
+  setIntegerParam(_evtPulsesValue, DEFAULT_EVT_PULSES);
+  epicsTimeGetCurrent(&_eventLastUpdate);
+  updateEventParams(true);
+  setIntegerParam(_cellsValue, _cells);
+  setIntegerParam(_cellStartValue, _cellStart);
+  setIntegerParam(_cellSourceValue, _cellSource);
+  setIntegerParam(_cellSplitValue, 0);
+  setStringParam(_cellMessageValue, "");
+  updateCellParams();
+
+  /* Initialize the per module receiver parameters */
+  for (int addr=0; addr<_numModules; addr++) {
+    _modules[addr].driver = this;
+    _modules[addr].module = addr;
+    _modules[addr].receiver = NULL;
+    _modules[addr].subscriber = NULL;
+    _modules[addr].udp = NULL;
+    _modules[addr].loss = new SlsDetPacketLoss(JUNGFRAU_PACKETS_PER_FRAME, LOSS_UPDATE_PERIOD);
+    _modules[addr].framesCaught = 0;
+    _modules[addr].frameNumber = 0;
+    _modules[addr].timestamp = 0;
+    _modules[addr].bunchId = 0;
+    _modules[addr].packetsCaught = 0;
+    _modules[addr].dropped = 0;
+    setIntegerParam(addr, _rxTcpPortValue, _rxTcpPort ? _rxTcpPort + addr : 0);
+    setIntegerParam(addr, _rxStatusValue, RX_DOWN);
+    setDoubleParam(addr, _rxFramesCaughtValue, 0.0);
+    setDoubleParam(addr, _rxFrameNumberValue, 0.0);
+    setDoubleParam(addr, _rxTimestampValue, 0.0);
+    setDoubleParam(addr, _rxBunchIdValue, 0.0);
+    setIntegerParam(addr, _rxPacketsCaughtValue, 0);
+    setDoubleParam(addr, _rxDroppedValue, 0.0);
+    setIntegerParam(addr, _rxLossResetValue, 0);
+    setStringParam(addr, _rxStreamEndpointValue, "");
+    setIntegerParam(addr, _rxStreamCoreValue, -1);
+    setDoubleParam(addr, _rxStreamBadValue, 0.0);
+    setDoubleParam(addr, _rxUdpLateValue, 0.0);
+    setDoubleParam(addr, _rxUdpMovedValue, 0.0);
+    setIntegerParam(addr, _rxUdpSocketBufferValue, 0);
+    setIntegerParam(addr, _geomFlipXValue, 0);
+    setIntegerParam(addr, _geomFlipYValue, 0);
+    updateLossParams(addr);
+    callParamCallbacks(addr);
+  }
+
+  /* The replay plays the part of the receivers, so it needs the modules set up */
+  setIntegerParam(_replayValue, 0);
+  setStringParam(_replayPathValue, "");
+  setStringParam(_replayNameValue, "run");
+  setIntegerParam(_replayIndexValue, 0);
+  setDoubleParam(_replayRateValue, DEFAULT_REPLAY_RATE);
+  setIntegerParam(_replayLoopsValue, 1);
+  try {
+    _replay = new SlsDetReplay(this, _numModules, JUNGFRAU_MODULE_BYTES, this->portName);
+  } catch (...) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to create the replay\n",
+              driverName, functionName, this->portName);
+    _replay = NULL;
+  }
+  epicsTimeGetCurrent(&_replayLastUpdate);
+  updateReplayParams(true);
+  setIntegerParam(_captureValue, 0);
+  setStringParam(_captureInterfaceValue, "");
+  setIntegerParam(_capturePortValue, DEFAULT_UDP_PORTNO);
+  setStringParam(_capturePathValue, "");
+  setStringParam(_captureNameValue, "run");
+  setIntegerParam(_captureFileSizeValue, DEFAULT_CAPTURE_FILE_SIZE);
+  try {
+    _capture = new SlsDetCapture(this->portName);
+  } catch (...) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to create the packet capture\n",
+              driverName, functionName, this->portName);
+    _capture = NULL;
+  }
+  epicsTimeGetCurrent(&_captureLastUpdate);
+  updateCaptureParams(true);
+  setDoubleParam(_latencyAssemblyValue, 0.0);
+  setDoubleParam(_latencyProcessValue, 0.0);
+  setDoubleParam(_latencyTotalValue, 0.0);
+  setDoubleParam(_latencyMaxValue, 0.0);
+  callParamCallbacks();
+
+  /* Fill the NDArrayPool with image sized buffers before data arrives */
+  preallocArrays(numBuffers);
+
+  if (streams && streams[0]) {
+    if (startStreams(streams, cores) != asynSuccess) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to subscribe to all of the streams\n",
+                driverName, functionName, this->portName);
+    }
+  } else if (startReceivers() != asynSuccess) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to start all of the receivers\n",
+              driverName, functionName, this->portName);
+  }
+
+  updateRxFlags();
+  _pedThread.start();
+  _statusThread.start();
+}
+
+SlsJungfrau::~SlsJungfrau()
+{
+  shutdown();
+  for (unsigned n=0; n<_modules.size(); n++) {
+    delete _modules[n].loss;
+  }
+}
+
+void SlsJungfrau::preallocArrays(int numBuffers)
+{
+  size_t dims[2];
+  std::vector<NDArray*> arrays;
+  static const char *functionName = "preallocArrays";
+
+  dims[0] = _assembler ? _assembler->sizeX() : JUNGFRAU_MODULE_COLS;
+  dims[1] = _assembler ? _assembler->sizeY() : JUNGFRAU_MODULE_ROWS;
+
+  for (int n=0; n<numBuffers; n++) {
+    NDArray *pArray = pNDArrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    if (!pArray) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s only able to preallocate %d of %d buffers\n",
+                driverName, functionName, this->portName, n, numBuffers);
+      break;
+    }
+    arrays.push_back(pArray);
+  }
+
+  /* Return the buffers to the free list of the pool */
+  for (unsigned n=0; n<arrays.size(); n++) {
+    arrays[n]->release();
+  }
+}
+
+asynStatus SlsJungfrau::startReceivers()
+{
+  int ret;
+  char progName[] = "slsReceiver";
+  char portOpt[] = "--rx_tcpport";
+  char portStr[16];
+  char *argv[] = {progName, portOpt, portStr};
+  SlsCpuMask saved;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "startReceivers";
+
+  /* The receivers start their own threads, which take the cores from this one */
+  if (!slsDetPushAffinity(this->portName, SlsThreadReceive, &saved)) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s unable to start the receivers on the receive cores\n",
+              driverName, functionName, this->portName);
+  }
+
+  for (int addr=0; addr<_numModules; addr++) {
+    epicsSnprintf(portStr, sizeof(portStr), "%d", _rxTcpPort + addr);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: port=%s address=%d starting receiver on tcp port %s\n",
+              driverName, functionName, this->portName, addr, portStr);
+
+    ret = slsReceiverDefs::OK;
+    try {
+      _modules[addr].receiver = new slsReceiverUsers(sizeof(argv)/sizeof(argv[0]), argv, ret);
+    } catch (...) {
+      _modules[addr].receiver = NULL;
+      ret = slsReceiverDefs::FAIL;
+    }
+
+    if (ret == slsReceiverDefs::FAIL) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d failed to create receiver on tcp port %s\n",
+                driverName, functionName, this->portName, addr, portStr);
+      if (_modules[addr].receiver) {
+        delete _modules[addr].receiver;
+        _modules[addr].receiver = NULL;
+      }
+      status = asynError;
+      continue;
+    }
+
+    _modules[addr].receiver->registerCallBackStartAcquisition(startAcquisitionCallback, &_modules[addr]);
+    _modules[addr].receiver->registerCallBackAcquisitionFinished(acquisitionFinishedCallback, &_modules[addr]);
+    _modules[addr].receiver->registerCallBackRawDataReady(rawDataReadyCallback, &_modules[addr]);
+
+    if (_modules[addr].receiver->start() == slsReceiverDefs::FAIL) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d failed to start receiver on tcp port %s\n",
+                driverName, functionName, this->portName, addr, portStr);
+      delete _modules[addr].receiver;
+      _modules[addr].receiver = NULL;
+      status = asynError;
+      continue;
+    }
+
+    setIntegerParam(addr, _rxStatusValue, RX_IDLE);
+    callParamCallbacks(addr);
+  }
+
+  slsDetPopAffinity(&saved);
+
+  return status;
+}
+
+asynStatus SlsJungfrau::startStreams(const char *streams, const char *cores)
+{
+  int cpu;
+  int numStreams = 0;
+  int numCores = 0;
+  char entry[256];
+  char endpoint[256];
+  const char *port;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "startStreams";
+
+  while (listEntry(streams, numStreams, entry, sizeof(entry))) numStreams++;
+  while (listEntry(cores, numCores, entry, sizeof(entry))) numCores++;
+
+  for (int addr=0; addr<_numModules; addr++) {
+    /* A single endpoint is the first of a range of ports, like the receiver streaming ports */
+    if (addr < numStreams) {
+      listEntry(streams, addr, endpoint, sizeof(endpoint));
+    } else if ((numStreams == 1) && listEntry(streams, 0, entry, sizeof(entry)) &&
+               (port = std::strrchr(entry, ':')) && (port[1] >= '0') && (port[1] <= '9')) {
+      epicsSnprintf(endpoint, sizeof(endpoint), "%.*s:%d", (int) (port - entry), entry,
+                    std::atoi(port + 1) + addr);
+    } else {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d no stream given for the module\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+      continue;
+    }
+
+    /* The cores are handed out in turn when there are fewer than modules */
+    cpu = -1;
+    if (numCores && listEntry(cores, addr % numCores, entry, sizeof(entry))) {
+      cpu = std::atoi(entry);
+    }
+
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: port=%s address=%d subscribing to %s on core %d\n",
+              driverName, functionName, this->portName, addr, endpoint, cpu);
+
+    setStringParam(addr, _rxStreamEndpointValue, endpoint);
+    setIntegerParam(addr, _rxStreamCoreValue, cpu);
+    if (!std::strncmp(endpoint, UDP_SCHEME, std::strlen(UDP_SCHEME))) {
+      if (startUdpReceiver(addr, endpoint + std::strlen(UDP_SCHEME), cpu) != asynSuccess) {
+        status = asynError;
+      }
+      callParamCallbacks(addr);
+      continue;
+    }
+    try {
+      _modules[addr].subscriber = new SlsDetSubscriber(this, addr, endpoint, cpu, STREAM_HWM,
+                                                       this->portName);
+    } catch (...) {
+      _modules[addr].subscriber = NULL;
+    }
+    if (!_modules[addr].subscriber || !_modules[addr].subscriber->start()) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d failed to subscribe to %s: %s\n",
+                driverName, functionName, this->portName, addr, endpoint,
+                _modules[addr].subscriber ? _modules[addr].subscriber->error() : "out of memory");
+      delete _modules[addr].subscriber;
+      _modules[addr].subscriber = NULL;
+      status = asynError;
+      callParamCallbacks(addr);
+      continue;
+    }
+
+    setIntegerParam(addr, _rxStatusValue, RX_IDLE);
+    callParamCallbacks(addr);
+  }
+
+  return status;
+}
+
+asynStatus SlsJungfrau::startUdpReceiver(int addr, const char *address, int cpu)
+{
+  char host[256];
+  const char *port;
+  SlsDetUdpReceiver *udp = NULL;
+  SlsDetUdpReceiverStats stats;
+  static const char *functionName = "startUdpReceiver";
+
+  /* host:port, with the host left out or * to listen on every interface */
+  port = std::strrchr(address, ':');
+  if (!port || (port[1] < '0') || (port[1] > '9')) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s address=%d no udp port in %s\n",
+              driverName, functionName, this->portName, addr, address);
+    return asynError;
+  }
+  epicsSnprintf(host, sizeof(host), "%.*s", (int) (port - address), address);
+  if (!std::strcmp(host, "*")) host[0] = '\0';
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: port=%s address=%d receiving udp on %s on core %d\n",
+            driverName, functionName, this->portName, addr, address, cpu);
+
+  try {
+    udp = new SlsDetUdpReceiver(host, std::atoi(port + 1), cpu, JUNGFRAU_PACKETS_PER_FRAME,
+                                JUNGFRAU_MODULE_BYTES / JUNGFRAU_PACKETS_PER_FRAME,
+                                UDP_SOCKET_BUFFER, UDP_BUSY_POLL, UDP_IDLE_TIME, this->portName);
+  } catch (...) {
+    udp = NULL;
+  }
+  if (udp) {
+    /* The same callbacks as the embedded receivers */
+    udp->registerCallBackStartAcquisition(startAcquisitionCallback, &_modules[addr]);
+    udp->registerCallBackAcquisitionFinished(acquisitionFinishedCallback, &_modules[addr]);
+    udp->registerCallBackRawDataReady(rawDataReadyCallback, &_modules[addr]);
+  }
+  if (!udp || !udp->start()) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s address=%d failed to receive udp on %s: %s\n",
+              driverName, functionName, this->portName, addr, address,
+              udp ? udp->error() : "out of memory");
+    delete udp;
+    return asynError;
+  }
+  /* Without the buffer a burst of packets is lost while the thread is busy with a frame */
+  udp->getStats(&stats);
+  if (stats.socketBuffer < UDP_SOCKET_BUFFER) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s:%s: port=%s address=%d receive buffer of only %d bytes, raise net.core.rmem_max\n",
+              driverName, functionName, this->portName, addr, stats.socketBuffer);
+  }
+
+  _modules[addr].udp = udp;
+  updateStreamParams(addr);
+  /* The capture looks for the packets of the modules from the first port on */
+  if (addr == 0) setIntegerParam(_capturePortValue, udp->port());
+  setIntegerParam(addr, _rxStatusValue, RX_IDLE);
+
+  return asynSuccess;
+}
+
+void SlsJungfrau::shutdown()
+{
+  /* Stop the status and pedestal threads before the objects they use go away */
+  if (_statusRunning) {
+    _statusRunning = false;
+    _statusEvent.signal();
+    _statusThread.exitWait(PED_THREAD_TMO);
+  }
+  if (_pedRunning) {
+    _pedRunning = false;
+    _pedAbort = true;
+    _pedStageEvent.signal();
+    _pedStartEvent.signal();
+    _pedThread.exitWait(PED_THREAD_TMO);
+  }
+
+  for (unsigned n=0; n<_modules.size(); n++) {
+    if (_modules[n].receiver) {
+      _modules[n].receiver->stop();
+      delete _modules[n].receiver;
+      _modules[n].receiver = NULL;
+    }
+    if (_modules[n].subscriber) {
+      delete _modules[n].subscriber;
+      _modules[n].subscriber = NULL;
+    }
+    if (_modules[n].udp) {
+      delete _modules[n].udp;
+      _modules[n].udp = NULL;
+    }
+  }
+  if (_replay) {
+    delete _replay;
+    _replay = NULL;
+  }
+  if (_capture) {
+    delete _capture;
+    _capture = NULL;
+  }
+  /* The frames waiting for their pulses go on unmatched */
+  if (_eventBuilder) {
+    SlsDetEventBuilder *builder = _eventBuilder;
+    _eventEnable = false;
+    _eventBuilder = NULL;
+    delete builder;
+  }
+  /* What is queued is processed before the outputs it goes to are closed,
+   * anything the assembler still flushes is processed as it comes */
+  if (_procStage) {
+    SlsDetFrameStage *stage = _procStage;
+    _procStage = NULL;
+    delete stage;
+    delete _procSink;
+    _procSink = NULL;
+  }
+  /* Closing the publisher hands back the frames ZeroMQ still holds */
+  if (_publisher) {
+    delete _publisher;
+    _publisher = NULL;
+  }
+  /* Readers keep what they have mapped, they see the ring closed */
+  if (_shmRing) {
+    delete _shmRing;
+    _shmRing = NULL;
+  }
+  /* Writes out what is queued and hands the frames back */
+  if (_writer) {
+    delete _writer;
+    _writer = NULL;
+  }
+  /* With the receivers gone nothing else is pushed into the assembler */
+  if (_assembler) {
+    delete _assembler;
+    _assembler = NULL;
+  }
+  /* The drift tracker swaps its pedestals into the converter */
+  if (_drift) {
+    delete _drift;
+    _drift = NULL;
+  }
+  if (_quantizer) {
+    delete _quantizer;
+    _quantizer = NULL;
+  }
+  if (_converter) {
+    delete _converter;
+    _converter = NULL;
+  }
+  if (_pedestal) {
+    delete _pedestal;
+    _pedestal = NULL;
+  }
+}
+
+void SlsJungfrau::setAcquire(int acquire)
+{
+  int writeEnable;
+
+  getIntegerParam(_writeEnableValue, &writeEnable);
+  if (acquire) {
+    setIntegerParam(ADNumImagesCounter, 0);
+    setIntegerParam(ADStatus, ADStatusAcquire);
+    setStringParam(ADStatusMessage, "Acquiring data");
+    if (writeEnable) startWriter();
+  } else {
+    setIntegerParam(ADStatus, ADStatusIdle);
+    setStringParam(ADStatusMessage, "Acquisition stopped");
+    if (_publisher) _publisher->publishEnd();
+    updateShmParams(true);
+    if (_eventBuilder) _eventBuilder->flush();
+    updateQueueParams(true);
+    stopWriter();
+    /* Only the embedded receivers are told by the detector when it stops */
+    for (int addr=0; addr<_numModules; addr++) {
+      if (_modules[addr].udp) _modules[addr].udp->endAcquisition();
+    }
+  }
+  setIntegerParam(ADAcquire, acquire);
+  updateRxFlags();
+}
+
+int SlsJungfrau::startAcquisition(int module, const char *filePath, const char *fileName,
+                                  uint64_t fileIndex, uint32_t dataSize)
+{
+  static const char *functionName = "startAcquisition";
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: port=%s address=%d receiver starting acquisition with datasize %u\n",
+            driverName, functionName, this->portName, module, dataSize);
+
+  epicsAtomicSetSizeT(&_modules[module].framesCaught, 0);
+  lock();
+  setIntegerParam(module, _rxStatusValue, RX_RUNNING);
+  updateModuleParams(module);
+  callParamCallbacks(module);
+  unlock();
+
+  /* The receivers start before the detector sends anything, so this drops
+   * what is left of the last acquisition and lets the frame numbers restart */
+  if (_assembler) _assembler->flush();
+
+  return 0;
+}
+
+void SlsJungfrau::acquisitionFinished(int module, uint64_t framesCaught)
+{
+  static const char *functionName = "acquisitionFinished";
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: port=%s address=%d receiver finished acquisition with %llu frames caught\n",
+            driverName, functionName, this->portName, module, (unsigned long long) framesCaught);
+
+  _modules[module].loss->idle();
+  epicsAtomicSetSizeT(&_modules[module].framesCaught, (size_t) framesCaught);
+
+  lock();
+  setIntegerParam(module, _rxStatusValue, RX_IDLE);
+  updateModuleParams(module);
+  updateLossParams(module);
+  updateStreamParams(module);
+  /* The replay parameters are on address 0, and module 0 is the first told it finished */
+  if (module == 0) {
+    updateReplayParams(true);
+    updateCaptureParams(true);
+  }
+  callParamCallbacks(module);
+  unlock();
+}
+
+void SlsJungfrau::rawDataReady(int module, char *header, char *data, uint32_t dataSize)
+{
+  size_t dims[2];
+  size_t copySize;
+  NDArray *pImage;
+  const slsReceiverDefs::sls_receiver_header *rxHeader =
+    (const slsReceiverDefs::sls_receiver_header *) header;
+  /* local copies of the header fields since the attributes need non-const pointers */
+  epicsUInt64 frameNumber   = rxHeader->detHeader.frameNumber;
+  epicsUInt64 timestamp     = rxHeader->detHeader.timestamp;
+  epicsUInt64 bunchId       = rxHeader->detHeader.bunchId;
+  epicsUInt16 modId         = rxHeader->detHeader.modId;
+  epicsUInt32 packetsCaught = _modules[module].loss->account(rxHeader);
+  SlsJungfrauModule &mod = _modules[module];
+  int acquire = epicsAtomicGetIntT(&_rxAcquire);
+  int arrayCallbacks = epicsAtomicGetIntT(&_rxCallbacks);
+  int asmEnable = epicsAtomicGetIntT(&_rxAssemble);
+  static const char *functionName = "rawDataReady";
+
+  /* The receive threads of the modules never wait on the port lock, the
+   * status thread takes these to the parameters */
+  epicsAtomicIncrSizeT(&mod.framesCaught);
+  epicsAtomicSetSizeT(&mod.frameNumber, (size_t) frameNumber);
+  epicsAtomicSetSizeT(&mod.timestamp, (size_t) timestamp);
+  epicsAtomicSetSizeT(&mod.bunchId, (size_t) bunchId);
+  epicsAtomicSetSizeT(&mod.packetsCaught, packetsCaught);
+
+  /* A pedestal run needs the assembled frames even when nothing is published */
+  if (_assembler && asmEnable && epicsAtomicGetIntT(&_rxPedestal)) {
+    _assembler->push(module, rxHeader, data, dataSize);
+    return;
+  }
+
+  /* Frames are only taken while the driver is acquiring */
+  if (!acquire) return;
+
+  /* The assembler copies this module in place on the receiver's own thread;
+   * the writer wants the frames whether or not the plugins get them */
+  if (_assembler && asmEnable) {
+    _assembler->push(module, rxHeader, data, dataSize);
+    return;
+  }
+
+  /* The modules on their own addresses only go to the plugins */
+  if (!arrayCallbacks) return;
+
+  dims[0] = JUNGFRAU_MODULE_COLS;
+  dims[1] = JUNGFRAU_MODULE_ROWS;
+  pImage = pNDArrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+  if (!pImage) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s address=%d unable to allocate array for frame %llu\n",
+              driverName, functionName, this->portName, module, (unsigned long long) frameNumber);
+    epicsAtomicIncrSizeT(&mod.dropped);
+    return;
+  }
+
+  /* Copy the frame out of the receiver's buffer and pad any short frame */
+  copySize = dataSize < pImage->dataSize ? dataSize : pImage->dataSize;
+  std::memcpy(pImage->pData, data, copySize);
+  if (copySize < pImage->dataSize) {
+    std::memset((char *) pImage->pData + copySize, 0, pImage->dataSize - copySize);
+  }
+
+  /* Attach the detector header to the array */
+  pImage->pAttributeList->add("SlsFrameNumber", "Detector frame number",
+                              NDAttrUInt64, &frameNumber);
+  pImage->pAttributeList->add("SlsTimestamp", "Detector timestamp (10 MHz clock)",
+                              NDAttrUInt64, &timestamp);
+  pImage->pAttributeList->add("SlsBunchId", "Beamline bunch id",
+                              NDAttrUInt64, &bunchId);
+  pImage->pAttributeList->add("SlsModId", "Detector module id",
+                              NDAttrUInt16, &modId);
+  pImage->pAttributeList->add("SlsPacketsCaught", "Packets set in the packetsMask",
+                              NDAttrUInt32, &packetsCaught);
+
+  /* Every module sends each frame, so module 0 paces the image counter */
+  publishArray(pImage, module, module == 0);
+}
+
+void SlsJungfrau::frameReady(SlsDetFrame *frame)
+{
+  bool writeCritical;
+  double writePhotonEnergy;
+  SlsDetWriter *writer;
+
+  /* This runs on the receive threads, so it only hands the frame on */
+  epicsTimeGetCurrent(&frame->assembled);
+  frame->storageCell = storageCell(frame);
+
+  /* A critical writer gets its reference before the frame can be dropped
+   * from the process queue; photons are only counted while processing, so
+   * they are written on a best effort basis (WritePhotonDropped_RBV) */
+  writer = useWriter(&writeCritical, &writePhotonEnergy);
+  if (writer) {
+    if (writeCritical && (writePhotonEnergy <= 0.)) {
+      frame->reserve();
+      writer->write(frame);
+    }
+    releaseWriter();
+  }
+
+  if (_eventBuilder && _eventEnable) {
+    _eventBuilder->frameReady(frame);
+  } else if (_procStage) {
+    _procStage->frameReady(frame);
+  } else {
+    processFrame(frame);
+  }
+}
+
+int SlsJungfrau::storageCell(const SlsDetFrame *frame) const
+{
+  /* These can change under a running acquisition, a frame sees one or the other */
+  int cells = _cells;
+  int cellStart = _cellStart;
+
+  if (cells <= 1) return 0;
+
+  if (_cellSource == CELL_FRAME_NUMBER) {
+    /* The frames of a burst follow on from the start cell, frame numbers count from 1 */
+    if (!frame->frameNumber) return cellStart;
+    return (cellStart + (int) ((frame->frameNumber - 1) % cells)) % SLS_MAX_CELLS;
+  }
+
+  /* Every module of a frame took it in the same cell */
+  for (int mod=0; mod<frame->numModules; mod++) {
+    if (frame->modulesMask & (1ULL << mod)) {
+      return (frame->header[mod].debug >> SLS_CELL_SHIFT) & SLS_CELL_MASK;
+    }
+  }
+
+  return cellStart;
+}
+
+void SlsJungfrau::processFrame(SlsDetFrame *frame)
+{
+  int acquire;
+  int arrayCallbacks;
+  int convEnable;
+  int convOutput;
+  int cellSplit;
+  int driftEnable;
+  int pedState;
+  int pubSource;
+  int shmSource;
+  double photonEnergy;
+  double photonThreshold;
+  bool writeCritical;
+  double writePhotonEnergy;
+  SlsDetWriter *writer;
+  size_t dims[2];
+  size_t copySize;
+  NDDataType_t dataType = NDUInt16;
+  NDArray *pImage;
+  epicsTimeStamp convStart;
+  epicsTimeStamp convEnd;
+  epicsTimeStamp ready = frame->assembled;
+  epicsTimeStamp arrival = frame->arrival;
+  /* The assembler's reference is dropped on whichever way out */
+  SlsDetFrameRef held(frame);
+  const epicsUInt16 *raw = frame->uint16Pixels();
+  bool shed;
+  epicsUInt64 frameNumber = frame->frameNumber;
+  epicsUInt64 timestamp = frame->timestamp;
+  epicsUInt64 bunchId = frame->bunchId;
+  epicsUInt64 missingMask = frame->missingMask;
+  epicsUInt32 packetsCaught = 0;
+  epicsInt32 eventMatch = frame->eventMatch;
+  epicsInt32 cell = frame->storageCell;
+  epicsTimeStamp eventTime = frame->eventTime;
+  static const char *functionName = "processFrame";
+
+  /* The pedestals, the converter and the drift tracker work on the raw counts */
+  if (!raw) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s frame %llu does not hold raw pixels\n",
+              driverName, functionName, this->portName, (unsigned long long) frameNumber);
+    return;
+  }
+
+  for (int mod=0; mod<frame->numModules; mod++) {
+    packetsCaught += frame->packetsCaught[mod];
+  }
+
+  if (_pedestal && _pedestal->accumulate(raw, cell)) {
+    _pedStageEvent.signal();
+  }
+
+  /* The settings are mirrored by updateRxFlags(), so no frame takes the port lock for them */
+  acquire = epicsAtomicGetIntT(&_rxAcquire);
+  arrayCallbacks = epicsAtomicGetIntT(&_rxCallbacks);
+  convEnable = epicsAtomicGetIntT(&_procConvEnable);
+  convOutput = epicsAtomicGetIntT(&_procConvOutput);
+  cellSplit = epicsAtomicGetIntT(&_procCellSplit);
+  driftEnable = epicsAtomicGetIntT(&_procDriftEnable);
+  pedState = epicsAtomicGetIntT(&_procPedState);
+  pubSource = epicsAtomicGetIntT(&_procPubSource);
+  shmSource = epicsAtomicGetIntT(&_procShmSource);
+  _procLock.lock();
+  photonEnergy = _procPhotonEnergy;
+  photonThreshold = _procPhotonThreshold;
+  _procLock.unlock();
+
+  /* Dark frames taken while a pedestal run forces the gain are of no use */
+  if (_drift && driftEnable && ((pedState < PED_SETTING_GAIN) || (pedState > PED_SAVING)) &&
+      _drift->isDark(frameNumber, bunchId, cell)) {
+    _drift->track(raw);
+  }
+
+  if (_converter && convEnable) {
+    dataType = convOutput == SlsConvertPhotons ? NDInt16 : NDFloat32;
+  }
+
+  /* The writer holds its own reference until the frame is on disk, its
+   * counters go to the parameters from the status thread */
+  writer = useWriter(&writeCritical, &writePhotonEnergy);
+  if (writer) {
+    if (writePhotonEnergy > 0.) {
+      /* Frames with no free buffer for their photon counts are dropped */
+      SlsDetFrame *counts = _quantizer->quantize(frame, writePhotonEnergy, photonThreshold);
+      if (counts) writer->write(counts);
+    } else if (!writeCritical) {
+      writer->write(held.share());
+    }
+    releaseWriter();
+  }
+
+  /* A flush after the acquisition stopped can still hand over frames */
+  if (!acquire) return;
+
+  /* The preview and the shared memory give way once the queue is half full */
+  shed = false;
+  if (_procStage) {
+    SlsDetFrameQueue *queue = _procStage->queue();
+    shed = 2 * queue->depth() >= queue->capacity();
+    if (shed && ((_publisher && _publisher->isOpen()) || (_shmRing && _shmRing->isOpen()))) {
+      epicsAtomicIncrSizeT(&_procShed);
+    }
+  }
+
+  /* The assembled image goes out as it is, before anything else happens to it */
+  if (!shed && (pubSource == PUB_ASSEMBLED)) publishFrame(frame, NULL);
+  if (!shed && (shmSource == PUB_ASSEMBLED)) shareFrame(frame, NULL);
+
+  /* ArrayCallbacks only turns off the NDArrays and what is made from them */
+  if (!arrayCallbacks) return;
+
+  dims[0] = frame->sizeX;
+  dims[1] = frame->sizeY;
+  pImage = pNDArrayPool->alloc(2, dims, dataType, 0, NULL);
+  if (!pImage) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s unable to allocate array for frame %llu\n",
+              driverName, functionName, this->portName, (unsigned long long) frameNumber);
+    return;
+  }
+
+  if (dataType == NDUInt16) {
+    copySize = frame->numPixels() * frame->bytesPerPixel;
+    if (copySize > pImage->dataSize) copySize = pImage->dataSize;
+    std::memcpy(pImage->pData, raw, copySize);
+  } else {
+    /* The converter writes straight into the array, so there is no extra copy */
+    epicsTimeGetCurrent(&convStart);
+    _converter->convert(raw, pImage->pData,
+                        (SlsConvertOutput) convOutput, photonEnergy, cell);
+    /* The gap pixels hold copies of their border pixel until they are shared out */
+    if (_assembler->geometry()->gapMode() == SlsGapSplit) {
+      for (int mod=0; mod<frame->numModules; mod++) {
+        if (dataType == NDFloat32) {
+          _assembler->geometry()->splitFloat((float *) pImage->pData, frame->origin[mod]);
+        } else {
+          _assembler->geometry()->splitInt16((epicsInt16 *) pImage->pData, frame->origin[mod]);
+        }
+      }
+    }
+    epicsTimeGetCurrent(&convEnd);
+    _latencyLock.lock();
+    _convTime = epicsTimeDiffInSeconds(&convEnd, &convStart) * 1.e3;
+    _latencyLock.unlock();
+  }
+  if (!shed && (pubSource == PUB_PROCESSED)) publishFrame(frame, pImage);
+  if (!shed && (shmSource == PUB_PROCESSED)) shareFrame(frame, pImage);
+  /* The buffer goes back to the pool before the plugins get the array */
+  held.reset();
+
+  /* Attach the detector header to the array */
+  pImage->pAttributeList->add("SlsFrameNumber", "Detector frame number",
+                              NDAttrUInt64, &frameNumber);
+  pImage->pAttributeList->add("SlsTimestamp", "Detector timestamp (10 MHz clock)",
+                              NDAttrUInt64, &timestamp);
+  pImage->pAttributeList->add("SlsBunchId", "Beamline bunch id",
+                              NDAttrUInt64, &bunchId);
+  pImage->pAttributeList->add("SlsMissingModules", "Mask of the modules missing from the frame",
+                              NDAttrUInt64, &missingMask);
+  pImage->pAttributeList->add("SlsPacketsCaught", "Packets set in the packetsMask of all modules",
+                              NDAttrUInt32, &packetsCaught);
+  pImage->pAttributeList->add("SlsEventMatch", "Pulse match: 0 none, 1 matched, 2 unmatched, 3 late",
+                              NDAttrInt32, &eventMatch);
+  pImage->pAttributeList->add("SlsStorageCell", "Storage cell the frame was taken in",
+                              NDAttrInt32, &cell);
+
+  /* The event builder knows when the pulse of the frame was, and each storage
+   * cell can have an address of its own after the one of the whole image */
+  publishArray(pImage, cellSplit ? SLS_CELL_ADDR + cell : 0, true,
+               eventMatch != SlsEventNone ? &eventTime : NULL);
+  updateLatency(&arrival, &ready);
+}
+
+void SlsJungfrau::publishArray(NDArray *pImage, int addr, bool countImage,
+                               const epicsTimeStamp *timeStamp)
+{
+  int imageMode;
+  int numImages;
+  int numImagesCounter;
+  int imageCounter;
+
+  lock();
+  getIntegerParam(NDArrayCounter, &imageCounter);
+  imageCounter++;
+  setIntegerParam(NDArrayCounter, imageCounter);
+  pImage->uniqueId = imageCounter;
+  if (timeStamp) {
+    pImage->epicsTS = *timeStamp;
+  } else {
+    updateTimeStamp(&pImage->epicsTS);
+  }
+  pImage->timeStamp = pImage->epicsTS.secPastEpoch + pImage->epicsTS.nsec / 1.e9;
+  getAttributes(pImage->pAttributeList);
+
+  if (countImage) {
+    getIntegerParam(ADImageMode, &imageMode);
+    getIntegerParam(ADNumImages, &numImages);
+    getIntegerParam(ADNumImagesCounter, &numImagesCounter);
+    numImagesCounter++;
+    setIntegerParam(ADNumImagesCounter, numImagesCounter);
+    if ((imageMode == ADImageSingle) ||
+        ((imageMode == ADImageMultiple) && (numImagesCounter >= numImages))) {
+      setAcquire(0);
+    }
+  }
+  callParamCallbacks();
+  unlock();
+
+  /* The lock must not be held here since the plugins may call back into the driver */
+  doCallbacksGenericPointer(pImage, NDArrayData, addr);
+  pImage->release();
+}
+
+void SlsJungfrau::publishFrame(SlsDetFrame *frame, NDArray *pImage)
+{
+  NDArrayInfo info;
+  SlsPubDataType type;
+
+  if (!_publisher || !_publisher->due()) return;
+
+  /* The publisher takes a reference that ZeroMQ drops once the pixels are sent */
+  if (!pImage) {
+    if (!frame->uint16Pixels()) return;
+    frame->reserve();
+    _publisher->publish(frame, SlsPubUInt16, frame->uint16Pixels(),
+                        frame->numPixels() * frame->bytesPerPixel, releaseFrame, frame);
+  } else {
+    switch (pImage->dataType) {
+      case NDInt16:
+        type = SlsPubInt16;
+        break;
+      case NDFloat32:
+        type = SlsPubFloat32;
+        break;
+      default:
+        type = SlsPubUInt16;
+        break;
+    }
+    pImage->getInfo(&info);
+    pImage->reserve();
+    _publisher->publish(frame, type, pImage->pData, info.totalBytes, releaseArray, pImage);
+  }
+}
+
+void SlsJungfrau::openPublisher()
+{
+  /* Must be called with the lock held */
+  int enable;
+  int every;
+  int highWaterMark;
+  double maxRate;
+  char endpoint[MAX_FILENAME_LEN];
+  static const char *functionName = "openPublisher";
+
+  if (!_publisher) {
+    setIntegerParam(_pubEnableValue, 0);
+    setStringParam(_pubMessageValue, "Publisher unavailable");
+    updatePublisherParams();
+    return;
+  }
+
+  getIntegerParam(_pubEnableValue, &enable);
+  getIntegerParam(_pubEveryValue, &every);
+  getIntegerParam(_pubHighWaterMarkValue, &highWaterMark);
+  getDoubleParam(_pubMaxRateValue, &maxRate);
+  getStringParam(_pubEndpointValue, sizeof(endpoint), endpoint);
+
+  _publisher->close();
+  _publisher->setDecimation(every > 0 ? every : 1, maxRate);
+  if (!enable) {
+    setStringParam(_pubMessageValue, "Disabled");
+  } else if (_publisher->open(endpoint, highWaterMark > 0 ? highWaterMark : 1)) {
+    _publisher->resetStats();
+    setStringParam(_pubMessageValue, _publisher->error());
+  } else {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to open the preview publisher: %s\n",
+              driverName, functionName, this->portName, _publisher->error());
+    setIntegerParam(_pubEnableValue, 0);
+    setStringParam(_pubMessageValue, _publisher->error());
+  }
+  updatePublisherParams();
+}
+
+void SlsJungfrau::updatePublisherParams()
+{
+  /* Must be called with the lock held */
+  SlsDetPublisherStats stats;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_publisher) _publisher->getStats(&stats);
+  setDoubleParam(_pubSentValue, (double) stats.sent);
+  setDoubleParam(_pubDecimatedValue, (double) stats.decimated);
+  setDoubleParam(_pubDroppedValue, (double) (stats.dropped + stats.failed));
+}
+
+void SlsJungfrau::shareFrame(SlsDetFrame *frame, NDArray *pImage)
+{
+  NDArrayInfo info;
+  SlsShmDataType type;
+
+  if (!_shmRing || !_shmRing->isOpen()) return;
+
+  /* The ring takes its own copy, so the readers never hold up the buffers */
+  if (!pImage) {
+    if (!frame->uint16Pixels()) return;
+    _shmRing->write(frame, SlsShmUInt16, frame->uint16Pixels(), frame->numPixels() * frame->bytesPerPixel);
+  } else {
+    switch (pImage->dataType) {
+      case NDInt16:
+        type = SlsShmInt16;
+        break;
+      case NDFloat32:
+        type = SlsShmFloat32;
+        break;
+      default:
+        type = SlsShmUInt16;
+        break;
+    }
+    pImage->getInfo(&info);
+    _shmRing->write(frame, type, pImage->pData, info.totalBytes);
+  }
+}
+
+void SlsJungfrau::openShmRing()
+{
+  /* Must be called with the lock held */
+  int enable;
+  int numSlots;
+  int source;
+  size_t dataSize;
+  char name[MAX_FILENAME_LEN];
+  static const char *functionName = "openShmRing";
+
+  if (!_shmRing) {
+    setIntegerParam(_shmEnableValue, 0);
+    setStringParam(_shmMessageValue, "Shared memory unavailable");
+    updateShmParams(true);
+    return;
+  }
+
+  getIntegerParam(_shmEnableValue, &enable);
+  getIntegerParam(_shmSlotsValue, &numSlots);
+  getIntegerParam(_shmSourceValue, &source);
+  getStringParam(_shmNameValue, sizeof(name), name);
+
+  /* The processed images can be Float32 whatever the conversion is set to now */
+  dataSize = _assembler->sizeX() * _assembler->sizeY() *
+             (source == PUB_PROCESSED ? sizeof(epicsFloat32) : sizeof(epicsUInt16));
+  if (numSlots < 1) {
+    numSlots = 1;
+    setIntegerParam(_shmSlotsValue, numSlots);
+  }
+
+  _shmRing->close();
+  if (!enable) {
+    setStringParam(_shmMessageValue, "Disabled");
+  } else if (_shmRing->open(name, numSlots, dataSize)) {
+    setStringParam(_shmMessageValue, _shmRing->error());
+  } else {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to open the shared memory ring: %s\n",
+              driverName, functionName, this->portName, _shmRing->error());
+    setIntegerParam(_shmEnableValue, 0);
+    setStringParam(_shmMessageValue, _shmRing->error());
+  }
+  updateShmParams(true);
+}
+
+void SlsJungfrau::updateShmParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetShmRingStats stats;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_shmLastUpdate) < SHM_UPDATE_PERIOD)) return;
+  _shmLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_shmRing) _shmRing->getStats(&stats);
+  setDoubleParam(_shmWrittenValue, (double) stats.written);
+  setIntegerParam(_shmReadersValue, (int) stats.readers);
+  setIntegerParam(_shmLagValue, (int) stats.maxLag);
+  setDoubleParam(_shmLostValue, (double) stats.lost);
+}
+
+bool SlsJungfrau::createWriter()
+{
+  /* Must be called with the lock held */
+  static const char *functionName = "createWriter";
+  int format;
+  int queueDepth;
+  int compression;
+  int framesPerChunk;
+  int numThreads;
+  double waited = 0.;
+  epicsTimeStamp start;
+  epicsTimeStamp now;
+
+  /* A frame that took the writer before the last file closed may still be in
+   * it. The frames take the port lock in processFrame, so it is dropped while
+   * waiting for releaseWriter() to signal that the last one is out. */
+  if (epicsAtomicGetIntT(&_writerUsers)) {
+    unlock();
+    epicsTimeGetCurrent(&start);
+    while (epicsAtomicGetIntT(&_writerUsers) && (waited < WRITER_RELEASE_TIMEOUT)) {
+      _writerReleased.wait(WRITER_RELEASE_TIMEOUT - waited);
+      epicsTimeGetCurrent(&now);
+      waited = epicsTimeDiffInSeconds(&now, &start);
+    }
+    lock();
+  }
+  /* Writing may also have started while the lock was dropped */
+  if (epicsAtomicGetIntT(&_writerUsers) || _writing) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s frames are still being written, the writer is kept\n",
+              driverName, functionName, this->portName);
+    return false;
+  }
+
+  getIntegerParam(_writeFormatValue, &format);
+  getIntegerParam(_writeQueueDepthValue, &queueDepth);
+  getIntegerParam(_writeCompressionValue, &compression);
+  getIntegerParam(_writeFramesPerChunkValue, &framesPerChunk);
+  getIntegerParam(_writeThreadsValue, &numThreads);
+
+  if (_writer) {
+    delete _writer;
+    _writer = NULL;
+  }
+  try {
+    if (format == slsReceiverDefs::HDF5) {
+#ifdef WITH_HDF5
+      _writer = new SlsDetHdf5Writer(queueDepth, numThreads, framesPerChunk,
+                                     (SlsCompressCodec) compression, DEFAULT_DEFLATE_LEVEL,
+                                     this->portName);
+#endif
+    } else {
+      _writer = new SlsDetWriter(queueDepth, "raw", this->portName);
+    }
+  } catch (...) {
+    asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s failed to create the %s writer\n",
+              driverName, functionName, this->portName,
+              slsReceiverDefs::getFileFormatType((slsReceiverDefs::fileFormat) format).c_str());
+    _writer = NULL;
+  }
+  if (_writer) {
+    int policy;
+    int decimate;
+    getIntegerParam(_writePolicyValue, &policy);
+    getIntegerParam(_writeDecimateValue, &decimate);
+    _writer->setPacketsPerModule(JUNGFRAU_PACKETS_PER_FRAME);
+    _writer->setPolicy((SlsQueuePolicy) policy, decimate);
+  }
+
+  setIntegerParam(_writeQueueDepthValue, _writer ? _writer->queueDepth() : 0);
+  setStringParam(_writeStatusValue, _writer ? "Idle" : "Writer unavailable");
+  updateWriterParams(true);
+
+  return _writer != NULL;
+}
+
+void SlsJungfrau::startWriter()
+{
+  /* Must be called with the lock held */
+  int fileIndex;
+  int framesPerFile;
+  int direct;
+  int photons;
+  char path[MAX_FILENAME_LEN];
+  char name[MAX_FILENAME_LEN];
+
+  if (!_writer || _writing) return;
+
+  getStringParam(_writePathValue, sizeof(path), path);
+  getStringParam(_writeNameValue, sizeof(name), name);
+  getIntegerParam(_writeIndexValue, &fileIndex);
+  getIntegerParam(_writeFramesPerFileValue, &framesPerFile);
+  getIntegerParam(_writeDirectValue, &direct);
+  getIntegerParam(_writePhotonsValue, &photons);
+
+  /* A file holds photons counted at one energy, so it is fixed until the writer stops */
+  _writerLock.lock();
+  _writePhotonEnergy = 0.;
+  if (photons && _quantizer) {
+    getDoubleParam(_convPhotonEnergyValue, &_writePhotonEnergy);
+    _quantizer->resetStats();
+  }
+  _writerLock.unlock();
+  if (_procStage) {
+    SlsDetFrameQueueStats proc;
+    _procStage->queue()->getStats(&proc);
+    _writeProcLost = proc.dropped + proc.decimated;
+  }
+  setDoubleParam(_writePhotonDroppedValue, 0.);
+  _writer->resetStats();
+#ifdef WITH_HDF5
+  SlsDetHdf5Writer *hdf5 = dynamic_cast<SlsDetHdf5Writer*>(_writer);
+  if (hdf5) hdf5->compressor()->resetStats();
+#endif
+  _writer->open(path[0] ? path : ".", name, fileIndex, framesPerFile > 0 ? framesPerFile : 0, direct);
+  _writerLock.lock();
+  _writing = true;
+  _writerLock.unlock();
+  updateWriterParams(true);
+}
+
+void SlsJungfrau::stopWriter()
+{
+  /* Must be called with the lock held */
+  int fileIndex;
+
+  if (!_writing) return;
+
+  /* Like the slsReceiver the next acquisition goes to the next file index;
+   * a frame that took the writer before this is counted dropped */
+  updateWriterParams(true);
+  _writerLock.lock();
+  _writing = false;
+  _writerLock.unlock();
+  _writer->close();
+  getIntegerParam(_writeIndexValue, &fileIndex);
+  setIntegerParam(_writeIndexValue, fileIndex + 1);
+  updateWriterParams(true);
+}
+
+SlsDetWriter* SlsJungfrau::useWriter(bool *critical, double *photonEnergy)
+{
+  /* The writer and its settings as one, NULL when no file is open; the
+   * writer is not remade before releaseWriter() */
+  SlsDetWriter *writer = NULL;
+
+  _writerLock.lock();
+  if (_writing) {
+    writer = _writer;
+    *critical = _writeCritical;
+    *photonEnergy = _writePhotonEnergy;
+    epicsAtomicIncrIntT(&_writerUsers);
+  }
+  _writerLock.unlock();
+
+  return writer;
+}
+
+void SlsJungfrau::releaseWriter()
+{
+  if (epicsAtomicDecrIntT(&_writerUsers) == 0) _writerReleased.signal();
+}
+
+void SlsJungfrau::updateWriterParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetWriterStats stats;
+  SlsDetQuantizerStats photons;
+  std::vector<epicsFloat64> threadRate;
+  std::vector<epicsFloat64> threadRatio;
+  epicsUInt64 bytesIn = 0;
+  epicsUInt64 bytesOut = 0;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_writeLastUpdate) < WRITE_UPDATE_PERIOD)) return;
+  _writeLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  std::memset(&photons, 0, sizeof(photons));
+  if (_writer) {
+    _writer->getStats(&stats);
+    setStringParam(_writeStatusValue, _writer->status());
+  }
+  if (_quantizer) _quantizer->getStats(&photons);
+  setIntegerParam(_writeDirectActiveValue, stats.direct ? 1 : 0);
+  setDoubleParam(_writeFramesValue, (double) stats.frames);
+  setDoubleParam(_writeDroppedValue, (double) (stats.dropped + photons.noBuffer));
+  setDoubleParam(_writeFailedValue, (double) stats.failed);
+  setDoubleParam(_writeRateValue, stats.rate);
+  setDoubleParam(_writeLatencyValue, stats.latency);
+  setDoubleParam(_writeMaxLatencyValue, stats.maxLatency);
+  setDoubleParam(_writePhotonCountValue, photons.photons);
+  setDoubleParam(_writePhotonErrorValue, photons.rmsError);
+  setDoubleParam(_writePhotonMaxErrorValue, photons.maxError);
+  setDoubleParam(_writePhotonMeanErrorValue, photons.meanRmsError);
+  /* Photons are only counted on the process thread, so the frames its queue
+   * loses while writing never reach the file whatever the WritePriority */
+  if (_writing && (_writePhotonEnergy > 0.) && _procStage) {
+    SlsDetFrameQueueStats proc;
+    _procStage->queue()->getStats(&proc);
+    setDoubleParam(_writePhotonDroppedValue, (double) (proc.dropped + proc.decimated - _writeProcLost));
+  }
+  setIntegerParam(_writeQueueUsedValue, stats.queue.depth);
+  setIntegerParam(_writeQueueHighWaterValue, stats.queue.highWater);
+
+#ifdef WITH_HDF5
+  /* What each compression thread got through and how far it shrank it */
+  SlsDetHdf5Writer *hdf5 = dynamic_cast<SlsDetHdf5Writer*>(_writer);
+  if (hdf5) {
+    SlsDetCompressor *compressor = hdf5->compressor();
+    int numThreads = compressor->numThreads() > 0 ? compressor->numThreads() : 1;
+    for (int n=0; n<numThreads; n++) {
+      SlsDetCompressorStats comp;
+      compressor->getStats(n, &comp);
+      threadRate.push_back(comp.busy > 0. ? comp.bytesIn / comp.busy / 1.e6 : 0.);
+      threadRatio.push_back(comp.bytesOut ? (double) comp.bytesIn / comp.bytesOut : 0.);
+      bytesIn += comp.bytesIn;
+      bytesOut += comp.bytesOut;
+    }
+  }
+#endif
+  setDoubleParam(_writeCompressRatioValue, bytesOut ? (double) bytesIn / bytesOut : 0.);
+  if (!threadRate.empty()) {
+    doCallbacksFloat64Array(&threadRate[0], threadRate.size(), _writeThreadRateValue, 0);
+    doCallbacksFloat64Array(&threadRatio[0], threadRatio.size(), _writeThreadRatioValue, 0);
+  }
+}
+
+void SlsJungfrau::updateReplayParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetReplayStats stats;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_replayLastUpdate) < REPLAY_UPDATE_PERIOD)) return;
+  _replayLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_replay) {
+    _replay->getStats(&stats);
+    setIntegerParam(_replayValue, _replay->running() ? 1 : 0);
+    setStringParam(_replayStatusValue, _replay->status());
+  } else {
+    setIntegerParam(_replayValue, 0);
+    setStringParam(_replayStatusValue, "Replay unavailable");
+  }
+  setDoubleParam(_replayFramesValue, (double) stats.frames);
+  setDoubleParam(_replayFrameRateValue, stats.rate);
+  setDoubleParam(_replayThroughputValue, stats.throughput);
+  setDoubleParam(_replayBehindValue, (double) stats.behind);
+}
+
+void SlsJungfrau::updateCaptureParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetCaptureStats stats;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_captureLastUpdate) < CAPTURE_UPDATE_PERIOD)) return;
+  _captureLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_capture) {
+    _capture->getStats(&stats);
+    setIntegerParam(_captureValue, _capture->running() ? 1 : 0);
+    setStringParam(_captureStatusValue, _capture->status());
+  } else {
+    setIntegerParam(_captureValue, 0);
+    setStringParam(_captureStatusValue, "Capture unavailable");
+  }
+  setDoubleParam(_capturePacketsValue, (double) stats.packets);
+  setDoubleParam(_captureRateValue, stats.rate);
+  setDoubleParam(_captureDroppedValue, (double) (stats.dropped + stats.failed));
+  setIntegerParam(_captureFilesValue, (int) stats.files);
+}
+
+void SlsJungfrau::updateLatency(const epicsTimeStamp *arrival, const epicsTimeStamp *ready)
+{
+  epicsTimeStamp now;
+  double total;
+
+  /* From the first module of the frame to the end of the plugin callbacks */
+  epicsTimeGetCurrent(&now);
+  total = epicsTimeDiffInSeconds(&now, arrival) * 1.e3;
+
+  _latencyLock.lock();
+  _latencyFrames++;
+  _latencyAssembly += epicsTimeDiffInSeconds(ready, arrival) * 1.e3;
+  _latencyProcess += epicsTimeDiffInSeconds(&now, ready) * 1.e3;
+  _latencyTotal += total;
+  if (total > _latencyMax) _latencyMax = total;
+  _latencyLock.unlock();
+}
+
+void SlsJungfrau::updateLatencyParams()
+{
+  /* Must be called with the lock held */
+  _latencyLock.lock();
+  setDoubleParam(_convTimeValue, _convTime);
+  if (_latencyFrames) {
+    setDoubleParam(_latencyAssemblyValue, _latencyAssembly / _latencyFrames);
+    setDoubleParam(_latencyProcessValue, _latencyProcess / _latencyFrames);
+    setDoubleParam(_latencyTotalValue, _latencyTotal / _latencyFrames);
+    setDoubleParam(_latencyMaxValue, _latencyMax);
+    _latencyFrames = 0;
+    _latencyAssembly = 0.;
+    _latencyProcess = 0.;
+    _latencyTotal = 0.;
+    _latencyMax = 0.;
+  }
+  _latencyLock.unlock();
+}
+
+void SlsJungfrau::updateLossParams(int module)
+{
+  /* Must be called with the lock held */
+  SlsDetPacketLossStats stats;
+  epicsFloat64 worstFrames[SLS_LOSS_WORST_FRAMES];
+
+  _modules[module].loss->getStats(&stats);
+  setDoubleParam(module, _rxFramesIncompleteValue, (double) stats.framesIncomplete);
+  setDoubleParam(module, _rxFramesMissedValue, (double) stats.framesMissed);
+  setDoubleParam(module, _rxPacketsLostValue, (double) stats.packetsLost);
+  setDoubleParam(module, _rxLossRateValue, stats.lossRate);
+  for (int n=0; n<stats.numWorst; n++) {
+    worstFrames[n] = (epicsFloat64) stats.worstFrame[n];
+  }
+  doCallbacksInt32Array(stats.burstHist, SLS_LOSS_BURST_BINS, _rxBurstHistValue, module);
+  doCallbacksFloat64Array(worstFrames, stats.numWorst, _rxWorstFramesValue, module);
+  doCallbacksInt32Array(stats.worstLost, stats.numWorst, _rxWorstLostValue, module);
+}
+
+void SlsJungfrau::updateModuleParams(int module)
+{
+  /* Must be called with the lock held */
+  SlsJungfrauModule &mod = _modules[module];
+
+  setDoubleParam(module, _rxFramesCaughtValue, (double) epicsAtomicGetSizeT(&mod.framesCaught));
+  setDoubleParam(module, _rxFrameNumberValue, (double) epicsAtomicGetSizeT(&mod.frameNumber));
+  setDoubleParam(module, _rxTimestampValue, (double) epicsAtomicGetSizeT(&mod.timestamp));
+  setDoubleParam(module, _rxBunchIdValue, (double) epicsAtomicGetSizeT(&mod.bunchId));
+  setIntegerParam(module, _rxPacketsCaughtValue, (int) epicsAtomicGetSizeT(&mod.packetsCaught));
+  setDoubleParam(module, _rxDroppedValue, (double) epicsAtomicGetSizeT(&mod.dropped));
+}
+
+void SlsJungfrau::updateRxFlags()
+{
+  /* Must be called with the lock held */
+  int acquire;
+  int arrayCallbacks;
+  int asmEnable;
+  int pedState;
+  int convEnable;
+  int convOutput;
+  int cellSplit;
+  int driftEnable;
+  int pubSource;
+  int shmSource;
+  double photonEnergy;
+  double photonThreshold;
+
+  getIntegerParam(ADAcquire, &acquire);
+  getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+  getIntegerParam(_asmEnableValue, &asmEnable);
+  getIntegerParam(_pedStateValue, &pedState);
+  getIntegerParam(_convEnableValue, &convEnable);
+  getIntegerParam(_convOutputValue, &convOutput);
+  getIntegerParam(_cellSplitValue, &cellSplit);
+  getIntegerParam(_driftEnableValue, &driftEnable);
+  getIntegerParam(_pubSourceValue, &pubSource);
+  getIntegerParam(_shmSourceValue, &shmSource);
+  getDoubleParam(_convPhotonEnergyValue, &photonEnergy);
+  getDoubleParam(_writePhotonThresholdValue, &photonThreshold);
+  epicsAtomicSetIntT(&_rxAcquire, acquire ? 1 : 0);
+  epicsAtomicSetIntT(&_rxCallbacks, arrayCallbacks ? 1 : 0);
+  epicsAtomicSetIntT(&_rxAssemble, asmEnable ? 1 : 0);
+  epicsAtomicSetIntT(&_rxPedestal, (pedState >= PED_SETTING_GAIN) && (pedState <= PED_GAIN2) ? 1 : 0);
+  epicsAtomicSetIntT(&_procConvEnable, convEnable);
+  epicsAtomicSetIntT(&_procConvOutput, convOutput);
+  epicsAtomicSetIntT(&_procCellSplit, cellSplit);
+  epicsAtomicSetIntT(&_procDriftEnable, driftEnable);
+  epicsAtomicSetIntT(&_procPedState, pedState);
+  epicsAtomicSetIntT(&_procPubSource, pubSource);
+  epicsAtomicSetIntT(&_procShmSource, shmSource);
+  _procLock.lock();
+  _procPhotonEnergy = photonEnergy;
+  _procPhotonThreshold = photonThreshold;
+  _procLock.unlock();
+}
+
+void SlsJungfrau::updateStreamParams(int module)
+{
+  /* Must be called with the lock held */
+  SlsDetSubscriberStats stats;
+  SlsDetUdpReceiverStats udp;
+
+  if (_modules[module].udp) {
+    _modules[module].udp->getStats(&udp);
+    setDoubleParam(module, _rxStreamBadValue, (double) udp.bad);
+    setDoubleParam(module, _rxUdpLateValue, (double) udp.late);
+    setDoubleParam(module, _rxUdpMovedValue, (double) udp.moved);
+    setIntegerParam(module, _rxUdpSocketBufferValue, udp.socketBuffer);
+    return;
+  }
+  if (!_modules[module].subscriber) return;
+
+  _modules[module].subscriber->getStats(&stats);
+  setDoubleParam(module, _rxStreamBadValue, (double) stats.bad);
+}
+
+void SlsJungfrau::updateDriftSelect()
+{
+  /* Must be called with the lock held */
+  int mode;
+  int modulus;
+  int offset;
+  int bunchMask;
+  int bunchValue;
+  double alpha;
+  SlsDetDarkSelect select;
+
+  if (!_drift) return;
+
+  getIntegerParam(_driftModeValue, &mode);
+  getIntegerParam(_driftModulusValue, &modulus);
+  getIntegerParam(_driftOffsetValue, &offset);
+  getIntegerParam(_driftBunchMaskValue, &bunchMask);
+  getIntegerParam(_driftBunchValueValue, &bunchValue);
+  getDoubleParam(_driftAlphaValue, &alpha);
+
+  select.mode = mode == SlsDarkBunchId ? SlsDarkBunchId : SlsDarkFrameNumber;
+  select.modulus = modulus > 0 ? modulus : 0;
+  select.offset = offset > 0 ? offset : 0;
+  /* The pattern only covers the low 32 bits of the bunchId */
+  select.mask = (epicsUInt32) bunchMask;
+  select.value = (epicsUInt32) bunchValue;
+  _drift->setSelect(select);
+  _drift->setAlpha(alpha);
+}
+
+void SlsJungfrau::updateDriftParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetDriftStats stats;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_driftLastUpdate) < DRIFT_UPDATE_PERIOD)) return;
+  _driftLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_drift) _drift->getStats(&stats);
+  setDoubleParam(_driftFramesValue, (double) stats.darkFrames);
+  setDoubleParam(_driftSkippedValue, (double) stats.skipped);
+  setDoubleParam(_driftMeanShiftValue, stats.meanShift);
+  setDoubleParam(_driftMaxShiftValue, stats.maxShift);
+}
+
+void SlsJungfrau::updateDataType()
+{
+  /* Must be called with the lock held */
+  int convEnable;
+  int convOutput;
+
+  getIntegerParam(_convEnableValue, &convEnable);
+  getIntegerParam(_convOutputValue, &convOutput);
+  if (_converter && convEnable) {
+    setIntegerParam(NDDataType, convOutput == SlsConvertPhotons ? NDInt16 : NDFloat32);
+  } else {
+    setIntegerParam(NDDataType, NDUInt16);
+  }
+}
+
+asynStatus SlsJungfrau::loadCalibration(const char *fileName)
+{
+  /* Must be called with the lock held */
+  SlsDetCalibration *cals[SLS_MAX_CELLS];
+  int cellList[SLS_MAX_CELLS];
+  int numCells;
+  char cellName[MAX_FILENAME_LEN];
+  char message[MAX_FILENAME_LEN];
+  bool perCell;
+  static const char *functionName = "loadCalibration";
+
+  if (!_converter) {
+    setStringParam(_convCalMessageValue, "Conversion unavailable");
+    return asynError;
+  }
+
+  /* A %d in the name loads a file for each storage cell in use */
+  perCell = cellFileName(cellName, sizeof(cellName), fileName, 0);
+  numCells = perCell ? cellsInUse(_cells, _cellStart, cellList) : cellsInUse(1, 0, cellList);
+
+  for (int k=0; k<numCells; k++) {
+    if (perCell) cellFileName(cellName, sizeof(cellName), fileName, cellList[k]);
+    try {
+      cals[k] = new SlsDetCalibration(_converter->sizeX(), _converter->sizeY());
+    } catch (...) {
+      cals[k] = NULL;
+    }
+    if (!cals[k]) {
+      setStringParam(_convCalMessageValue, "Unable to allocate the calibration");
+    } else if (!cals[k]->read(perCell ? cellName : fileName)) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s failed to load calibration: %s\n",
+                driverName, functionName, this->portName, cals[k]->error());
+      setStringParam(_convCalMessageValue, cals[k]->error());
+      cals[k]->release();
+      cals[k] = NULL;
+    }
+    /* Either every cell gets its tables or none does */
+    if (!cals[k]) {
+      for (int n=0; n<k; n++) cals[n]->release();
+      return asynError;
+    }
+  }
+
+  /* Frames being converted finish with the old tables */
+  for (int k=0; k<numCells; k++) {
+    _converter->setCalibration(cals[k], cellList[k]);
+  }
+  if (perCell) {
+    epicsSnprintf(message, sizeof(message), "Calibration of %d storage cells loaded", numCells);
+    setStringParam(_convCalMessageValue, message);
+  } else {
+    /* A single file is for every cell */
+    for (int cell=1; cell<SLS_MAX_CELLS; cell++) {
+      _converter->clearCalibration(cell);
+    }
+    setStringParam(_convCalMessageValue, "Calibration loaded");
+  }
+  updateCellParams();
+
+  return asynSuccess;
+}
+
+void SlsJungfrau::setPedestalState(int state, const char *message)
+{
+  static const char *functionName = "setPedestalState";
+
+  asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s:%s: port=%s pedestal run state %d: %s\n",
+            driverName, functionName, this->portName, state, message);
+
+  lock();
+  setIntegerParam(_pedStateValue, state);
+  setStringParam(_pedMessageValue, message);
+  if ((state < PED_SETTING_GAIN) || (state > PED_SAVING)) {
+    setIntegerParam(_pedStartValue, 0);
+  }
+  updateRxFlags();
+  callParamCallbacks();
+  unlock();
+}
+
+asynStatus SlsJungfrau::setDetectorGain(asynUser **pasynUsers, int setting)
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "setDetectorGain";
+
+  for (int addr=0; addr<_numModules; addr++) {
+    if (pasynInt32SyncIO->write(pasynUsers[addr], setting, PED_CONTROL_TIMEOUT) != asynSuccess) {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d failed to set the gain to %d: %s\n",
+                driverName, functionName, this->portName, addr, setting,
+                pasynUsers[addr]->errorMessage);
+      status = asynError;
+    }
+  }
+
+  return status;
+}
+
+asynStatus SlsJungfrau::pedestalRun()
+{
+  int numFrames;
+  int settleFrames;
+  int settings[SLS_NUM_GAINS];
+  int restore = -1;
+  int cellList[SLS_MAX_CELLS];
+  int numCells;
+  bool burst;
+  double timeout;
+  char message[MAX_FILENAME_LEN];
+  char controlPort[MAX_FILENAME_LEN];
+  char fileName[MAX_FILENAME_LEN];
+  char cellName[MAX_FILENAME_LEN];
+  SlsDetCalibration *cals[SLS_MAX_CELLS];
+  std::vector<asynUser*> pasynUsers(_numModules, (asynUser*) NULL);
+  asynUser *pasynUserGain = NULL;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "pedestalRun";
+
+  lock();
+  getIntegerParam(_pedFramesValue, &numFrames);
+  getIntegerParam(_pedSettleFramesValue, &settleFrames);
+  getDoubleParam(_pedTimeoutValue, &timeout);
+  getIntegerParam(_pedSetting0Value, &settings[0]);
+  getIntegerParam(_pedSetting1Value, &settings[1]);
+  getIntegerParam(_pedSetting2Value, &settings[2]);
+  getStringParam(_pedControlPortValue, sizeof(controlPort), controlPort);
+  getStringParam(_pedFileValue, sizeof(fileName), fileName);
+  burst = _cells > 1;
+  numCells = cellsInUse(_cells, _cellStart, cellList);
+  setIntegerParam(_pedProgressValue, 0);
+  unlock();
+
+  if (!controlPort[0]) {
+    setPedestalState(PED_FAILED, "No detector control port set");
+    return asynError;
+  }
+  if (numFrames < 1) numFrames = 1;
+  if (settleFrames < 0) settleFrames = 0;
+
+  /* The gains stay as they were, only the pedestals and noise are new */
+  for (int k=0; k<numCells; k++) {
+    SlsDetCalibration *current = _converter->getCalibration(cellList[k]);
+    try {
+      cals[k] = new SlsDetCalibration(current->sizeX(), current->sizeY());
+    } catch (...) {
+      cals[k] = NULL;
+    }
+    if (cals[k]) cals[k]->copy(current);
+    current->release();
+    if (!cals[k]) {
+      for (int n=0; n<k; n++) cals[n]->release();
+      setPedestalState(PED_FAILED, "Unable to allocate the calibration");
+      return asynError;
+    }
+  }
+
+  /* Each module of the detector is an address of the SlsDet control port */
+  for (int addr=0; addr<_numModules; addr++) {
+    if (pasynInt32SyncIO->connect(controlPort, addr, &pasynUsers[addr], SlsCtrlSetGainString) != asynSuccess) {
+      epicsSnprintf(message, sizeof(message), "Unable to connect to %s address %d",
+                    controlPort, addr);
+      setPedestalState(PED_FAILED, message);
+      pasynUsers[addr] = NULL;
+      status = asynError;
+    }
+  }
+
+  /* Remember the settings of the detector to put them back at the end */
+  if ((status == asynSuccess) &&
+      (pasynInt32SyncIO->connect(controlPort, 0, &pasynUserGain, SlsCtrlGetGainString) == asynSuccess)) {
+    if (pasynInt32SyncIO->read(pasynUserGain, &restore, PED_CONTROL_TIMEOUT) != asynSuccess) {
+      restore = -1;
+    }
+    pasynInt32SyncIO->disconnect(pasynUserGain);
+  }
+
+  /* In burst mode each gain is measured for one storage cell after the other */
+  for (int gain=0; (status == asynSuccess) && (gain<SLS_NUM_GAINS); gain++) {
+    epicsSnprintf(message, sizeof(message), "Setting gain %d", gain);
+    setPedestalState(PED_SETTING_GAIN, message);
+    if (setDetectorGain(&pasynUsers[0], settings[gain]) != asynSuccess) {
+      setPedestalState(PED_FAILED, "Failed to set the detector gain");
+      status = asynError;
+      break;
+    }
+
+    for (int k=0; (status == asynSuccess) && (k<numCells); k++) {
+      epicsTimeStamp start;
+      epicsTimeStamp now;
+
+      _pedStageEvent.tryWait();
+      _pedestal->start(gain, settleFrames, numFrames, burst ? cellList[k] : -1);
+      if (burst) {
+        epicsSnprintf(message, sizeof(message), "Accumulating gain %d cell %d", gain, cellList[k]);
+      } else {
+        epicsSnprintf(message, sizeof(message), "Accumulating gain %d", gain);
+      }
+      setPedestalState(PED_GAIN0 + gain, message);
+
+      epicsTimeGetCurrent(&start);
+      while (_pedestal->active()) {
+        _pedStageEvent.wait(PED_POLL_TIME);
+        lock();
+        setIntegerParam(_pedProgressValue, _pedestal->framesDone());
+        callParamCallbacks();
+        unlock();
+        epicsTimeGetCurrent(&now);
+        if (_pedAbort) {
+          setPedestalState(PED_ABORTED, "Aborted");
+          status = asynError;
+          break;
+        } else if (epicsTimeDiffInSeconds(&now, &start) > timeout) {
+          if (burst) {
+            epicsSnprintf(message, sizeof(message), "Timed out accumulating gain %d cell %d after %u frames",
+                          gain, cellList[k], _pedestal->framesDone());
+          } else {
+            epicsSnprintf(message, sizeof(message), "Timed out accumulating gain %d after %u frames",
+                          gain, _pedestal->framesDone());
+          }
+          setPedestalState(PED_FAILED, message);
+          status = asynError;
+          break;
+        }
+      }
+      _pedestal->stop();
+      if (status == asynSuccess) _pedestal->fill(cals[k], gain);
+    }
+  }
+
+  if ((restore >= 0) && pasynUsers[0]) {
+    setDetectorGain(&pasynUsers[0], restore);
+  }
+  for (int addr=0; addr<_numModules; addr++) {
+    if (pasynUsers[addr]) pasynInt32SyncIO->disconnect(pasynUsers[addr]);
+  }
+
+  if (status != asynSuccess) {
+    for (int k=0; k<numCells; k++) cals[k]->release();
+    return status;
+  }
+
+  setPedestalState(PED_SAVING, "Publishing the pedestals");
+  if (fileName[0] && burst && !cellFileName(cellName, sizeof(cellName), fileName, 0)) {
+    epicsSnprintf(message, sizeof(message), "Pedestals in use but not saved: no %%d for the cell in %s",
+                  fileName);
+    fileName[0] = '\0';
+  } else if (fileName[0]) {
+    epicsSnprintf(message, sizeof(message), "Pedestals in use and saved to %s", fileName);
+    for (int k=0; k<numCells; k++) {
+      if (burst) cellFileName(cellName, sizeof(cellName), fileName, cellList[k]);
+      if (!cals[k]->write(burst ? cellName : fileName)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s:%s: port=%s failed to save the pedestals: %s\n",
+                  driverName, functionName, this->portName, cals[k]->error());
+        epicsSnprintf(message, sizeof(message), "Pedestals in use but not saved: %s", cals[k]->error());
+        fileName[0] = '\0';
+        break;
+      }
+    }
+  } else {
+    epicsSnprintf(message, sizeof(message), "Pedestals in use");
+  }
+
+  for (int k=0; k<numCells; k++) {
+    _converter->setCalibration(cals[k], cellList[k]);
+  }
+  /* Outside burst mode the pedestals are for every cell */
+  if (!burst) {
+    for (int cell=1; cell<SLS_MAX_CELLS; cell++) {
+      _converter->clearCalibration(cell);
+    }
+  }
+  lock();
+  setStringParam(_convCalMessageValue, "Calibration from pedestal run");
+  if (fileName[0]) setStringParam(_convCalFileValue, fileName);
+  updateCellParams();
+  unlock();
+  setPedestalState(PED_DONE, message);
+
+  return status;
+}
+
+void SlsJungfrau::applyStorageCells()
+{
+  int cells;
+  int cellStart;
+  char controlPort[MAX_FILENAME_LEN];
+  char message[MAX_FILENAME_LEN];
+  asynUser *pasynUserCells = NULL;
+  asynUser *pasynUserStart = NULL;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "applyStorageCells";
+
+  lock();
+  cells = _cells;
+  cellStart = _cellStart;
+  getStringParam(_pedControlPortValue, sizeof(controlPort), controlPort);
+  unlock();
+
+  if (!controlPort[0]) {
+    epicsSnprintf(message, sizeof(message), "%d storage cells from %d, no detector control port set",
+                  cells, cellStart);
+  } else {
+    /* The detector counts the cells beyond the first */
+    for (int addr=0; (status == asynSuccess) && (addr<_numModules); addr++) {
+      if ((pasynInt32SyncIO->connect(controlPort, addr, &pasynUserCells, SlsCtrlSetStorageCellsString) != asynSuccess) ||
+          (pasynInt32SyncIO->connect(controlPort, addr, &pasynUserStart, SlsCtrlSetStorageCellStartString) != asynSuccess)) {
+        epicsSnprintf(message, sizeof(message), "Unable to connect to %s address %d", controlPort, addr);
+        status = asynError;
+      } else if ((pasynInt32SyncIO->write(pasynUserCells, cells - 1, PED_CONTROL_TIMEOUT) != asynSuccess) ||
+                 (pasynInt32SyncIO->write(pasynUserStart, cellStart, PED_CONTROL_TIMEOUT) != asynSuccess)) {
+        epicsSnprintf(message, sizeof(message), "Failed to set the storage cells of module %d", addr);
+        status = asynError;
+      }
+      if (pasynUserCells) pasynInt32SyncIO->disconnect(pasynUserCells);
+      if (pasynUserStart) pasynInt32SyncIO->disconnect(pasynUserStart);
+      pasynUserCells = NULL;
+      pasynUserStart = NULL;
+    }
+    if (status == asynSuccess) {
+      epicsSnprintf(message, sizeof(message), "%d storage cells from %d set on %s", cells, cellStart, controlPort);
+    } else {
+      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s %s\n",
+                driverName, functionName, this->portName, message);
+    }
+  }
+
+  lock();
+  setStringParam(_cellMessageValue, message);
+  callParamCallbacks();
+  unlock();
+}
+
+void SlsJungfrau::updateCellParams()
+{
+  /* Must be called with the lock held */
+  int tables = 0;
+
+  if (_converter) {
+    for (int cell=0; cell<SLS_MAX_CELLS; cell++) {
+      if (_converter->hasCalibration(cell)) tables++;
+    }
+  }
+  setIntegerParam(_cellTablesValue, tables);
+}
+
+void SlsJungfrau::run()
+{
+  slsDetPinThread(this->portName, SlsThreadProcess);
+
+  while (true) {
+    _pedStartEvent.wait();
+    if (!_pedRunning) break;
+    /* The control port can block, so the storage cells are set from here */
+    if (_cellsChanged) {
+      _cellsChanged = false;
+      applyStorageCells();
+    }
+    if (_pedRequested) {
+      _pedRequested = false;
+      _pedAbort = false;
+      pedestalRun();
+    }
+  }
+
+  slsDetUnpinThread();
+}
+
+void SlsJungfrau::updateAssemblerStats()
+{
+  /* Must be called with the lock held */
+  SlsDetAssemblerStats stats;
+
+  if (!_assembler) return;
+
+  _assembler->getStats(&stats);
+  setDoubleParam(_asmCompleteValue, (double) stats.complete);
+  setDoubleParam(_asmIncompleteValue, (double) stats.incomplete);
+  setDoubleParam(_asmLateValue, (double) stats.late);
+  setDoubleParam(_asmNoBufferValue, (double) stats.noBuffer);
+  setDoubleParam(_asmMissingMaskValue, (double) stats.lastMissing);
+}
+
+void SlsJungfrau::statusTask()
+{
+  while (_statusRunning) {
+    _statusEvent.wait(STATUS_UPDATE_PERIOD);
+    if (!_statusRunning) break;
+
+    /* The receive and process threads only count, the parameters and their
+     * callbacks are brought up to date from here */
+    for (int addr=0; addr<_numModules; addr++) {
+      _modules[addr].loss->updateDue();
+      lock();
+      updateModuleParams(addr);
+      updateLossParams(addr);
+      updateStreamParams(addr);
+      callParamCallbacks(addr);
+      unlock();
+    }
+
+    lock();
+    updateAssemblerStats();
+    updatePoolParams();
+    updateQueueParams(true);
+    updateEventParams(true);
+    updateDriftParams(true);
+    updatePublisherParams();
+    updateShmParams(true);
+    updateWriterParams(true);
+    updateReplayParams(true);
+    updateCaptureParams(true);
+    updateLatencyParams();
+    callParamCallbacks();
+    unlock();
+  }
+}
+
+void SlsJungfrauStatus::run()
+{
+  _driver->statusTask();
+}
+
+/* Must be called with the lock held */
+void SlsJungfrau::updatePoolParams()
+{
+  SlsDetFramePoolStats pool;
+
+  if (!_assembler) return;
+
+  _assembler->pool()->getStats(&pool);
+  setIntegerParam(_poolFramesValue, pool.numFrames);
+  setIntegerParam(_poolUsedValue, pool.inUse);
+  setIntegerParam(_poolHighWaterValue, pool.highWater);
+  setDoubleParam(_poolFailuresValue, (double) pool.allocFailures);
+  setIntegerParam(_poolPagesValue, pool.pages);
+  setIntegerParam(_poolLockedValue, pool.locked ? 1 : 0);
+}
+
+void SlsJungfrau::updateQueueParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetFrameQueueStats proc;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_queueLastUpdate) < QUEUE_UPDATE_PERIOD)) return;
+  _queueLastUpdate = now;
+
+  std::memset(&proc, 0, sizeof(proc));
+  if (_procStage) _procStage->queue()->getStats(&proc);
+  setIntegerParam(_procUsedValue, proc.depth);
+  setIntegerParam(_procHighWaterValue, proc.highWater);
+  setDoubleParam(_procDroppedValue, (double) proc.dropped);
+  setDoubleParam(_procDecimatedValue, (double) proc.decimated);
+  setDoubleParam(_procShedValue, (double) epicsAtomicGetSizeT(&_procShed));
+}
+
+void SlsJungfrau::updateEventParams(bool force)
+{
+  /* Must be called with the lock held */
+  SlsDetEventStats stats;
+  epicsTimeStamp now;
+
+  epicsTimeGetCurrent(&now);
+  if (!force && (epicsTimeDiffInSeconds(&now, &_eventLastUpdate) < EVT_UPDATE_PERIOD)) return;
+  _eventLastUpdate = now;
+
+  std::memset(&stats, 0, sizeof(stats));
+  if (_eventBuilder) _eventBuilder->getStats(&stats);
+  setDoubleParam(_evtMatchedValue, (double) stats.matched);
+  setDoubleParam(_evtUnmatchedValue, (double) stats.unmatched);
+  setDoubleParam(_evtLateValue, (double) stats.late);
+  setIntegerParam(_evtPendingValue, stats.pending);
+  setDoubleParam(_evtDriftValue, stats.drift);
+  setDoubleParam(_evtJitterValue, stats.jitter);
+  setIntegerParam(_evtLockedValue, stats.locked ? 1 : 0);
+}
+
+asynStatus SlsJungfrau::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+  const char* name = NULL;
+  int addr;
+  int function = pasynUser->reason;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "writeInt32";
+
+  status = getAddress(pasynUser, &addr); if (status != asynSuccess) return status;
+
+  getParamName(addr, function, &name);
+  if (name) {
+    asynPrint(pasynUser, ASYN_TRACEIO_DEVICE,
+              "%s:%s: port=%s address=%d received write request (%d) for parameter: %s\n",
+               driverName, functionName, this->portName, addr, value, name);
+  }
+
+  if (function == ADAcquire) {
+    setAcquire(value);
+    callParamCallbacks();
+  } else if (function == _rxLossResetValue) {
+    if (value) {
+      _modules[addr].loss->reset();
+      if (_modules[addr].udp) _modules[addr].udp->resetStats();
+      updateLossParams(addr);
+      updateStreamParams(addr);
+    }
+    callParamCallbacks(addr);
+  } else if (function == _asmEnableValue) {
+    if (value && !_assembler) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the frame assembler is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else {
+      setIntegerParam(function, value ? 1 : 0);
+      callParamCallbacks();
+    }
+  } else if (function == _pedStartValue) {
+    int pedState;
+    getIntegerParam(_pedStateValue, &pedState);
+    bool running = (pedState >= PED_SETTING_GAIN) && (pedState <= PED_SAVING);
+    if (value && !running) {
+      if (!_pedestal) {
+        status = asynError;
+      } else {
+        setIntegerParam(function, 1);
+        setIntegerParam(_pedStateValue, PED_SETTING_GAIN);
+        _pedRequested = true;
+        _pedStartEvent.signal();
+      }
+    } else if (!value && running) {
+      _pedAbort = true;
+      _pedStageEvent.signal();
+    }
+    callParamCallbacks();
+  } else if ((function == _geomFlipXValue) || (function == _geomFlipYValue)) {
+    int flipX;
+    int flipY;
+    setIntegerParam(addr, function, value ? 1 : 0);
+    getIntegerParam(addr, _geomFlipXValue, &flipX);
+    getIntegerParam(addr, _geomFlipYValue, &flipY);
+    if (_assembler) _assembler->setFlip(addr, flipX, flipY);
+    callParamCallbacks(addr);
+  } else if (function == _writePhotonsValue) {
+    if ((value && !_quantizer) || _writing) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d unable to change the photon counting %s\n",
+                driverName, functionName, this->portName, addr,
+                _writing ? "while writing" : "without a converter");
+      status = asynError;
+    } else {
+      setIntegerParam(function, value ? 1 : 0);
+      callParamCallbacks();
+    }
+  } else if (function == _driftEnableValue) {
+    if (value && !_drift) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the pedestal drift tracker is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else {
+      setIntegerParam(function, value ? 1 : 0);
+      callParamCallbacks();
+    }
+  } else if ((function == _driftModeValue) || (function == _driftModulusValue) ||
+             (function == _driftOffsetValue) || (function == _driftBunchMaskValue) ||
+             (function == _driftBunchValueValue)) {
+    setIntegerParam(function, value);
+    updateDriftSelect();
+    callParamCallbacks();
+  } else if (function == _driftResetValue) {
+    if (value && _drift) {
+      _drift->reset();
+      updateDriftParams(true);
+    }
+    callParamCallbacks();
+  } else if ((function == _convEnableValue) || (function == _convOutputValue)) {
+    setIntegerParam(function, value);
+    updateDataType();
+    callParamCallbacks();
+  } else if ((function == _pubEnableValue) || (function == _pubHighWaterMarkValue)) {
+    setIntegerParam(function, value);
+    openPublisher();
+    callParamCallbacks();
+  } else if ((function == _shmEnableValue) || (function == _shmSlotsValue) ||
+             (function == _shmSourceValue)) {
+    /* The slots are sized for the source, so a new source is a new ring */
+    setIntegerParam(function, value);
+    openShmRing();
+    callParamCallbacks();
+  } else if (function == _writeEnableValue) {
+    int acquire;
+    if (value && !_writer) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the writer is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else {
+      setIntegerParam(function, value ? 1 : 0);
+      getIntegerParam(ADAcquire, &acquire);
+      if (value && acquire) {
+        startWriter();
+      } else if (!value) {
+        stopWriter();
+      }
+      callParamCallbacks();
+    }
+  } else if ((function == _writeFormatValue) || (function == _writeQueueDepthValue) ||
+             (function == _writeCompressionValue) || (function == _writeFramesPerChunkValue) ||
+             (function == _writeThreadsValue)) {
+    /* These are fixed when the writer is made, so it is remade while idle */
+    bool valid;
+    if (function == _writeFormatValue) {
+#ifdef WITH_HDF5
+      valid = (value == slsReceiverDefs::BINARY) || (value == slsReceiverDefs::HDF5);
+#else
+      valid = value == slsReceiverDefs::BINARY;
+#endif
+    } else if (function == _writeCompressionValue) {
+      valid = (value == SlsCompressNone) || (value == SlsCompressDeflate) ||
+              (value == SlsCompressBitshuffleLz4);
+    } else if (function == _writeThreadsValue) {
+      valid = value >= 0;
+    } else {
+      valid = value >= 1;
+    }
+    if (!_assembler || _writing || !valid) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d unable to set the writer to %d while %s\n",
+                driverName, functionName, this->portName, addr, value,
+                _writing ? "writing" : "unavailable or out of range");
+      status = asynError;
+    } else {
+      setIntegerParam(function, value);
+      if (!createWriter()) status = asynError;
+      callParamCallbacks();
+    }
+  } else if ((function == _writePolicyValue) || (function == _writeDecimateValue)) {
+    int policy;
+    int decimate;
+    if ((function == _writePolicyValue) && ((value < SlsQueueBlock) || (value > SlsQueueDecimate))) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d invalid writer queue policy %d\n",
+                driverName, functionName, this->portName, addr, value);
+      status = asynError;
+    } else {
+      setIntegerParam(function, value);
+      getIntegerParam(_writePolicyValue, &policy);
+      getIntegerParam(_writeDecimateValue, &decimate);
+      if (_writer) _writer->setPolicy((SlsQueuePolicy) policy, decimate);
+      callParamCallbacks();
+    }
+  } else if (function == _writePriorityValue) {
+    /* The frames of a file all take the same way to the writer */
+    if (_writing) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d unable to change the writer priority while writing\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else {
+      _writerLock.lock();
+      _writeCritical = value == WRITE_CRITICAL;
+      _writerLock.unlock();
+      setIntegerParam(function, _writeCritical ? WRITE_CRITICAL : WRITE_BEST_EFFORT);
+      callParamCallbacks();
+    }
+  } else if ((function == _procQueueDepthValue) || (function == _procPolicyValue) ||
+             (function == _procDecimateValue)) {
+    int depth;
+    int policy;
+    int decimate;
+    if (!_procStage || ((function == _procQueueDepthValue) && (value < 1)) ||
+        ((function == _procPolicyValue) && ((value < SlsQueueBlock) || (value > SlsQueueDecimate)))) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d unable to set the process queue to %d while %s\n",
+                driverName, functionName, this->portName, addr, value,
+                _procStage ? "out of range" : "unavailable");
+      status = asynError;
+    } else {
+      setIntegerParam(function, value);
+      getIntegerParam(_procQueueDepthValue, &depth);
+      getIntegerParam(_procPolicyValue, &policy);
+      getIntegerParam(_procDecimateValue, &decimate);
+      _procStage->queue()->setCapacity(depth);
+      _procStage->queue()->setPolicy((SlsQueuePolicy) policy, decimate);
+      updateQueueParams(true);
+      callParamCallbacks();
+    }
+  } else if (function == _evtEnableValue) {
+    if (value && !_eventBuilder) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the event builder is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else {
+      /* Each time it is enabled it starts from a clean index and clock model */
+      if (value && !_eventEnable) _eventBuilder->reset();
+      if (!value && _eventEnable) _eventBuilder->flush();
+      _eventEnable = value != 0;
+      setIntegerParam(function, _eventEnable ? 1 : 0);
+      updateEventParams(true);
+      callParamCallbacks();
+    }
+  } else if ((function == _cellsValue) || (function == _cellStartValue)) {
+    if (function == _cellsValue) {
+      _cells = value < 1 ? 1 : (value > SLS_MAX_CELLS ? SLS_MAX_CELLS : value);
+      setIntegerParam(function, _cells);
+    } else {
+      _cellStart = value < 0 ? 0 : (value > SLS_MAX_CELLS - 1 ? SLS_MAX_CELLS - 1 : value);
+      setIntegerParam(function, _cellStart);
+    }
+    /* The dark frames tracked are those of the first cell of a burst */
+    if (_drift) _drift->setCell(_cells > 1 ? _cellStart : 0);
+    _cellsChanged = true;
+    _pedStartEvent.signal();
+    callParamCallbacks();
+  } else if (function == _cellSourceValue) {
+    _cellSource = value == CELL_FRAME_NUMBER ? CELL_FRAME_NUMBER : CELL_HEADER;
+    setIntegerParam(function, _cellSource);
+    callParamCallbacks();
+  } else if (function == _evtPulsesValue) {
+    double window;
+    if (value < 1) value = 1;
+    setIntegerParam(function, value);
+    getDoubleParam(_evtWindowValue, &window);
+    if (_eventBuilder) _eventBuilder->setWindow(value, window);
+    callParamCallbacks();
+  } else if (function == _pubEveryValue) {
+    double maxRate;
+    if (value < 1) value = 1;
+    setIntegerParam(function, value);
+    getDoubleParam(_pubMaxRateValue, &maxRate);
+    if (_publisher) _publisher->setDecimation(value, maxRate);
+    callParamCallbacks();
+  } else if (function == _replayValue) {
+    if (value && !_replay) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the replay is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else if (value) {
+      char path[256];
+      char name[256];
+      int fileIndex;
+      int loops;
+      double rate;
+      getStringParam(_replayPathValue, sizeof(path), path);
+      getStringParam(_replayNameValue, sizeof(name), name);
+      getIntegerParam(_replayIndexValue, &fileIndex);
+      getIntegerParam(_replayLoopsValue, &loops);
+      getDoubleParam(_replayRateValue, &rate);
+      /* Mapping the files does not call back into the driver, so the lock can stay held */
+      _replay->resetStats();
+      if (!_replay->open(path, name, fileIndex) || !_replay->start(rate, loops > 0 ? loops : 0)) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s:%s: port=%s address=%d unable to replay: %s\n",
+                  driverName, functionName, this->portName, addr, _replay->status());
+        status = asynError;
+      }
+      updateReplayParams(true);
+      callParamCallbacks();
+    } else {
+      /* The replay finishes on its own thread, which clears the parameter */
+      if (_replay) _replay->stop();
+    }
+  } else if (function == _captureValue) {
+    if (value && !_capture) {
+      asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                "%s:%s: port=%s address=%d the packet capture is not available\n",
+                driverName, functionName, this->portName, addr);
+      status = asynError;
+    } else if (value) {
+      char interface[64];
+      char path[256];
+      char name[256];
+      int port;
+      int fileSize;
+      getStringParam(_captureInterfaceValue, sizeof(interface), interface);
+      getIntegerParam(_capturePortValue, &port);
+      getStringParam(_capturePathValue, sizeof(path), path);
+      getStringParam(_captureNameValue, sizeof(name), name);
+      getIntegerParam(_captureFileSizeValue, &fileSize);
+      _capture->resetStats();
+      if (!_capture->start(interface, port, _numModules, path, name,
+                           fileSize > 0 ? (size_t) fileSize * 1024 * 1024 : 0)) {
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                  "%s:%s: port=%s address=%d unable to capture: %s\n",
+                  driverName, functionName, this->portName, addr, _capture->status());
+        status = asynError;
+      }
+      updateCaptureParams(true);
+      callParamCallbacks();
+    } else {
+      /* The capture closes its file on its own thread */
+      if (_capture) _capture->stop();
+      updateCaptureParams(true);
+      callParamCallbacks();
+    }
+  } else if (function == _asmReorderWindowValue) {
+    if (value < 1) value = 1;
+    if (_assembler) _assembler->setReorderWindow(value);
+    setIntegerParam(function, value);
+    callParamCallbacks();
+  } else { // Other functions we call the base class method
+    status = ADDriver::writeInt32(pasynUser, value);
+  }
+
+  /* The receive threads pick up any change to the flags they use without the lock */
+  updateRxFlags();
+
+  return status;
+}
+
+asynStatus SlsJungfrau::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
+{
+  const char* name = NULL;
+  int addr;
+  int function = pasynUser->reason;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "writeFloat64";
+
+  status = getAddress(pasynUser, &addr); if (status != asynSuccess) return status;
+
+  getParamName(addr, function, &name);
+  if (name) {
+    asynPrint(pasynUser, ASYN_TRACEIO_DEVICE,
+              "%s:%s: port=%s address=%d received write request (%f) for parameter: %s\n",
+               driverName, functionName, this->portName, addr, value, name);
+  }
+
+  if (function == _asmTimeoutValue) {
+    if (value < 0.) value = 0.;
+    if (_assembler) _assembler->setTimeout(value);
+    setDoubleParam(function, value);
+    callParamCallbacks();
+  } else if (function == _evtPulseIdValue) {
+    /* The time of the pulse is the time of the timing event that came with it */
+    epicsTimeStamp time;
+    int timeEvent;
+    getIntegerParam(_evtTimeEventValue, &timeEvent);
+    if (epicsTimeGetEvent(&time, timeEvent) != epicsTimeOK) epicsTimeGetCurrent(&time);
+    if ((value < 0.) || !_eventBuilder) {
+      status = asynError;
+    } else {
+      _eventBuilder->addPulse((epicsUInt64) value, &time);
+      setDoubleParam(function, value);
+      callParamCallbacks();
+    }
+  } else if (function == _evtWindowValue) {
+    int pulses;
+    if (value < 0.) value = 0.;
+    setDoubleParam(function, value);
+    getIntegerParam(_evtPulsesValue, &pulses);
+    if (_eventBuilder) _eventBuilder->setWindow(pulses, value);
+    callParamCallbacks();
+  } else if (function == _driftAlphaValue) {
+    if ((value <= 0.) || (value > 1.)) {
+      status = asynError;
+    } else {
+      setDoubleParam(function, value);
+      updateDriftSelect();
+      callParamCallbacks();
+    }
+  } else if (function == _pubMaxRateValue) {
+    int every;
+    if (value < 0.) value = 0.;
+    setDoubleParam(function, value);
+    getIntegerParam(_pubEveryValue, &every);
+    if (_publisher) _publisher->setDecimation(every, value);
+    callParamCallbacks();
+  } else if (function == _convPhotonEnergyValue) {
+    if (value <= 0.) {
+      status = asynError;
+    } else {
+      setDoubleParam(function, value);
+      callParamCallbacks();
+    }
+  } else if (function == _writePhotonThresholdValue) {
+    /* A fraction of the photon energy, at 0 an empty pixel would count a photon */
+    if ((value < SLS_PHOTON_THRESHOLD_MIN) || (value > 1.)) {
+      status = asynError;
+    } else {
+      setDoubleParam(function, value);
+      callParamCallbacks();
+    }
+  } else { // Other functions we call the base class method
+    status = ADDriver::writeFloat64(pasynUser, value);
+  }
+
+  /* processFrame() picks up the photon energy and threshold without the lock */
+  updateRxFlags();
+
+  return status;
+}
+
+asynStatus SlsJungfrau::writeOctet(asynUser *pasynUser, const char *value,
+                                   size_t nChars, size_t *nActual)
+{
+  int addr;
+  int function = pasynUser->reason;
+  asynStatus status = asynSuccess;
+  static const char *functionName = "writeOctet";
+
+  status = getAddress(pasynUser, &addr); if (status != asynSuccess) return status;
+
+  if (function == _convCalFileValue) {
+    asynPrint(pasynUser, ASYN_TRACEIO_DEVICE,
+              "%s:%s: port=%s address=%d loading calibration file %s\n",
+              driverName, functionName, this->portName, addr, value);
+    setStringParam(function, value);
+    status = loadCalibration(value);
+    callParamCallbacks();
+    *nActual = nChars;
+  } else if (function == _pubEndpointValue) {
+    int enable;
+    setStringParam(function, value);
+    getIntegerParam(_pubEnableValue, &enable);
+    if (enable) openPublisher();
+    callParamCallbacks();
+    *nActual = nChars;
+  } else if (function == _shmNameValue) {
+    int enable;
+    setStringParam(function, value);
+    getIntegerParam(_shmEnableValue, &enable);
+    if (enable) openShmRing();
+    callParamCallbacks();
+    *nActual = nChars;
+  } else { // Other functions we call the base class method
+    status = ADDriver::writeOctet(pasynUser, value, nChars, nActual);
+  }
+
+  return status;
+}
+
+void SlsJungfrau::report(FILE *fp, int details)
+{
+  fprintf(fp, "SlsJungfrau detector %s\n", this->portName);
+  if (details > 0) {
+    for (int addr=0; addr<_numModules; addr++) {
+      int rxStatus;
+      double framesCaught;
+      SlsDetPacketLossStats loss;
+      getIntegerParam(addr, _rxStatusValue, &rxStatus);
+      getDoubleParam(addr, _rxFramesCaughtValue, &framesCaught);
+      _modules[addr].loss->getStats(&loss);
+      fprintf(fp, "  module %d: rx tcp port %d, status %d, frames caught %.0f\n",
+              addr, _rxTcpPort + addr, rxStatus, framesCaught);
+      fprintf(fp, "    packets lost %llu, frames incomplete %llu, frames missed %llu\n",
+              (unsigned long long) loss.packetsLost, (unsigned long long) loss.framesIncomplete,
+              (unsigned long long) loss.framesMissed);
+      if (_modules[addr].subscriber) {
+        SlsDetSubscriberStats stream;
+        _modules[addr].subscriber->getStats(&stream);
+        fprintf(fp, "    stream %s on core %d: %llu frames, %llu bad messages, %s\n",
+                _modules[addr].subscriber->endpoint(), _modules[addr].subscriber->cpu(),
+                (unsigned long long) stream.frames, (unsigned long long) stream.bad,
+                _modules[addr].subscriber->error());
+      }
+      if (_modules[addr].udp) {
+        SlsDetUdpReceiverStats udp;
+        _modules[addr].udp->getStats(&udp);
+        fprintf(fp, "    udp port %d on core %d: %llu packets, %llu frames, %llu late, %llu bad, "
+                "%llu moved, %llu no buffer, %.1f packets per read, %d byte buffer, %s\n",
+                _modules[addr].udp->port(), _modules[addr].udp->cpu(),
+                (unsigned long long) udp.packets, (unsigned long long) udp.frames,
+                (unsigned long long) udp.late, (unsigned long long) udp.bad,
+                (unsigned long long) udp.moved, (unsigned long long) udp.noBuffer,
+                udp.reads ? (double) udp.packets / udp.reads : 0., udp.socketBuffer,
+                _modules[addr].udp->error());
+      }
+    }
+    fprintf(fp, "  packetsMask popcount: %s\n", SlsDetPacketLoss::kernelName());
+    if (_converter) {
+      fprintf(fp, "  converter: %s kernel, %d threads\n",
+              SlsDetConverter::kernelName(), _converter->numThreads());
+    }
+    int cellTables;
+    getIntegerParam(_cellTablesValue, &cellTables);
+    fprintf(fp, "  storage cells: %d from %d by %s, %d with their own tables\n",
+            _cells, _cellStart, _cellSource == CELL_FRAME_NUMBER ? "frame number" : "header", cellTables);
+    if (_pedestal) {
+      fprintf(fp, "  pedestal: %s kernel, %u frames done, %lu frames skipped\n",
+              SlsDetPedestal::kernelName(), _pedestal->framesDone(),
+              (unsigned long) _pedestal->framesSkipped());
+    }
+    if (_quantizer) {
+      SlsDetQuantizerStats photons;
+      _quantizer->getStats(&photons);
+      fprintf(fp, "  photon quantizer: %s kernel, %llu frames, RMS error %.3f keV, mean %.3f keV\n",
+              SlsDetQuantizer::kernelName(), (unsigned long long) photons.frames,
+              photons.rmsError, photons.meanRmsError);
+    }
+    if (_drift) {
+      SlsDetDriftStats drift;
+      _drift->getStats(&drift);
+      fprintf(fp, "  pedestal drift: %s kernel, %llu dark frames, %llu skipped, mean shift %.3f ADU\n",
+              SlsDetDriftTracker::kernelName(), (unsigned long long) drift.darkFrames,
+              (unsigned long long) drift.skipped, drift.meanShift);
+    }
+    if (_writer) {
+      SlsDetWriterStats write;
+      _writer->getStats(&write);
+      fprintf(fp, "  writer: %llu frames, %llu dropped, %llu failed, %.1f MB/s, %s\n",
+              (unsigned long long) write.frames, (unsigned long long) write.dropped,
+              (unsigned long long) write.failed, write.rate, _writer->status());
+      fprintf(fp, "  writer queue: %s, %s, %u of %u frames, high water %u, %llu blocked\n",
+              _writeCritical ? "critical" : "best effort",
+              SlsDetFrameQueue::policyName((SlsQueuePolicy) write.queue.policy),
+              write.queue.depth, write.queue.capacity, write.queue.highWater,
+              (unsigned long long) write.queue.blocked);
+#ifdef WITH_HDF5
+      SlsDetHdf5Writer *hdf5 = dynamic_cast<SlsDetHdf5Writer*>(_writer);
+      if (hdf5) {
+        fprintf(fp, "  HDF5 writer: %s chunks of %u frames, %d compression threads, %s bitshuffle kernel\n",
+                SlsDetCompressor::codecName(hdf5->codec()), hdf5->framesPerChunk(), hdf5->numThreads(),
+                slsDetBitshuffleKernelName());
+      }
+#endif
+    }
+    if (_replay) {
+      SlsDetReplayStats replay;
+      _replay->getStats(&replay);
+      fprintf(fp, "  replay: %llu frames, %.0f frames/s, %.1f MB/s, %llu passes, %s\n",
+              (unsigned long long) replay.frames, replay.rate, replay.throughput,
+              (unsigned long long) replay.loops, _replay->status());
+    }
+    if (_capture) {
+      SlsDetCaptureStats capture;
+      _capture->getStats(&capture);
+      fprintf(fp, "  capture: %llu packets, %.0f packets/s, %llu dropped, %llu failed, %llu files, %s\n",
+              (unsigned long long) capture.packets, capture.rate, (unsigned long long) capture.dropped,
+              (unsigned long long) capture.failed, (unsigned long long) capture.files, _capture->status());
+    }
+    if (_procStage) {
+      SlsDetFrameQueueStats proc;
+      _procStage->queue()->getStats(&proc);
+      fprintf(fp, "  process queue: %s, %u of %u frames, high water %u, %llu dropped, "
+              "%llu decimated, %llu blocked, %llu shed\n",
+              SlsDetFrameQueue::policyName((SlsQueuePolicy) proc.policy), proc.depth, proc.capacity,
+              proc.highWater, (unsigned long long) proc.dropped, (unsigned long long) proc.decimated,
+              (unsigned long long) proc.blocked, (unsigned long long) epicsAtomicGetSizeT(&_procShed));
+    }
+    if (_eventBuilder) {
+      SlsDetEventStats event;
+      _eventBuilder->getStats(&event);
+      fprintf(fp, "  event builder: %s, %llu pulses, %llu matched, %llu unmatched, %llu late, "
+              "%u waiting, clock %s %+.2f ppm, %.1f us RMS\n",
+              _eventEnable ? "enabled" : "disabled", (unsigned long long) event.pulses,
+              (unsigned long long) event.matched, (unsigned long long) event.unmatched,
+              (unsigned long long) event.late, event.pending, event.locked ? "locked" : "unlocked",
+              event.drift, event.jitter);
+    }
+    slsDetAffinityReport(fp, this->portName);
+    if (_publisher && _publisher->isOpen()) {
+      SlsDetPublisherStats pub;
+      _publisher->getStats(&pub);
+      fprintf(fp, "  publisher: %llu sent, %llu decimated, %llu dropped, %llu failed\n",
+              (unsigned long long) pub.sent, (unsigned long long) pub.decimated,
+              (unsigned long long) pub.dropped, (unsigned long long) pub.failed);
+    }
+    if (_shmRing && _shmRing->isOpen()) {
+      SlsDetShmRingStats shm;
+      _shmRing->getStats(&shm);
+      fprintf(fp, "  shared memory: %llu written, %llu too large, %u readers, lag %llu, %llu lost, %s\n",
+              (unsigned long long) shm.written, (unsigned long long) shm.failed, shm.readers,
+              (unsigned long long) shm.maxLag, (unsigned long long) shm.lost, _shmRing->error());
+    }
+    if (_assembler) {
+      SlsDetAssemblerStats stats;
+      _assembler->getStats(&stats);
+      fprintf(fp, "  assembler: %llu complete, %llu incomplete, %llu late, %llu no buffer, %u of %u buffers free\n",
+              (unsigned long long) stats.complete, (unsigned long long) stats.incomplete,
+              (unsigned long long) stats.late, (unsigned long long) stats.noBuffer,
+              _assembler->pool()->numFree(), _assembler->pool()->numFrames());
+      SlsDetFramePoolStats pool;
+      _assembler->pool()->getStats(&pool);
+      fprintf(fp, "  frame pool: %u of %u buffers in use, high water %u, %llu failures, %s pages, %s\n",
+              pool.inUse, pool.numFrames, pool.highWater, (unsigned long long) pool.allocFailures,
+              SlsDetFramePool::pagesName(pool.pages), pool.locked ? "locked" : "not locked");
+    }
+  }
+  /* Invoke the base class method */
+  ADDriver::report(fp, details);
+}
+
+/** Configuration command, called directly or from iocsh */
+extern "C" int SlsJungfrauConfigure(const char *portName, int numModules, int numModulesX, int gapPixels, int rxTcpPort,
+                                    int numBuffers, int numConvThreads, int maxMemory, int priority, int stackSize)
+{
+  if (numModules < 1) numModules = 1;
+  if (numModules > SLS_MAX_MODULES) numModules = SLS_MAX_MODULES;
+  if ((numModulesX < 1) || (numModulesX > numModules)) numModulesX = 1;
+  if ((gapPixels < SlsGapNone) || (gapPixels > SlsGapSplit)) gapPixels = SlsGapNone;
+  if (rxTcpPort <= 0) rxTcpPort = DEFAULT_RX_TCP_PORT;
+  if (numConvThreads < 0) numConvThreads = 0;
+  new SlsJungfrau(portName, numModules, numModulesX, gapPixels, rxTcpPort, NULL, NULL, numBuffers,
+                  numConvThreads, (size_t) maxMemory, priority, stackSize);
+  return(asynSuccess);
+}
+
+/** Configuration command for a detector read from the ZeroMQ streams of its receivers or its UDP packets */
+extern "C" int SlsJungfrauStreamConfigure(const char *portName, int numModules, int numModulesX, int gapPixels,
+                                          const char *streams, const char *cores, int numBuffers,
+                                          int numConvThreads, int maxMemory, int priority, int stackSize)
+{
+  if (numModules < 1) numModules = 1;
+  if (numModules > SLS_MAX_MODULES) numModules = SLS_MAX_MODULES;
+  if ((numModulesX < 1) || (numModulesX > numModules)) numModulesX = 1;
+  if ((gapPixels < SlsGapNone) || (gapPixels > SlsGapSplit)) gapPixels = SlsGapNone;
+  if (!streams || !streams[0]) {
+    printf("SlsJungfrauStreamConfigure: no streams given for port %s\n", portName);
+    return(asynError);
+  }
+  if (numConvThreads < 0) numConvThreads = 0;
+  new SlsJungfrau(portName, numModules, numModulesX, gapPixels, 0, streams, cores, numBuffers,
+                  numConvThreads, (size_t) maxMemory, priority, stackSize);
+  return(asynSuccess);
+}
+
+
+static const iocshArg configArg0 = { "Port name",         iocshArgString};
+static const iocshArg configArg1 = { "Number of modules", iocshArgInt};
+static const iocshArg configArg2 = { "Modules per row",   iocshArgInt};
+static const iocshArg configArg3 = { "Gap pixels",        iocshArgInt};
+static const iocshArg configArg4 = { "Receiver TCP port", iocshArgInt};
+static const iocshArg configArg5 = { "Number of buffers", iocshArgInt};
+static const iocshArg configArg6 = { "Conversion threads", iocshArgInt};
+static const iocshArg configArg7 = { "Max memory",        iocshArgInt};
+static const iocshArg configArg8 = { "Priority",          iocshArgInt};
+static const iocshArg configArg9 = { "Stack size",        iocshArgInt};
+static const iocshArg * const configArgs[] = {&configArg0,
+                                              &configArg1,
+                                              &configArg2,
+                                              &configArg3,
+                                              &configArg4,
+                                              &configArg5,
+                                              &configArg6,
+                                              &configArg7,
+                                              &configArg8,
+                                              &configArg9};
+static const iocshFuncDef configFuncDef = {"SlsJungfrauConfigure", 10, configArgs};
+static void configCallFunc(const iocshArgBuf *args)
+{
+  SlsJungfrauConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
+                       args[4].ival, args[5].ival, args[6].ival, args[7].ival,
+                       args[8].ival, args[9].ival);
+}
+
+static const iocshArg streamConfigArg0 = { "Port name",          iocshArgString};
+static const iocshArg streamConfigArg1 = { "Number of modules",  iocshArgInt};
+static const iocshArg streamConfigArg2 = { "Modules per row",    iocshArgInt};
+static const iocshArg streamConfigArg3 = { "Gap pixels",         iocshArgInt};
+static const iocshArg streamConfigArg4 = { "Stream endpoints",   iocshArgString};
+static const iocshArg streamConfigArg5 = { "Stream cores",       iocshArgString};
+static const iocshArg streamConfigArg6 = { "Number of buffers",  iocshArgInt};
+static const iocshArg streamConfigArg7 = { "Conversion threads", iocshArgInt};
+static const iocshArg streamConfigArg8 = { "Max memory",         iocshArgInt};
+static const iocshArg streamConfigArg9 = { "Priority",           iocshArgInt};
+static const iocshArg streamConfigArg10 = { "Stack size",        iocshArgInt};
+static const iocshArg * const streamConfigArgs[] = {&streamConfigArg0,
+                                                    &streamConfigArg1,
+                                                    &streamConfigArg2,
+                                                    &streamConfigArg3,
+                                                    &streamConfigArg4,
+                                                    &streamConfigArg5,
+                                                    &streamConfigArg6,
+                                                    &streamConfigArg7,
+                                                    &streamConfigArg8,
+                                                    &streamConfigArg9,
+                                                    &streamConfigArg10};
+static const iocshFuncDef streamConfigFuncDef = {"SlsJungfrauStreamConfigure", 11, streamConfigArgs};
+static void streamConfigCallFunc(const iocshArgBuf *args)
+{
+  SlsJungfrauStreamConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
+                             args[4].sval, args[5].sval, args[6].ival, args[7].ival,
+                             args[8].ival, args[9].ival, args[10].ival);
+}
+
+void drvSlsJungfrauRegister(void)
+{
+  iocshRegister(&configFuncDef,configCallFunc);
+  iocshRegister(&streamConfigFuncDef,streamConfigCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(drvSlsJungfrauRegister);
+}
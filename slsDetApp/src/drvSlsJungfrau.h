@@ -0,0 +1,431 @@
+#ifndef drvSlsJungfrau_H
+#define drvSlsJungfrau_H
+
+#include "slsDetFrame.h"
+#include "slsDetSubscriber.h"
+
+#include <ADDriver.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <stdint.h>
+#include <vector>
+
+/* Geometry of a single Jungfrau module as it arrives from the receiver */
+#define JUNGFRAU_MODULE_COLS  1024
+#define JUNGFRAU_MODULE_ROWS  512
+#define JUNGFRAU_PIXEL_BYTES  2
+#define JUNGFRAU_MODULE_BYTES (JUNGFRAU_MODULE_COLS * JUNGFRAU_MODULE_ROWS * JUNGFRAU_PIXEL_BYTES)
+#define JUNGFRAU_PACKETS_PER_FRAME 128
+/* Each module is read out by 4 x 2 chips */
+#define JUNGFRAU_CHIP_COLS    256
+#define JUNGFRAU_CHIP_ROWS    256
+
+class slsReceiverUsers;
+class SlsDetAssembler;
+class SlsDetPacketLoss;
+class SlsDetConverter;
+class SlsDetPedestal;
+class SlsDetDriftTracker;
+class SlsDetQuantizer;
+class SlsDetPublisher;
+class SlsDetShmRing;
+class SlsDetFrameStage;
+class SlsDetEventBuilder;
+class SlsDetWriter;
+class SlsDetReplay;
+class SlsDetUdpReceiver;
+class SlsDetCapture;
+class SlsJungfrau;
+
+/** Runs the periodic parameter updates of a SlsJungfrau on a thread of their own */
+class SlsJungfrauStatus : public epicsThreadRunable {
+public:
+  SlsJungfrauStatus(SlsJungfrau *driver) : _driver(driver) {}
+  virtual void run();
+
+private:
+  SlsJungfrau *_driver;
+};
+
+/** Class definition for the SlsJungfrau class
+  *
+  * An areaDetector driver that embeds one slsReceiverUsers instance per
+  * Jungfrau module, subscribes to the ZeroMQ stream of receivers running
+  * elsewhere or receives the UDP packets of the modules itself, and turns
+  * the raw data of each module into NDArrays. With the
+  * assembler enabled the modules are combined into a full detector image on
+  * address 0, otherwise each module is published on its own address.
+  * Assembled images can be converted to energy or photons on the way out,
+  * using pedestals that the driver can measure itself in a pedestal run and
+  * keep up to date from dark frames while it runs. A decimated copy of the
+  * images can be published over ZeroMQ for live viewers, and the raw
+  * assembled frames written to disk, either straight from their buffers to
+  * raw files or as compressed chunks to HDF5 files. The assembled frames
+  * are processed on a thread of their own behind a bounded queue, with the
+  * writer fed ahead of it so that a backlog only costs the other outputs.
+  * An event builder can pair the frames with the pulses of the timing system
+  * by bunchId on the way, giving each image the EPICS time of its pulse.
+  * In burst mode each frame is converted with the tables of its storage cell
+  * and the images of each cell can go out on an address of their own, 1 + cell.
+  * Raw files of the slsReceiver can be played back in place of the detector
+  * to load the IOC, and the packets of the modules captured off the network
+  * alongside the receivers to tell where lost packets went.
+  */
+class SlsJungfrau : public ADDriver, public SlsDetFrameSink, public SlsDetStreamSink,
+                    public epicsThreadRunable {
+public:
+  /* Per module context handed to the receiver callbacks */
+  typedef struct {
+    SlsJungfrau       *driver;
+    int               module;
+    slsReceiverUsers  *receiver;
+    SlsDetSubscriber  *subscriber;
+    SlsDetUdpReceiver *udp;
+    SlsDetPacketLoss  *loss;
+    /* Counted on the receive thread with epicsAtomic and pushed to the
+     * parameters by the status thread */
+    size_t            framesCaught;
+    size_t            frameNumber;
+    size_t            timestamp;
+    size_t            bunchId;
+    size_t            packetsCaught;
+    size_t            dropped;
+  } SlsJungfrauModule;
+
+public:
+  /* With streams set the modules are read from those endpoints instead of embedded receivers */
+  SlsJungfrau(const char *portName, int numModules, int numModulesX, int gapPixels, int rxTcpPort,
+              const char *streams, const char *cores, int numBuffers, int numConvThreads,
+              size_t maxMemory, int priority, int stackSize);
+  virtual ~SlsJungfrau();
+
+  /* These are the methods that we override from ADDriver */
+  virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+  virtual asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
+  virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+  virtual void report(FILE *fp, int details);
+  /* stops and cleans up the embedded receivers */
+  virtual void shutdown();
+
+  /* These are called from the receiver callbacks or the stream subscribers */
+  virtual int startAcquisition(int module, const char *filePath, const char *fileName,
+                               uint64_t fileIndex, uint32_t dataSize);
+  virtual void acquisitionFinished(int module, uint64_t framesCaught);
+  virtual void rawDataReady(int module, char *header, char *data, uint32_t dataSize);
+
+  /* Called from the assembler with a full detector image */
+  virtual void frameReady(SlsDetFrame *frame);
+  /* Called from the process stage with the frames frameReady() queued */
+  virtual void processFrame(SlsDetFrame *frame);
+
+  /* Runs the pedestal sequences */
+  virtual void run();
+  /* Pushes the counters of the receive and process threads to the parameters */
+  virtual void statusTask();
+
+protected:
+  virtual asynStatus startReceivers();
+  virtual asynStatus startStreams(const char *streams, const char *cores);
+  virtual asynStatus startUdpReceiver(int addr, const char *address, int cpu);
+  virtual void updateStreamParams(int module);
+  virtual void updateModuleParams(int module);
+  /* Copies the parameters the receive and process threads look at for every frame */
+  virtual void updateRxFlags();
+  virtual void preallocArrays(int numBuffers);
+  virtual void setAcquire(int acquire);
+  /* The array gets timeStamp as its EPICS time when it is given */
+  virtual void publishArray(NDArray *pImage, int addr, bool countImage,
+                            const epicsTimeStamp *timeStamp=NULL);
+  virtual void updateAssemblerStats();
+  virtual void updatePoolParams();
+  virtual void updateQueueParams(bool force);
+  virtual void updateEventParams(bool force);
+  virtual void updateLossParams(int module);
+  virtual void updateDataType();
+  virtual asynStatus loadCalibration(const char *fileName);
+  virtual asynStatus pedestalRun();
+  virtual asynStatus setDetectorGain(asynUser **pasynUsers, int setting);
+  virtual void applyStorageCells();
+  virtual void updateCellParams();
+  /* The storage cell of an assembled frame, 0 outside burst mode */
+  virtual int storageCell(const SlsDetFrame *frame) const;
+  virtual void setPedestalState(int state, const char *message);
+  virtual void updateDriftSelect();
+  virtual void updateDriftParams(bool force);
+  virtual void openPublisher();
+  virtual void updatePublisherParams();
+  virtual void publishFrame(SlsDetFrame *frame, NDArray *pImage);
+  virtual void openShmRing();
+  virtual void updateShmParams(bool force);
+  virtual void shareFrame(SlsDetFrame *frame, NDArray *pImage);
+  virtual bool createWriter();
+  virtual void startWriter();
+  virtual void stopWriter();
+  virtual SlsDetWriter* useWriter(bool *critical, double *photonEnergy);
+  virtual void releaseWriter();
+  virtual void updateWriterParams(bool force);
+  virtual void updateReplayParams(bool force);
+  virtual void updateCaptureParams(bool force);
+  virtual void updateLatency(const epicsTimeStamp *arrival, const epicsTimeStamp *ready);
+  virtual void updateLatencyParams();
+  // parameters
+  int _numModulesValue;
+  int _rxTcpPortValue;
+  int _rxStatusValue;
+  int _rxFramesCaughtValue;
+  int _rxFrameNumberValue;
+  int _rxTimestampValue;
+  int _rxBunchIdValue;
+  int _rxPacketsCaughtValue;
+  int _rxDroppedValue;
+  int _rxFramesIncompleteValue;
+  int _rxFramesMissedValue;
+  int _rxPacketsLostValue;
+  int _rxLossRateValue;
+  int _rxBurstHistValue;
+  int _rxWorstFramesValue;
+  int _rxWorstLostValue;
+  int _rxLossResetValue;
+  int _rxStreamEndpointValue;
+  int _rxStreamCoreValue;
+  int _rxStreamBadValue;
+  int _rxUdpLateValue;
+  int _rxUdpMovedValue;
+  int _rxUdpSocketBufferValue;
+  int _asmEnableValue;
+  int _asmReorderWindowValue;
+  int _asmTimeoutValue;
+  int _asmCompleteValue;
+  int _asmIncompleteValue;
+  int _asmLateValue;
+  int _asmNoBufferValue;
+  int _asmMissingMaskValue;
+  int _poolFramesValue;
+  int _poolUsedValue;
+  int _poolHighWaterValue;
+  int _poolFailuresValue;
+  int _poolPagesValue;
+  int _poolLockedValue;
+  int _geomGapPixelsValue;
+  int _geomFlipXValue;
+  int _geomFlipYValue;
+  int _convEnableValue;
+  int _convOutputValue;
+  int _convPhotonEnergyValue;
+  int _convCalFileValue;
+  int _convCalMessageValue;
+  int _convThreadsValue;
+  int _convKernelValue;
+  int _convTimeValue;
+  int _pedStartValue;
+  int _pedStateValue;
+  int _pedMessageValue;
+  int _pedFramesValue;
+  int _pedSettleFramesValue;
+  int _pedTimeoutValue;
+  int _pedSetting0Value;
+  int _pedSetting1Value;
+  int _pedSetting2Value;
+  int _pedControlPortValue;
+  int _pedFileValue;
+  int _pedProgressValue;
+  int _driftEnableValue;
+  int _driftModeValue;
+  int _driftModulusValue;
+  int _driftOffsetValue;
+  int _driftBunchMaskValue;
+  int _driftBunchValueValue;
+  int _driftAlphaValue;
+  int _driftFramesValue;
+  int _driftSkippedValue;
+  int _driftMeanShiftValue;
+  int _driftMaxShiftValue;
+  int _driftResetValue;
+  int _pubEnableValue;
+  int _pubEndpointValue;
+  int _pubSourceValue;
+  int _pubEveryValue;
+  int _pubMaxRateValue;
+  int _pubHighWaterMarkValue;
+  int _pubSentValue;
+  int _pubDecimatedValue;
+  int _pubDroppedValue;
+  int _pubMessageValue;
+  int _shmEnableValue;
+  int _shmNameValue;
+  int _shmSlotsValue;
+  int _shmSourceValue;
+  int _shmWrittenValue;
+  int _shmReadersValue;
+  int _shmLagValue;
+  int _shmLostValue;
+  int _shmMessageValue;
+  int _writeEnableValue;
+  int _writeFormatValue;
+  int _writePathValue;
+  int _writeNameValue;
+  int _writeIndexValue;
+  int _writeFramesPerFileValue;
+  int _writeQueueDepthValue;
+  int _writeCompressionValue;
+  int _writeFramesPerChunkValue;
+  int _writeThreadsValue;
+  int _writeDirectValue;
+  int _writeDirectActiveValue;
+  int _writeFramesValue;
+  int _writeDroppedValue;
+  int _writeFailedValue;
+  int _writeRateValue;
+  int _writeLatencyValue;
+  int _writeMaxLatencyValue;
+  int _writeStatusValue;
+  int _writeCompressRatioValue;
+  int _writeThreadRateValue;
+  int _writeThreadRatioValue;
+  int _writePhotonsValue;
+  int _writePhotonThresholdValue;
+  int _writePhotonCountValue;
+  int _writePhotonErrorValue;
+  int _writePhotonMaxErrorValue;
+  int _writePhotonMeanErrorValue;
+  int _writePhotonDroppedValue;
+  int _writePolicyValue;
+  int _writeDecimateValue;
+  int _writePriorityValue;
+  int _writeQueueUsedValue;
+  int _writeQueueHighWaterValue;
+  int _replayValue;
+  int _replayPathValue;
+  int _replayNameValue;
+  int _replayIndexValue;
+  int _replayRateValue;
+  int _replayLoopsValue;
+  int _replayFramesValue;
+  int _replayFrameRateValue;
+  int _replayThroughputValue;
+  int _replayBehindValue;
+  int _replayStatusValue;
+  int _captureValue;
+  int _captureInterfaceValue;
+  int _capturePortValue;
+  int _capturePathValue;
+  int _captureNameValue;
+  int _captureFileSizeValue;
+  int _capturePacketsValue;
+  int _captureRateValue;
+  int _captureDroppedValue;
+  int _captureFilesValue;
+  int _captureStatusValue;
+  int _latencyAssemblyValue;
+  int _latencyProcessValue;
+  int _latencyTotalValue;
+  int _latencyMaxValue;
+  int _procQueueDepthValue;
+  int _procPolicyValue;
+  int _procDecimateValue;
+  int _procUsedValue;
+  int _procHighWaterValue;
+  int _procDroppedValue;
+  int _procDecimatedValue;
+  int _procShedValue;
+  int _cellsValue;
+  int _cellStartValue;
+  int _cellSourceValue;
+  int _cellSplitValue;
+  int _cellMessageValue;
+  int _cellTablesValue;
+  int _evtEnableValue;
+  int _evtPulseIdValue;
+  int _evtTimeEventValue;
+  int _evtWindowValue;
+  int _evtPulsesValue;
+  int _evtMatchedValue;
+  int _evtUnmatchedValue;
+  int _evtLateValue;
+  int _evtPendingValue;
+  int _evtDriftValue;
+  int _evtJitterValue;
+  int _evtLockedValue;
+
+private:
+  typedef std::vector<SlsJungfrauModule> SlsModuleList;
+
+private:
+  const int         _numModules;
+  const int         _rxTcpPort;
+  SlsModuleList     _modules;
+  SlsDetAssembler   *_assembler;
+  SlsDetConverter   *_converter;
+  SlsDetPedestal    *_pedestal;
+  SlsDetDriftTracker *_drift;
+  SlsDetQuantizer   *_quantizer;
+  SlsDetPublisher   *_publisher;
+  SlsDetShmRing     *_shmRing;
+  epicsTimeStamp    _shmLastUpdate;
+  SlsDetFrameSink   *_procSink;
+  SlsDetFrameStage  *_procStage;
+  size_t            _procShed;
+  epicsTimeStamp    _queueLastUpdate;
+  SlsDetEventBuilder *_eventBuilder;
+  bool              _eventEnable;
+  epicsTimeStamp    _eventLastUpdate;
+  int               _cells;
+  int               _cellStart;
+  int               _cellSource;
+  bool              _cellsChanged;
+  SlsDetWriter      *_writer;
+  /* Set under the port lock and _writerLock, the frames take them with useWriter() */
+  epicsMutex        _writerLock;
+  bool              _writing;
+  bool              _writeCritical;
+  double            _writePhotonEnergy;
+  int               _writerUsers;           /* frames inside the writer, epicsAtomic */
+  epicsEvent        _writerReleased;        /* signalled when the last frame leaves the writer */
+  epicsUInt64       _writeProcLost;         /* frames the process queue had lost when the writer started */
+  SlsDetReplay      *_replay;
+  epicsTimeStamp    _replayLastUpdate;
+  SlsDetCapture     *_capture;
+  epicsTimeStamp    _captureLastUpdate;
+  /* The flags rawDataReady() needs, set with epicsAtomic by updateRxFlags() */
+  int               _rxAcquire;
+  int               _rxCallbacks;
+  int               _rxAssemble;
+  int               _rxPedestal;
+  /* The settings processFrame() needs, mirrored by updateRxFlags() the same
+   * way; the two doubles are copied under _procLock */
+  int               _procConvEnable;
+  int               _procConvOutput;
+  int               _procCellSplit;
+  int               _procDriftEnable;
+  int               _procPedState;
+  int               _procPubSource;
+  int               _procShmSource;
+  epicsMutex        _procLock;
+  double            _procPhotonEnergy;
+  double            _procPhotonThreshold;
+  /* The process thread adds to these under _latencyLock, not the port lock */
+  epicsMutex        _latencyLock;
+  unsigned          _latencyFrames;
+  double            _latencyAssembly;
+  double            _latencyProcess;
+  double            _latencyTotal;
+  double            _latencyMax;
+  double            _convTime;
+  epicsTimeStamp    _driftLastUpdate;
+  epicsTimeStamp    _writeLastUpdate;
+  bool              _pedRunning;
+  bool              _pedRequested;
+  bool              _pedAbort;
+  epicsEvent        _pedStartEvent;
+  epicsEvent        _pedStageEvent;
+  epicsThread       _pedThread;
+  bool              _statusRunning;
+  epicsEvent        _statusEvent;
+  SlsJungfrauStatus _status;
+  epicsThread       _statusThread;
+};
+
+#endif
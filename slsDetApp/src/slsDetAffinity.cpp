@@ -0,0 +1,426 @@
+#include "slsDetAffinity.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsStdio.h>
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+/* Most NUMA nodes looked for */
+#define MAX_NODES 64
+/* Most nodes the mask handed to mbind can hold */
+#define NODE_MASK_WORDS 16
+
+/* What is set for a port */
+typedef struct {
+  std::string port;
+  std::string cpus[SlsThreadClasses];
+  int         node;
+  std::string nodeSource;
+} SlsAffinityConfig;
+
+/* A pinned thread */
+typedef struct {
+  epicsThreadId  id;
+  std::string    port;
+  SlsThreadClass threadClass;
+  std::string    name;
+  std::string    cpus;
+  bool           pinned;
+} SlsPinnedThread;
+
+/* Memory bound to a node */
+typedef struct {
+  size_t bound;
+  size_t failed;
+} SlsNodeMemory;
+
+static const char *threadClassNames[SlsThreadClasses] = {
+  "control",
+  "receive",
+  "process",
+  "write",
+};
+
+static epicsMutex *affinityLock = NULL;
+static std::vector<SlsAffinityConfig> *affinityConfigs = NULL;
+static std::vector<SlsPinnedThread> *pinnedThreads = NULL;
+static SlsNodeMemory nodeMemory[MAX_NODES];
+static epicsThreadOnceId affinityOnce = EPICS_THREAD_ONCE_INIT;
+
+static void affinityInit(void *arg)
+{
+  affinityLock = new epicsMutex();
+  affinityConfigs = new std::vector<SlsAffinityConfig>();
+  pinnedThreads = new std::vector<SlsPinnedThread>();
+}
+
+/* Parses a list of cores like "0-3,8" and writes it back in the same form,
+ * returning false if it is not valid */
+static bool parseCpuList(const char *list, std::vector<int> *cpus, std::string *canonical)
+{
+  const char *pos = list;
+  char *end;
+  long first, last;
+  char range[32];
+
+  cpus->clear();
+  if (canonical) canonical->clear();
+  while (*pos) {
+    while ((*pos == ' ') || (*pos == ',')) pos++;
+    if (!*pos) break;
+    first = std::strtol(pos, &end, 10);
+    if ((end == pos) || (first < 0)) return false;
+    pos = end;
+    last = first;
+    if (*pos == '-') {
+      pos++;
+      last = std::strtol(pos, &end, 10);
+      if ((end == pos) || (last < first)) return false;
+      pos = end;
+    }
+    if ((*pos != ',') && (*pos != ' ') && *pos) return false;
+#ifdef __linux__
+    if (last >= CPU_SETSIZE) return false;
+#endif
+    for (long cpu=first; cpu<=last; cpu++) cpus->push_back((int) cpu);
+    if (canonical) {
+      if (first == last) {
+        epicsSnprintf(range, sizeof(range), "%s%ld", canonical->empty() ? "" : ",", first);
+      } else {
+        epicsSnprintf(range, sizeof(range), "%s%ld-%ld", canonical->empty() ? "" : ",", first, last);
+      }
+      canonical->append(range);
+    }
+  }
+  return true;
+}
+
+/* Reads the first line of a file under /sys */
+static bool readSysFile(const char *path, char *value, size_t size)
+{
+  FILE *fp = fopen(path, "r");
+  bool found = false;
+
+  if (fp) {
+    if (fgets(value, size, fp)) {
+      value[strcspn(value, "\n")] = '\0';
+      found = true;
+    }
+    fclose(fp);
+  }
+  return found;
+}
+
+static std::string nodeCpus(int node)
+{
+  char path[128];
+  char value[256];
+
+  if (node < 0) return "";
+  epicsSnprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  return readSysFile(path, value, sizeof(value)) ? value : "";
+}
+
+static int cpuNode(int cpu)
+{
+  std::vector<int> cpus;
+
+  for (int node=0; node<MAX_NODES; node++) {
+    std::string list = nodeCpus(node);
+    if (list.empty()) continue;
+    if (!parseCpuList(list.c_str(), &cpus, NULL)) continue;
+    for (unsigned n=0; n<cpus.size(); n++) {
+      if (cpus[n] == cpu) return node;
+    }
+  }
+  return -1;
+}
+
+/* Must be called with the lock held */
+static SlsAffinityConfig* findConfig(const char *port, bool create)
+{
+  if (!port || !port[0]) port = "*";
+  for (unsigned n=0; n<affinityConfigs->size(); n++) {
+    if ((*affinityConfigs)[n].port == port) return &(*affinityConfigs)[n];
+  }
+  if (!create) return NULL;
+  SlsAffinityConfig config;
+  config.port = port;
+  config.node = -1;
+  affinityConfigs->push_back(config);
+  return &affinityConfigs->back();
+}
+
+/* The cores of a class of threads of the port, must be called with the lock held */
+static std::string classCpus(const char *port, SlsThreadClass threadClass)
+{
+  const char *ports[2] = { port, "*" };
+
+  for (unsigned p=0; p<2; p++) {
+    SlsAffinityConfig *config = findConfig(ports[p], false);
+    if (!config) continue;
+    if (!config->cpus[threadClass].empty()) return config->cpus[threadClass];
+    if ((threadClass != SlsThreadControl) && (config->node >= 0)) return nodeCpus(config->node);
+  }
+  return "";
+}
+
+/* Must be called with the lock held */
+static int portNode(const char *port)
+{
+  const char *ports[2] = { port, "*" };
+  std::vector<int> cpus;
+
+  for (unsigned p=0; p<2; p++) {
+    SlsAffinityConfig *config = findConfig(ports[p], false);
+    if (!config) continue;
+    if (config->node >= 0) return config->node;
+    if (parseCpuList(config->cpus[SlsThreadReceive].c_str(), &cpus, NULL) && !cpus.empty()) {
+      return cpuNode(cpus[0]);
+    }
+  }
+  return -1;
+}
+
+bool slsDetSetAffinity(const char *port, const char *threadClass, const char *cpus)
+{
+  std::vector<int> list;
+  std::string canonical;
+  int first = -1;
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  if (threadClass) {
+    if (!strcmp(threadClass, "all")) {
+      first = SlsThreadClasses;
+    } else {
+      for (int n=0; n<SlsThreadClasses; n++) {
+        if (!strcmp(threadClass, threadClassNames[n])) first = n;
+      }
+    }
+  }
+  if (first < 0) return false;
+  if (!parseCpuList(cpus ? cpus : "", &list, &canonical)) return false;
+
+  affinityLock->lock();
+  SlsAffinityConfig *config = findConfig(port, true);
+  for (int n=0; n<SlsThreadClasses; n++) {
+    if ((first == n) || (first == SlsThreadClasses)) config->cpus[n] = canonical;
+  }
+  affinityLock->unlock();
+
+  return true;
+}
+
+bool slsDetSetNumaNode(const char *port, const char *node)
+{
+  char path[128];
+  char value[32];
+  char *end;
+  long number = -1;
+  bool interface = false;
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  if (node && node[0]) {
+    number = std::strtol(node, &end, 10);
+    interface = (*end != '\0');
+    if (interface) {
+      /* An interface, whose device says which node it hangs off */
+      epicsSnprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", node);
+      if (!readSysFile(path, value, sizeof(value))) return false;
+      number = std::strtol(value, NULL, 10);
+    }
+    if (number >= MAX_NODES) return false;
+  }
+
+  affinityLock->lock();
+  SlsAffinityConfig *config = findConfig(port, true);
+  config->node = (number < 0) ? -1 : (int) number;
+  config->nodeSource = interface ? node : "";
+  affinityLock->unlock();
+
+  return true;
+}
+
+bool slsDetPinThread(const char *port, SlsThreadClass threadClass, int cpu)
+{
+  SlsPinnedThread thread;
+  std::vector<int> cpus;
+  char single[16];
+  bool pinned = true;
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  if (threadClass >= SlsThreadClasses) return false;
+
+  affinityLock->lock();
+  thread.cpus = classCpus(port, threadClass);
+  affinityLock->unlock();
+  if (cpu >= 0) {
+    epicsSnprintf(single, sizeof(single), "%d", cpu);
+    thread.cpus = single;
+  }
+  parseCpuList(thread.cpus.c_str(), &cpus, NULL);
+
+  if (!cpus.empty()) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned n=0; n<cpus.size(); n++) CPU_SET(cpus[n], &set);
+    pinned = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#else
+    pinned = false;
+#endif
+  }
+
+  thread.id = epicsThreadGetIdSelf();
+  thread.port = (port && port[0]) ? port : "*";
+  thread.threadClass = threadClass;
+  thread.name = epicsThreadGetNameSelf();
+  thread.pinned = pinned && !cpus.empty();
+
+  affinityLock->lock();
+  pinnedThreads->push_back(thread);
+  affinityLock->unlock();
+
+  return pinned;
+}
+
+void slsDetUnpinThread()
+{
+  epicsThreadId id = epicsThreadGetIdSelf();
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  affinityLock->lock();
+  for (unsigned n=0; n<pinnedThreads->size(); n++) {
+    if ((*pinnedThreads)[n].id == id) {
+      pinnedThreads->erase(pinnedThreads->begin() + n);
+      break;
+    }
+  }
+  affinityLock->unlock();
+}
+
+bool slsDetPushAffinity(const char *port, SlsThreadClass threadClass, SlsCpuMask *saved)
+{
+  std::vector<int> cpus;
+  std::string list;
+
+  saved->saved = false;
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  if (threadClass >= SlsThreadClasses) return false;
+
+  affinityLock->lock();
+  list = classCpus(port, threadClass);
+  affinityLock->unlock();
+  parseCpuList(list.c_str(), &cpus, NULL);
+  if (cpus.empty()) return true;
+
+#ifdef __linux__
+  cpu_set_t set;
+  if (sizeof(set) > sizeof(saved->bits)) return false;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set)) return false;
+  std::memcpy(saved->bits, &set, sizeof(set));
+  saved->saved = true;
+  CPU_ZERO(&set);
+  for (unsigned n=0; n<cpus.size(); n++) CPU_SET(cpus[n], &set);
+  return (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+#else
+  return false;
+#endif
+}
+
+void slsDetPopAffinity(const SlsCpuMask *saved)
+{
+  if (!saved->saved) return;
+#ifdef __linux__
+  cpu_set_t set;
+  std::memcpy(&set, saved->bits, sizeof(set));
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+int slsDetNumaNode(const char *port)
+{
+  int node;
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  affinityLock->lock();
+  node = portNode(port);
+  affinityLock->unlock();
+
+  return node;
+}
+
+bool slsDetBindMemory(void *addr, size_t size, int node)
+{
+  bool bound = false;
+
+  if ((node < 0) || (node >= MAX_NODES)) return false;
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[NODE_MASK_WORDS];
+  const unsigned bits = 8 * sizeof(mask[0]);
+  std::memset(mask, 0, sizeof(mask));
+  mask[node / bits] |= 1UL << (node % bits);
+  /* Preferred rather than bound, so a full node spills over instead of failing */
+  bound = (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask,
+                   (unsigned long) (NODE_MASK_WORDS * bits), MPOL_MF_MOVE) == 0);
+#endif
+
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  affinityLock->lock();
+  if (bound) {
+    nodeMemory[node].bound += size;
+  } else {
+    nodeMemory[node].failed += size;
+  }
+  affinityLock->unlock();
+
+  return bound;
+}
+
+const char* slsDetThreadClassName(SlsThreadClass threadClass)
+{
+  return (threadClass < SlsThreadClasses) ? threadClassNames[threadClass] : "unknown";
+}
+
+void slsDetAffinityReport(FILE *fp, const char *port)
+{
+  epicsThreadOnce(&affinityOnce, affinityInit, NULL);
+  affinityLock->lock();
+  int node = portNode(port);
+  fprintf(fp, "  placement: buffers on node %d", node);
+  SlsAffinityConfig *config = findConfig(port, false);
+  if (!config) config = findConfig("*", false);
+  if (config && !config->nodeSource.empty()) fprintf(fp, " of %s", config->nodeSource.c_str());
+  fprintf(fp, "\n");
+  for (int n=0; n<SlsThreadClasses; n++) {
+    std::string cpus = classCpus(port, (SlsThreadClass) n);
+    fprintf(fp, "    %s threads on cores %s\n", threadClassNames[n], cpus.empty() ? "any" : cpus.c_str());
+  }
+  for (unsigned n=0; n<pinnedThreads->size(); n++) {
+    const SlsPinnedThread &thread = (*pinnedThreads)[n];
+    if (port && (thread.port != port)) continue;
+    fprintf(fp, "    thread %s (%s%s%s): %s%s\n", thread.name.c_str(), port ? "" : thread.port.c_str(),
+            port ? "" : " ", threadClassNames[thread.threadClass],
+            thread.cpus.empty() ? "not pinned" : thread.cpus.c_str(),
+            (!thread.cpus.empty() && !thread.pinned) ? ", failed to pin" : "");
+  }
+  for (int n=0; n<MAX_NODES; n++) {
+    if (nodeMemory[n].bound || nodeMemory[n].failed) {
+      fprintf(fp, "    node %d: %.1f MB of buffers bound, %.1f MB failed\n", n,
+              nodeMemory[n].bound / 1048576., nodeMemory[n].failed / 1048576.);
+    }
+  }
+  affinityLock->unlock();
+}
@@ -0,0 +1,69 @@
+#ifndef slsDetAffinity_H
+#define slsDetAffinity_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Where the threads of the driver run and where its frame buffers live.
+ *
+ * Every thread belongs to a class and pins itself, as it starts, to the cores
+ * set for its class and port with slsDetSetAffinity(), or to the cores set for
+ * port "*" when the port has none of its own. A port (or "*") can also be
+ * given the NUMA node of its network interface with slsDetSetNumaNode(); its
+ * frame buffers are then bound to that node, and its receive, processing and
+ * writer threads run on the cores of the node unless they are set. Without a
+ * node the buffers go to the node of the first receive core, if there is one.
+ *
+ * The settings only apply to the threads started after them, so they belong
+ * in the startup script before the configure commands.
+ */
+
+/* The classes of threads */
+typedef enum {
+  SlsThreadControl,   /* talks to the detector */
+  SlsThreadReceive,   /* gets the frames or packets of the modules */
+  SlsThreadProcess,   /* assembles, converts and compresses the frames */
+  SlsThreadWrite,     /* writes the files */
+  SlsThreadClasses
+} SlsThreadClass;
+
+/* The cores a thread ran on before slsDetPushAffinity() */
+typedef struct {
+  unsigned long bits[1024 / (8 * sizeof(unsigned long))];
+  bool          saved;
+} SlsCpuMask;
+
+/* Sets the cores, a list like "0-3,8", the threads of a class run on for a
+ * port, "*" for every port without its own and class "all" for every class;
+ * an empty list clears it, leaving the threads to the default or to the
+ * scheduler. Returns false if the class or the list is not valid. */
+extern bool slsDetSetAffinity(const char *port, const char *threadClass, const char *cpus);
+/* Sets the NUMA node of a port, either the node or the network interface to
+ * take it from, -1 or empty to clear it */
+extern bool slsDetSetNumaNode(const char *port, const char *node);
+
+/* Pins the calling thread to the cores of its class for the port, or to cpu
+ * when it is not -1, and keeps it for the report. Returns false if the thread
+ * could not be pinned; a thread with nothing set is left where it is. */
+extern bool slsDetPinThread(const char *port, SlsThreadClass threadClass, int cpu=-1);
+/* Called by a pinned thread as it exits */
+extern void slsDetUnpinThread();
+/* Moves the calling thread to the cores of a class for the port until
+ * slsDetPopAffinity(), so the threads a library starts from it, which
+ * cannot be pinned any other way, inherit them */
+extern bool slsDetPushAffinity(const char *port, SlsThreadClass threadClass, SlsCpuMask *saved);
+extern void slsDetPopAffinity(const SlsCpuMask *saved);
+
+/* The NUMA node the buffers of the port belong on, -1 for anywhere */
+extern int slsDetNumaNode(const char *port);
+/* Binds the pages of a buffer that is not yet written to a NUMA node, the
+ * address and size being multiples of the page size */
+extern bool slsDetBindMemory(void *addr, size_t size, int node);
+
+extern const char* slsDetThreadClassName(SlsThreadClass threadClass);
+/* Prints the settings and the threads of the port, or of every port when it
+ * is NULL, and the memory bound */
+extern void slsDetAffinityReport(FILE *fp, const char *port);
+
+#endif
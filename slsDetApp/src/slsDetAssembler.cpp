@@ -0,0 +1,353 @@
+#include "slsDetAssembler.h"
+#include "slsDetFramePool.h"
+#include "slsDetPacketLoss.h"
+#include "slsDetGeometry.h"
+#include "slsDetAffinity.h"
+
+#include <cstring>
+
+#define MIN_POLL_TIME 0.001
+#define MAX_POLL_TIME 0.100
+#define THREAD_TMO 2.0
+
+SlsDetAssembler::SlsDetAssembler(SlsDetFrameSink *sink, SlsDetGeometry *geometry, size_t bytesPerPixel,
+                                 unsigned numFrames, unsigned reorderWindow, double timeout,
+                                 const char *portName) :
+  _sink(sink),
+  _portName(portName),
+  _running(true),
+  _geometry(geometry),
+  _numModules(geometry->numModules()),
+  _bytesPerPixel(bytesPerPixel),
+  _allModules(_numModules < SLS_MAX_MODULES ? (1ULL << _numModules) - 1 : ~0ULL),
+  _timeout(timeout),
+  _pool(new SlsDetFramePool(geometry->sizeX() * geometry->sizeY() * bytesPerPixel, numFrames,
+                            slsDetNumaNode(portName))),
+  _slots(reorderWindow > 0 ? reorderWindow : 1, (SlsDetFrame*) NULL),
+  _slotNext(_slots.size(), 0),
+  _placement(_numModules),
+  _thread(*this, "slsDetAsm", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+{
+  std::memset(&_stats, 0, sizeof(_stats));
+  /* Until a header says otherwise modules fill the image row by row */
+  for (int mod=0; mod<_numModules; mod++) {
+    _placement[mod].row = mod / _geometry->modulesX();
+    _placement[mod].col = mod % _geometry->modulesX();
+    _placement[mod].flipX = false;
+    _placement[mod].flipY = false;
+  }
+  _thread.start();
+}
+
+SlsDetAssembler::~SlsDetAssembler()
+{
+  _running = false;
+  _wakeup.signal();
+  _thread.exitWait(THREAD_TMO);
+  flush();
+  delete _pool;
+  delete _geometry;
+}
+
+int SlsDetAssembler::numModules() const
+{
+  return _numModules;
+}
+
+size_t SlsDetAssembler::sizeX() const
+{
+  return _geometry->sizeX();
+}
+
+size_t SlsDetAssembler::sizeY() const
+{
+  return _geometry->sizeY();
+}
+
+size_t SlsDetAssembler::bytesPerPixel() const
+{
+  return _bytesPerPixel;
+}
+
+SlsDetFramePool* SlsDetAssembler::pool() const
+{
+  return _pool;
+}
+
+const SlsDetGeometry* SlsDetAssembler::geometry() const
+{
+  return _geometry;
+}
+
+void SlsDetAssembler::push(int module, const slsReceiverDefs::sls_receiver_header *header,
+                           const char *data, size_t dataSize)
+{
+  SlsDetFrame *frame = NULL;
+  SlsDetFrame *evicted = NULL;
+  SlsDetFrame *done = NULL;
+  SlsModulePlacement place;
+  epicsUInt64 frameNumber = header->detHeader.frameNumber;
+  epicsUInt64 bit;
+
+  if ((module < 0) || (module >= _numModules)) return;
+  bit = 1ULL << module;
+
+  _lock.lock();
+  size_t slot = frameNumber % _slots.size();
+
+  /* Anything older than the window, or already emitted, is late */
+  if (frameNumber < _slotNext[slot] ||
+      (_slots[slot] && _slots[slot]->frameNumber > frameNumber)) {
+    _stats.late++;
+    _lock.unlock();
+    return;
+  }
+
+  /* A newer frame pushes the frame using this slot out of the window */
+  if (_slots[slot] && _slots[slot]->frameNumber != frameNumber) {
+    evicted = detach(_slots[slot]);
+    _slots[slot] = NULL;
+  }
+
+  if (!_slots[slot]) {
+    frame = _pool->alloc();
+    if (!frame) {
+      _stats.noBuffer++;
+      _lock.unlock();
+      if (evicted) emit(evicted);
+      return;
+    }
+    frame->frameNumber = frameNumber;
+    frame->timestamp = header->detHeader.timestamp;
+    frame->bunchId = header->detHeader.bunchId;
+    frame->numModules = _numModules;
+    frame->sizeX = sizeX();
+    frame->sizeY = sizeY();
+    frame->setDataType(_bytesPerPixel == sizeof(epicsInt32) ? SlsFrameInt32 : SlsFrameUInt16);
+    epicsTimeGetCurrent(&frame->arrival);
+    _slots[slot] = frame;
+  }
+  frame = _slots[slot];
+
+  /* A module sending the same frame twice is treated as late */
+  if (frame->modulesMask & bit) {
+    _stats.late++;
+    _lock.unlock();
+    if (evicted) emit(evicted);
+    return;
+  }
+
+  /* Follow the position of the module in the detector from its header */
+  if (((int) header->detHeader.row < _geometry->modulesY()) &&
+      ((int) header->detHeader.column < _geometry->modulesX())) {
+    _placement[module].row = header->detHeader.row;
+    _placement[module].col = header->detHeader.column;
+  }
+  place = _placement[module];
+
+  frame->modulesMask |= bit;
+  frame->header[module] = header->detHeader;
+  frame->packetsCaught[module] = SlsDetPacketLoss::packetsCaught(header);
+  frame->origin[module] = _geometry->origin(place.row, place.col);
+  frame->_pending++;
+  if (frame->modulesMask == _allModules) {
+    detach(frame);
+    _slots[slot] = NULL;
+  }
+  _lock.unlock();
+
+  /* The copy itself runs without the lock so the modules copy in parallel */
+  copyModule(frame, place, data, dataSize);
+
+  _lock.lock();
+  frame->_pending--;
+  if (frame->_detached && (frame->_pending == 0)) {
+    done = frame;
+  }
+  _lock.unlock();
+
+  if (evicted) emit(evicted);
+  if (done) emit(done);
+}
+
+SlsDetFrame* SlsDetAssembler::detach(SlsDetFrame *frame)
+{
+  /* Must be called with the lock held */
+  frame->_detached = true;
+  /* Anything for this frame or older that still turns up is late */
+  _slotNext[frame->frameNumber % _slotNext.size()] = frame->frameNumber + 1;
+  frame->missingMask = _allModules & ~frame->modulesMask;
+  if (frame->missingMask) {
+    _stats.incomplete++;
+    _stats.lastMissing = frame->missingMask;
+  } else {
+    _stats.complete++;
+  }
+
+  /* If a copy is still running the module doing it emits the frame */
+  return frame->_pending ? NULL : frame;
+}
+
+void SlsDetAssembler::emit(SlsDetFrame *frame)
+{
+  if (frame->missingMask) {
+    SlsModulePlacement place[SLS_MAX_MODULES];
+    _lock.lock();
+    for (int mod=0; mod<_numModules; mod++) {
+      place[mod] = _placement[mod];
+    }
+    _lock.unlock();
+    for (int mod=0; mod<_numModules; mod++) {
+      if (frame->missingMask & (1ULL << mod)) {
+        frame->origin[mod] = _geometry->origin(place[mod].row, place[mod].col);
+        clearModule(frame, place[mod]);
+      }
+    }
+  }
+
+  if (_sink) {
+    _sink->frameReady(frame);
+  } else {
+    frame->release();
+  }
+}
+
+void SlsDetAssembler::copyModule(SlsDetFrame *frame, const SlsModulePlacement &place,
+                                 const char *data, size_t dataSize)
+{
+  size_t numPixels = _geometry->moduleCols() * _geometry->moduleRows();
+  char *dest = (char *) frame->data + _geometry->origin(place.row, place.col) * _bytesPerPixel;
+
+  if (dataSize < numPixels * _bytesPerPixel) {
+    /* pad a short sub-frame rather than leave stale data from the pool */
+    clearModule(frame, place);
+    numPixels = dataSize / _bytesPerPixel;
+  }
+
+  SlsDetGeometry::place(_geometry->map(place.flipX, place.flipY), dest, data, numPixels, _bytesPerPixel);
+}
+
+void SlsDetAssembler::clearModule(SlsDetFrame *frame, const SlsModulePlacement &place)
+{
+  size_t rowBytes = _geometry->moduleSizeX() * _bytesPerPixel;
+  size_t stride = sizeX() * _bytesPerPixel;
+  size_t rows = _geometry->moduleSizeY();
+  char *dest = (char *) frame->data + _geometry->origin(place.row, place.col) * _bytesPerPixel;
+
+  if (rowBytes == stride) {
+    std::memset(dest, 0, rowBytes * rows);
+  } else {
+    for (size_t row=0; row < rows; row++) {
+      std::memset(dest + row * stride, 0, rowBytes);
+    }
+  }
+}
+
+void SlsDetAssembler::detachAll(SlsFrameList &ready)
+{
+  /* Must be called with the lock held */
+  for (size_t slot=0; slot<_slots.size(); slot++) {
+    if (_slots[slot]) {
+      SlsDetFrame *frame = detach(_slots[slot]);
+      if (frame) ready.push_back(frame);
+      _slots[slot] = NULL;
+    }
+    _slotNext[slot] = 0;
+  }
+}
+
+void SlsDetAssembler::flush()
+{
+  SlsFrameList ready;
+
+  _lock.lock();
+  detachAll(ready);
+  _lock.unlock();
+
+  for (size_t n=0; n<ready.size(); n++) {
+    emit(ready[n]);
+  }
+}
+
+void SlsDetAssembler::flushExpired()
+{
+  epicsTimeStamp now;
+  SlsFrameList ready;
+
+  epicsTimeGetCurrent(&now);
+
+  _lock.lock();
+  for (size_t slot=0; slot<_slots.size(); slot++) {
+    if (_slots[slot] && (epicsTimeDiffInSeconds(&now, &_slots[slot]->arrival) > _timeout)) {
+      SlsDetFrame *frame = detach(_slots[slot]);
+      if (frame) ready.push_back(frame);
+      _slots[slot] = NULL;
+    }
+  }
+  _lock.unlock();
+
+  for (size_t n=0; n<ready.size(); n++) {
+    emit(ready[n]);
+  }
+}
+
+void SlsDetAssembler::setReorderWindow(unsigned reorderWindow)
+{
+  SlsFrameList ready;
+
+  if (reorderWindow < 1) reorderWindow = 1;
+
+  /* Frames in flight are mapped to slots by the window size, so emit them first */
+  _lock.lock();
+  detachAll(ready);
+  _slots.assign(reorderWindow, (SlsDetFrame*) NULL);
+  _slotNext.assign(reorderWindow, 0);
+  _lock.unlock();
+
+  for (size_t n=0; n<ready.size(); n++) {
+    emit(ready[n]);
+  }
+}
+
+void SlsDetAssembler::setTimeout(double timeout)
+{
+  _lock.lock();
+  _timeout = timeout;
+  _lock.unlock();
+  _wakeup.signal();
+}
+
+void SlsDetAssembler::setFlip(int module, bool flipX, bool flipY)
+{
+  if ((module < 0) || (module >= _numModules)) return;
+
+  _lock.lock();
+  _placement[module].flipX = flipX;
+  _placement[module].flipY = flipY;
+  _lock.unlock();
+}
+
+void SlsDetAssembler::getStats(SlsDetAssemblerStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+void SlsDetAssembler::run()
+{
+  slsDetPinThread(_portName, SlsThreadProcess);
+
+  while (_running) {
+    double pollTime;
+    _lock.lock();
+    pollTime = _timeout / 2.;
+    _lock.unlock();
+    if (pollTime < MIN_POLL_TIME) pollTime = MIN_POLL_TIME;
+    if (pollTime > MAX_POLL_TIME) pollTime = MAX_POLL_TIME;
+    _wakeup.wait(pollTime);
+    if (_running) flushExpired();
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,106 @@
+#ifndef slsDetAssembler_H
+#define slsDetAssembler_H
+
+#include "slsDetFrame.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
+#include <vector>
+
+class SlsDetFramePool;
+class SlsDetGeometry;
+
+/** Counters kept by the SlsDetAssembler */
+typedef struct {
+  epicsUInt64 complete;     /**< frames emitted with all the modules */
+  epicsUInt64 incomplete;   /**< frames emitted with modules missing */
+  epicsUInt64 late;         /**< module sub-frames that arrived after their frame was emitted */
+  epicsUInt64 noBuffer;     /**< module sub-frames dropped since the pool was empty */
+  epicsUInt64 lastMissing;  /**< missing module mask of the last incomplete frame */
+} SlsDetAssemblerStats;
+
+/** Class definition for the SlsDetAssembler class
+  *
+  * Matches the sub-frames of each module on the frameNumber of the detector
+  * header and copies them into a full detector image from a SlsDetFramePool,
+  * placing them using the row and column of the header and the copy spans
+  * compiled by a SlsDetGeometry for the module's orientation. Each module's source
+  * thread copies its own sub-frame, so the copies for the different modules
+  * run in parallel without going through a single assembly thread.
+  *
+  * Up to reorderWindow frames can be in flight at once. A frame is handed to
+  * the sink as soon as every module has arrived, when it is pushed out of the
+  * window by a newer frame, or when it has waited longer than the timeout.
+  */
+class SlsDetAssembler : public epicsThreadRunable {
+public:
+  /* The assembler takes over the geometry; portName is the port whose thread
+   * placement and NUMA node it follows */
+  SlsDetAssembler(SlsDetFrameSink *sink, SlsDetGeometry *geometry, size_t bytesPerPixel,
+                  unsigned numFrames, unsigned reorderWindow, double timeout,
+                  const char *portName=NULL);
+  virtual ~SlsDetAssembler();
+  virtual void run();
+
+  /* Called from the per module source threads */
+  virtual void push(int module, const slsReceiverDefs::sls_receiver_header *header,
+                    const char *data, size_t dataSize);
+  /* Emits every frame still waiting for modules */
+  virtual void flush();
+
+  virtual void setReorderWindow(unsigned reorderWindow);
+  virtual void setTimeout(double timeout);
+  /* Takes effect from the next sub-frame of the module */
+  virtual void setFlip(int module, bool flipX, bool flipY);
+  virtual void getStats(SlsDetAssemblerStats *stats);
+
+  int numModules() const;
+  size_t sizeX() const;
+  size_t sizeY() const;
+  size_t bytesPerPixel() const;
+  SlsDetFramePool* pool() const;
+  const SlsDetGeometry* geometry() const;
+
+protected:
+  typedef struct {
+    size_t row;
+    size_t col;
+    bool   flipX;
+    bool   flipY;
+  } SlsModulePlacement;
+
+  virtual SlsDetFrame* detach(SlsDetFrame *frame);
+  virtual void detachAll(std::vector<SlsDetFrame*> &ready);
+  virtual void emit(SlsDetFrame *frame);
+  virtual void flushExpired();
+  virtual void copyModule(SlsDetFrame *frame, const SlsModulePlacement &place,
+                          const char *data, size_t dataSize);
+  virtual void clearModule(SlsDetFrame *frame, const SlsModulePlacement &place);
+
+private:
+  typedef std::vector<SlsDetFrame*> SlsFrameList;
+  typedef std::vector<epicsUInt64> SlsFrameNumberList;
+  typedef std::vector<SlsModulePlacement> SlsPlacementList;
+
+private:
+  SlsDetFrameSink       *_sink;
+  const char            *_portName;
+  bool                  _running;
+  SlsDetGeometry        *_geometry;
+  const int             _numModules;
+  const size_t          _bytesPerPixel;
+  const epicsUInt64     _allModules;
+  double                _timeout;
+  SlsDetFramePool       *_pool;
+  SlsFrameList          _slots;
+  SlsFrameNumberList    _slotNext;
+  SlsPlacementList      _placement;
+  SlsDetAssemblerStats  _stats;
+  epicsMutex            _lock;
+  epicsEvent            _wakeup;
+  epicsThread           _thread;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "slsDetBitshuffle.h"
+#include "slsDetLz4.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The filter aims for blocks of this many bytes */
+#define TARGET_BLOCK_BYTES 8192
+#define MIN_BLOCK_SIZE 128
+/* Blocks and the bit rows are whole groups of 8 elements */
+#define BLOCK_MULT SLS_SHUFFLE_MULT
+
+typedef void (*shuffleFunc)(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize);
+
+/* Transposes an 8x8 bit matrix, byte m bit k goes to byte k bit m */
+static inline epicsUInt64 transpose8x8(epicsUInt64 x)
+{
+  epicsUInt64 t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+/* Row n of the output holds bit n of every element, element e in bit e % 8 of byte e / 8 */
+void slsDetShuffleGeneric(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize)
+{
+  size_t rowBytes = size / BLOCK_MULT;
+
+  for (size_t group=0; group<rowBytes; group++) {
+    const unsigned char *elements = in + group * BLOCK_MULT * elemSize;
+    for (size_t byte=0; byte<elemSize; byte++) {
+      epicsUInt64 x = 0;
+      for (int m=0; m<BLOCK_MULT; m++) {
+        x |= (epicsUInt64) elements[m * elemSize + byte] << (8 * m);
+      }
+      x = transpose8x8(x);
+      for (int k=0; k<8; k++) {
+        out[(8 * byte + k) * rowBytes + group] = (unsigned char) (x >> (8 * k));
+      }
+    }
+  }
+}
+
+static void unshuffleGeneric(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize)
+{
+  size_t rowBytes = size / BLOCK_MULT;
+
+  for (size_t group=0; group<rowBytes; group++) {
+    unsigned char *elements = out + group * BLOCK_MULT * elemSize;
+    for (size_t byte=0; byte<elemSize; byte++) {
+      epicsUInt64 x = 0;
+      for (int k=0; k<8; k++) {
+        x |= (epicsUInt64) in[(8 * byte + k) * rowBytes + group] << (8 * k);
+      }
+      x = transpose8x8(x);
+      for (int m=0; m<BLOCK_MULT; m++) {
+        elements[m * elemSize + byte] = (unsigned char) (x >> (8 * m));
+      }
+    }
+  }
+}
+
+#ifdef __SSE2__
+/* SSE2 is part of x86-64, so this one is built with the module. The low and
+ * high bytes of 16 pixels are packed into a register each and movemask picks
+ * off one bit of all 16 at a time. */
+void slsDetShuffleSse2(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize)
+{
+  const __m128i lowMask = _mm_set1_epi16(0xff);
+  size_t rowBytes = size / BLOCK_MULT;
+  size_t i = 0;
+
+  if (elemSize != 2) {
+    slsDetShuffleGeneric(in, out, size, elemSize);
+    return;
+  }
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (in + 2 * i + 16));
+    __m128i lo = _mm_packus_epi16(_mm_and_si128(a, lowMask), _mm_and_si128(b, lowMask));
+    __m128i hi = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    for (int k=7; k>=0; k--) {
+      epicsUInt16 bitsLo = (epicsUInt16) _mm_movemask_epi8(lo);
+      epicsUInt16 bitsHi = (epicsUInt16) _mm_movemask_epi8(hi);
+      std::memcpy(out + k * rowBytes + i / 8, &bitsLo, sizeof(bitsLo));
+      std::memcpy(out + (8 + k) * rowBytes + i / 8, &bitsHi, sizeof(bitsHi));
+      lo = _mm_add_epi8(lo, lo);
+      hi = _mm_add_epi8(hi, hi);
+    }
+  }
+  /* A block that is a multiple of 8 but not of 16 pixels */
+  for (; i < size; i += BLOCK_MULT) {
+    for (size_t byte=0; byte<2; byte++) {
+      epicsUInt64 x = 0;
+      for (int m=0; m<BLOCK_MULT; m++) {
+        x |= (epicsUInt64) in[(i + m) * 2 + byte] << (8 * m);
+      }
+      x = transpose8x8(x);
+      for (int k=0; k<8; k++) {
+        out[(8 * byte + k) * rowBytes + i / 8] = (unsigned char) (x >> (8 * k));
+      }
+    }
+  }
+}
+#endif
+
+static shuffleFunc shuffleKernel = slsDetShuffleGeneric;
+static const char *shuffleName = "generic";
+static epicsThreadOnceId shuffleOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectKernel(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    shuffleKernel = slsDetShuffleAvx2;
+    shuffleName = slsDetCpuFeatureName(SlsCpuAvx2);
+    return;
+  }
+#endif
+#ifdef __SSE2__
+  shuffleKernel = slsDetShuffleSse2;
+  shuffleName = "sse2";
+#endif
+}
+
+static inline void writeBE32(unsigned char *out, epicsUInt32 value)
+{
+  out[0] = (unsigned char) (value >> 24);
+  out[1] = (unsigned char) (value >> 16);
+  out[2] = (unsigned char) (value >> 8);
+  out[3] = (unsigned char) value;
+}
+
+static inline epicsUInt32 readBE32(const unsigned char *in)
+{
+  return ((epicsUInt32) in[0] << 24) | ((epicsUInt32) in[1] << 16) |
+         ((epicsUInt32) in[2] << 8) | (epicsUInt32) in[3];
+}
+
+const char* slsDetBitshuffleKernelName()
+{
+  epicsThreadOnce(&shuffleOnce, selectKernel, NULL);
+  return shuffleName;
+}
+
+size_t slsDetBshufBlockSize(size_t elemSize)
+{
+  size_t blockSize = TARGET_BLOCK_BYTES / (elemSize > 0 ? elemSize : 1);
+  blockSize -= blockSize % BLOCK_MULT;
+  return blockSize > MIN_BLOCK_SIZE ? blockSize : MIN_BLOCK_SIZE;
+}
+
+void slsDetBitshuffle(const void *in, void *out, size_t size, size_t elemSize)
+{
+  epicsThreadOnce(&shuffleOnce, selectKernel, NULL);
+  shuffleKernel((const unsigned char *) in, (unsigned char *) out, size, elemSize);
+}
+
+void slsDetBitunshuffle(const void *in, void *out, size_t size, size_t elemSize)
+{
+  unshuffleGeneric((const unsigned char *) in, (unsigned char *) out, size, elemSize);
+}
+
+size_t slsDetBshufLz4BlockBound(size_t blockSize, size_t elemSize)
+{
+  return 4 + SLS_LZ4_BOUND(blockSize * elemSize);
+}
+
+size_t slsDetBshufLz4Block(const void *in, void *out, size_t size, size_t elemSize, void *scratch)
+{
+  size_t bytes = size * elemSize;
+  size_t compressed;
+
+  slsDetBitshuffle(in, scratch, size, elemSize);
+  compressed = slsDetLz4Compress(scratch, (unsigned char *) out + 4, bytes, SLS_LZ4_BOUND(bytes));
+  if (!compressed && bytes) return 0;
+  writeBE32((unsigned char *) out, (epicsUInt32) compressed);
+
+  return compressed + 4;
+}
+
+size_t slsDetBshufLz4Bound(size_t size, size_t elemSize, size_t blockSize)
+{
+  size_t numBlocks = (size + blockSize - 1) / blockSize;
+  return SLS_BSHUF_HEADER_SIZE + numBlocks * slsDetBshufLz4BlockBound(blockSize, elemSize) +
+         (size % BLOCK_MULT) * elemSize;
+}
+
+void slsDetBshufWriteHeader(void *out, size_t bytes, size_t blockSize, size_t elemSize)
+{
+  unsigned char *header = (unsigned char *) out;
+  writeBE32(header, (epicsUInt32) ((epicsUInt64) bytes >> 32));
+  writeBE32(header + 4, (epicsUInt32) bytes);
+  writeBE32(header + 8, (epicsUInt32) (blockSize * elemSize));
+}
+
+size_t slsDetBshufLz4Compress(const void *in, void *out, size_t size, size_t elemSize, size_t blockSize)
+{
+  const unsigned char *ip = (const unsigned char *) in;
+  unsigned char *op = (unsigned char *) out + SLS_BSHUF_HEADER_SIZE;
+  size_t last;
+  size_t written;
+
+  if (!blockSize || (blockSize % BLOCK_MULT)) return 0;
+  std::vector<unsigned char> scratch(blockSize * elemSize);
+  slsDetBshufWriteHeader(out, size * elemSize, blockSize, elemSize);
+
+  for (size_t block=0; block<size/blockSize; block++) {
+    written = slsDetBshufLz4Block(ip, op, blockSize, elemSize, &scratch[0]);
+    if (!written) return 0;
+    ip += blockSize * elemSize;
+    op += written;
+  }
+  last = size % blockSize;
+  last -= last % BLOCK_MULT;
+  if (last) {
+    written = slsDetBshufLz4Block(ip, op, last, elemSize, &scratch[0]);
+    if (!written) return 0;
+    ip += last * elemSize;
+    op += written;
+  }
+  std::memcpy(op, ip, (size % BLOCK_MULT) * elemSize);
+  op += (size % BLOCK_MULT) * elemSize;
+
+  return op - (unsigned char *) out;
+}
+
+size_t slsDetBshufLz4Decompress(const void *in, size_t inSize, void *out, size_t capacity, size_t elemSize)
+{
+  const unsigned char *ip = (const unsigned char *) in;
+  const unsigned char *iend = ip + inSize;
+  unsigned char *op = (unsigned char *) out;
+  epicsUInt64 bytes;
+  size_t blockSize;
+  size_t size;
+  size_t done = 0;
+
+  if ((inSize < SLS_BSHUF_HEADER_SIZE) || !elemSize) return 0;
+  bytes = ((epicsUInt64) readBE32(ip) << 32) | readBE32(ip + 4);
+  blockSize = readBE32(ip + 8) / elemSize;
+  ip += SLS_BSHUF_HEADER_SIZE;
+  size = bytes / elemSize;
+  if ((bytes > capacity) || !blockSize || (blockSize % BLOCK_MULT)) return 0;
+
+  std::vector<unsigned char> scratch(blockSize * elemSize);
+  while (size - done >= BLOCK_MULT) {
+    size_t block = size - done < blockSize ? (size - done) - (size - done) % BLOCK_MULT : blockSize;
+    size_t compressed;
+    if (iend - ip < 4) return 0;
+    compressed = readBE32(ip);
+    ip += 4;
+    if (compressed > (size_t) (iend - ip)) return 0;
+    if (slsDetLz4Decompress(ip, &scratch[0], compressed, block * elemSize) != (long) (block * elemSize)) {
+      return 0;
+    }
+    slsDetBitunshuffle(&scratch[0], op + done * elemSize, block, elemSize);
+    ip += compressed;
+    done += block;
+  }
+  if ((size_t) (iend - ip) < (size - done) * elemSize) return 0;
+  std::memcpy(op + done * elemSize, ip, (size - done) * elemSize);
+
+  return bytes;
+}
@@ -0,0 +1,55 @@
+#ifndef slsDetBitshuffle_H
+#define slsDetBitshuffle_H
+
+#include <stddef.h>
+
+/*
+ * Bitshuffle and the bitshuffle/LZ4 chunk format of the HDF5 bitshuffle
+ * filter (filter id 32008), so chunks compressed here can be written with
+ * H5Dwrite_chunk and read back by any reader with the filter plugin.
+ *
+ * A chunk starts with a 12 byte header, the size of the uncompressed data as
+ * a big endian 64 bit number and the block size in bytes as a big endian 32
+ * bit number. The data is split in blocks of blockSize elements, a multiple
+ * of 8, the last one shortened to a multiple of 8. Each block is bit
+ * transposed, so bit n of every element ends up in the same row, and stored
+ * as its big endian 32 bit LZ4 size followed by the LZ4 block. The last
+ * (size % 8) elements follow as they are.
+ */
+
+/* Id of the HDF5 bitshuffle filter and its LZ4 option */
+#define SLS_BSHUF_H5_FILTER 32008
+#define SLS_BSHUF_H5_COMPRESS_LZ4 2
+/* Version of the filter the chunks follow, for the filter parameters */
+#define SLS_BSHUF_VERSION_MAJOR 0
+#define SLS_BSHUF_VERSION_MINOR 3
+/* Size of the chunk header */
+#define SLS_BSHUF_HEADER_SIZE 12
+
+/* Elements in a block by default, about 8 kB like the filter picks */
+extern size_t slsDetBshufBlockSize(size_t elemSize);
+
+/* Bit transposes size elements, a multiple of 8, and back */
+extern void slsDetBitshuffle(const void *in, void *out, size_t size, size_t elemSize);
+extern void slsDetBitunshuffle(const void *in, void *out, size_t size, size_t elemSize);
+
+/* Worst case size of one compressed block, its size included */
+extern size_t slsDetBshufLz4BlockBound(size_t blockSize, size_t elemSize);
+/* Compresses one block of size elements using scratch of size * elemSize
+ * bytes, returning the bytes written to out or 0 if it failed */
+extern size_t slsDetBshufLz4Block(const void *in, void *out, size_t size, size_t elemSize, void *scratch);
+
+/* Worst case size of a chunk of size elements, its header included */
+extern size_t slsDetBshufLz4Bound(size_t size, size_t elemSize, size_t blockSize);
+/* Compresses a whole chunk on the calling thread, returning its size or 0 */
+extern size_t slsDetBshufLz4Compress(const void *in, void *out, size_t size, size_t elemSize, size_t blockSize);
+/* Decompresses a chunk into capacity bytes, returning its size or 0 if it is malformed */
+extern size_t slsDetBshufLz4Decompress(const void *in, size_t inSize, void *out, size_t capacity, size_t elemSize);
+
+/* Writes the header of a chunk */
+extern void slsDetBshufWriteHeader(void *out, size_t bytes, size_t blockSize, size_t elemSize);
+
+/* Name of the bitshuffle kernel in use */
+extern const char* slsDetBitshuffleKernelName();
+
+#endif
@@ -0,0 +1,47 @@
+/* AVX2 kernels of slsDetBitshuffle, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+#include <string.h>
+
+void slsDetShuffleAvx2(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize)
+{
+  const __m256i lowMask = _mm256_set1_epi16(0xff);
+  size_t rowBytes = size / SLS_SHUFFLE_MULT;
+  size_t i = 0;
+
+  if (elemSize != 2) {
+    slsDetShuffleGeneric(in, out, size, elemSize);
+    return;
+  }
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (in + 2 * i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (in + 2 * i + 32));
+    /* The packs work on each 128 bit lane, the permute puts the pixels back in order */
+    __m256i lo = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16(_mm256_and_si256(a, lowMask), _mm256_and_si256(b, lowMask)), 0xD8);
+    __m256i hi = _mm256_permute4x64_epi64(
+      _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)), 0xD8);
+    for (int k=7; k>=0; k--) {
+      epicsUInt32 bitsLo = (epicsUInt32) _mm256_movemask_epi8(lo);
+      epicsUInt32 bitsHi = (epicsUInt32) _mm256_movemask_epi8(hi);
+      memcpy(out + k * rowBytes + i / 8, &bitsLo, sizeof(bitsLo));
+      memcpy(out + (8 + k) * rowBytes + i / 8, &bitsHi, sizeof(bitsHi));
+      lo = _mm256_add_epi8(lo, lo);
+      hi = _mm256_add_epi8(hi, hi);
+    }
+  }
+  if (i < size) {
+    /* The rest of the rows start i / 8 bytes in, there are fewer than 32 pixels left */
+    unsigned char tail[64];
+    size_t tailRow = (size - i) / SLS_SHUFFLE_MULT;
+    slsDetShuffleSse2(in + 2 * i, tail, size - i, 2);
+    for (int row=0; row<16; row++) {
+      memcpy(out + row * rowBytes + i / 8, tail + row * tailRow, tailRow);
+    }
+  }
+}
+#endif
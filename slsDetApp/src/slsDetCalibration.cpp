@@ -0,0 +1,274 @@
+#include "slsDetCalibration.h"
+
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+/* Alignment of the maps, a cache line so the vector loads never split one */
+#define MAP_ALIGN 64
+
+#define CAL_FILE_MAGIC    "SLSDCAL"
+#define CAL_FILE_VERSION  1
+
+/* Header of a calibration file, followed by the pedestal maps of each gain
+ * stage, the gain maps in ADU per keV and optionally the noise maps in ADU,
+ * all as float32 */
+typedef struct {
+  char        magic[8];
+  epicsUInt32 version;
+  epicsUInt32 sizeX;
+  epicsUInt32 sizeY;
+  epicsUInt32 numGains;
+  epicsUInt32 numMaps;
+  epicsUInt32 reserved[3];
+} SlsCalFileHeader;
+
+SlsDetCalibration::SlsDetCalibration(size_t sizeX, size_t sizeY) :
+  _sizeX(sizeX),
+  _sizeY(sizeY),
+  _refCount(1)
+{
+  size_t n = numPixels();
+  std::memset(_pedestal, 0, sizeof(_pedestal));
+  std::memset(_gainInv, 0, sizeof(_gainInv));
+  std::memset(_noise, 0, sizeof(_noise));
+  _error[0] = '\0';
+
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    void *ped = NULL;
+    void *gain = NULL;
+    void *noise = NULL;
+    if (posix_memalign(&ped, MAP_ALIGN, n * sizeof(float)) ||
+        posix_memalign(&gain, MAP_ALIGN, n * sizeof(float)) ||
+        posix_memalign(&noise, MAP_ALIGN, n * sizeof(float))) {
+      std::free(ped);
+      std::free(gain);
+      for (int m=0; m<g; m++) {
+        std::free(_pedestal[m]);
+        std::free(_gainInv[m]);
+        std::free(_noise[m]);
+      }
+      throw std::bad_alloc();
+    }
+    _pedestal[g] = (float *) ped;
+    _gainInv[g] = (float *) gain;
+    _noise[g] = (float *) noise;
+    /* Until a calibration is loaded the output is the raw ADC value */
+    for (size_t pix=0; pix<n; pix++) {
+      _pedestal[g][pix] = 0.0f;
+      _gainInv[g][pix] = 1.0f;
+      _noise[g][pix] = 0.0f;
+    }
+  }
+}
+
+SlsDetCalibration::~SlsDetCalibration()
+{
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    std::free(_pedestal[g]);
+    std::free(_gainInv[g]);
+    std::free(_noise[g]);
+  }
+}
+
+int SlsDetCalibration::reserve()
+{
+  return epicsAtomicIncrIntT(&_refCount);
+}
+
+int SlsDetCalibration::release()
+{
+  int count = epicsAtomicDecrIntT(&_refCount);
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
+
+int SlsDetCalibration::refCount() const
+{
+  return epicsAtomicGetIntT(&_refCount);
+}
+
+size_t SlsDetCalibration::sizeX() const
+{
+  return _sizeX;
+}
+
+size_t SlsDetCalibration::sizeY() const
+{
+  return _sizeY;
+}
+
+size_t SlsDetCalibration::numPixels() const
+{
+  return _sizeX * _sizeY;
+}
+
+float* SlsDetCalibration::pedestal(int gain)
+{
+  return _pedestal[gain];
+}
+
+const float* SlsDetCalibration::pedestal(int gain) const
+{
+  return _pedestal[gain];
+}
+
+float* SlsDetCalibration::gainInv(int gain)
+{
+  return _gainInv[gain];
+}
+
+const float* SlsDetCalibration::gainInv(int gain) const
+{
+  return _gainInv[gain];
+}
+
+float SlsDetCalibration::gain(int gain, size_t pixel) const
+{
+  float inv = _gainInv[gain][pixel];
+  return inv != 0.0f ? 1.0f / inv : 0.0f;
+}
+
+void SlsDetCalibration::setGain(int gain, size_t pixel, float adcPerKeV)
+{
+  _gainInv[gain][pixel] = adcPerKeV != 0.0f ? 1.0f / adcPerKeV : 0.0f;
+}
+
+float* SlsDetCalibration::noise(int gain)
+{
+  return _noise[gain];
+}
+
+const float* SlsDetCalibration::noise(int gain) const
+{
+  return _noise[gain];
+}
+
+void SlsDetCalibration::copy(const SlsDetCalibration *other)
+{
+  size_t nbytes = numPixels() * sizeof(float);
+
+  if (other->numPixels() != numPixels()) return;
+
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    std::memcpy(_pedestal[g], other->_pedestal[g], nbytes);
+    std::memcpy(_gainInv[g], other->_gainInv[g], nbytes);
+    std::memcpy(_noise[g], other->_noise[g], nbytes);
+  }
+}
+
+const char* SlsDetCalibration::error() const
+{
+  return _error;
+}
+
+void SlsDetCalibration::setError(const char *fmt, ...) const
+{
+  va_list args;
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+}
+
+bool SlsDetCalibration::read(const char *fileName)
+{
+  SlsCalFileHeader header;
+  size_t n = numPixels();
+  bool ok = false;
+  FILE *fp = fopen(fileName, "rb");
+
+  if (!fp) {
+    setError("unable to open %s: %s", fileName, strerror(errno));
+    return false;
+  }
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      std::strncmp(header.magic, CAL_FILE_MAGIC, sizeof(header.magic))) {
+    setError("%s is not a calibration file", fileName);
+  } else if (header.version != CAL_FILE_VERSION) {
+    setError("%s has unsupported version %u", fileName, header.version);
+  } else if ((header.sizeX != _sizeX) || (header.sizeY != _sizeY)) {
+    setError("%s is for a %ux%u detector not %lux%lu", fileName,
+             header.sizeX, header.sizeY, (unsigned long) _sizeX, (unsigned long) _sizeY);
+  } else if ((header.numGains != SLS_NUM_GAINS) || (header.numMaps < 2 * SLS_NUM_GAINS)) {
+    setError("%s has %u gains and %u maps", fileName, header.numGains, header.numMaps);
+  } else {
+    ok = true;
+    for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+      ok = fread(_pedestal[g], sizeof(float), n, fp) == n;
+    }
+    /* The gains are read into the inverse maps and flipped in place */
+    for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+      ok = fread(_gainInv[g], sizeof(float), n, fp) == n;
+      for (size_t pix=0; ok && pix<n; pix++) {
+        setGain(g, pix, _gainInv[g][pix]);
+      }
+    }
+    /* Older files have no noise maps */
+    for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+      if (header.numMaps >= 3 * SLS_NUM_GAINS) {
+        ok = fread(_noise[g], sizeof(float), n, fp) == n;
+      } else {
+        std::memset(_noise[g], 0, n * sizeof(float));
+      }
+    }
+    if (!ok) setError("%s is truncated", fileName);
+  }
+
+  fclose(fp);
+  return ok;
+}
+
+bool SlsDetCalibration::write(const char *fileName) const
+{
+  SlsCalFileHeader header;
+  size_t n = numPixels();
+  float *row = new float[_sizeX];
+  bool ok;
+  FILE *fp = fopen(fileName, "wb");
+
+  if (!fp) {
+    setError("unable to create %s: %s", fileName, strerror(errno));
+    delete [] row;
+    return false;
+  }
+
+  std::memset(&header, 0, sizeof(header));
+  std::strncpy(header.magic, CAL_FILE_MAGIC, sizeof(header.magic));
+  header.version = CAL_FILE_VERSION;
+  header.sizeX = _sizeX;
+  header.sizeY = _sizeY;
+  header.numGains = SLS_NUM_GAINS;
+  header.numMaps = 3 * SLS_NUM_GAINS;
+
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+    ok = fwrite(_pedestal[g], sizeof(float), n, fp) == n;
+  }
+  for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+    for (size_t y=0; ok && y<_sizeY; y++) {
+      for (size_t x=0; x<_sizeX; x++) {
+        row[x] = gain(g, y * _sizeX + x);
+      }
+      ok = fwrite(row, sizeof(float), _sizeX, fp) == _sizeX;
+    }
+  }
+  for (int g=0; ok && g<SLS_NUM_GAINS; g++) {
+    ok = fwrite(_noise[g], sizeof(float), n, fp) == n;
+  }
+  if (fclose(fp) || !ok) {
+    setError("failed writing %s: %s", fileName, strerror(errno));
+    ok = false;
+  }
+
+  delete [] row;
+  return ok;
+}
@@ -0,0 +1,69 @@
+#ifndef slsDetCalibration_H
+#define slsDetCalibration_H
+
+#include <epicsTypes.h>
+
+#include <stddef.h>
+
+/* Gain stages of the Jungfrau, given by the top two bits of each pixel */
+#define SLS_NUM_GAINS   3
+#define SLS_GAIN_SHIFT  14
+#define SLS_ADC_MASK    0x3fff
+/* Storage cells of the Jungfrau, each with its own pedestals and gains in burst mode */
+#define SLS_MAX_CELLS   16
+
+/** Class definition for the SlsDetCalibration class
+  *
+  * Per pixel pedestal and gain maps for each gain stage, kept as separate
+  * float arrays (structure of arrays) so the conversion kernels can load
+  * consecutive pixels straight into vector registers. The gains are given
+  * in ADU per keV and kept as their inverse, a zero gain masks the pixel.
+  * The noise maps hold the pedestal RMS in ADU when it is known.
+  *
+  * Tables are shared by reference counting so a new set can be swapped in
+  * while frames are still being converted with the old one.
+  */
+class SlsDetCalibration {
+public:
+  SlsDetCalibration(size_t sizeX, size_t sizeY);
+  virtual ~SlsDetCalibration();
+
+  int reserve();
+  int release();
+  int refCount() const;
+
+  size_t sizeX() const;
+  size_t sizeY() const;
+  size_t numPixels() const;
+
+  float* pedestal(int gain);
+  const float* pedestal(int gain) const;
+  float* gainInv(int gain);
+  const float* gainInv(int gain) const;
+  float gain(int gain, size_t pixel) const;
+  void setGain(int gain, size_t pixel, float adcPerKeV);
+  float* noise(int gain);
+  const float* noise(int gain) const;
+  /* Copies all the maps of a calibration of the same size */
+  void copy(const SlsDetCalibration *other);
+
+  /* Reads or writes a calibration file, returning false on failure */
+  virtual bool read(const char *fileName);
+  virtual bool write(const char *fileName) const;
+  /* Description of what went wrong with the last read or write */
+  const char* error() const;
+
+protected:
+  void setError(const char *fmt, ...) const;
+
+private:
+  const size_t  _sizeX;
+  const size_t  _sizeY;
+  int           _refCount;
+  float         *_pedestal[SLS_NUM_GAINS];
+  float         *_gainInv[SLS_NUM_GAINS];
+  float         *_noise[SLS_NUM_GAINS];
+  mutable char  _error[256];
+};
+
+#endif
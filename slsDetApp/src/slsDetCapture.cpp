@@ -0,0 +1,477 @@
+#include "slsDetCapture.h"
+#include "slsDetAffinity.h"
+
+#include <epicsStdio.h>
+
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
+
+#define THREAD_TMO 10.0
+/* How often the rate and the kernel drops are worked out */
+#define WINDOW_TIME 1.0
+/* How long the thread waits for a block before it looks at whether it should stop, in ms */
+#define POLL_TIMEOUT 100
+/* The ring is 64 blocks of 4 MB, a quarter of a second of a 10 GbE link */
+#define RING_BLOCK_SIZE (4 * 1024 * 1024)
+#define RING_BLOCKS 64
+#define RING_FRAME_SIZE 2048
+/* Time in ms after which a block is handed over even if it is not full */
+#define RING_BLOCK_TIMEOUT 10
+/* Packets written with each writev, two iovecs each within IOV_MAX */
+#define WRITE_PACKETS 512
+
+/* pcap with the timestamps in ns, link type Ethernet */
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_LINK_ETHERNET 1
+#define PCAP_SNAPLEN 65535
+
+typedef struct {
+  epicsUInt32 magic;
+  epicsUInt16 versionMajor;
+  epicsUInt16 versionMinor;
+  epicsInt32  thisZone;
+  epicsUInt32 sigFigs;
+  epicsUInt32 snapLen;
+  epicsUInt32 linkType;
+} SlsPcapHeader;
+
+typedef struct {
+  epicsUInt32 sec;
+  epicsUInt32 nsec;
+  epicsUInt32 inclLen;
+  epicsUInt32 origLen;
+} SlsPcapRecord;
+
+SlsDetCapture::SlsDetCapture(const char *portName) :
+  _portName(portName),
+  _socket(-1),
+  _ring(NULL),
+  _ringSize(0),
+  _fd(-1),
+  _fileSize(0),
+  _fileBytes(0),
+  _fileNumber(0),
+  _active(false),
+  _stopping(false),
+  _quit(false),
+  _records(WRITE_PACKETS * sizeof(SlsPcapRecord)),
+  _iov(2 * WRITE_PACKETS),
+  _windowPackets(0),
+  _startEvent(epicsEventEmpty),
+  /* Falling behind only costs packets of the capture, never of the receivers */
+  _thread(*this, "slsDetCapture", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+{
+  _path[0] = '\0';
+  _name[0] = '\0';
+  std::memset(&_stats, 0, sizeof(_stats));
+  epicsTimeGetCurrent(&_windowStart);
+  epicsSnprintf(_status, sizeof(_status), "Idle");
+  _thread.start();
+}
+
+SlsDetCapture::~SlsDetCapture()
+{
+  _lock.lock();
+  _stopping = true;
+  _quit = true;
+  _lock.unlock();
+  _startEvent.signal();
+  _thread.exitWait(THREAD_TMO);
+  closeRing();
+  closeFile();
+}
+
+void SlsDetCapture::setStatus(const char *fmt, ...)
+{
+  va_list args;
+  _lock.lock();
+  va_start(args, fmt);
+  epicsVsnprintf(_status, sizeof(_status), fmt, args);
+  va_end(args);
+  _lock.unlock();
+}
+
+const char* SlsDetCapture::status()
+{
+  return _status;
+}
+
+bool SlsDetCapture::running()
+{
+  bool running;
+
+  _lock.lock();
+  running = _active;
+  _lock.unlock();
+
+  return running;
+}
+
+void SlsDetCapture::getStats(SlsDetCaptureStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+void SlsDetCapture::resetStats()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _lock.unlock();
+}
+
+bool SlsDetCapture::start(const char *interface, int firstPort, int numPorts,
+                          const char *path, const char *name, size_t fileSize)
+{
+  _lock.lock();
+  if (_active) {
+    _lock.unlock();
+    setStatus("The capture is already running");
+    return false;
+  }
+  _lock.unlock();
+
+  epicsSnprintf(_path, sizeof(_path), "%s", path);
+  epicsSnprintf(_name, sizeof(_name), "%s", name);
+  _fileSize = fileSize;
+  _fileNumber = 0;
+  if (!openRing(interface, firstPort, numPorts)) return false;
+  if (!newFile()) {
+    closeRing();
+    return false;
+  }
+
+  _lock.lock();
+  _stats.files++;
+  _active = true;
+  _stopping = false;
+  _lock.unlock();
+  _startEvent.signal();
+
+  return true;
+}
+
+void SlsDetCapture::stop()
+{
+  _lock.lock();
+  if (_active) _stopping = true;
+  _lock.unlock();
+}
+
+#ifdef __linux__
+bool SlsDetCapture::openRing(const char *interface, int firstPort, int numPorts)
+{
+  /* udp dst portrange firstPort-lastPort on IPv4 over Ethernet, first fragments
+   * only, and not what the host sends itself */
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD  + BPF_W   + BPF_ABS, (unsigned) (SKF_AD_OFF + SKF_AD_PKTTYPE)),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   PACKET_OUTGOING, 11, 0),
+    BPF_STMT(BPF_LD  + BPF_H   + BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   ETH_P_IP, 0, 9),
+    BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   IPPROTO_UDP, 0, 7),
+    BPF_STMT(BPF_LD  + BPF_H   + BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,  0x1fff, 5, 0),
+    BPF_STMT(BPF_LDX + BPF_B   + BPF_MSH, 14),
+    BPF_STMT(BPF_LD  + BPF_H   + BPF_IND, 16),
+    BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K,   (unsigned) firstPort, 0, 2),
+    BPF_JUMP(BPF_JMP + BPF_JGT + BPF_K,   (unsigned) (firstPort + numPorts - 1), 1, 0),
+    BPF_STMT(BPF_RET + BPF_K,             0x40000),
+    BPF_STMT(BPF_RET + BPF_K,             0),
+  };
+  struct sock_fprog filter;
+  struct tpacket_req3 req;
+  struct sockaddr_ll addr;
+  int version = TPACKET_V3;
+
+  _socket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+  if (_socket < 0) {
+    setStatus("Unable to open a packet socket, it needs CAP_NET_RAW: %s", strerror(errno));
+    return false;
+  }
+
+  /* The filter goes on before the socket is bound so nothing else gets in first */
+  filter.len = sizeof(code) / sizeof(code[0]);
+  filter.filter = code;
+  if (setsockopt(_socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter))) {
+    setStatus("Unable to filter the packet socket: %s", strerror(errno));
+    closeRing();
+    return false;
+  }
+  if (setsockopt(_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+    setStatus("TPACKET_V3 is not supported: %s", strerror(errno));
+    closeRing();
+    return false;
+  }
+
+  std::memset(&req, 0, sizeof(req));
+  req.tp_block_size = RING_BLOCK_SIZE;
+  req.tp_block_nr = RING_BLOCKS;
+  req.tp_frame_size = RING_FRAME_SIZE;
+  req.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCKS;
+  req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+  if (setsockopt(_socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+    setStatus("Unable to set up the packet ring: %s", strerror(errno));
+    closeRing();
+    return false;
+  }
+  _ringSize = (size_t) req.tp_block_size * req.tp_block_nr;
+  _ring = (char *) mmap(NULL, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, _socket, 0);
+  if (_ring == MAP_FAILED) {
+    _ring = NULL;
+    setStatus("Unable to map the packet ring: %s", strerror(errno));
+    closeRing();
+    return false;
+  }
+
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_IP);
+  addr.sll_ifindex = if_nametoindex(interface);
+  if (!addr.sll_ifindex) {
+    setStatus("No interface %s", interface);
+    closeRing();
+    return false;
+  }
+  if (bind(_socket, (struct sockaddr *) &addr, sizeof(addr))) {
+    setStatus("Unable to capture on %s: %s", interface, strerror(errno));
+    closeRing();
+    return false;
+  }
+
+  return true;
+}
+
+void SlsDetCapture::readDrops()
+{
+  struct tpacket_stats_v3 stats;
+  socklen_t length = sizeof(stats);
+
+  /* Reading the counters clears them */
+  if (getsockopt(_socket, SOL_PACKET, PACKET_STATISTICS, &stats, &length)) return;
+  _lock.lock();
+  _stats.dropped += stats.tp_drops;
+  _lock.unlock();
+}
+
+void SlsDetCapture::writeBlock(void *block)
+{
+  struct tpacket_block_desc *desc = (struct tpacket_block_desc *) block;
+  struct tpacket3_hdr *packet;
+  SlsPcapRecord *records = (SlsPcapRecord *) &_records[0];
+  size_t bytes = 0;
+  int count = 0;
+
+  packet = (struct tpacket3_hdr *) ((char *) desc + desc->hdr.bh1.offset_to_first_pkt);
+  for (unsigned n=0; n<desc->hdr.bh1.num_pkts; n++) {
+    records[count].sec = packet->tp_sec;
+    records[count].nsec = packet->tp_nsec;
+    records[count].inclLen = packet->tp_snaplen;
+    records[count].origLen = packet->tp_len;
+    /* The record header and then the packet where the kernel put it */
+    _iov[2 * count].iov_base = &records[count];
+    _iov[2 * count].iov_len = sizeof(SlsPcapRecord);
+    _iov[2 * count + 1].iov_base = (char *) packet + packet->tp_mac;
+    _iov[2 * count + 1].iov_len = packet->tp_snaplen;
+    bytes += sizeof(SlsPcapRecord) + packet->tp_snaplen;
+    if (++count == WRITE_PACKETS) {
+      writePackets(count, bytes);
+      count = 0;
+      bytes = 0;
+    }
+    packet = (struct tpacket3_hdr *) ((char *) packet + packet->tp_next_offset);
+  }
+  if (count) writePackets(count, bytes);
+}
+
+void SlsDetCapture::capture()
+{
+  struct tpacket_block_desc *desc;
+  struct pollfd pfd;
+  epicsTimeStamp now;
+  double window;
+  unsigned block = 0;
+  bool stopping = false;
+
+  pfd.fd = _socket;
+  pfd.events = POLLIN | POLLERR;
+  pfd.revents = 0;
+
+  _lock.lock();
+  epicsTimeGetCurrent(&_windowStart);
+  _windowPackets = 0;
+  _lock.unlock();
+
+  while (!stopping) {
+    desc = (struct tpacket_block_desc *) (_ring + (size_t) block * RING_BLOCK_SIZE);
+    if (desc->hdr.bh1.block_status & TP_STATUS_USER) {
+      writeBlock(desc);
+      /* The packets have to be written before the kernel gets the block back */
+      __sync_synchronize();
+      desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+      block = (block + 1) % RING_BLOCKS;
+    } else {
+      poll(&pfd, 1, POLL_TIMEOUT);
+    }
+
+    epicsTimeGetCurrent(&now);
+    _lock.lock();
+    window = epicsTimeDiffInSeconds(&now, &_windowStart);
+    if (window >= WINDOW_TIME) {
+      _stats.rate = _windowPackets / window;
+      _windowStart = now;
+      _windowPackets = 0;
+    }
+    stopping = _stopping;
+    _lock.unlock();
+    if (window >= WINDOW_TIME) readDrops();
+  }
+  readDrops();
+}
+#else
+bool SlsDetCapture::openRing(const char *interface, int firstPort, int numPorts)
+{
+  setStatus("Packet capture needs Linux");
+  return false;
+}
+
+void SlsDetCapture::readDrops()
+{
+}
+
+void SlsDetCapture::writeBlock(void *block)
+{
+}
+
+void SlsDetCapture::capture()
+{
+}
+#endif
+
+void SlsDetCapture::closeRing()
+{
+  if (_ring) {
+    munmap(_ring, _ringSize);
+    _ring = NULL;
+  }
+  if (_socket >= 0) {
+    ::close(_socket);
+    _socket = -1;
+  }
+}
+
+bool SlsDetCapture::newFile()
+{
+  char fileName[sizeof(_path) + sizeof(_name) + 64];
+  SlsPcapHeader header;
+
+  epicsSnprintf(fileName, sizeof(fileName), "%s/%s_capture_%06u.pcap", _path, _name, _fileNumber);
+  _fd = ::open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+  if (_fd < 0) {
+    setStatus("Unable to open %s: %s", fileName, strerror(errno));
+    return false;
+  }
+
+  std::memset(&header, 0, sizeof(header));
+  header.magic = PCAP_MAGIC_NS;
+  header.versionMajor = 2;
+  header.versionMinor = 4;
+  header.snapLen = PCAP_SNAPLEN;
+  header.linkType = PCAP_LINK_ETHERNET;
+  if (::write(_fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+    setStatus("Unable to write %s: %s", fileName, strerror(errno));
+    closeFile();
+    return false;
+  }
+  _fileBytes = sizeof(header);
+  _fileNumber++;
+  setStatus("%s", fileName);
+
+  return true;
+}
+
+void SlsDetCapture::closeFile()
+{
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+void SlsDetCapture::writePackets(int count, size_t bytes)
+{
+  ssize_t written = -1;
+
+  /* A file only goes over its size if a single write does */
+  if ((_fd >= 0) && _fileSize && (_fileBytes > sizeof(SlsPcapHeader)) && (_fileBytes + bytes > _fileSize)) {
+    closeFile();
+    if (newFile()) {
+      _lock.lock();
+      _stats.files++;
+      _lock.unlock();
+    }
+  }
+
+  if (_fd >= 0) written = ::writev(_fd, &_iov[0], 2 * count);
+  if (written != (ssize_t) bytes) {
+    if (_fd >= 0) {
+      setStatus("Unable to write the capture: %s", written < 0 ? strerror(errno) : "disk full");
+      /* Nothing after a short write can be read, so the capture stops here */
+      closeFile();
+    }
+    _lock.lock();
+    _stats.failed += count;
+    _lock.unlock();
+    return;
+  }
+  _fileBytes += bytes;
+
+  _lock.lock();
+  _stats.packets += count;
+  _stats.bytes += bytes - count * sizeof(SlsPcapRecord);
+  _windowPackets += count;
+  _lock.unlock();
+}
+
+void SlsDetCapture::run()
+{
+  slsDetPinThread(_portName, SlsThreadWrite);
+
+  while (true) {
+    _startEvent.wait();
+    _lock.lock();
+    if (_quit) {
+      _lock.unlock();
+      break;
+    }
+    _lock.unlock();
+
+    capture();
+    closeRing();
+    closeFile();
+
+    _lock.lock();
+    _active = false;
+    _stopping = false;
+    _stats.rate = 0.;
+    _lock.unlock();
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,97 @@
+#ifndef slsDetCapture_H
+#define slsDetCapture_H
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsTypes.h>
+
+#include <stddef.h>
+#include <vector>
+#include <sys/uio.h>
+
+/** Counters kept by the SlsDetCapture */
+typedef struct {
+  epicsUInt64 packets;      /**< packets written to the files */
+  epicsUInt64 bytes;        /**< bytes of the packets written */
+  epicsUInt64 dropped;      /**< packets the kernel dropped with the ring full */
+  epicsUInt64 failed;       /**< packets that could not be written */
+  epicsUInt64 files;        /**< files started */
+  double      rate;         /**< packets/s over the last second */
+} SlsDetCaptureStats;
+
+/** Class definition for the SlsDetCapture class
+  *
+  * Captures the UDP packets the detector sends to the receivers, as they
+  * arrive on the network interface, for working out afterwards whether lost
+  * packets never arrived or were dropped by the receiver. The packets are
+  * taken from an AF_PACKET TPACKET_V3 ring mapped from the kernel, with a BPF
+  * filter that only lets through the UDP ports of the modules, and written
+  * to pcap files with their kernel timestamps in ns. Each packet goes from
+  * the ring to the file with writev, so nothing is copied in user space, and
+  * the receivers get their packets as usual alongside.
+  *
+  * The files are <path>/<name>_capture_<n>.pcap, a new one once a file
+  * reaches its size, and can be read by tcpdump, Wireshark or anything that
+  * reads pcap. Opening the ring needs CAP_NET_RAW and Linux.
+  */
+class SlsDetCapture : public epicsThreadRunable {
+public:
+  /* portName is the port whose thread placement the capture follows */
+  SlsDetCapture(const char *portName=NULL);
+  virtual ~SlsDetCapture();
+  virtual void run();
+
+  /* Captures the UDP packets to ports firstPort to firstPort + numPorts - 1
+   * that arrive on the interface; fileSize is the size in bytes a file is
+   * allowed to reach before the next is started, 0 for a single file */
+  virtual bool start(const char *interface, int firstPort, int numPorts,
+                     const char *path, const char *name, size_t fileSize);
+  /* Asks the capture to stop, the thread closes the ring and the file */
+  virtual void stop();
+
+  bool running();
+  void getStats(SlsDetCaptureStats *stats);
+  void resetStats();
+  /* The file being written or the last thing that went wrong */
+  const char* status();
+
+protected:
+  void setStatus(const char *fmt, ...);
+  virtual bool openRing(const char *interface, int firstPort, int numPorts);
+  virtual void closeRing();
+  virtual bool newFile();
+  virtual void closeFile();
+  virtual void capture();
+  virtual void writeBlock(void *block);
+  virtual void writePackets(int count, size_t bytes);
+  virtual void readDrops();
+
+private:
+  const char        *_portName;
+  int               _socket;
+  char              *_ring;
+  size_t            _ringSize;
+  int               _fd;
+  char              _path[256];
+  char              _name[256];
+  size_t            _fileSize;
+  size_t            _fileBytes;
+  unsigned          _fileNumber;
+  bool              _active;
+  bool              _stopping;
+  bool              _quit;
+  /* The pcap record headers and the iovecs of the packets of one writev */
+  std::vector<char> _records;
+  std::vector<struct iovec> _iov;
+  epicsTimeStamp    _windowStart;
+  epicsUInt64       _windowPackets;
+  SlsDetCaptureStats _stats;
+  char              _status[512];
+  epicsMutex        _lock;
+  epicsEvent        _startEvent;
+  epicsThread       _thread;
+};
+
+#endif
@@ -0,0 +1,418 @@
+#include "slsDetCompressor.h"
+#include "slsDetFramePool.h"
+#include "slsDetBitshuffle.h"
+#include "slsDetAffinity.h"
+
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+
+#include <zlib.h>
+
+#define THREAD_TMO 2.0
+/* Tasks the queue holds for each worker thread */
+#define TASKS_PER_THREAD 64
+/* Bitshuffle blocks a worker takes on at least, 64 kB of 16 bit pixels */
+#define MIN_BLOCKS_PER_GROUP 8
+/* Stands in for the frames missing from a chunk that is not full */
+#define ZEROS_SIZE 65536
+
+static const char zeros[ZEROS_SIZE] = { 0 };
+
+SlsDetChunk::SlsDetChunk(size_t frameSize, size_t elemSize, unsigned maxFrames, size_t bufferSize) :
+  frameSize(frameSize),
+  elemSize(elemSize > 0 ? elemSize : 1),
+  maxFrames(maxFrames > 0 ? maxFrames : 1),
+  buffer(NULL),
+  bufferSize(bufferSize),
+  out(NULL),
+  outSize(0),
+  filtered(false),
+  elapsed(0.),
+  _remaining(0)
+{
+  void *data = NULL;
+
+  if (posix_memalign(&data, SLS_FRAME_ALIGN, bufferSize > 0 ? bufferSize : 1)) {
+    throw std::bad_alloc();
+  }
+  buffer = (char *) data;
+  frames.reserve(this->maxFrames);
+}
+
+SlsDetChunk::~SlsDetChunk()
+{
+  clear();
+  std::free(buffer);
+}
+
+void SlsDetChunk::add(SlsDetFrame *frame)
+{
+  frames.push_back(frame);
+}
+
+void SlsDetChunk::clear()
+{
+  for (unsigned n=0; n<frames.size(); n++) {
+    frames[n]->release();
+  }
+  frames.clear();
+  out = NULL;
+  outSize = 0;
+  filtered = false;
+  elapsed = 0.;
+}
+
+bool SlsDetChunk::full() const
+{
+  return frames.size() >= maxFrames;
+}
+
+SlsDetCompressor::SlsDetCompressor(int numThreads, SlsCompressCodec codec, int level, const char *portName) :
+  _codec(codec),
+  _level(level),
+  _portName(portName),
+  _started(0),
+  _queue((numThreads > 0 ? numThreads : 1) * TASKS_PER_THREAD, sizeof(SlsCompressTask))
+{
+  char name[32];
+
+  _stats.resize(numThreads > 0 ? numThreads : 1);
+  resetStats();
+
+  for (int n=0; n<numThreads; n++) {
+    epicsSnprintf(name, sizeof(name), "slsDetComp%d", n);
+    epicsThread *thread = new epicsThread(*this, name,
+                                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                                          epicsThreadPriorityMedium);
+    _threads.push_back(thread);
+    thread->start();
+  }
+}
+
+SlsDetCompressor::~SlsDetCompressor()
+{
+  SlsCompressTask task;
+  task.chunk = NULL;
+  task.group = 0;
+
+  /* One empty task for each worker tells it to exit */
+  for (unsigned n=0; n<_threads.size(); n++) {
+    _queue.send(&task, sizeof(task));
+  }
+  for (unsigned n=0; n<_threads.size(); n++) {
+    _threads[n]->exitWait(THREAD_TMO);
+    delete _threads[n];
+  }
+}
+
+int SlsDetCompressor::numThreads() const
+{
+  return (int) _threads.size();
+}
+
+SlsCompressCodec SlsDetCompressor::codec() const
+{
+  return _codec;
+}
+
+int SlsDetCompressor::level() const
+{
+  return _level;
+}
+
+void SlsDetCompressor::getStats(int thread, SlsDetCompressorStats *stats)
+{
+  _lock.lock();
+  if ((thread >= 0) && (thread < (int) _stats.size())) {
+    *stats = _stats[thread];
+  } else {
+    std::memset(stats, 0, sizeof(*stats));
+  }
+  _lock.unlock();
+}
+
+void SlsDetCompressor::resetStats()
+{
+  _lock.lock();
+  for (unsigned n=0; n<_stats.size(); n++) {
+    std::memset(&_stats[n], 0, sizeof(_stats[n]));
+  }
+  _lock.unlock();
+}
+
+size_t SlsDetCompressor::bound(SlsCompressCodec codec, size_t size, size_t elemSize)
+{
+  size_t compressed;
+
+  switch (codec) {
+  case SlsCompressDeflate:
+    return compressBound(size);
+  case SlsCompressBitshuffleLz4:
+    compressed = slsDetBshufLz4Bound(size / elemSize, elemSize, slsDetBshufBlockSize(elemSize));
+    /* Chunks that do not compress are stored plain in the same buffer */
+    return compressed > size ? compressed : size;
+  default:
+    return size;
+  }
+}
+
+const char* SlsDetCompressor::codecName(SlsCompressCodec codec)
+{
+  switch (codec) {
+  case SlsCompressNone:
+    return "none";
+  case SlsCompressDeflate:
+    return "deflate";
+  case SlsCompressBitshuffleLz4:
+    return "bslz4";
+  default:
+    return "unknown";
+  }
+}
+
+void SlsDetCompressor::gather(SlsDetChunk *chunk)
+{
+  size_t pos = 0;
+
+  for (unsigned n=0; n<chunk->frames.size(); n++) {
+    std::memcpy(chunk->buffer + pos, chunk->frames[n]->data, chunk->frameSize);
+    pos += chunk->frameSize;
+  }
+  std::memset(chunk->buffer + pos, 0, chunk->frameSize * chunk->maxFrames - pos);
+  chunk->out = chunk->buffer;
+  chunk->outSize = chunk->frameSize * chunk->maxFrames;
+}
+
+bool SlsDetCompressor::deflate(SlsDetChunk *chunk)
+{
+  z_stream stream;
+  size_t left;
+  int status = Z_OK;
+
+  std::memset(&stream, 0, sizeof(stream));
+  if (deflateInit(&stream, _level) != Z_OK) return false;
+  stream.next_out = (Bytef *) chunk->buffer;
+  stream.avail_out = chunk->bufferSize;
+
+  /* Streamed a frame at a time, so the frames are never gathered */
+  for (unsigned n=0; (n<chunk->maxFrames) && (status == Z_OK); n++) {
+    left = chunk->frameSize;
+    while (left && (status == Z_OK)) {
+      if (n < chunk->frames.size()) {
+        stream.next_in = (Bytef *) chunk->frames[n]->data;
+        stream.avail_in = left;
+      } else {
+        stream.next_in = (Bytef *) zeros;
+        stream.avail_in = left < ZEROS_SIZE ? left : ZEROS_SIZE;
+      }
+      left -= stream.avail_in;
+      status = ::deflate(&stream, Z_NO_FLUSH);
+      /* Running out of room means the chunk does not compress */
+      if (stream.avail_in) status = Z_BUF_ERROR;
+    }
+  }
+  if (status == Z_OK) status = ::deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+
+  if ((status != Z_STREAM_END) || (stream.total_out >= chunk->frameSize * chunk->maxFrames)) {
+    return false;
+  }
+  chunk->out = chunk->buffer;
+  chunk->outSize = stream.total_out;
+
+  return true;
+}
+
+const char* SlsDetCompressor::chunkData(SlsDetChunk *chunk, size_t offset, size_t size, char *copy)
+{
+  size_t frame = offset / chunk->frameSize;
+  size_t pos = offset % chunk->frameSize;
+  size_t done = 0;
+
+  if ((pos + size <= chunk->frameSize) && (frame < chunk->frames.size())) {
+    return (const char *) chunk->frames[frame]->data + pos;
+  }
+  /* Spread over frames or reaching past the last one */
+  while (done < size) {
+    size_t part = chunk->frameSize - pos;
+    if (part > size - done) part = size - done;
+    if (frame < chunk->frames.size()) {
+      std::memcpy(copy + done, (const char *) chunk->frames[frame]->data + pos, part);
+    } else {
+      std::memset(copy + done, 0, part);
+    }
+    done += part;
+    frame++;
+    pos = 0;
+  }
+
+  return copy;
+}
+
+size_t SlsDetCompressor::bitshuffleLz4(SlsDetChunk *chunk, unsigned group, std::vector<char> &scratch)
+{
+  size_t elements = chunk->frameSize * chunk->maxFrames / chunk->elemSize;
+  size_t blockSize = slsDetBshufBlockSize(chunk->elemSize);
+  size_t blockBytes = blockSize * chunk->elemSize;
+  size_t fullBlocks = elements / blockSize;
+  size_t lastBlock = (elements % blockSize) - (elements % blockSize) % 8;
+  size_t numBlocks = fullBlocks + (lastBlock ? 1 : 0);
+  size_t numGroups = chunk->_groupSize.size();
+  size_t first = group * numBlocks / numGroups;
+  size_t last = (group + 1) * numBlocks / numGroups;
+  char *start = chunk->buffer + SLS_BSHUF_HEADER_SIZE + first * slsDetBshufLz4BlockBound(blockSize, chunk->elemSize);
+  char *out = start;
+
+  scratch.resize(2 * blockBytes);
+  for (size_t block=first; block<last; block++) {
+    size_t size = block < fullBlocks ? blockSize : lastBlock;
+    const char *in = chunkData(chunk, block * blockBytes, size * chunk->elemSize, &scratch[blockBytes]);
+    size_t written = slsDetBshufLz4Block(in, out, size, chunk->elemSize, &scratch[0]);
+    if (!written) return 0;
+    out += written;
+  }
+
+  return out - start;
+}
+
+void SlsDetCompressor::compressGroup(SlsDetChunk *chunk, unsigned group, int thread,
+                                     std::vector<char> &scratch)
+{
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  size_t bytesIn = chunk->frameSize * chunk->maxFrames;
+  size_t bytesOut = 0;
+
+  epicsTimeGetCurrent(&start);
+  if (_codec == SlsCompressBitshuffleLz4) {
+    size_t numGroups = chunk->_groupSize.size();
+    bytesOut = bitshuffleLz4(chunk, group, scratch);
+    chunk->_groupSize[group] = bytesOut;
+    bytesIn = (bytesIn / numGroups) + (group == numGroups - 1 ? bytesIn % numGroups : 0);
+  } else {
+    chunk->filtered = (_codec == SlsCompressDeflate) && deflate(chunk);
+    if (!chunk->filtered) {
+      if ((chunk->maxFrames == 1) && (chunk->frames.size() == 1)) {
+        chunk->out = chunk->frames[0]->data;
+        chunk->outSize = chunk->frameSize;
+      } else {
+        gather(chunk);
+      }
+    }
+    bytesOut = chunk->outSize;
+  }
+  epicsTimeGetCurrent(&end);
+
+  _lock.lock();
+  _stats[thread].bytesIn += bytesIn;
+  _stats[thread].bytesOut += bytesOut;
+  _stats[thread].tasks++;
+  _stats[thread].busy += epicsTimeDiffInSeconds(&end, &start);
+  _lock.unlock();
+
+  /* Whoever compressed the last group hands the chunk back */
+  if (epicsAtomicDecrIntT(&chunk->_remaining) == 0) {
+    finish(chunk);
+  }
+}
+
+void SlsDetCompressor::finish(SlsDetChunk *chunk)
+{
+  epicsTimeStamp now;
+
+  if (_codec == SlsCompressBitshuffleLz4) {
+    size_t elements = chunk->frameSize * chunk->maxFrames / chunk->elemSize;
+    size_t blockSize = slsDetBshufBlockSize(chunk->elemSize);
+    size_t blockBound = slsDetBshufLz4BlockBound(blockSize, chunk->elemSize);
+    size_t fullBlocks = elements / blockSize;
+    size_t numBlocks = fullBlocks + ((elements % blockSize) >= 8 ? 1 : 0);
+    size_t numGroups = chunk->_groupSize.size();
+    size_t leftover = (elements % 8) * chunk->elemSize;
+    size_t pos = SLS_BSHUF_HEADER_SIZE;
+
+    chunk->filtered = true;
+    for (size_t group=0; group<numGroups; group++) {
+      size_t first = group * numBlocks / numGroups;
+      if (!chunk->_groupSize[group] && (first < (group + 1) * numBlocks / numGroups)) {
+        chunk->filtered = false;
+        break;
+      }
+      /* The groups were written apart in case they did not compress */
+      std::memmove(chunk->buffer + pos, chunk->buffer + SLS_BSHUF_HEADER_SIZE + first * blockBound,
+                   chunk->_groupSize[group]);
+      pos += chunk->_groupSize[group];
+    }
+    if (chunk->filtered && leftover) {
+      const char *tail = chunkData(chunk, (elements - elements % 8) * chunk->elemSize, leftover,
+                                   chunk->buffer + pos);
+      if (tail != chunk->buffer + pos) std::memcpy(chunk->buffer + pos, tail, leftover);
+      pos += leftover;
+    }
+    if (chunk->filtered && (pos < chunk->frameSize * chunk->maxFrames)) {
+      slsDetBshufWriteHeader(chunk->buffer, elements * chunk->elemSize, blockSize, chunk->elemSize);
+      chunk->out = chunk->buffer;
+      chunk->outSize = pos;
+    } else {
+      /* Chunks that do not compress are stored as they are */
+      chunk->filtered = false;
+      if ((chunk->maxFrames == 1) && (chunk->frames.size() == 1)) {
+        chunk->out = chunk->frames[0]->data;
+        chunk->outSize = chunk->frameSize;
+      } else {
+        gather(chunk);
+      }
+    }
+  }
+
+  epicsTimeGetCurrent(&now);
+  chunk->elapsed = epicsTimeDiffInSeconds(&now, &chunk->_submitted);
+  chunk->done.signal();
+}
+
+void SlsDetCompressor::submit(SlsDetChunk *chunk)
+{
+  SlsCompressTask task;
+  unsigned numGroups = 1;
+
+  if (_codec == SlsCompressBitshuffleLz4) {
+    size_t elements = chunk->frameSize * chunk->maxFrames / chunk->elemSize;
+    size_t numBlocks = elements / slsDetBshufBlockSize(chunk->elemSize) + 1;
+    numGroups = numBlocks / MIN_BLOCKS_PER_GROUP;
+    if (numGroups > _threads.size()) numGroups = _threads.size();
+    if (numGroups < 1) numGroups = 1;
+  }
+  chunk->_groupSize.assign(numGroups, 0);
+  chunk->_remaining = numGroups;
+  epicsTimeGetCurrent(&chunk->_submitted);
+
+  if (_threads.empty()) {
+    std::vector<char> scratch;
+    compressGroup(chunk, 0, 0, scratch);
+  } else {
+    task.chunk = chunk;
+    for (unsigned group=0; group<numGroups; group++) {
+      task.group = group;
+      _queue.send(&task, sizeof(task));
+    }
+  }
+}
+
+void SlsDetCompressor::run()
+{
+  SlsCompressTask task;
+  std::vector<char> scratch;
+  int thread = epicsAtomicIncrIntT(&_started) - 1;
+
+  slsDetPinThread(_portName, SlsThreadProcess);
+
+  while (_queue.receive(&task, sizeof(task)) == sizeof(task)) {
+    if (!task.chunk) break;
+    compressGroup(task.chunk, task.group, thread, scratch);
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,128 @@
+#ifndef slsDetCompressor_H
+#define slsDetCompressor_H
+
+#include "slsDetFrame.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+#include <epicsTime.h>
+
+#include <vector>
+
+/* Codecs of the SlsDetCompressor */
+typedef enum {
+  SlsCompressNone,            /**< the frames are only gathered into the chunk */
+  SlsCompressDeflate,         /**< zlib stream, as the HDF5 deflate filter stores it */
+  SlsCompressBitshuffleLz4    /**< bitshuffle and LZ4, as the HDF5 bitshuffle filter stores it */
+} SlsCompressCodec;
+
+/** Counters of one thread of the SlsDetCompressor */
+typedef struct {
+  epicsUInt64 bytesIn;      /**< bytes handed to the codec */
+  epicsUInt64 bytesOut;     /**< bytes the codec turned them into */
+  epicsUInt64 tasks;        /**< chunks or groups of blocks compressed */
+  double      busy;         /**< time spent compressing in seconds */
+} SlsDetCompressorStats;
+
+/** Class definition for the SlsDetChunk class
+  *
+  * A chunk of up to maxFrames frames of the same size and the buffer it is
+  * compressed into. The chunk holds a reference to each frame it was given
+  * until clear() is called. A chunk that is not full is compressed as if
+  * the missing frames were zeros. The buffer is sized with
+  * SlsDetCompressor::bound() for the codec in use.
+  */
+class SlsDetChunk {
+public:
+  SlsDetChunk(size_t frameSize, size_t elemSize, unsigned maxFrames, size_t bufferSize);
+  ~SlsDetChunk();
+
+  /* Takes over a reference to the frame */
+  void add(SlsDetFrame *frame);
+  /* Releases the frames */
+  void clear();
+  bool full() const;
+
+  const size_t  frameSize;    /**< size of the pixels of one frame in bytes */
+  const size_t  elemSize;     /**< size of a pixel in bytes */
+  const unsigned maxFrames;   /**< frames in a full chunk */
+  std::vector<SlsDetFrame*> frames;
+  char          *buffer;      /**< room for the compressed chunk */
+  size_t        bufferSize;   /**< size of buffer in bytes */
+  const void    *out;         /**< the chunk as it goes into the file */
+  size_t        outSize;      /**< size of out in bytes */
+  bool          filtered;     /**< out went through the codec, otherwise it is the plain chunk */
+  double        elapsed;      /**< time from submitting the chunk until out was ready in seconds */
+  epicsEvent    done;         /**< signalled once out is ready */
+
+private:
+  friend class SlsDetCompressor;
+  std::vector<size_t> _groupSize;   /* compressed size of each group of blocks, 0 if it failed */
+  int             _remaining;       /* groups still being compressed */
+  epicsTimeStamp  _submitted;
+};
+
+/** Class definition for the SlsDetCompressor class
+  *
+  * Compresses chunks of frames on a pool of worker threads so consecutive
+  * chunks are compressed in parallel while the caller writes out the ones
+  * that are done in order. Bitshuffle/LZ4 works on independent blocks of
+  * about 8 kB, so its chunks are also split into groups of blocks that the
+  * workers compress at the same time; the last worker to finish packs the
+  * groups together. A chunk of a single frame that needs no compression is
+  * passed through without a copy.
+  */
+class SlsDetCompressor : public epicsThreadRunable {
+public:
+  /* portName is the port whose thread placement the workers follow */
+  SlsDetCompressor(int numThreads, SlsCompressCodec codec, int level, const char *portName=NULL);
+  virtual ~SlsDetCompressor();
+  virtual void run();
+
+  /* Compresses the chunk on the workers, or on the caller without workers, then signals done */
+  virtual void submit(SlsDetChunk *chunk);
+
+  int numThreads() const;
+  SlsCompressCodec codec() const;
+  int level() const;
+  /* Counters of a worker, or of the caller without workers */
+  void getStats(int thread, SlsDetCompressorStats *stats);
+  void resetStats();
+
+  /* Size of the buffer a chunk of the given size may need */
+  static size_t bound(SlsCompressCodec codec, size_t size, size_t elemSize);
+  static const char* codecName(SlsCompressCodec codec);
+
+protected:
+  typedef struct {
+    SlsDetChunk *chunk;
+    unsigned    group;
+  } SlsCompressTask;
+
+  /* Compresses one group of the chunk, finishing the chunk if it was the last */
+  virtual void compressGroup(SlsDetChunk *chunk, unsigned group, int thread, std::vector<char> &scratch);
+  /* Copies the frames into the buffer of the chunk */
+  void gather(SlsDetChunk *chunk);
+  bool deflate(SlsDetChunk *chunk);
+  size_t bitshuffleLz4(SlsDetChunk *chunk, unsigned group, std::vector<char> &scratch);
+  void finish(SlsDetChunk *chunk);
+  /* Points at size bytes of the chunk from offset, copying them if they are not in one frame */
+  const char* chunkData(SlsDetChunk *chunk, size_t offset, size_t size, char *copy);
+
+private:
+  typedef std::vector<epicsThread*> SlsThreadList;
+
+private:
+  const SlsCompressCodec _codec;
+  const int           _level;
+  const char          *_portName;
+  int                 _started;
+  epicsMutex          _lock;
+  std::vector<SlsDetCompressorStats> _stats;
+  epicsMessageQueue   _queue;
+  SlsThreadList       _threads;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "slsDetConverter.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+#include "slsDetAffinity.h"
+
+#include <epicsAtomic.h>
+#include <epicsStdio.h>
+
+#include <new>
+#include <cstring>
+#include <math.h>
+
+#define THREAD_TMO 2.0
+/* Poll time while waiting for conversions to leave the standby calibration */
+#define DRAIN_POLL_TIME 0.0002
+/* Tasks the queue holds for each worker thread */
+#define TASKS_PER_THREAD 64
+
+typedef void (*convertFunc)(const SlsConvertArgs &args, size_t start);
+
+/* The tail of every kernel and the fallback when there are no vector units */
+void slsDetConvertGeneric(const SlsConvertArgs &a, size_t start)
+{
+  for (size_t i=start; i<a.n; i++) {
+    unsigned g = a.raw[i] >> SLS_GAIN_SHIFT;
+    if (g > 2) g = 2;
+    float e = ((float) (a.raw[i] & SLS_ADC_MASK) - a.ped[g][i]) * a.gain[g][i] * a.scale;
+    if (a.energy) {
+      a.energy[i] = e;
+    } else {
+      if (e < SLS_PHOTONS_MIN) e = SLS_PHOTONS_MIN;
+      if (e > SLS_PHOTONS_MAX) e = SLS_PHOTONS_MAX;
+      a.photons[i] = (epicsInt16) lrintf(e);
+    }
+  }
+}
+
+static convertFunc convertKernel = slsDetConvertGeneric;
+static const char *convertName = "generic";
+static epicsThreadOnceId convertOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectKernel(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    convertKernel = slsDetConvertAvx2;
+    convertName = slsDetCpuFeatureName(SlsCpuAvx2);
+    return;
+  }
+#endif
+#ifdef SLS_CPU_SSE41
+  if (slsDetCpuHas(SlsCpuSse41)) {
+    convertKernel = slsDetConvertSse41;
+    convertName = slsDetCpuFeatureName(SlsCpuSse41);
+  }
+#endif
+}
+
+SlsDetConverter::SlsDetConverter(size_t sizeX, size_t sizeY, int numThreads, const char *portName) :
+  _sizeX(sizeX),
+  _sizeY(sizeY),
+  _portName(portName),
+  _generation(0),
+  _queue((numThreads > 0 ? numThreads : 1) * TASKS_PER_THREAD, sizeof(SlsConvertTask))
+{
+  char name[32];
+
+  for (int cell=0; cell<SLS_MAX_CELLS; cell++) {
+    _cal[cell][0] = _cal[cell][1] = NULL;
+    _readers[cell][0] = _readers[cell][1] = 0;
+    _current[cell] = 0;
+    _loaded[cell] = 0;
+    _standbyGain[cell] = -1;
+  }
+  /* The standby slot, and the other cells, are only allocated once a calibration is swapped in */
+  _cal[0][0] = new SlsDetCalibration(sizeX, sizeY);
+  _loaded[0] = 1;
+
+  epicsThreadOnce(&convertOnce, selectKernel, NULL);
+
+  for (int n=0; n<numThreads; n++) {
+    epicsSnprintf(name, sizeof(name), "slsDetConv%d", n);
+    epicsThread *thread = new epicsThread(*this, name,
+                                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                                          epicsThreadPriorityHigh);
+    _threads.push_back(thread);
+    thread->start();
+  }
+}
+
+SlsDetConverter::~SlsDetConverter()
+{
+  SlsConvertTask task;
+  task.job = NULL;
+  task.begin = task.end = 0;
+
+  /* One empty task for each worker tells it to exit */
+  for (unsigned n=0; n<_threads.size(); n++) {
+    _queue.send(&task, sizeof(task));
+  }
+  for (unsigned n=0; n<_threads.size(); n++) {
+    _threads[n]->exitWait(THREAD_TMO);
+    delete _threads[n];
+  }
+  for (int cell=0; cell<SLS_MAX_CELLS; cell++) {
+    for (int slot=0; slot<2; slot++) {
+      if (_cal[cell][slot]) _cal[cell][slot]->release();
+    }
+  }
+}
+
+size_t SlsDetConverter::sizeX() const
+{
+  return _sizeX;
+}
+
+size_t SlsDetConverter::sizeY() const
+{
+  return _sizeY;
+}
+
+int SlsDetConverter::numThreads() const
+{
+  return _threads.size();
+}
+
+const char* SlsDetConverter::kernelName()
+{
+  epicsThreadOnce(&convertOnce, selectKernel, NULL);
+  return convertName;
+}
+
+int SlsDetConverter::generation() const
+{
+  return epicsAtomicGetIntT(&_generation);
+}
+
+bool SlsDetConverter::hasCalibration(int cell) const
+{
+  if (cell == 0) return true;
+  return (cell > 0) && (cell < SLS_MAX_CELLS) && epicsAtomicGetIntT(&_loaded[cell]);
+}
+
+int SlsDetConverter::enterSlot(int *cell)
+{
+  int slot;
+  int use;
+
+  /* Retry if the writer made the other slot current, or dropped the tables
+   * of the cell, before we were counted */
+  for (;;) {
+    use = hasCalibration(*cell) ? *cell : 0;
+    slot = epicsAtomicGetIntT(&_current[use]);
+    epicsAtomicIncrIntT(&_readers[use][slot]);
+    if ((epicsAtomicGetIntT(&_current[use]) == slot) && hasCalibration(use)) break;
+    epicsAtomicDecrIntT(&_readers[use][slot]);
+  }
+  *cell = use;
+
+  return slot;
+}
+
+void SlsDetConverter::leaveSlot(int cell, int slot)
+{
+  epicsAtomicDecrIntT(&_readers[cell][slot]);
+}
+
+void SlsDetConverter::drainSlot(int cell, int slot)
+{
+  /* Readers only enter the current slot, so the standby count can only drop */
+  while (epicsAtomicGetIntT(&_readers[cell][slot]) != 0) {
+    epicsThreadSleep(DRAIN_POLL_TIME);
+  }
+}
+
+void SlsDetConverter::publishSlot(int cell, int slot)
+{
+  /* The tables must be complete before any reader can see the slot */
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetIntT(&_current[cell], slot);
+  epicsAtomicSetIntT(&_loaded[cell], 1);
+}
+
+void SlsDetConverter::setCalibration(SlsDetCalibration *cal, int cell)
+{
+  SlsDetCalibration *old;
+  int standby;
+
+  if ((cell < 0) || (cell >= SLS_MAX_CELLS)) {
+    cal->release();
+    return;
+  }
+
+  _lock.lock();
+  standby = 1 - _current[cell];
+  drainSlot(cell, standby);
+  old = _cal[cell][standby];
+  _cal[cell][standby] = cal;
+  publishSlot(cell, standby);
+  /* The slot left behind holds the previous tables until the next swap */
+  _standbyGain[cell] = -1;
+  epicsAtomicIncrIntT(&_generation);
+  _lock.unlock();
+
+  /* Anyone still using the tables from two swaps ago holds their own reference */
+  if (old) old->release();
+}
+
+SlsDetCalibration* SlsDetConverter::getCalibration(int cell)
+{
+  SlsDetCalibration *cal;
+  int slot = enterSlot(&cell);
+
+  cal = _cal[cell][slot];
+  cal->reserve();
+  leaveSlot(cell, slot);
+
+  return cal;
+}
+
+void SlsDetConverter::clearCalibration(int cell)
+{
+  SlsDetCalibration *old[2];
+
+  if ((cell <= 0) || (cell >= SLS_MAX_CELLS)) return;
+
+  _lock.lock();
+  if (!_loaded[cell]) {
+    _lock.unlock();
+    return;
+  }
+  /* New conversions of the cell go to cell 0, the ones under way finish first */
+  epicsAtomicSetIntT(&_loaded[cell], 0);
+  for (int slot=0; slot<2; slot++) {
+    drainSlot(cell, slot);
+    old[slot] = _cal[cell][slot];
+    _cal[cell][slot] = NULL;
+  }
+  _current[cell] = 0;
+  _standbyGain[cell] = -1;
+  epicsAtomicIncrIntT(&_generation);
+  _lock.unlock();
+
+  for (int slot=0; slot<2; slot++) {
+    if (old[slot]) old[slot]->release();
+  }
+}
+
+bool SlsDetConverter::updatePedestal(int gain, const float *pedestal, int cell)
+{
+  SlsDetCalibration *next;
+  int standby;
+
+  if ((gain < 0) || (gain >= SLS_NUM_GAINS)) return false;
+  if ((cell < 0) || (cell >= SLS_MAX_CELLS)) return false;
+
+  _lock.lock();
+  standby = 1 - _current[cell];
+  drainSlot(cell, standby);
+  next = _cal[cell][standby];
+
+  /* Tables someone else holds a reference to are left alone */
+  if (next && (next->refCount() > 1)) {
+    next->release();
+    next = NULL;
+  }
+  if (!next) {
+    try {
+      next = new SlsDetCalibration(_sizeX, _sizeY);
+    } catch (...) {
+      _cal[cell][standby] = NULL;
+      _lock.unlock();
+      return false;
+    }
+    _standbyGain[cell] = -1;
+  }
+  _cal[cell][standby] = next;
+
+  /* After a pedestal update the standby only differs in that one map, a cell
+   * without tables of its own starts from those of cell 0 */
+  if (_standbyGain[cell] != gain) {
+    next->copy(_loaded[cell] ? _cal[cell][_current[cell]] : _cal[0][_current[0]]);
+  }
+  std::memcpy(next->pedestal(gain), pedestal, next->numPixels() * sizeof(float));
+  publishSlot(cell, standby);
+  _standbyGain[cell] = gain;
+  _lock.unlock();
+
+  return true;
+}
+
+void SlsDetConverter::convert(const epicsUInt16 *raw, void *out, SlsConvertOutput output, double photonEnergy,
+                              int cell)
+{
+  SlsConvertJob job;
+  SlsConvertTask task;
+  epicsEvent done;
+  size_t numBlocks = _threads.size() + 1;
+  size_t rowsPerBlock = (_sizeY + numBlocks - 1) / numBlocks;
+
+  job.raw = raw;
+  job.out = out;
+  job.output = output;
+  job.scale = ((output == SlsConvertPhotons) && (photonEnergy > 0.)) ? (float) (1. / photonEnergy) : 1.0f;
+  job.cell = cell;
+  job.slot = enterSlot(&job.cell);
+  job.cal = _cal[job.cell][job.slot];
+  job.remaining = 1;
+  job.done = &done;
+  task.job = &job;
+
+  /* Hand every block but the first to the workers, or do it here if they are swamped */
+  for (size_t block=1; block<numBlocks; block++) {
+    task.begin = block * rowsPerBlock;
+    task.end = task.begin + rowsPerBlock < _sizeY ? task.begin + rowsPerBlock : _sizeY;
+    if (task.begin >= task.end) break;
+    epicsAtomicIncrIntT(&job.remaining);
+    if (_queue.trySend(&task, sizeof(task))) {
+      convertBlock(&job, task.begin, task.end);
+    }
+  }
+  convertBlock(&job, 0, rowsPerBlock < _sizeY ? rowsPerBlock : _sizeY);
+
+  /* The last block to finish signals the event */
+  done.wait();
+  leaveSlot(job.cell, job.slot);
+}
+
+void SlsDetConverter::convertBlock(SlsConvertJob *job, size_t begin, size_t end)
+{
+  SlsConvertArgs args;
+  size_t offset = begin * _sizeX;
+
+  args.raw = job->raw + offset;
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    args.ped[g] = job->cal->pedestal(g) + offset;
+    args.gain[g] = job->cal->gainInv(g) + offset;
+  }
+  args.scale = job->scale;
+  args.energy = job->output == SlsConvertEnergy ? (float *) job->out + offset : NULL;
+  args.photons = job->output == SlsConvertPhotons ? (epicsInt16 *) job->out + offset : NULL;
+  args.n = (end - begin) * _sizeX;
+
+  convertKernel(args, 0);
+
+  if (epicsAtomicDecrIntT(&job->remaining) == 0) {
+    job->done->signal();
+  }
+}
+
+void SlsDetConverter::run()
+{
+  SlsConvertTask task;
+
+  slsDetPinThread(_portName, SlsThreadProcess);
+
+  while (_queue.receive(&task, sizeof(task)) == sizeof(task)) {
+    if (!task.job) break;
+    convertBlock(task.job, task.begin, task.end);
+  }
+
+  slsDetUnpinThread();
+}
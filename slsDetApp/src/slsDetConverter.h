@@ -0,0 +1,114 @@
+#ifndef slsDetConverter_H
+#define slsDetConverter_H
+
+#include "slsDetCalibration.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+
+#include <vector>
+
+/* Output formats of the SlsDetConverter */
+typedef enum {
+  SlsConvertEnergy,   /**< float32 energy in keV */
+  SlsConvertPhotons   /**< int16 energy rounded to a number of photons */
+} SlsConvertOutput;
+
+/** Class definition for the SlsDetConverter class
+  *
+  * Converts raw Jungfrau frames, 2 gain bits and 14 ADC bits per pixel, to
+  * (adc - pedestal[g]) / gain[g] using the widest vector kernel the host
+  * supports. Each frame is split into blocks of rows that are converted in
+  * parallel by a pool of worker threads and the calling thread. Several
+  * frames can be converted at once from different threads.
+  *
+  * The calibration is double buffered: conversions read whichever of the
+  * two slots is current, counted per slot with atomics, while new tables are
+  * written to the other slot and made current with a single atomic store.
+  * Converting a frame never takes a lock, only the writers are serialized.
+  *
+  * In burst mode each storage cell has its own pair of slots. Only cell 0
+  * has tables from the start, a frame of a cell that was never given any
+  * is converted with those of cell 0.
+  */
+class SlsDetConverter : public epicsThreadRunable {
+public:
+  /* portName is the port whose thread placement the workers follow */
+  SlsDetConverter(size_t sizeX, size_t sizeY, int numThreads, const char *portName=NULL);
+  virtual ~SlsDetConverter();
+  virtual void run();
+
+  /* Converts a whole frame of a storage cell, returning when every block is done */
+  virtual void convert(const epicsUInt16 *raw, void *out, SlsConvertOutput output, double photonEnergy,
+                       int cell=0);
+
+  /* The converter takes over the reference of the caller */
+  virtual void setCalibration(SlsDetCalibration *cal, int cell=0);
+  /* Returns the calibration in use for the cell with a reference for the caller */
+  virtual SlsDetCalibration* getCalibration(int cell=0);
+  /* Swaps in the current calibration with the pedestal map of one gain replaced */
+  virtual bool updatePedestal(int gain, const float *pedestal, int cell=0);
+  /* Drops the tables of a cell other than 0, which goes back to those of cell 0 */
+  virtual void clearCalibration(int cell);
+  /* True if the cell has tables of its own */
+  bool hasCalibration(int cell) const;
+  /* Counts the calls to setCalibration, so users of the maps can tell they changed */
+  int generation() const;
+
+  size_t sizeX() const;
+  size_t sizeY() const;
+  int numThreads() const;
+
+  /* Name of the conversion kernel in use */
+  static const char* kernelName();
+
+protected:
+  typedef struct {
+    const epicsUInt16         *raw;
+    void                      *out;
+    SlsConvertOutput          output;
+    float                     scale;
+    const SlsDetCalibration   *cal;
+    int                       cell;
+    int                       slot;
+    int                       remaining;
+    epicsEvent                *done;
+  } SlsConvertJob;
+
+  typedef struct {
+    SlsConvertJob *job;
+    size_t        begin;
+    size_t        end;
+  } SlsConvertTask;
+
+  virtual void convertBlock(SlsConvertJob *job, size_t begin, size_t end);
+
+  /* Enters the current calibration slot of the tables a frame of the cell is
+   * converted with, setting cell to whose they are, and leaves it, without locking */
+  int enterSlot(int *cell);
+  void leaveSlot(int cell, int slot);
+  /* Must be called with the lock held */
+  void drainSlot(int cell, int slot);
+  void publishSlot(int cell, int slot);
+
+private:
+  typedef std::vector<epicsThread*> SlsThreadList;
+
+private:
+  const size_t        _sizeX;
+  const size_t        _sizeY;
+  const char          *_portName;
+  SlsDetCalibration   *_cal[SLS_MAX_CELLS][2];
+  int                 _readers[SLS_MAX_CELLS][2];
+  int                 _current[SLS_MAX_CELLS];
+  int                 _loaded[SLS_MAX_CELLS];
+  int                 _generation;
+  int                 _standbyGain[SLS_MAX_CELLS];
+  epicsMutex          _lock;
+  epicsMessageQueue   _queue;
+  SlsThreadList       _threads;
+};
+
+#endif
@@ -0,0 +1,43 @@
+/* AVX2 kernels of slsDetConverter, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+
+void slsDetConvertAvx2(const SlsConvertArgs &a, size_t start)
+{
+  const __m256i adcMask = _mm256_set1_epi32(SLS_ADC_MASK);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256 scale = _mm256_set1_ps(a.scale);
+  const __m256 lo = _mm256_set1_ps(SLS_PHOTONS_MIN);
+  const __m256 hi = _mm256_set1_ps(SLS_PHOTONS_MAX);
+  size_t i = start;
+
+  for (; i + 8 <= a.n; i += 8) {
+    __m256i raw = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (a.raw + i)));
+    __m256i g = _mm256_srli_epi32(raw, SLS_GAIN_SHIFT);
+    __m256 adc = _mm256_cvtepi32_ps(_mm256_and_si256(raw, adcMask));
+    __m256 ped = _mm256_loadu_ps(a.ped[0] + i);
+    __m256 gain = _mm256_loadu_ps(a.gain[0] + i);
+    /* Most pixels sit in gain 0, only touch the other maps when needed */
+    if (!_mm256_testz_si256(g, g)) {
+      __m256 isG1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(g, one));
+      __m256 isG2 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(g, one));
+      ped = _mm256_blendv_ps(ped, _mm256_loadu_ps(a.ped[1] + i), isG1);
+      ped = _mm256_blendv_ps(ped, _mm256_loadu_ps(a.ped[2] + i), isG2);
+      gain = _mm256_blendv_ps(gain, _mm256_loadu_ps(a.gain[1] + i), isG1);
+      gain = _mm256_blendv_ps(gain, _mm256_loadu_ps(a.gain[2] + i), isG2);
+    }
+    __m256 e = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(adc, ped), gain), scale);
+    if (a.energy) {
+      _mm256_storeu_ps(a.energy + i, e);
+    } else {
+      __m256i p = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(e, lo), hi));
+      _mm_storeu_si128((__m128i *) (a.photons + i),
+                       _mm_packs_epi32(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1)));
+    }
+  }
+  slsDetConvertGeneric(a, i);
+}
+#endif
@@ -0,0 +1,42 @@
+/* SSE4.1 kernels of slsDetConverter, built with -msse4.1 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_SSE41
+#include <smmintrin.h>
+
+void slsDetConvertSse41(const SlsConvertArgs &a, size_t start)
+{
+  const __m128i adcMask = _mm_set1_epi32(SLS_ADC_MASK);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128 scale = _mm_set1_ps(a.scale);
+  const __m128 lo = _mm_set1_ps(SLS_PHOTONS_MIN);
+  const __m128 hi = _mm_set1_ps(SLS_PHOTONS_MAX);
+  size_t i = start;
+
+  for (; i + 4 <= a.n; i += 4) {
+    __m128i raw = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *) (a.raw + i)));
+    __m128i g = _mm_srli_epi32(raw, SLS_GAIN_SHIFT);
+    __m128 adc = _mm_cvtepi32_ps(_mm_and_si128(raw, adcMask));
+    __m128 ped = _mm_loadu_ps(a.ped[0] + i);
+    __m128 gain = _mm_loadu_ps(a.gain[0] + i);
+    /* Most pixels sit in gain 0, only touch the other maps when needed */
+    if (!_mm_testz_si128(g, g)) {
+      __m128 isG1 = _mm_castsi128_ps(_mm_cmpeq_epi32(g, one));
+      __m128 isG2 = _mm_castsi128_ps(_mm_cmpgt_epi32(g, one));
+      ped = _mm_blendv_ps(ped, _mm_loadu_ps(a.ped[1] + i), isG1);
+      ped = _mm_blendv_ps(ped, _mm_loadu_ps(a.ped[2] + i), isG2);
+      gain = _mm_blendv_ps(gain, _mm_loadu_ps(a.gain[1] + i), isG1);
+      gain = _mm_blendv_ps(gain, _mm_loadu_ps(a.gain[2] + i), isG2);
+    }
+    __m128 e = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(adc, ped), gain), scale);
+    if (a.energy) {
+      _mm_storeu_ps(a.energy + i, e);
+    } else {
+      __m128i p = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(e, lo), hi));
+      _mm_storel_epi64((__m128i *) (a.photons + i), _mm_packs_epi32(p, p));
+    }
+  }
+  slsDetConvertGeneric(a, i);
+}
+#endif
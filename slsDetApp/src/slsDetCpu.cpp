@@ -0,0 +1,78 @@
+#include "slsDetCpu.h"
+
+#include <epicsThread.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+
+/* CPUID leaf 1 ecx and leaf 7 ebx bits, not all named by the cpuid.h of gcc 4.4 */
+#define CPUID_SSE41   (1 << 19)
+#define CPUID_POPCNT  (1 << 23)
+#define CPUID_OSXSAVE (1 << 27)
+#define CPUID_AVX     (1 << 28)
+#define CPUID_AVX2    (1 << 5)
+/* XCR0 bits of the SSE and AVX register state */
+#define XCR0_SSE_AVX  0x6
+#endif
+
+static int cpuFeatures = SlsCpuGeneric;
+static epicsThreadOnceId cpuOnce = EPICS_THREAD_ONCE_INIT;
+
+static const struct {
+  SlsCpuFeature feature;
+  const char    *name;
+} cpuFeatureNames[] = {
+  {SlsCpuPopcnt, "popcnt"},
+  {SlsCpuSse41,  "sse4.1"},
+  {SlsCpuAvx2,   "avx2"},
+};
+
+static void detectCpu(void *arg)
+{
+  int features = SlsCpuGeneric;
+#if defined(__x86_64__) && defined(__GNUC__)
+  unsigned eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    if (ecx & CPUID_POPCNT) features |= SlsCpuPopcnt;
+    if (ecx & CPUID_SSE41)  features |= SlsCpuSse41;
+    /* The AVX registers can only be used if the operating system saves them */
+    if ((ecx & CPUID_OSXSAVE) && (ecx & CPUID_AVX) && (__get_cpuid_max(0, NULL) >= 7)) {
+      unsigned xcr0;
+      __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      if (((xcr0 & XCR0_SSE_AVX) == XCR0_SSE_AVX) && (ebx & CPUID_AVX2)) features |= SlsCpuAvx2;
+    }
+  }
+#endif
+  const char *disable = getenv("SLS_CPU_DISABLE");
+  if (disable) {
+    for (unsigned n=0; n<sizeof(cpuFeatureNames)/sizeof(cpuFeatureNames[0]); n++) {
+      if (strstr(disable, cpuFeatureNames[n].name) || strstr(disable, "all")) {
+        features &= ~cpuFeatureNames[n].feature;
+      }
+    }
+  }
+  cpuFeatures = features;
+}
+
+int slsDetCpuFeatures()
+{
+  epicsThreadOnce(&cpuOnce, detectCpu, NULL);
+  return cpuFeatures;
+}
+
+bool slsDetCpuHas(SlsCpuFeature feature)
+{
+  return (slsDetCpuFeatures() & feature) == feature;
+}
+
+const char* slsDetCpuFeatureName(SlsCpuFeature feature)
+{
+  for (unsigned n=0; n<sizeof(cpuFeatureNames)/sizeof(cpuFeatureNames[0]); n++) {
+    if (cpuFeatureNames[n].feature == feature) return cpuFeatureNames[n].name;
+  }
+  return "generic";
+}
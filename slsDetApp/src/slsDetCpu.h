@@ -0,0 +1,29 @@
+#ifndef slsDetCpu_H
+#define slsDetCpu_H
+
+/*
+ * The vectorized kernels live in sources of their own, e.g.
+ * slsDetPacketLossAvx2.cpp, which the Makefile builds on x86_64 with the -m
+ * flag of their instruction set only. The rest of the library stays generic
+ * x86-64 and the best kernel the host has is picked at run time. The
+ * Makefile defines SLS_CPU_POPCNT, SLS_CPU_SSE41 and SLS_CPU_AVX2 for the
+ * kernels it builds; gcc before 4.7, like the gcc 4.4 of rhel6, has no
+ * -mavx2 and only gets the POPCNT and SSE4.1 kernels. Other architectures
+ * only get the portable kernels.
+ */
+
+/* Instruction set extensions the kernels can use */
+typedef enum {
+  SlsCpuGeneric = 0,
+  SlsCpuPopcnt  = 1 << 0,
+  SlsCpuSse41   = 1 << 1,
+  SlsCpuAvx2    = 1 << 2
+} SlsCpuFeature;
+
+/* Returns the mask of SlsCpuFeature supported by the host and not disabled
+ * with the SLS_CPU_DISABLE environment variable (e.g. "avx2,sse4.1") */
+extern int slsDetCpuFeatures();
+extern bool slsDetCpuHas(SlsCpuFeature feature);
+extern const char* slsDetCpuFeatureName(SlsCpuFeature feature);
+
+#endif
@@ -0,0 +1,231 @@
+#include "slsDetDrift.h"
+#include "slsDetConverter.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+
+/* Alignment of the maps, a cache line so the vector loads never split one */
+#define MAP_ALIGN 64
+/* Values further than this many sigma from the pedestal are taken as hits */
+#define REJECT_SIGMA 5.0f
+#define DEFAULT_ALPHA 0.01f
+
+typedef void (*emaFunc)(const epicsUInt16 *raw, float *ped, const float *threshold,
+                        float alpha, size_t start, size_t n);
+
+/* The tail of every kernel and the fallback when there are no vector units */
+void slsDetEmaGeneric(const epicsUInt16 *raw, float *ped, const float *threshold,
+                      float alpha, size_t start, size_t n)
+{
+  for (size_t i=start; i<n; i++) {
+    if (raw[i] >> SLS_GAIN_SHIFT) continue;
+    float delta = (float) (raw[i] & SLS_ADC_MASK) - ped[i];
+    /* Pixels without a noise value have nothing to reject hits with */
+    if ((threshold[i] == 0.0f) || (fabsf(delta) <= threshold[i])) {
+      ped[i] = ped[i] + alpha * delta;
+    }
+  }
+}
+
+static emaFunc emaKernel = slsDetEmaGeneric;
+static const char *emaName = "generic";
+static epicsThreadOnceId emaOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectKernel(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    emaKernel = slsDetEmaAvx2;
+    emaName = slsDetCpuFeatureName(SlsCpuAvx2);
+  }
+#endif
+}
+
+SlsDetDriftTracker::SlsDetDriftTracker(SlsDetConverter *converter) :
+  _converter(converter),
+  _numPixels(converter->sizeX() * converter->sizeY()),
+  _pedestal(NULL),
+  _reference(NULL),
+  _threshold(NULL),
+  _generation(0),
+  _cell(0),
+  _loadedCell(0),
+  _loaded(false),
+  _alpha(DEFAULT_ALPHA),
+  _darkFrames(0),
+  _skipped(0)
+{
+  void *ped = NULL;
+  void *ref = NULL;
+  void *thr = NULL;
+
+  epicsThreadOnce(&emaOnce, selectKernel, NULL);
+
+  if (posix_memalign(&ped, MAP_ALIGN, _numPixels * sizeof(float)) ||
+      posix_memalign(&ref, MAP_ALIGN, _numPixels * sizeof(float)) ||
+      posix_memalign(&thr, MAP_ALIGN, _numPixels * sizeof(float))) {
+    std::free(ped);
+    std::free(ref);
+    throw std::bad_alloc();
+  }
+  _pedestal = (float *) ped;
+  _reference = (float *) ref;
+  _threshold = (float *) thr;
+
+  _select.mode = SlsDarkFrameNumber;
+  _select.modulus = 0;
+  _select.offset = 0;
+  _select.mask = 0;
+  _select.value = 0;
+}
+
+SlsDetDriftTracker::~SlsDetDriftTracker()
+{
+  std::free(_pedestal);
+  std::free(_reference);
+  std::free(_threshold);
+}
+
+const char* SlsDetDriftTracker::kernelName()
+{
+  epicsThreadOnce(&emaOnce, selectKernel, NULL);
+  return emaName;
+}
+
+void SlsDetDriftTracker::setSelect(const SlsDetDarkSelect &select)
+{
+  _selectLock.lock();
+  _select = select;
+  _selectLock.unlock();
+}
+
+bool SlsDetDriftTracker::isDark(epicsUInt64 frameNumber, epicsUInt64 bunchId, int cell)
+{
+  bool dark;
+
+  _selectLock.lock();
+  if (cell != _cell) {
+    dark = false;
+  } else if (_select.mode == SlsDarkBunchId) {
+    /* A zero mask would take every frame as dark */
+    dark = _select.mask && ((bunchId & _select.mask) == _select.value);
+  } else {
+    dark = _select.modulus && ((frameNumber % _select.modulus) == _select.offset);
+  }
+  _selectLock.unlock();
+
+  return dark;
+}
+
+void SlsDetDriftTracker::setAlpha(double alpha)
+{
+  if (alpha <= 0. || alpha > 1.) return;
+
+  _selectLock.lock();
+  _alpha = (float) alpha;
+  _selectLock.unlock();
+}
+
+void SlsDetDriftTracker::setCell(int cell)
+{
+  if ((cell < 0) || (cell >= SLS_MAX_CELLS)) return;
+
+  _selectLock.lock();
+  _cell = cell;
+  _selectLock.unlock();
+}
+
+int SlsDetDriftTracker::cell()
+{
+  int cell;
+  _selectLock.lock();
+  cell = _cell;
+  _selectLock.unlock();
+  return cell;
+}
+
+void SlsDetDriftTracker::load(int cell)
+{
+  /* Must be called with the lock held */
+  int generation = _converter->generation();
+  SlsDetCalibration *cal = _converter->getCalibration(cell);
+
+  std::memcpy(_pedestal, cal->pedestal(0), _numPixels * sizeof(float));
+  std::memcpy(_reference, cal->pedestal(0), _numPixels * sizeof(float));
+  for (size_t pix=0; pix<_numPixels; pix++) {
+    _threshold[pix] = REJECT_SIGMA * cal->noise(0)[pix];
+  }
+  cal->release();
+
+  /* Taking the generation first means a swap in between only loads twice */
+  _generation = generation;
+  _loadedCell = cell;
+  _darkFrames = 0;
+  _loaded = true;
+}
+
+bool SlsDetDriftTracker::track(const epicsUInt16 *raw)
+{
+  float alpha;
+  int cell;
+
+  if (!_lock.tryLock()) {
+    epicsAtomicIncrSizeT(&_skipped);
+    return false;
+  }
+
+  _selectLock.lock();
+  alpha = _alpha;
+  cell = _cell;
+  _selectLock.unlock();
+
+  if (!_loaded || (_loadedCell != cell) || (_generation != _converter->generation())) {
+    load(cell);
+  }
+
+  emaKernel(raw, _pedestal, _threshold, alpha, 0, _numPixels);
+  _converter->updatePedestal(0, _pedestal, cell);
+  _darkFrames++;
+  _lock.unlock();
+
+  return true;
+}
+
+void SlsDetDriftTracker::reset()
+{
+  _lock.lock();
+  if (_loaded && (_generation == _converter->generation())) {
+    std::memcpy(_pedestal, _reference, _numPixels * sizeof(float));
+    _converter->updatePedestal(0, _pedestal, _loadedCell);
+  }
+  _darkFrames = 0;
+  epicsAtomicSetSizeT(&_skipped, 0);
+  _lock.unlock();
+}
+
+void SlsDetDriftTracker::getStats(SlsDetDriftStats *stats)
+{
+  double sum = 0.;
+  double maxShift = 0.;
+
+  _lock.lock();
+  if (_loaded) {
+    for (size_t pix=0; pix<_numPixels; pix++) {
+      double shift = _pedestal[pix] - _reference[pix];
+      sum += shift;
+      if (fabs(shift) > maxShift) maxShift = fabs(shift);
+    }
+  }
+  stats->darkFrames = _darkFrames;
+  stats->skipped = epicsAtomicGetSizeT(&_skipped);
+  stats->meanShift = _numPixels ? sum / _numPixels : 0.;
+  stats->maxShift = maxShift;
+  _lock.unlock();
+}
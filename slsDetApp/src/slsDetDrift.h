@@ -0,0 +1,87 @@
+#ifndef slsDetDrift_H
+#define slsDetDrift_H
+
+#include "slsDetCalibration.h"
+
+#include <epicsMutex.h>
+
+class SlsDetConverter;
+
+/* How the dark frames are picked out of the stream */
+typedef enum {
+  SlsDarkFrameNumber, /**< frameNumber % modulus == offset */
+  SlsDarkBunchId      /**< (bunchId & mask) == value */
+} SlsDarkMode;
+
+typedef struct {
+  SlsDarkMode mode;
+  epicsUInt64 modulus;
+  epicsUInt64 offset;
+  epicsUInt64 mask;
+  epicsUInt64 value;
+} SlsDetDarkSelect;
+
+/** Counters kept by the SlsDetDriftTracker */
+typedef struct {
+  epicsUInt64 darkFrames;   /**< dark frames used to update the pedestals */
+  epicsUInt64 skipped;      /**< dark frames skipped while another was being used */
+  double      meanShift;    /**< mean gain 0 pedestal change since the calibration was set, ADU */
+  double      maxShift;     /**< largest absolute change of a single pixel, ADU */
+} SlsDetDriftStats;
+
+/** Class definition for the SlsDetDriftTracker class
+  *
+  * Follows the drift of the gain 0 pedestals during a run. Each dark frame
+  * moves the pedestal of every pixel that is in gain 0 towards its ADC value
+  * with an exponential moving average, skipping values further than a few
+  * sigma of the noise map from the pedestal so stray hits are not averaged
+  * in. The running map is then swapped into the converter, which keeps the
+  * conversions lock free. When a new calibration is set on the converter
+  * the tracker starts again from its pedestals.
+  *
+  * In burst mode the tracker follows the storage cell it is set to, the dark
+  * frames of the other cells are left alone.
+  */
+class SlsDetDriftTracker {
+public:
+  SlsDetDriftTracker(SlsDetConverter *converter);
+  virtual ~SlsDetDriftTracker();
+
+  virtual void setSelect(const SlsDetDarkSelect &select);
+  virtual bool isDark(epicsUInt64 frameNumber, epicsUInt64 bunchId, int cell=0);
+  virtual void setAlpha(double alpha);
+  /* Moves on to the pedestals of another storage cell */
+  virtual void setCell(int cell);
+  int cell();
+
+  /* Updates the pedestals with a dark frame, false if it was skipped */
+  virtual bool track(const epicsUInt16 *raw);
+  /* Puts back the pedestals of the calibration that was set */
+  virtual void reset();
+  virtual void getStats(SlsDetDriftStats *stats);
+
+  /* Name of the moving average kernel in use */
+  static const char* kernelName();
+
+private:
+  void load(int cell);
+
+private:
+  SlsDetConverter   *_converter;
+  const size_t      _numPixels;
+  float             *_pedestal;
+  float             *_reference;
+  float             *_threshold;
+  int               _generation;
+  int               _cell;
+  int               _loadedCell;
+  bool              _loaded;
+  float             _alpha;
+  epicsUInt64       _darkFrames;
+  size_t            _skipped;
+  SlsDetDarkSelect  _select;
+  epicsMutex        _selectLock;
+  epicsMutex        _lock;
+};
+
+#endif
@@ -0,0 +1,33 @@
+/* AVX2 kernels of slsDetDrift, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+
+void slsDetEmaAvx2(const epicsUInt16 *raw, float *ped, const float *threshold,
+                   float alpha, size_t start, size_t n)
+{
+  const __m256i gainMask = _mm256_set1_epi32(~SLS_ADC_MASK & 0xffff);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 a = _mm256_set1_ps(alpha);
+  size_t i = start;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i r = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (raw + i)));
+    __m256 use = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(r, gainMask), zero));
+    if (_mm256_testz_ps(use, use)) continue;
+    __m256 p = _mm256_loadu_ps(ped + i);
+    __m256 t = _mm256_loadu_ps(threshold + i);
+    __m256 delta = _mm256_sub_ps(_mm256_cvtepi32_ps(r), p);
+    __m256 inside = _mm256_or_ps(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_EQ_OQ),
+                                 _mm256_cmp_ps(_mm256_and_ps(delta, absMask), t, _CMP_LE_OQ));
+    use = _mm256_and_ps(use, inside);
+    /* The pixels left out have nothing added */
+    p = _mm256_add_ps(p, _mm256_and_ps(use, _mm256_mul_ps(a, delta)));
+    _mm256_storeu_ps(ped + i, p);
+  }
+  slsDetEmaGeneric(raw, ped, threshold, alpha, i, n);
+}
+#endif
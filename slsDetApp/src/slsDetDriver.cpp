@@ -1,4 +1,5 @@
 #include "slsDetDriver.h"
+#include "slsDetAffinity.h"
 
 #include <epicsString.h>
 #include <multiSlsDetector.h>
@@ -412,6 +413,94 @@ SlsDetMessage SlsDetDriver::gainSettings(int value)
   return rep;
 }
 
+SlsDetMessage SlsDetDriver::storageCells(int value)
+{
+  int crit;
+  int ret;
+  int64_t errors;
+  SlsDetMessage rep(SlsDetMessage::Error);
+  static const char *functionName = "storageCells";
+
+  if (_det) {
+    asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s, port=%s, address=%d calling setTimer(STORAGE_CELL_NUMBER)(%d)\n",
+              driverName, functionName, _portName, _addr, value);
+    ret = (int) _det->setTimer(slsDetectorDefs::STORAGE_CELL_NUMBER, value);
+    errors = _det->getErrorMask();
+    if (!errors) {
+      if (value < 0) { // this is a read
+        asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+                 "%s:%s, port=%s, address=%d setTimer(STORAGE_CELL_NUMBER) read returned: %d\n",
+                 driverName, functionName, _portName, _addr, ret);
+        rep = SlsDetMessage(SlsDetMessage::Ok, SlsDetMessage::Int32);
+        rep.setInteger(ret);
+      } else { // this is a write
+        asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+                 "%s:%s, port=%s, address=%d setTimer(STORAGE_CELL_NUMBER) write returned: %d\n",
+                 driverName, functionName, _portName, _addr, ret);
+        if (ret == value) {
+          rep = SlsDetMessage(SlsDetMessage::Ok);
+        } else {
+          rep = SlsDetMessage(SlsDetMessage::Failed);
+        }
+      }
+    } else if (errors == (1<<_pos)) {
+      _det->clearAllErrorMask(); // clear the error mask
+      rep = SlsDetMessage(SlsDetMessage::Failed);
+    } else {
+      asynPrint(_pasynUser, ASYN_TRACE_ERROR,
+                 "%s:%s: port=%s address=%d error calling setTimer(STORAGE_CELL_NUMBER): %s\n",
+                 driverName, functionName, _portName, _addr, _det->getErrorMessage(crit).c_str());
+    }
+  }
+
+  return rep;
+}
+
+SlsDetMessage SlsDetDriver::storageCellStart(int value)
+{
+  int crit;
+  int ret;
+  int64_t errors;
+  SlsDetMessage rep(SlsDetMessage::Error);
+  static const char *functionName = "storageCellStart";
+
+  if (_det) {
+    asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s, port=%s, address=%d calling setStoragecellStart(%d)\n",
+              driverName, functionName, _portName, _addr, value);
+    ret = _det->setStoragecellStart(value);
+    errors = _det->getErrorMask();
+    if (!errors) {
+      if (value < 0) { // this is a read
+        asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+                 "%s:%s, port=%s, address=%d setStoragecellStart read returned: %d\n",
+                 driverName, functionName, _portName, _addr, ret);
+        rep = SlsDetMessage(SlsDetMessage::Ok, SlsDetMessage::Int32);
+        rep.setInteger(ret);
+      } else { // this is a write
+        asynPrint(_pasynUser, ASYN_TRACEIO_DRIVER,
+                 "%s:%s, port=%s, address=%d setStoragecellStart write returned: %d\n",
+                 driverName, functionName, _portName, _addr, ret);
+        if (ret == value) {
+          rep = SlsDetMessage(SlsDetMessage::Ok);
+        } else {
+          rep = SlsDetMessage(SlsDetMessage::Failed);
+        }
+      }
+    } else if (errors == (1<<_pos)) {
+      _det->clearAllErrorMask(); // clear the error mask
+      rep = SlsDetMessage(SlsDetMessage::Failed);
+    } else {
+      asynPrint(_pasynUser, ASYN_TRACE_ERROR,
+                 "%s:%s: port=%s address=%d error calling setStoragecellStart: %s\n",
+                 driverName, functionName, _portName, _addr, _det->getErrorMessage(crit).c_str());
+    }
+  }
+
+  return rep;
+}
+
 SlsDetMessage SlsDetDriver::thresholdTemperature(double value)
 {
   int crit;
@@ -705,6 +794,12 @@ SlsDetMessage SlsDetDriver::process(SlsDetMessage req)
     case SlsDetMessage::ReadGainMode:
       rep = gainSettings();
       break;
+    case SlsDetMessage::ReadStorageCells:
+      rep = storageCells();
+      break;
+    case SlsDetMessage::ReadStorageCellStart:
+      rep = storageCellStart();
+      break;
     default:
       asynPrint(_pasynUser, ASYN_TRACE_WARNING,
                 "%s:%s: port=%s address=%d unsupported read request type: %s\n",
@@ -733,6 +828,12 @@ SlsDetMessage SlsDetDriver::process(SlsDetMessage req)
     case SlsDetMessage::WriteGainMode:
       rep = gainSettings(req.asInteger());
       break;
+    case SlsDetMessage::WriteStorageCells:
+      rep = storageCells(req.asInteger());
+      break;
+    case SlsDetMessage::WriteStorageCellStart:
+      rep = storageCellStart(req.asInteger());
+      break;
     default:
       asynPrint(_pasynUser, ASYN_TRACE_WARNING,
                 "%s:%s: port=%s address=%d unsupported write request type: %s\n",
@@ -773,6 +874,12 @@ void SlsDetDriver::run()
             "%s:%s: port=%s address=%d start\n",
             driverName, functionName, _portName, _addr);
 
+  if (!slsDetPinThread(_portName, SlsThreadControl)) {
+    asynPrint(_pasynUser, ASYN_TRACE_ERROR,
+              "%s:%s: port=%s address=%d unable to pin to the control cores\n",
+              driverName, functionName, _portName, _addr);
+  }
+
   /* Flush any pending messages from the request queue */
   asynPrint(_pasynUser, ASYN_TRACE_FLOW,
             "*%s:%s: port=%s address=%d flushing %d pending requests\n",
@@ -820,6 +927,8 @@ void SlsDetDriver::run()
     }
   }
 
+  slsDetUnpinThread();
+
   asynPrint(_pasynUser, ASYN_TRACE_FLOW,
             "%s:%s: port=%s address=%d end\n",
             driverName, functionName, _portName, _addr);
@@ -47,6 +47,8 @@ protected:
   virtual SlsDetMessage highVoltage(int value=-1);
   virtual SlsDetMessage clockDivider(int value=-1);
   virtual SlsDetMessage gainSettings(int value=-1);
+  virtual SlsDetMessage storageCells(int value=-1);
+  virtual SlsDetMessage storageCellStart(int value=-1);
 
 private:
   asynUser*         _pasynUser;
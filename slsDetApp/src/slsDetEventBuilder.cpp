@@ -0,0 +1,361 @@
+#include "slsDetEventBuilder.h"
+
+#include <cstring>
+#include <cmath>
+
+#define THREAD_TMO 10.0
+/* How often the waiting frames are looked at without a frame or a pulse coming */
+#define POLL_TIME 0.01
+/* Seconds per tick of the detector timestamp */
+#define DETECTOR_CLOCK 1.e-7
+/* Matches before the clock model stamps the unmatched frames */
+#define CLOCK_MIN_MATCHES 16
+/* Seconds of matches before the rate of the detector clock is fitted */
+#define CLOCK_MIN_SPAN 1.0
+/* Weight of a match in the fit, which forgets the old ones slowly to follow
+ * the drift, and in the average of the errors */
+#define CLOCK_ALPHA 1.e-4
+#define JITTER_ALPHA 0.01
+/* A match further off than this in seconds starts the model again, e.g.
+ * when the detector timestamp restarts with an acquisition */
+#define CLOCK_MAX_ERROR 0.5
+/* Fibonacci hashing spreads the consecutive pulse IDs over the index */
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+SlsDetEventBuilder::SlsDetEventBuilder(SlsDetFrameSink *sink, unsigned maxPulses, unsigned maxPending,
+                                       double window, const char *portName) :
+  _sink(sink),
+  _portName(portName),
+  _maxPulses(maxPulses > 0 ? maxPulses : 1),
+  _maxPending(maxPending > 0 ? maxPending : 1),
+  _window(window > 0. ? window : 0.),
+  _mask(0),
+  _shift(0),
+  _evicted(false),
+  _evictedMax(0),
+  _flush(false),
+  _quit(false),
+  _wakeup(epicsEventEmpty),
+  _thread(*this, "slsDetEvent", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+{
+  resize(_maxPulses);
+  resetClock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _thread.start();
+}
+
+SlsDetEventBuilder::~SlsDetEventBuilder()
+{
+  /* The frames still waiting are handed on unmatched */
+  _lock.lock();
+  _quit = true;
+  _lock.unlock();
+  _wakeup.signal();
+  _thread.exitWait(THREAD_TMO);
+}
+
+void SlsDetEventBuilder::frameReady(SlsDetFrame *frame)
+{
+  _lock.lock();
+  _pending.push_back(frame);
+  _lock.unlock();
+  _wakeup.signal();
+}
+
+void SlsDetEventBuilder::addPulse(epicsUInt64 pulseId, const epicsTimeStamp *time)
+{
+  SlsPulseEntry *entry;
+  SlsPulseOrder order;
+
+  _lock.lock();
+  _stats.pulses++;
+  /* A pulse ID at or below one that already left the window means the
+   * timing system started counting again, frames of the new pulses are not late */
+  if (_evicted && (pulseId <= _evictedMax)) {
+    _evicted = false;
+    _evictedMax = 0;
+  }
+  entry = find(pulseId);
+  if (entry) {
+    /* The timing system sent it again, the latest time wins */
+    entry->time = *time;
+  } else {
+    if (_order.size() >= _maxPulses) {
+      _evicted = true;
+      if (_order.front().pulseId > _evictedMax) _evictedMax = _order.front().pulseId;
+      erase(_order.front().pulseId);
+      _order.pop_front();
+    }
+    size_t slot = slotOf(pulseId);
+    while (_index[slot].used) slot = (slot + 1) & _mask;
+    _index[slot].pulseId = pulseId;
+    _index[slot].time = *time;
+    _index[slot].used = true;
+    order.pulseId = pulseId;
+    order.time = *time;
+    _order.push_back(order);
+  }
+  evict(time);
+  _lock.unlock();
+  _wakeup.signal();
+}
+
+void SlsDetEventBuilder::flush()
+{
+  _lock.lock();
+  _flush = true;
+  _lock.unlock();
+  _wakeup.signal();
+}
+
+void SlsDetEventBuilder::setWindow(unsigned maxPulses, double window)
+{
+  _lock.lock();
+  _maxPulses = maxPulses > 0 ? maxPulses : 1;
+  _window = window > 0. ? window : 0.;
+  resize(_maxPulses);
+  _lock.unlock();
+  _wakeup.signal();
+}
+
+void SlsDetEventBuilder::reset()
+{
+  _lock.lock();
+  resize(_maxPulses);
+  resetClock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _lock.unlock();
+}
+
+void SlsDetEventBuilder::getStats(SlsDetEventStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  stats->pending = _pending.size();
+  stats->drift = (_clockRate - 1.) * 1.e6;
+  stats->jitter = std::sqrt(_clockVariance) * 1.e6;
+  stats->locked = _clockMatches >= CLOCK_MIN_MATCHES;
+  _lock.unlock();
+}
+
+bool SlsDetEventBuilder::toEpicsTime(epicsUInt64 timestamp, epicsTimeStamp *time)
+{
+  bool valid;
+
+  _lock.lock();
+  valid = predict(timestamp, time);
+  _lock.unlock();
+
+  return valid;
+}
+
+void SlsDetEventBuilder::resize(unsigned maxPulses)
+{
+  /* Must be called with the lock held */
+  SlsPulseEntry empty;
+  size_t size = 16;
+  unsigned bits = 4;
+
+  /* At most half full keeps the probes short */
+  while (size < 2 * (size_t) maxPulses) {
+    size <<= 1;
+    bits++;
+  }
+  std::memset(&empty, 0, sizeof(empty));
+  _index.assign(size, empty);
+  _mask = size - 1;
+  _shift = 64 - bits;
+  _order.clear();
+  _evicted = false;
+  _evictedMax = 0;
+}
+
+size_t SlsDetEventBuilder::slotOf(epicsUInt64 pulseId) const
+{
+  return (size_t) ((pulseId * HASH_MULTIPLIER) >> _shift);
+}
+
+SlsDetEventBuilder::SlsPulseEntry* SlsDetEventBuilder::find(epicsUInt64 pulseId)
+{
+  /* Must be called with the lock held */
+  size_t slot = slotOf(pulseId);
+
+  while (_index[slot].used) {
+    if (_index[slot].pulseId == pulseId) return &_index[slot];
+    slot = (slot + 1) & _mask;
+  }
+  return NULL;
+}
+
+void SlsDetEventBuilder::erase(epicsUInt64 pulseId)
+{
+  /* Must be called with the lock held */
+  SlsPulseEntry *entry = find(pulseId);
+  size_t hole;
+  size_t next;
+
+  if (!entry) return;
+
+  /* Shifts back the entries that probed past the hole, so no tombstones are needed */
+  hole = entry - &_index[0];
+  next = hole;
+  while (true) {
+    next = (next + 1) & _mask;
+    if (!_index[next].used) break;
+    size_t home = slotOf(_index[next].pulseId);
+    bool between = hole < next ? (home > hole) && (home <= next) : (home > hole) || (home <= next);
+    if (!between) {
+      _index[hole] = _index[next];
+      hole = next;
+    }
+  }
+  _index[hole].used = false;
+}
+
+void SlsDetEventBuilder::evict(const epicsTimeStamp *now)
+{
+  /* Must be called with the lock held */
+  while (!_order.empty() && (epicsTimeDiffInSeconds(now, &_order.front().time) > _window)) {
+    _evicted = true;
+    if (_order.front().pulseId > _evictedMax) _evictedMax = _order.front().pulseId;
+    erase(_order.front().pulseId);
+    _order.pop_front();
+  }
+}
+
+bool SlsDetEventBuilder::pair(SlsDetFrame *frame, bool waited)
+{
+  /* Must be called with the lock held */
+  SlsPulseEntry *entry = find(frame->bunchId);
+
+  if (entry) {
+    frame->eventTime = entry->time;
+    frame->eventMatch = SlsEventMatched;
+    _stats.matched++;
+    fitClock(frame->timestamp, &entry->time);
+    return true;
+  }
+
+  if (_evicted && (frame->bunchId <= _evictedMax)) {
+    frame->eventMatch = SlsEventLate;
+    _stats.late++;
+  } else if (waited) {
+    frame->eventMatch = SlsEventUnmatched;
+    _stats.unmatched++;
+  } else {
+    return false;
+  }
+  if (!predict(frame->timestamp, &frame->eventTime)) frame->eventTime = frame->arrival;
+
+  return true;
+}
+
+void SlsDetEventBuilder::fitClock(epicsUInt64 timestamp, const epicsTimeStamp *time)
+{
+  /* Must be called with the lock held */
+  double span;
+  double elapsed;
+  double error;
+
+  if (!_clockMatches || (timestamp < _clockTimestamp)) {
+    resetClock();
+    _clockTimestamp = timestamp;
+    _clockTime = *time;
+    _clockMatches = 1;
+    return;
+  }
+
+  span = (timestamp - _clockTimestamp) * DETECTOR_CLOCK;
+  elapsed = epicsTimeDiffInSeconds(time, &_clockTime);
+  error = elapsed - (span * _clockRate + _clockOffset);
+  if (std::fabs(error) > CLOCK_MAX_ERROR) {
+    resetClock();
+    _clockTimestamp = timestamp;
+    _clockTime = *time;
+    _clockMatches = 1;
+    return;
+  }
+  _clockMatches++;
+  _clockVariance += JITTER_ALPHA * (error * error - _clockVariance);
+
+  /* Least squares line of EPICS time against detector time since the anchor */
+  _clockSw = (1. - CLOCK_ALPHA) * _clockSw + 1.;
+  _clockSx = (1. - CLOCK_ALPHA) * _clockSx + span;
+  _clockSy = (1. - CLOCK_ALPHA) * _clockSy + elapsed;
+  _clockSxx = (1. - CLOCK_ALPHA) * _clockSxx + span * span;
+  _clockSxy = (1. - CLOCK_ALPHA) * _clockSxy + span * elapsed;
+  double det = _clockSw * _clockSxx - _clockSx * _clockSx;
+  /* The rate only means something over a long enough span */
+  if (det > _clockSw * _clockSw * CLOCK_MIN_SPAN * CLOCK_MIN_SPAN / 12.) {
+    _clockRate = (_clockSw * _clockSxy - _clockSx * _clockSy) / det;
+  }
+  _clockOffset = (_clockSy - _clockRate * _clockSx) / _clockSw;
+}
+
+bool SlsDetEventBuilder::predict(epicsUInt64 timestamp, epicsTimeStamp *time)
+{
+  /* Must be called with the lock held */
+  if ((_clockMatches < CLOCK_MIN_MATCHES) || (timestamp < _clockTimestamp)) return false;
+
+  *time = _clockTime;
+  epicsTimeAddSeconds(time, (timestamp - _clockTimestamp) * DETECTOR_CLOCK * _clockRate + _clockOffset);
+  return true;
+}
+
+void SlsDetEventBuilder::resetClock()
+{
+  /* Must be called with the lock held */
+  _clockTimestamp = 0;
+  std::memset(&_clockTime, 0, sizeof(_clockTime));
+  _clockMatches = 0;
+  _clockRate = 1.;
+  _clockOffset = 0.;
+  _clockVariance = 0.;
+  _clockSw = 0.;
+  _clockSx = 0.;
+  _clockSy = 0.;
+  _clockSxx = 0.;
+  _clockSxy = 0.;
+}
+
+void SlsDetEventBuilder::run()
+{
+  std::vector<SlsDetFrame*> ready;
+  epicsTimeStamp now;
+  bool quit;
+
+  slsDetPinThread(_portName, SlsThreadProcess);
+
+  while (true) {
+    _wakeup.wait(POLL_TIME);
+    epicsTimeGetCurrent(&now);
+
+    /* The frames go on in order, so the first one still waiting holds up the rest */
+    _lock.lock();
+    while (!_pending.empty()) {
+      SlsDetFrame *frame = _pending.front();
+      bool waited = _flush || _quit || (_pending.size() > _maxPending) ||
+                    (epicsTimeDiffInSeconds(&now, &frame->arrival) >= _window);
+      if (!pair(frame, waited)) break;
+      _pending.pop_front();
+      ready.push_back(frame);
+    }
+    /* The acquisition is over, the next one starts without a high water mark */
+    if (_flush) {
+      _evicted = false;
+      _evictedMax = 0;
+    }
+    _flush = false;
+    quit = _quit;
+    _lock.unlock();
+
+    /* The sink may block, so it is called without the lock */
+    for (size_t n=0; n<ready.size(); n++) {
+      _sink->frameReady(ready[n]);
+    }
+    ready.clear();
+    if (quit) break;
+  }
+
+  slsDetUnpinThread();
+}
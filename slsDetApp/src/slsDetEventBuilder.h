@@ -0,0 +1,124 @@
+#ifndef slsDetEventBuilder_H
+#define slsDetEventBuilder_H
+
+#include "slsDetFrame.h"
+#include "slsDetAffinity.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+
+#include <deque>
+#include <vector>
+
+/** Counters kept by the SlsDetEventBuilder */
+typedef struct {
+  epicsUInt64 pulses;     /**< pulse IDs given to the index */
+  epicsUInt64 matched;    /**< frames paired with their pulse */
+  epicsUInt64 unmatched;  /**< frames whose pulse did not come within the window */
+  epicsUInt64 late;       /**< frames whose pulse had already left the window */
+  unsigned    pending;    /**< frames waiting for their pulse */
+  double      drift;      /**< rate of the detector clock against EPICS time, ppm */
+  double      jitter;     /**< RMS error of the detector clock model on the matched frames, us */
+  bool        locked;     /**< the detector clock model stamps the unmatched frames */
+} SlsDetEventStats;
+
+/** Class definition for the SlsDetEventBuilder class
+  *
+  * Pairs the frames with the pulses of the timing system by pulse ID, which
+  * the timing system hands the detector as the bunchId of each frame. The
+  * pulse IDs and their EPICS times are given to addPulse() and kept in a hash
+  * index for a window of time, up to maxPulses of them. A frame whose pulse
+  * is not indexed yet waits up to the window for it; frames are handed on to
+  * the sink in the order they came, on a thread of the event builder, with
+  * eventTime and eventMatch set.
+  *
+  * The matched frames also fit a model of the 10 MHz detector timestamp
+  * against EPICS time, which follows the drift of the detector clock. Frames
+  * without a pulse are stamped from the model once it has locked, or with
+  * their arrival time before that.
+  */
+class SlsDetEventBuilder : public SlsDetFrameSink, public epicsThreadRunable {
+public:
+  /* Frames beyond maxPending are handed on unmatched rather than tying up the pool */
+  SlsDetEventBuilder(SlsDetFrameSink *sink, unsigned maxPulses, unsigned maxPending, double window,
+                     const char *portName=NULL);
+  virtual ~SlsDetEventBuilder();
+  virtual void run();
+
+  /* Queues the frame to be paired with its pulse */
+  virtual void frameReady(SlsDetFrame *frame);
+  /* Indexes a pulse of the timing system */
+  void addPulse(epicsUInt64 pulseId, const epicsTimeStamp *time);
+  /* Hands on the frames still waiting without waiting for their pulses, then
+   * forgets which pulses left the window so none of the next frames are late */
+  void flush();
+
+  /* Clears the index */
+  void setWindow(unsigned maxPulses, double window);
+  /* Clears the index, the clock model and the counters */
+  void reset();
+  void getStats(SlsDetEventStats *stats);
+
+  /* The EPICS time of a detector timestamp, false before the clock model locks */
+  bool toEpicsTime(epicsUInt64 timestamp, epicsTimeStamp *time);
+
+private:
+  typedef struct {
+    epicsUInt64     pulseId;
+    epicsTimeStamp  time;
+    bool            used;
+  } SlsPulseEntry;
+
+  typedef struct {
+    epicsUInt64     pulseId;
+    epicsTimeStamp  time;
+  } SlsPulseOrder;
+
+private:
+  /* These are called with the lock held */
+  void resize(unsigned maxPulses);
+  size_t slotOf(epicsUInt64 pulseId) const;
+  SlsPulseEntry* find(epicsUInt64 pulseId);
+  void erase(epicsUInt64 pulseId);
+  void evict(const epicsTimeStamp *now);
+  bool pair(SlsDetFrame *frame, bool waited);
+  void fitClock(epicsUInt64 timestamp, const epicsTimeStamp *time);
+  bool predict(epicsUInt64 timestamp, epicsTimeStamp *time);
+  void resetClock();
+
+private:
+  SlsDetFrameSink   *_sink;
+  const char        *_portName;
+  unsigned          _maxPulses;
+  unsigned          _maxPending;
+  double            _window;
+  std::vector<SlsPulseEntry> _index;
+  size_t            _mask;
+  unsigned          _shift;
+  std::deque<SlsPulseOrder> _order;         /* indexed pulses, oldest first */
+  bool              _evicted;
+  epicsUInt64       _evictedMax;            /* newest pulse ID that left the window */
+  std::deque<SlsDetFrame*> _pending;
+  bool              _flush;
+  bool              _quit;
+  /* Detector clock model: time = anchor + (timestamp - anchor) * rate + offset */
+  epicsUInt64       _clockTimestamp;
+  epicsTimeStamp    _clockTime;
+  unsigned          _clockMatches;
+  double            _clockRate;
+  double            _clockOffset;
+  double            _clockVariance;
+  double            _clockSw;               /* weighted sums of the fit */
+  double            _clockSx;
+  double            _clockSy;
+  double            _clockSxx;
+  double            _clockSxy;
+  SlsDetEventStats  _stats;
+  epicsMutex        _lock;
+  epicsEvent        _wakeup;
+  epicsThread       _thread;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "slsDetFrame.h"
+#include "slsDetFramePool.h"
+
+#include <detectorData.h>
+#include <epicsAtomic.h>
+
+#include <cstring>
+
+static const size_t typeSizes[] = {
+  sizeof(epicsUInt16),
+  sizeof(epicsInt32),
+  sizeof(epicsFloat32),
+};
+
+SlsDetFrame::SlsDetFrame(SlsDetFramePool *pool, void *data, size_t dataSize) :
+  data(data),
+  dataSize(dataSize),
+  _pool(pool),
+  _refCount(0)
+{
+  clear();
+}
+
+int SlsDetFrame::reserve()
+{
+  return epicsAtomicIncrIntT(&_refCount);
+}
+
+int SlsDetFrame::release()
+{
+  int count = epicsAtomicDecrIntT(&_refCount);
+  if (count == 0) {
+    _pool->release(this);
+  }
+  return count;
+}
+
+int SlsDetFrame::refCount() const
+{
+  return epicsAtomicGetIntT(&_refCount);
+}
+
+void SlsDetFrame::clear()
+{
+  frameNumber = 0;
+  timestamp = 0;
+  bunchId = 0;
+  modulesMask = 0;
+  missingMask = 0;
+  arrival.secPastEpoch = 0;
+  arrival.nsec = 0;
+  assembled = arrival;
+  eventTime = arrival;
+  eventMatch = SlsEventNone;
+  storageCell = 0;
+  numModules = 0;
+  sizeX = 0;
+  sizeY = 0;
+  bytesPerPixel = 0;
+  dataType = SlsFrameUInt16;
+  photonEnergy = 0.;
+  photonError = 0.;
+  _pending = 0;
+  _detached = false;
+  std::memset(header, 0, sizeof(header));
+  std::memset(packetsCaught, 0, sizeof(packetsCaught));
+  std::memset(origin, 0, sizeof(origin));
+}
+
+bool SlsDetFrame::setDataType(SlsFrameDataType type)
+{
+  if ((type < SlsFrameUInt16) || (type > SlsFrameFloat32) ||
+      (sizeX * sizeY * typeSizes[type] > dataSize)) {
+    return false;
+  }
+  dataType = type;
+  bytesPerPixel = typeSizes[type];
+  return true;
+}
+
+epicsUInt16* SlsDetFrame::uint16Pixels() const
+{
+  return dataType == SlsFrameUInt16 ? (epicsUInt16 *) data : NULL;
+}
+
+epicsInt32* SlsDetFrame::int32Pixels() const
+{
+  return dataType == SlsFrameInt32 ? (epicsInt32 *) data : NULL;
+}
+
+epicsFloat32* SlsDetFrame::float32Pixels() const
+{
+  return dataType == SlsFrameFloat32 ? (epicsFloat32 *) data : NULL;
+}
+
+size_t SlsDetFrame::numPixels() const
+{
+  return sizeX * sizeY;
+}
+
+SlsDetFrameRef::SlsDetFrameRef() :
+  _frame(NULL)
+{
+}
+
+SlsDetFrameRef::SlsDetFrameRef(SlsDetFrame *frame) :
+  _frame(frame)
+{
+}
+
+SlsDetFrameRef::~SlsDetFrameRef()
+{
+  if (_frame) _frame->release();
+}
+
+#if __cplusplus >= 201103L
+SlsDetFrameRef::SlsDetFrameRef(SlsDetFrameRef &&other) :
+  _frame(other.take())
+{
+}
+
+SlsDetFrameRef& SlsDetFrameRef::operator=(SlsDetFrameRef &&other)
+{
+  if (this != &other) reset(other.take());
+  return *this;
+}
+#endif
+
+SlsDetFrame* SlsDetFrameRef::get() const
+{
+  return _frame;
+}
+
+SlsDetFrame* SlsDetFrameRef::operator->() const
+{
+  return _frame;
+}
+
+bool SlsDetFrameRef::valid() const
+{
+  return _frame != NULL;
+}
+
+SlsDetFrame* SlsDetFrameRef::take()
+{
+  SlsDetFrame *frame = _frame;
+  _frame = NULL;
+  return frame;
+}
+
+SlsDetFrame* SlsDetFrameRef::share() const
+{
+  if (_frame) _frame->reserve();
+  return _frame;
+}
+
+void SlsDetFrameRef::reset(SlsDetFrame *frame)
+{
+  SlsDetFrame *old = _frame;
+  _frame = frame;
+  if (old) old->release();
+}
+
+void SlsDetFrameRef::swap(SlsDetFrameRef &other)
+{
+  SlsDetFrame *frame = _frame;
+  _frame = other._frame;
+  other._frame = frame;
+}
+
+SlsDetFrame* slsDetFrameFromData(SlsDetFramePool *pool, const detectorData *data,
+                                 epicsUInt64 frameNumber)
+{
+  SlsDetFrame *frame;
+  SlsFrameDataType type;
+  size_t imageSize;
+  size_t copySize;
+
+  if (data->cvalues && (data->dynamicRange == 16)) {
+    type = SlsFrameUInt16;
+  } else if (data->cvalues && (data->dynamicRange == 32)) {
+    type = SlsFrameInt32;
+  } else if (!data->cvalues && data->values) {
+    type = SlsFrameFloat32;
+  } else {
+    return NULL;
+  }
+  if (data->npoints <= 0) return NULL;
+
+  frame = pool->alloc();
+  if (!frame) return NULL;
+  frame->sizeX = data->npoints;
+  frame->sizeY = data->npy > 0 ? data->npy : 1;
+  if (!frame->setDataType(type)) {
+    frame->release();
+    return NULL;
+  }
+  frame->frameNumber = frameNumber;
+  epicsTimeGetCurrent(&frame->arrival);
+
+  imageSize = frame->numPixels() * frame->bytesPerPixel;
+  if (type == SlsFrameFloat32) {
+    /* Single precision is plenty for counts and angles */
+    epicsFloat32 *pixels = frame->float32Pixels();
+    for (size_t n=0; n<frame->numPixels(); n++) {
+      pixels[n] = (epicsFloat32) data->values[n];
+    }
+  } else {
+    copySize = data->databytes > 0 ? (size_t) data->databytes : 0;
+    if (copySize > imageSize) copySize = imageSize;
+    std::memcpy(frame->data, data->cvalues, copySize);
+    if (copySize < imageSize) std::memset((char *) frame->data + copySize, 0, imageSize - copySize);
+  }
+
+  return frame;
+}
+
+void slsDetFrameToData(const SlsDetFrame *frame, detectorData *data)
+{
+  data->cvalues = (char *) frame->data;
+  data->databytes = frame->numPixels() * frame->bytesPerPixel;
+  data->npoints = frame->sizeX;
+  data->npy = frame->sizeY;
+  data->dynamicRange = frame->bytesPerPixel * 8;
+}
@@ -0,0 +1,152 @@
+#ifndef slsDetFrame_H
+#define slsDetFrame_H
+
+#include <sls_receiver_defs.h>
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include <stddef.h>
+
+/* Maximum number of modules in an assembled frame (one bit each in the masks) */
+#define SLS_MAX_MODULES 64
+
+class SlsDetFramePool;
+class detectorData;
+
+/* Pixel types a frame can hold */
+typedef enum {
+  SlsFrameUInt16,   /* raw, assembled or photon counts */
+  SlsFrameInt32,    /* 32 bit counters */
+  SlsFrameFloat32   /* energy */
+} SlsFrameDataType;
+
+/* How the event builder paired a frame with a pulse of the timing system */
+typedef enum {
+  SlsEventNone,       /* the frame did not go through the event builder */
+  SlsEventMatched,    /* its bunchId is the ID of a pulse the event builder was given */
+  SlsEventUnmatched,  /* no pulse with its bunchId came within the window */
+  SlsEventLate        /* its pulse had already left the window */
+} SlsEventMatch;
+
+/** Class definition for the SlsDetFrame class
+  *
+  * A full detector image from a SlsDetFramePool together with the detector
+  * headers of the module sub-frames that it was assembled from. Frames are
+  * reference counted like NDArrays: reserve() adds a reference and release()
+  * returns the frame to its pool when the last reference is dropped.
+  */
+class SlsDetFrame {
+public:
+  SlsDetFrame(SlsDetFramePool *pool, void *data, size_t dataSize);
+
+  int reserve();
+  int release();
+  int refCount() const;
+  void clear();
+
+  /* Sets the pixel type and size, returning false if the image does not fit the buffer */
+  bool setDataType(SlsFrameDataType type);
+  /* The pixels as their type, NULL if they are of another */
+  epicsUInt16* uint16Pixels() const;
+  epicsInt32* int32Pixels() const;
+  epicsFloat32* float32Pixels() const;
+  size_t numPixels() const;
+
+  epicsUInt64     frameNumber;    /**< frame number shared by all the modules */
+  epicsUInt64     timestamp;      /**< timestamp of the first module to arrive */
+  epicsUInt64     bunchId;        /**< bunch id of the first module to arrive */
+  epicsUInt64     modulesMask;    /**< bit n is set if module n arrived */
+  epicsUInt64     missingMask;    /**< bit n is set if module n is missing */
+  epicsTimeStamp  arrival;        /**< time the first module arrived */
+  epicsTimeStamp  assembled;      /**< time the frame was handed on complete */
+  epicsTimeStamp  eventTime;      /**< EPICS time of its pulse, or from the detector clock if unmatched */
+  SlsEventMatch   eventMatch;     /**< how the event builder paired it with its pulse */
+  int             storageCell;    /**< storage cell it was taken in, 0 outside burst mode */
+  int             numModules;     /**< number of modules in the detector */
+  size_t          sizeX;          /**< image width in pixels */
+  size_t          sizeY;          /**< image height in pixels */
+  size_t          bytesPerPixel;  /**< size of a pixel in bytes */
+  SlsFrameDataType dataType;      /**< type of the pixels */
+  double          photonEnergy;   /**< keV of a photon if the pixels count photons, 0 for raw data */
+  double          photonError;    /**< RMS error of the photon counts against the energy in keV */
+  void            *data;          /**< the pooled image buffer */
+  size_t          dataSize;       /**< size of the image buffer in bytes */
+  slsReceiverDefs::sls_detector_header header[SLS_MAX_MODULES];  /**< module headers */
+  epicsUInt32     packetsCaught[SLS_MAX_MODULES];                /**< packets in each packetsMask */
+  size_t          origin[SLS_MAX_MODULES];                       /**< image pixel of each module's top left corner */
+
+private:
+  friend class SlsDetAssembler;
+  SlsDetFramePool *_pool;
+  int             _refCount;
+  int             _pending;       /* module copies still in progress */
+  bool            _detached;      /* no more modules will be added */
+};
+
+/** Class definition for the SlsDetFrameRef class
+  *
+  * Holds one reference to a frame and drops it when it goes out of scope, so
+  * a frame handed along the pipeline is released on every path. A reference
+  * can be moved but not copied: take() hands it over to a consumer that
+  * releases it itself, swap() and, with C++11, the move constructor and
+  * assignment pass it to another SlsDetFrameRef. share() makes an extra
+  * reference for a consumer that keeps the frame beyond the holder.
+  */
+class SlsDetFrameRef {
+public:
+  SlsDetFrameRef();
+  /* Takes over a reference the caller holds */
+  explicit SlsDetFrameRef(SlsDetFrame *frame);
+  ~SlsDetFrameRef();
+#if __cplusplus >= 201103L
+  SlsDetFrameRef(SlsDetFrameRef &&other);
+  SlsDetFrameRef& operator=(SlsDetFrameRef &&other);
+#endif
+
+  SlsDetFrame* get() const;
+  SlsDetFrame* operator->() const;
+  bool valid() const;
+
+  /* Hands the reference over, leaving the holder empty */
+  SlsDetFrame* take();
+  /* Returns a new reference to the frame */
+  SlsDetFrame* share() const;
+  /* Drops the reference, taking over frame's if it is given */
+  void reset(SlsDetFrame *frame=NULL);
+  void swap(SlsDetFrameRef &other);
+
+private:
+  SlsDetFrameRef(const SlsDetFrameRef &);
+  SlsDetFrameRef& operator=(const SlsDetFrameRef &);
+
+private:
+  SlsDetFrame     *_frame;
+};
+
+/* Adapters for the detectorData of the slsDetectorUsers data callback.
+ *
+ * slsDetFrameFromData() copies the image of a callback, which is only valid
+ * during the call, into a frame of the pool: the char data as 16 or 32 bit
+ * pixels, or the double values of a 1D detector as Float32. It returns NULL
+ * when no buffer is free or the image does not fit.
+ *
+ * slsDetFrameToData() points a detectorData at the pixels of a frame without
+ * copying them, for code that takes the vendor type. The detectorData does
+ * not free cvalues, so it can be reused for every frame; the frame has to be
+ * held until the detectorData is done with. */
+extern SlsDetFrame* slsDetFrameFromData(SlsDetFramePool *pool, const detectorData *data,
+                                        epicsUInt64 frameNumber);
+extern void slsDetFrameToData(const SlsDetFrame *frame, detectorData *data);
+
+/** Class definition for the SlsDetFrameSink class
+  *
+  * Interface for anything that consumes frames. The sink takes over one
+  * reference to the frame and must release it when done.
+  */
+class SlsDetFrameSink {
+public:
+  virtual ~SlsDetFrameSink() {}
+  virtual void frameReady(SlsDetFrame *frame) = 0;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include "slsDetFrameIndex.h"
+
+#include <epicsStdio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdarg>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Entries held back so frames a little out of order still go in their place */
+#define REORDER_KEEP 256
+/* Entries written to the file at a time */
+#define WRITE_BATCH 1024
+
+static bool frameBefore(const SlsDetIndexEntry &a, const SlsDetIndexEntry &b)
+{
+  return a.frameNumber < b.frameNumber;
+}
+
+static bool timeBefore(const SlsDetIndexEntry &a, epicsUInt64 timestamp)
+{
+  return a.timestamp < timestamp;
+}
+
+SlsDetIndexWriter::SlsDetIndexWriter() :
+  _fd(-1),
+  _lastWritten(0)
+{
+  std::memset(&_header, 0, sizeof(_header));
+  _fileName[0] = '\0';
+  _error[0] = '\0';
+}
+
+SlsDetIndexWriter::~SlsDetIndexWriter()
+{
+  close();
+}
+
+bool SlsDetIndexWriter::isOpen() const
+{
+  return _fd >= 0;
+}
+
+const char* SlsDetIndexWriter::error() const
+{
+  return _error;
+}
+
+void SlsDetIndexWriter::setError(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+}
+
+bool SlsDetIndexWriter::open(const char *fileName, int format, int fileIndex)
+{
+  close();
+
+  /* Read access too, the file may have to be sorted in place when it is closed */
+  _fd = ::open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0664);
+  if (_fd < 0) {
+    setError("Unable to open %s: %s", fileName, strerror(errno));
+    return false;
+  }
+  epicsSnprintf(_fileName, sizeof(_fileName), "%s", fileName);
+
+  std::memset(&_header, 0, sizeof(_header));
+  std::memcpy(_header.magic, SLS_INDEX_MAGIC, sizeof(SLS_INDEX_MAGIC));
+  _header.version = SLS_INDEX_VERSION;
+  _header.entrySize = sizeof(SlsDetIndexEntry);
+  _header.format = format;
+  _header.fileIndex = fileIndex;
+  _header.sorted = 1;
+  _lastWritten = 0;
+  _pending.clear();
+
+  if (!writeHeader()) {
+    ::close(_fd);
+    _fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+bool SlsDetIndexWriter::writeHeader()
+{
+  if (::pwrite(_fd, &_header, sizeof(_header), 0) != (ssize_t) sizeof(_header)) {
+    setError("Unable to write %s: %s", _fileName, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void SlsDetIndexWriter::add(const SlsDetIndexEntry &entry)
+{
+  std::vector<SlsDetIndexEntry>::iterator pos = _pending.end();
+
+  if (_fd < 0) return;
+
+  /* Frames come nearly in order, so their place is found from the back */
+  while ((pos != _pending.begin()) && ((pos - 1)->frameNumber > entry.frameNumber)) {
+    --pos;
+  }
+  _pending.insert(pos, entry);
+  if (_header.numEntries && (entry.frameNumber < _lastWritten)) {
+    _header.sorted = 0;
+  }
+
+  if (_pending.size() >= REORDER_KEEP + WRITE_BATCH) {
+    flush(false);
+  }
+}
+
+bool SlsDetIndexWriter::flush(bool all)
+{
+  size_t count = _pending.size();
+  size_t bytes;
+  off_t offset;
+
+  if (_fd < 0) return false;
+  if (!all) count = count > REORDER_KEEP ? count - REORDER_KEEP : 0;
+  if (!count) return true;
+
+  /* The entries go in before the count that makes them visible */
+  bytes = count * sizeof(SlsDetIndexEntry);
+  offset = SLS_INDEX_HEADER_SIZE + _header.numEntries * sizeof(SlsDetIndexEntry);
+  if (::pwrite(_fd, &_pending[0], bytes, offset) != (ssize_t) bytes) {
+    setError("Unable to write %s: %s", _fileName, strerror(errno));
+    _pending.erase(_pending.begin(), _pending.begin() + count);
+    return false;
+  }
+  _lastWritten = _pending[count - 1].frameNumber;
+  _pending.erase(_pending.begin(), _pending.begin() + count);
+  _header.numEntries += count;
+
+  return writeHeader();
+}
+
+bool SlsDetIndexWriter::close()
+{
+  bool ok;
+
+  if (_fd < 0) return true;
+
+  ok = flush(true);
+  if (ok && !_header.sorted) {
+    size_t size = SLS_INDEX_HEADER_SIZE + _header.numEntries * sizeof(SlsDetIndexEntry);
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+      setError("Unable to sort %s: %s", _fileName, strerror(errno));
+      ok = false;
+    } else {
+      SlsDetIndexEntry *entries = (SlsDetIndexEntry *) ((char *) map + SLS_INDEX_HEADER_SIZE);
+      std::stable_sort(entries, entries + _header.numEntries, frameBefore);
+      munmap(map, size);
+      _header.sorted = 1;
+    }
+  }
+  _header.complete = 1;
+  ok = writeHeader() && ok;
+  ::close(_fd);
+  _fd = -1;
+
+  return ok;
+}
+
+SlsDetFrameIndex::SlsDetFrameIndex() :
+  _fd(-1),
+  _map(NULL),
+  _mapSize(0),
+  _numEntries(0),
+  _sorted(0),
+  _timeChecked(0),
+  _timeOrdered(true)
+{
+  _error[0] = '\0';
+}
+
+SlsDetFrameIndex::~SlsDetFrameIndex()
+{
+  close();
+}
+
+const char* SlsDetFrameIndex::error() const
+{
+  return _error;
+}
+
+void SlsDetFrameIndex::setError(const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+}
+
+bool SlsDetFrameIndex::open(const char *fileName)
+{
+  SlsDetIndexHeader header;
+
+  close();
+  _fd = ::open(fileName, O_RDONLY);
+  if (_fd < 0) {
+    setError("Unable to open %s: %s", fileName, strerror(errno));
+    return false;
+  }
+  if ((::pread(_fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) ||
+      std::memcmp(header.magic, SLS_INDEX_MAGIC, sizeof(SLS_INDEX_MAGIC)) ||
+      (header.version != SLS_INDEX_VERSION) || (header.entrySize != sizeof(SlsDetIndexEntry))) {
+    setError("%s is not a frame index", fileName);
+    close();
+    return false;
+  }
+
+  return refresh();
+}
+
+void SlsDetFrameIndex::close()
+{
+  if (_map) {
+    munmap(_map, _mapSize);
+    _map = NULL;
+  }
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  _mapSize = 0;
+  _numEntries = 0;
+  _sorted = 0;
+  _timeChecked = 0;
+  _timeOrdered = true;
+}
+
+bool SlsDetFrameIndex::refresh()
+{
+  SlsDetIndexHeader header;
+  size_t size;
+
+  if (_fd < 0) return false;
+  if (::pread(_fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+    setError("Unable to read the index: %s", strerror(errno));
+    return false;
+  }
+
+  /* The mapping only ever grows, the entries in it do not move */
+  size = SLS_INDEX_HEADER_SIZE + header.numEntries * sizeof(SlsDetIndexEntry);
+  if (size > _mapSize) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+      setError("Unable to map the index: %s", strerror(errno));
+      return false;
+    }
+    if (_map) munmap(_map, _mapSize);
+    _map = map;
+    _mapSize = size;
+  }
+  _numEntries = header.numEntries;
+
+  /* Sorting on close moves the entries, so they are checked again */
+  if (header.sorted != _sorted) {
+    _sorted = header.sorted;
+    _timeChecked = 0;
+    _timeOrdered = true;
+  }
+  for (; _timeOrdered && (_timeChecked < _numEntries); _timeChecked++) {
+    if (_timeChecked && (entry(_timeChecked)->timestamp < entry(_timeChecked-1)->timestamp))
+      _timeOrdered = false;
+  }
+
+  return true;
+}
+
+size_t SlsDetFrameIndex::size() const
+{
+  return _numEntries;
+}
+
+const SlsDetIndexHeader* SlsDetFrameIndex::header() const
+{
+  return (const SlsDetIndexHeader *) _map;
+}
+
+const SlsDetIndexEntry* SlsDetFrameIndex::entry(size_t n) const
+{
+  if (n >= _numEntries) return NULL;
+  return (const SlsDetIndexEntry *) ((const char *) _map + SLS_INDEX_HEADER_SIZE) + n;
+}
+
+const SlsDetIndexEntry* SlsDetFrameIndex::find(epicsUInt64 frameNumber) const
+{
+  const SlsDetIndexEntry *begin = entry(0);
+  const SlsDetIndexEntry *end = begin + _numEntries;
+  const SlsDetIndexEntry *found;
+  SlsDetIndexEntry key;
+
+  if (!_numEntries) return NULL;
+
+  /* An index that is still out of order can only be searched one entry at a time */
+  if (!header()->sorted) {
+    for (found=begin; found<end; found++) {
+      if (found->frameNumber == frameNumber) return found;
+    }
+    return NULL;
+  }
+  key.frameNumber = frameNumber;
+  found = std::lower_bound(begin, end, key, frameBefore);
+
+  return ((found < end) && (found->frameNumber == frameNumber)) ? found : NULL;
+}
+
+void SlsDetFrameIndex::findTime(epicsUInt64 start, epicsUInt64 end, size_t *first, size_t *last) const
+{
+  const SlsDetIndexEntry *begin = entry(0);
+
+  *first = 0;
+  *last = 0;
+  if (!_numEntries || (start >= end)) return;
+
+  /* Without timestamps in order the entries in range can be anywhere */
+  if (!header()->sorted || !_timeOrdered) {
+    size_t n;
+    *first = _numEntries;
+    for (n=0; n<_numEntries; n++) {
+      const SlsDetIndexEntry *e = entry(n);
+      if ((e->timestamp < start) || (e->timestamp >= end)) continue;
+      if (n < *first) *first = n;
+      *last = n + 1;
+    }
+    if (*first == _numEntries) *first = 0;
+    return;
+  }
+  *first = std::lower_bound(begin, begin + _numEntries, start, timeBefore) - begin;
+  *last = std::lower_bound(begin, begin + _numEntries, end, timeBefore) - begin;
+}
@@ -0,0 +1,123 @@
+#ifndef slsDetFrameIndex_H
+#define slsDetFrameIndex_H
+
+#include <epicsTypes.h>
+
+#include <stddef.h>
+#include <vector>
+
+/* Magic and version at the start of every index file */
+#define SLS_INDEX_MAGIC "SLSDIDX"
+#define SLS_INDEX_VERSION 1
+/* Size of the header in front of the entries */
+#define SLS_INDEX_HEADER_SIZE 64
+
+/** Header of an index file, followed by numEntries SlsDetIndexEntry */
+typedef struct {
+  char        magic[8];       /**< SLS_INDEX_MAGIC */
+  epicsUInt32 version;        /**< SLS_INDEX_VERSION */
+  epicsUInt32 entrySize;      /**< sizeof(SlsDetIndexEntry) */
+  epicsUInt64 numEntries;     /**< entries in the file, updated after they are written */
+  epicsUInt32 format;         /**< slsReceiverDefs::fileFormat of the data files */
+  epicsInt32  fileIndex;      /**< acquisition index in the names of the data files */
+  epicsUInt32 sorted;         /**< the entries are in frame number order */
+  epicsUInt32 complete;       /**< the acquisition is over and nothing more is added */
+  epicsUInt32 reserved[6];
+} SlsDetIndexHeader;
+
+/** Where a frame is in the data files of an acquisition */
+typedef struct {
+  epicsUInt64 frameNumber;    /**< frame number shared by all the modules */
+  epicsUInt64 timestamp;      /**< timestamp of the first module to arrive */
+  epicsUInt64 bunchId;        /**< bunch id of the first module to arrive */
+  epicsUInt64 offset;         /**< byte offset of the record in raw files, row of the dataset in HDF5 files */
+  epicsUInt32 fileId;         /**< n of the data file <name>_d0_f<n>_<index> */
+  epicsUInt32 size;           /**< bytes of the record in raw files, of its chunk in HDF5 files */
+  epicsUInt32 packetsLost;    /**< packets missing from all the modules */
+  epicsUInt32 missingModules; /**< modules missing altogether */
+} SlsDetIndexEntry;
+
+/** Class definition for the SlsDetIndexWriter class
+  *
+  * Writes the index of the frames of an acquisition next to its data files.
+  * Entries are kept sorted by frame number while they wait to be written,
+  * holding back the newest few so frames that arrive a little out of order
+  * still go in their place, and are appended to the file in batches with
+  * the entry count updated last, so readers can follow a running
+  * acquisition. Should a frame arrive after later ones were written the
+  * index is sorted when it is closed.
+  */
+class SlsDetIndexWriter {
+public:
+  SlsDetIndexWriter();
+  virtual ~SlsDetIndexWriter();
+
+  virtual bool open(const char *fileName, int format, int fileIndex);
+  virtual void add(const SlsDetIndexEntry &entry);
+  /* Writes out the entries waiting, all of them or all but the newest few */
+  virtual bool flush(bool all);
+  /* Writes everything out, sorts the file if needed and marks it complete */
+  virtual bool close();
+  bool isOpen() const;
+
+  const char* error() const;
+
+private:
+  bool writeHeader();
+  void setError(const char *fmt, ...);
+
+private:
+  int               _fd;
+  SlsDetIndexHeader _header;
+  epicsUInt64       _lastWritten;
+  std::vector<SlsDetIndexEntry> _pending;
+  char              _fileName[512];
+  char              _error[256];
+};
+
+/** Class definition for the SlsDetFrameIndex class
+  *
+  * Maps an index file into memory so frames can be looked up by frame
+  * number or timestamp with a binary search, without reading the data
+  * files. The index of an acquisition still being written can be followed
+  * with refresh(). The binary search by timestamp needs the timestamps to
+  * rise with the frame number; refresh() checks the entries it maps in and
+  * an index where they do not, or one not sorted yet, is scanned instead.
+  */
+class SlsDetFrameIndex {
+public:
+  SlsDetFrameIndex();
+  virtual ~SlsDetFrameIndex();
+
+  virtual bool open(const char *fileName);
+  virtual void close();
+  /* Maps in the entries added since the index was opened or last refreshed */
+  virtual bool refresh();
+
+  size_t size() const;
+  const SlsDetIndexHeader* header() const;
+  const SlsDetIndexEntry* entry(size_t n) const;
+  /* Entry of a frame, NULL if it is not in the index */
+  const SlsDetIndexEntry* find(epicsUInt64 frameNumber) const;
+  /* Entries [first, last) with timestamps in [start, end). Should the
+   * timestamps not rise with the frame number the range runs from the first
+   * to the last entry in [start, end) and may hold entries outside it */
+  void findTime(epicsUInt64 start, epicsUInt64 end, size_t *first, size_t *last) const;
+
+  const char* error() const;
+
+private:
+  void setError(const char *fmt, ...);
+
+private:
+  int               _fd;
+  void              *_map;
+  size_t            _mapSize;
+  size_t            _numEntries;
+  epicsUInt32       _sorted;
+  size_t            _timeChecked;
+  bool              _timeOrdered;
+  char              _error[256];
+};
+
+#endif
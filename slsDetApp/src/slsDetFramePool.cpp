@@ -0,0 +1,294 @@
+#include "slsDetFramePool.h"
+#include "slsDetAffinity.h"
+
+#include <epicsAtomic.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifdef MAP_HUGETLB
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+#define HUGE_2M ((size_t) 1 << 21)
+#define HUGE_1G ((size_t) 1 << 30)
+/* Buffers in a word of the free mask */
+#define MASK_BITS (8 * sizeof(size_t))
+
+static const char *pagesNames[] = {
+  "normal",
+  "transparent",
+  "2M",
+  "1G",
+};
+
+/* The best pages the environment allows */
+static SlsPoolPages maxPages()
+{
+  const char *limit = getenv("SLS_POOL_PAGES");
+  if (limit) {
+    for (int n=SlsPoolPagesNormal; n<=SlsPoolPages1G; n++) {
+      if (!strcmp(limit, pagesNames[n])) return (SlsPoolPages) n;
+    }
+  }
+  return SlsPoolPages1G;
+}
+
+static unsigned lowestBit(size_t bits)
+{
+#ifdef __GNUC__
+  return __builtin_ctzl((unsigned long) bits);
+#else
+  unsigned bit = 0;
+  while (!(bits & 1)) {
+    bits >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+SlsDetFramePool::SlsDetFramePool(size_t frameSize, unsigned numFrames, int node) :
+  _frameSize(frameSize),
+  _stride(SLS_FRAME_PADDED(frameSize)),
+  _node(node),
+  _region(NULL),
+  _regionSize(0),
+  _pages(SlsPoolPagesNormal),
+  _locked(false),
+  _freeMask((numFrames + MASK_BITS - 1) / MASK_BITS, 0),
+  _hint(0),
+  _inUse(0),
+  _highWater(0),
+  _allocFailures(0)
+{
+  size_t size = _stride * (numFrames > 0 ? numFrames : 1);
+  SlsPoolPages limit = maxPages();
+
+  /* The largest pages that are not mostly wasted and that there are enough of */
+  if (!(((limit >= SlsPoolPages1G) && (size >= HUGE_1G) && mapRegion(size, SlsPoolPages1G)) ||
+        ((limit >= SlsPoolPages2M) && (size >= HUGE_2M) && mapRegion(size, SlsPoolPages2M)) ||
+        mapRegion(size, ((limit >= SlsPoolPagesTransparent) && (size >= HUGE_2M)) ?
+                        SlsPoolPagesTransparent : SlsPoolPagesNormal))) {
+    throw std::bad_alloc();
+  }
+
+  /* Nothing is written yet, so the pages are faulted in on the node */
+  if (_node >= 0) slsDetBindMemory(_region, _regionSize, _node);
+  _locked = (mlock(_region, _regionSize) == 0);
+  if (!_locked) {
+    /* At least have the pages there before the first frame */
+    for (size_t offset=0; offset<_regionSize; offset+=SLS_FRAME_ALIGN) {
+      _region[offset] = 0;
+    }
+  }
+
+  /* The mapping starts out zeroed, so the padding is too and whole blocks
+   * can be written out as they are. The destructor does not run if the
+   * constructor throws, so the mapping and the frames made are freed here */
+  try {
+    _frames.reserve(numFrames);
+    for (unsigned n=0; n<numFrames; n++) {
+      SlsDetFrame *frame = new SlsDetFrame(this, _region + n * _stride, _frameSize);
+      _frames.push_back(frame);
+      _freeMask[n / MASK_BITS] |= (size_t) 1 << (n % MASK_BITS);
+    }
+  } catch (...) {
+    freeFrames();
+    throw;
+  }
+}
+
+SlsDetFramePool::~SlsDetFramePool()
+{
+  freeFrames();
+}
+
+bool SlsDetFramePool::mapRegion(size_t size, SlsPoolPages pages)
+{
+  size_t pageSize = SLS_FRAME_ALIGN;
+  size_t extra = 0;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  char *addr;
+
+  if (pages == SlsPoolPages1G) {
+#ifdef MAP_HUGETLB
+    pageSize = HUGE_1G;
+    flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+#else
+    return false;
+#endif
+  } else if (pages == SlsPoolPages2M) {
+#ifdef MAP_HUGETLB
+    pageSize = HUGE_2M;
+    flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+#else
+    return false;
+#endif
+  } else if (pages == SlsPoolPagesTransparent) {
+    /* Only the 2 MB aligned parts can become hugepages, so map enough to align it */
+    pageSize = HUGE_2M;
+    extra = HUGE_2M;
+  }
+  size = (size + pageSize - 1) & ~(pageSize - 1);
+
+  addr = (char *) mmap(NULL, size + extra, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (addr == (char *) MAP_FAILED) return false;
+  if (extra) {
+    size_t head = (HUGE_2M - ((size_t) addr & (HUGE_2M - 1))) & (HUGE_2M - 1);
+    if (head) munmap(addr, head);
+    if (extra - head) munmap(addr + head + size, extra - head);
+    addr += head;
+  }
+
+  if (pages == SlsPoolPagesTransparent) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(addr, size, MADV_HUGEPAGE)) pages = SlsPoolPagesNormal;
+#else
+    pages = SlsPoolPagesNormal;
+#endif
+  }
+
+  _region = addr;
+  _regionSize = size;
+  _pages = pages;
+  return true;
+}
+
+void SlsDetFramePool::freeFrames()
+{
+  for (unsigned n=0; n<_frames.size(); n++) {
+    delete _frames[n];
+  }
+  _frames.clear();
+  if (_region) {
+    if (_locked) munlock(_region, _regionSize);
+    munmap(_region, _regionSize);
+    _region = NULL;
+  }
+}
+
+SlsDetFrame* SlsDetFramePool::alloc()
+{
+  const size_t words = _freeMask.size();
+  size_t start = epicsAtomicGetSizeT(&_hint);
+  SlsDetFrame *frame = NULL;
+
+  for (size_t w=0; (w<words) && !frame; w++) {
+    size_t word = (start + w) % words;
+    size_t bits = epicsAtomicGetSizeT(&_freeMask[word]);
+    while (bits) {
+      size_t bit = bits & (~bits + 1);
+      size_t seen = epicsAtomicCmpAndSwapSizeT(&_freeMask[word], bits, bits & ~bit);
+      if (seen == bits) {
+        frame = _frames[word * MASK_BITS + lowestBit(bit)];
+        break;
+      }
+      bits = seen;
+    }
+  }
+
+  if (!frame) {
+    epicsAtomicIncrSizeT(&_allocFailures);
+    return NULL;
+  }
+
+  size_t inUse = epicsAtomicIncrSizeT(&_inUse);
+  size_t highWater = epicsAtomicGetSizeT(&_highWater);
+  while (inUse > highWater) {
+    size_t seen = epicsAtomicCmpAndSwapSizeT(&_highWater, highWater, inUse);
+    if (seen == highWater) break;
+    highWater = seen;
+  }
+
+  frame->clear();
+  frame->reserve();
+
+  return frame;
+}
+
+void SlsDetFramePool::release(SlsDetFrame *frame)
+{
+  size_t index = ((char *) frame->data - _region) / _stride;
+  size_t word = index / MASK_BITS;
+  size_t bit = (size_t) 1 << (index % MASK_BITS);
+  size_t bits = epicsAtomicGetSizeT(&_freeMask[word]);
+
+  epicsAtomicDecrSizeT(&_inUse);
+  while (true) {
+    size_t seen = epicsAtomicCmpAndSwapSizeT(&_freeMask[word], bits, bits | bit);
+    if (seen == bits) break;
+    bits = seen;
+  }
+  /* The buffers released last are the ones still in the cache */
+  epicsAtomicSetSizeT(&_hint, word);
+}
+
+size_t SlsDetFramePool::frameSize() const
+{
+  return _frameSize;
+}
+
+unsigned SlsDetFramePool::numFrames() const
+{
+  return _frames.size();
+}
+
+int SlsDetFramePool::node() const
+{
+  return _node;
+}
+
+unsigned SlsDetFramePool::numFree()
+{
+  return _frames.size() - epicsAtomicGetSizeT(&_inUse);
+}
+
+unsigned SlsDetFramePool::highWater()
+{
+  return epicsAtomicGetSizeT(&_highWater);
+}
+
+epicsUInt64 SlsDetFramePool::allocFailures()
+{
+  return epicsAtomicGetSizeT(&_allocFailures);
+}
+
+SlsPoolPages SlsDetFramePool::pages() const
+{
+  return _pages;
+}
+
+bool SlsDetFramePool::locked() const
+{
+  return _locked;
+}
+
+void SlsDetFramePool::getStats(SlsDetFramePoolStats *stats)
+{
+  stats->numFrames = _frames.size();
+  stats->inUse = epicsAtomicGetSizeT(&_inUse);
+  stats->highWater = epicsAtomicGetSizeT(&_highWater);
+  stats->allocFailures = epicsAtomicGetSizeT(&_allocFailures);
+  stats->pages = _pages;
+  stats->locked = _locked;
+}
+
+const char* SlsDetFramePool::pagesName(SlsPoolPages pages)
+{
+  return ((pages >= SlsPoolPagesNormal) && (pages <= SlsPoolPages1G)) ? pagesNames[pages] : "unknown";
+}
@@ -0,0 +1,101 @@
+#ifndef slsDetFramePool_H
+#define slsDetFramePool_H
+
+#include "slsDetFrame.h"
+
+#include <epicsTypes.h>
+
+#include <vector>
+
+/* Alignment of the frame buffers, a page so they also suit O_DIRECT and SIMD.
+ * The buffers are padded with zeros to a multiple of it. */
+#define SLS_FRAME_ALIGN 4096
+/* Size of a frame buffer including the padding */
+#define SLS_FRAME_PADDED(size) (((size) + SLS_FRAME_ALIGN - 1) & ~((size_t) SLS_FRAME_ALIGN - 1))
+
+/* The pages the buffers of a pool ended up on */
+typedef enum {
+  SlsPoolPagesNormal,       /* ordinary pages */
+  SlsPoolPagesTransparent,  /* ordinary pages the kernel is asked to back with hugepages */
+  SlsPoolPages2M,           /* reserved 2 MB hugepages */
+  SlsPoolPages1G            /* reserved 1 GB hugepages */
+} SlsPoolPages;
+
+/** Counters kept by the SlsDetFramePool */
+typedef struct {
+  unsigned      numFrames;      /**< buffers in the pool */
+  unsigned      inUse;          /**< buffers handed out */
+  unsigned      highWater;      /**< most buffers handed out at once */
+  epicsUInt64   allocFailures;  /**< allocations with no buffer free */
+  SlsPoolPages  pages;          /**< pages the buffers are on */
+  bool          locked;         /**< the buffers are locked in memory */
+} SlsDetFramePoolStats;
+
+/** Class definition for the SlsDetFramePool class
+  *
+  * A fixed number of equally sized frame buffers that are allocated up front
+  * and handed out and returned without touching the heap. The buffers are
+  * slabs of one mapping, taken from reserved 1 GB or 2 MB hugepages when
+  * there are enough of them and otherwise from ordinary pages the kernel is
+  * asked to back with transparent hugepages, so a frame costs few TLB
+  * entries. The mapping is locked in memory, when the memlock limit allows
+  * it, so writing a frame never page faults. The buffers can be bound to a
+  * NUMA node, e.g. that of the network interface the frames come in on,
+  * before anything is written to them.
+  *
+  * Buffers are handed out and returned without a lock, a bit per buffer in
+  * a free mask taken and given back with compare and swap, so the module
+  * threads never wait on each other for a frame.
+  *
+  * The SLS_POOL_PAGES environment variable caps the pages tried: "normal",
+  * "transparent", "2M" or "1G" (the default).
+  */
+class SlsDetFramePool {
+public:
+  /* node is the NUMA node of the buffers, -1 for wherever they are first written */
+  SlsDetFramePool(size_t frameSize, unsigned numFrames, int node=-1);
+  virtual ~SlsDetFramePool();
+
+  /* Returns a frame with one reference or NULL when none is free */
+  virtual SlsDetFrame* alloc();
+  virtual void release(SlsDetFrame *frame);
+
+  size_t frameSize() const;
+  unsigned numFrames() const;
+  int node() const;
+  unsigned numFree();
+  unsigned highWater();
+  epicsUInt64 allocFailures();
+  SlsPoolPages pages() const;
+  bool locked() const;
+  void getStats(SlsDetFramePoolStats *stats);
+
+  static const char* pagesName(SlsPoolPages pages);
+
+private:
+  bool mapRegion(size_t size, SlsPoolPages pages);
+  void freeFrames();
+
+private:
+  typedef std::vector<SlsDetFrame*> SlsFrameList;
+  typedef std::vector<size_t> SlsFreeMask;
+
+private:
+  const size_t  _frameSize;
+  const size_t  _stride;
+  const int     _node;
+  char          *_region;
+  size_t        _regionSize;
+  SlsPoolPages  _pages;
+  bool          _locked;
+  SlsFrameList  _frames;
+  /* A bit set for every free buffer */
+  SlsFreeMask   _freeMask;
+  /* The word of the free mask the last buffer went back to */
+  size_t        _hint;
+  size_t        _inUse;
+  size_t        _highWater;
+  size_t        _allocFailures;
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "slsDetFrameQueue.h"
+
+#include <cstring>
+
+#define THREAD_TMO 10.0
+/* Room for the markers on top of the frames */
+#define MARKER_ROOM 8
+/* How long a blocked producer waits before it looks at the queue again */
+#define BLOCK_WAIT 0.01
+/* Tells the thread of a stage to exit */
+#define STAGE_QUIT -1
+
+static const char *policyNames[] = {
+  "block",
+  "drop newest",
+  "drop oldest",
+  "decimate",
+};
+
+SlsDetFrameQueue::SlsDetFrameQueue(unsigned capacity, SlsQueuePolicy policy, unsigned decimation) :
+  _head(0),
+  _count(0),
+  _frames(0),
+  _capacity(capacity > 0 ? capacity : 1),
+  _policy(policy),
+  _decimation(decimation > 1 ? decimation : 2),
+  _skip(0),
+  _notEmpty(epicsEventEmpty),
+  _notFull(epicsEventEmpty)
+{
+  SlsQueueEntry empty = { NULL, 0 };
+  _entries.assign(_capacity + MARKER_ROOM, empty);
+  std::memset(&_stats, 0, sizeof(_stats));
+}
+
+SlsDetFrameQueue::~SlsDetFrameQueue()
+{
+  while (_count) {
+    SlsQueueEntry &entry = _entries[_head];
+    if (entry.frame) entry.frame->release();
+    _head = (_head + 1) % _entries.size();
+    _count--;
+  }
+}
+
+void SlsDetFrameQueue::append(SlsDetFrame *frame, int marker)
+{
+  /* Must be called with the lock held */
+  SlsQueueEntry &entry = _entries[(_head + _count) % _entries.size()];
+  entry.frame = frame;
+  entry.marker = marker;
+  _count++;
+  if (frame) {
+    _frames++;
+    _stats.queued++;
+    if (_frames > _stats.highWater) _stats.highWater = _frames;
+  }
+}
+
+bool SlsDetFrameQueue::full() const
+{
+  /* Must be called with the lock held */
+  /* Markers the consumer has not got to yet can take up the room of frames too */
+  return (_frames >= _capacity) || (_count >= _entries.size());
+}
+
+SlsDetFrame* SlsDetFrameQueue::dropOldest()
+{
+  /* Must be called with the lock held */
+  SlsDetFrame *frame;
+
+  /* A marker holds its place, the frames after it are newer than it */
+  if (!_count || !_entries[_head].frame) return NULL;
+  frame = _entries[_head].frame;
+  _head = (_head + 1) % _entries.size();
+  _count--;
+  _frames--;
+  return frame;
+}
+
+bool SlsDetFrameQueue::push(SlsDetFrame *frame)
+{
+  SlsDetFrame *dropped = NULL;
+
+  _lock.lock();
+  if ((_policy == SlsQueueDecimate) && (_frames >= (_capacity + 1) / 2) && (++_skip % _decimation)) {
+    _stats.decimated++;
+    _lock.unlock();
+    frame->release();
+    return false;
+  }
+
+  if (full()) {
+    if (_policy == SlsQueueBlock) {
+      _stats.blocked++;
+      while (full() && (_policy == SlsQueueBlock)) {
+        _lock.unlock();
+        _notFull.wait(BLOCK_WAIT);
+        _lock.lock();
+      }
+    } else if (_policy == SlsQueueDropOldest) {
+      dropped = dropOldest();
+    }
+    if (full()) {
+      _stats.dropped++;
+      _lock.unlock();
+      frame->release();
+      return false;
+    }
+    if (dropped) _stats.dropped++;
+  }
+
+  append(frame, 0);
+  _lock.unlock();
+  _notEmpty.signal();
+
+  /* The frame given up goes back to its pool outside the lock */
+  if (dropped) dropped->release();
+
+  return true;
+}
+
+void SlsDetFrameQueue::pushMarker(int marker)
+{
+  _lock.lock();
+  while (_count >= _entries.size()) {
+    _lock.unlock();
+    _notFull.wait(BLOCK_WAIT);
+    _lock.lock();
+  }
+  append(NULL, marker);
+  _lock.unlock();
+  _notEmpty.signal();
+}
+
+bool SlsDetFrameQueue::pop(SlsDetFrame **frame, int *marker, double timeout)
+{
+  _lock.lock();
+  while (!_count) {
+    _lock.unlock();
+    if (timeout < 0.) {
+      _notEmpty.wait();
+    } else if (!_notEmpty.wait(timeout)) {
+      return false;
+    }
+    _lock.lock();
+    /* A signal left over from an entry already taken */
+    if (!_count && (timeout >= 0.)) {
+      _lock.unlock();
+      return false;
+    }
+  }
+
+  SlsQueueEntry &entry = _entries[_head];
+  *frame = entry.frame;
+  *marker = entry.marker;
+  _head = (_head + 1) % _entries.size();
+  _count--;
+  if (entry.frame) _frames--;
+  _lock.unlock();
+  _notFull.signal();
+
+  return true;
+}
+
+void SlsDetFrameQueue::setCapacity(unsigned capacity)
+{
+  SlsQueueEntry empty = { NULL, 0 };
+  SlsEntryList entries;
+  std::vector<SlsDetFrame*> dropped;
+  size_t count = 0;
+  size_t size;
+
+  if (capacity < 1) capacity = 1;
+
+  _lock.lock();
+  while (_frames > capacity) {
+    SlsDetFrame *frame = dropOldest();
+    if (!frame) break;
+    _stats.dropped++;
+    dropped.push_back(frame);
+  }
+  /* Frames behind a marker are kept even over the capacity */
+  size = capacity + MARKER_ROOM;
+  if (_count + MARKER_ROOM > size) size = _count + MARKER_ROOM;
+  entries.assign(size, empty);
+  while (_count) {
+    entries[count++] = _entries[_head];
+    _head = (_head + 1) % _entries.size();
+    _count--;
+  }
+  _entries.swap(entries);
+  _head = 0;
+  _count = count;
+  _capacity = capacity;
+  _lock.unlock();
+  _notFull.signal();
+
+  for (size_t n=0; n<dropped.size(); n++) {
+    dropped[n]->release();
+  }
+}
+
+void SlsDetFrameQueue::setPolicy(SlsQueuePolicy policy, unsigned decimation)
+{
+  _lock.lock();
+  _policy = policy;
+  _decimation = decimation > 1 ? decimation : 2;
+  _skip = 0;
+  _lock.unlock();
+  /* Producers blocked under the old policy look again */
+  _notFull.signal();
+}
+
+unsigned SlsDetFrameQueue::capacity()
+{
+  unsigned capacity;
+  _lock.lock();
+  capacity = _capacity;
+  _lock.unlock();
+  return capacity;
+}
+
+unsigned SlsDetFrameQueue::depth()
+{
+  unsigned depth;
+  _lock.lock();
+  depth = _frames;
+  _lock.unlock();
+  return depth;
+}
+
+void SlsDetFrameQueue::getStats(SlsDetFrameQueueStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  stats->depth = _frames;
+  stats->capacity = _capacity;
+  stats->policy = _policy;
+  _lock.unlock();
+}
+
+void SlsDetFrameQueue::resetStats()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _stats.highWater = _frames;
+  _lock.unlock();
+}
+
+const char* SlsDetFrameQueue::policyName(SlsQueuePolicy policy)
+{
+  return ((policy >= SlsQueueBlock) && (policy <= SlsQueueDecimate)) ? policyNames[policy] : "unknown";
+}
+
+SlsDetFrameStage::SlsDetFrameStage(SlsDetFrameSink *sink, unsigned capacity, SlsQueuePolicy policy,
+                                   const char *name, SlsThreadClass threadClass, const char *portName) :
+  _sink(sink),
+  _threadClass(threadClass),
+  _portName(portName),
+  _queue(capacity, policy),
+  _thread(*this, name, epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+{
+  _thread.start();
+}
+
+SlsDetFrameStage::~SlsDetFrameStage()
+{
+  _queue.pushMarker(STAGE_QUIT);
+  _thread.exitWait(THREAD_TMO);
+}
+
+void SlsDetFrameStage::frameReady(SlsDetFrame *frame)
+{
+  _queue.push(frame);
+}
+
+SlsDetFrameQueue* SlsDetFrameStage::queue()
+{
+  return &_queue;
+}
+
+void SlsDetFrameStage::run()
+{
+  SlsDetFrame *frame;
+  int marker;
+
+  slsDetPinThread(_portName, _threadClass);
+
+  while (true) {
+    if (!_queue.pop(&frame, &marker, -1.)) continue;
+    if (frame) {
+      _sink->frameReady(frame);
+    } else if (marker == STAGE_QUIT) {
+      break;
+    }
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,123 @@
+#ifndef slsDetFrameQueue_H
+#define slsDetFrameQueue_H
+
+#include "slsDetFrame.h"
+#include "slsDetAffinity.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
+#include <vector>
+
+/* What a full SlsDetFrameQueue does with another frame */
+typedef enum {
+  SlsQueueBlock,        /* the producer waits for room */
+  SlsQueueDropNewest,   /* the frame is dropped */
+  SlsQueueDropOldest,   /* the oldest frame waiting is dropped to make room */
+  SlsQueueDecimate      /* from half full only every Nth frame goes in, the rest are dropped */
+} SlsQueuePolicy;
+
+/** Counters kept by the SlsDetFrameQueue */
+typedef struct {
+  unsigned    depth;      /**< frames waiting */
+  unsigned    capacity;   /**< most frames that can wait */
+  unsigned    highWater;  /**< most frames waiting at once */
+  int         policy;     /**< SlsQueuePolicy for a full queue */
+  epicsUInt64 queued;     /**< frames that went in */
+  epicsUInt64 dropped;    /**< frames dropped since the queue was full */
+  epicsUInt64 decimated;  /**< frames left out by the decimation */
+  epicsUInt64 blocked;    /**< frames the producer had to wait to queue */
+} SlsDetFrameQueueStats;
+
+/** Class definition for the SlsDetFrameQueue class
+  *
+  * A bounded queue of frames between two stages of the pipeline, with any
+  * number of producers and a single consumer. The queue holds a reference to
+  * each frame, so a frame it drops goes straight back to its pool. What
+  * happens to a frame that finds the queue full is set by the policy, the
+  * same choice the receiver offers with its frameDiscardPolicy, and the
+  * counters tell how often each case came up.
+  *
+  * Markers go in order with the frames but ignore the policy and the
+  * capacity, so the consumer always sees a command queued after the frames.
+  */
+class SlsDetFrameQueue {
+public:
+  SlsDetFrameQueue(unsigned capacity, SlsQueuePolicy policy=SlsQueueDropNewest, unsigned decimation=2);
+  virtual ~SlsDetFrameQueue();
+
+  /* Takes over a reference to the frame, returning false if it was dropped */
+  virtual bool push(SlsDetFrame *frame);
+  virtual void pushMarker(int marker);
+  /* Waits up to timeout seconds, or for ever when negative, for the next
+   * entry: a frame, or NULL and the marker. Returns false on a timeout. */
+  virtual bool pop(SlsDetFrame **frame, int *marker, double timeout);
+
+  /* Frames over a smaller capacity are dropped, oldest first */
+  void setCapacity(unsigned capacity);
+  void setPolicy(SlsQueuePolicy policy, unsigned decimation);
+  unsigned capacity();
+  unsigned depth();
+  void getStats(SlsDetFrameQueueStats *stats);
+  void resetStats();
+
+  static const char* policyName(SlsQueuePolicy policy);
+
+private:
+  typedef struct {
+    SlsDetFrame *frame;
+    int         marker;
+  } SlsQueueEntry;
+
+  typedef std::vector<SlsQueueEntry> SlsEntryList;
+
+private:
+  /* These are called with the lock held */
+  bool full() const;
+  void append(SlsDetFrame *frame, int marker);
+  SlsDetFrame* dropOldest();
+
+private:
+  SlsEntryList    _entries;
+  size_t          _head;
+  size_t          _count;       /* entries, frames and markers */
+  unsigned        _frames;      /* frames among them */
+  unsigned        _capacity;
+  SlsQueuePolicy  _policy;
+  unsigned        _decimation;
+  unsigned        _skip;
+  SlsDetFrameQueueStats _stats;
+  epicsMutex      _lock;
+  epicsEvent      _notEmpty;
+  epicsEvent      _notFull;
+};
+
+/** Class definition for the SlsDetFrameStage class
+  *
+  * A SlsDetFrameQueue with a thread of its own that hands the frames on to a
+  * sink, so the thread that emits the frames only pays for queuing them and a
+  * slow sink is dealt with by the policy of the queue.
+  */
+class SlsDetFrameStage : public SlsDetFrameSink, public epicsThreadRunable {
+public:
+  /* portName is the port whose thread placement the stage follows */
+  SlsDetFrameStage(SlsDetFrameSink *sink, unsigned capacity, SlsQueuePolicy policy,
+                   const char *name, SlsThreadClass threadClass, const char *portName=NULL);
+  virtual ~SlsDetFrameStage();
+  virtual void run();
+
+  /* Queues the frame for the sink */
+  virtual void frameReady(SlsDetFrame *frame);
+
+  SlsDetFrameQueue* queue();
+
+private:
+  SlsDetFrameSink   *_sink;
+  SlsThreadClass    _threadClass;
+  const char        *_portName;
+  SlsDetFrameQueue  _queue;
+  epicsThread       _thread;
+};
+
+#endif
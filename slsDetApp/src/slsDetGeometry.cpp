@@ -0,0 +1,286 @@
+#include "slsDetGeometry.h"
+
+#include <algorithm>
+#include <cstring>
+
+/* Pixels between two chips, one for each of the double sized border pixels */
+#define CHIP_GAP 2
+
+/* The image pixel whose area a gap pixel belongs to, or the pixel itself */
+static size_t ownerOf(size_t pos, size_t chip, size_t gap)
+{
+  size_t period = chip + gap;
+  size_t offset = pos % period;
+
+  if (offset < chip) return pos;
+  /* The first half of the gap belongs to the chip before it, the rest to the next */
+  return (offset - chip) < gap / 2 ? pos - offset + chip - 1 : pos - offset + period;
+}
+
+SlsDetGeometry::SlsDetGeometry(int numModules, int modulesX, size_t moduleCols, size_t moduleRows,
+                               size_t chipCols, size_t chipRows, SlsGapMode gapMode) :
+  _numModules(numModules),
+  _modulesX(modulesX),
+  _modulesY((numModules + modulesX - 1) / modulesX),
+  _moduleCols(moduleCols),
+  _moduleRows(moduleRows),
+  /* A module that does not split evenly into chips is treated as a single chip */
+  _chipCols(chipCols && !(moduleCols % chipCols) ? chipCols : moduleCols),
+  _chipRows(chipRows && !(moduleRows % chipRows) ? chipRows : moduleRows),
+  _gapMode(gapMode),
+  _gapX(gapMode != SlsGapNone ? CHIP_GAP : 0),
+  _gapY(gapMode != SlsGapNone ? CHIP_GAP : 0)
+{
+  /* Index 1 is flipped in x and index 2 in y */
+  for (int flip=0; flip<4; flip++) {
+    compile(_maps[flip], flip & 1, flip & 2);
+  }
+  if (_gapMode == SlsGapSplit) {
+    compileBorders();
+  }
+}
+
+SlsDetGeometry::~SlsDetGeometry()
+{
+}
+
+int SlsDetGeometry::numModules() const
+{
+  return _numModules;
+}
+
+int SlsDetGeometry::modulesX() const
+{
+  return _modulesX;
+}
+
+int SlsDetGeometry::modulesY() const
+{
+  return _modulesY;
+}
+
+SlsGapMode SlsDetGeometry::gapMode() const
+{
+  return _gapMode;
+}
+
+size_t SlsDetGeometry::moduleCols() const
+{
+  return _moduleCols;
+}
+
+size_t SlsDetGeometry::moduleRows() const
+{
+  return _moduleRows;
+}
+
+size_t SlsDetGeometry::moduleSizeX() const
+{
+  return _moduleCols + _gapX * (_moduleCols / _chipCols - 1);
+}
+
+size_t SlsDetGeometry::moduleSizeY() const
+{
+  return _moduleRows + _gapY * (_moduleRows / _chipRows - 1);
+}
+
+size_t SlsDetGeometry::sizeX() const
+{
+  return _modulesX * moduleSizeX();
+}
+
+size_t SlsDetGeometry::sizeY() const
+{
+  return _modulesY * moduleSizeY();
+}
+
+size_t SlsDetGeometry::origin(size_t row, size_t col) const
+{
+  return row * moduleSizeY() * sizeX() + col * moduleSizeX();
+}
+
+const SlsModuleMap& SlsDetGeometry::map(bool flipX, bool flipY) const
+{
+  return _maps[(flipX ? 1 : 0) | (flipY ? 2 : 0)];
+}
+
+const std::vector<SlsBorderGroup>& SlsDetGeometry::borders() const
+{
+  return _borders;
+}
+
+size_t SlsDetGeometry::imageCol(size_t col) const
+{
+  return col + _gapX * (col / _chipCols);
+}
+
+size_t SlsDetGeometry::imageRow(size_t row) const
+{
+  return row + _gapY * (row / _chipRows);
+}
+
+void SlsDetGeometry::compile(SlsModuleMap &map, bool flipX, bool flipY)
+{
+  size_t stride = sizeX();
+  size_t modSizeX = moduleSizeX();
+  size_t modSizeY = moduleSizeY();
+
+  map.spans.clear();
+  map.fills.clear();
+
+  /* Each row of a chip stays contiguous whatever the gaps and flips */
+  for (size_t row=0; row<_moduleRows; row++) {
+    size_t dstRow = imageRow(flipY ? _moduleRows - 1 - row : row) * stride;
+    for (size_t col=0; col<_moduleCols; col+=_chipCols) {
+      SlsCopySpan span;
+      span.src = row * _moduleCols + col;
+      span.len = _chipCols;
+      span.reverse = flipX;
+      span.dst = dstRow + imageCol(flipX ? _moduleCols - col - _chipCols : col);
+
+      if (!map.spans.empty()) {
+        SlsCopySpan &last = map.spans.back();
+        if ((last.reverse == span.reverse) && (last.src + last.len == span.src)) {
+          if (!span.reverse && (last.dst + last.len == span.dst)) {
+            last.len += span.len;
+            continue;
+          }
+          if (span.reverse && (span.dst + span.len == last.dst)) {
+            last.dst = span.dst;
+            last.len += span.len;
+            continue;
+          }
+        }
+      }
+      map.spans.push_back(span);
+    }
+  }
+
+  if (_gapMode == SlsGapNone) return;
+
+  /* Every gap pixel takes the raw value of the border pixel it belongs to */
+  for (size_t y=0; y<modSizeY; y++) {
+    size_t ownerY = ownerOf(y, _chipRows, _gapY);
+    for (size_t x=0; x<modSizeX; x++) {
+      size_t ownerX = ownerOf(x, _chipCols, _gapX);
+      if ((ownerX == x) && (ownerY == y)) continue;
+
+      SlsFillPixel fill;
+      fill.dst = y * stride + x;
+      if (_gapMode == SlsGapZero) {
+        fill.src = SLS_FILL_ZERO;
+      } else {
+        size_t col = (ownerX / (_chipCols + _gapX)) * _chipCols + ownerX % (_chipCols + _gapX);
+        size_t row = (ownerY / (_chipRows + _gapY)) * _chipRows + ownerY % (_chipRows + _gapY);
+        if (flipX) col = _moduleCols - 1 - col;
+        if (flipY) row = _moduleRows - 1 - row;
+        fill.src = row * _moduleCols + col;
+      }
+      map.fills.push_back(fill);
+    }
+  }
+}
+
+void SlsDetGeometry::compileBorders()
+{
+  std::vector< std::pair<size_t, size_t> > owned;
+  size_t stride = sizeX();
+  size_t modSizeX = moduleSizeX();
+  size_t modSizeY = moduleSizeY();
+
+  /* The gaps are symmetric so the groups are the same for every flip */
+  for (size_t y=0; y<modSizeY; y++) {
+    size_t ownerY = ownerOf(y, _chipRows, _gapY);
+    for (size_t x=0; x<modSizeX; x++) {
+      size_t ownerX = ownerOf(x, _chipCols, _gapX);
+      if ((ownerX == x) && (ownerY == y)) continue;
+      owned.push_back(std::make_pair(ownerY * stride + ownerX, y * stride + x));
+    }
+  }
+  std::sort(owned.begin(), owned.end());
+
+  _borders.clear();
+  for (size_t n=0; n<owned.size(); n++) {
+    if (_borders.empty() || (_borders.back().pixel[0] != owned[n].first)) {
+      SlsBorderGroup group;
+      std::memset(&group, 0, sizeof(group));
+      group.pixel[0] = owned[n].first;
+      group.count = 1;
+      _borders.push_back(group);
+    }
+    SlsBorderGroup &group = _borders.back();
+    if (group.count < 4) {
+      group.pixel[group.count++] = owned[n].second;
+    }
+  }
+}
+
+void SlsDetGeometry::place(const SlsModuleMap &map, void *image, const void *raw,
+                           size_t numPixels, size_t bytesPerPixel)
+{
+  char *dst = (char *) image;
+  const char *src = (const char *) raw;
+
+  for (size_t n=0; n<map.spans.size(); n++) {
+    const SlsCopySpan &span = map.spans[n];
+    if (span.src >= numPixels) continue;
+    size_t len = span.src + span.len <= numPixels ? span.len : numPixels - span.src;
+
+    if (!span.reverse) {
+      std::memcpy(dst + span.dst * bytesPerPixel, src + span.src * bytesPerPixel, len * bytesPerPixel);
+    } else if (bytesPerPixel == 2) {
+      const epicsUInt16 *from = (const epicsUInt16 *) src + span.src;
+      epicsUInt16 *to = (epicsUInt16 *) dst + span.dst + span.len - 1;
+      for (size_t pix=0; pix<len; pix++) {
+        *(to - pix) = from[pix];
+      }
+    } else {
+      for (size_t pix=0; pix<len; pix++) {
+        std::memcpy(dst + (span.dst + span.len - 1 - pix) * bytesPerPixel,
+                    src + (span.src + pix) * bytesPerPixel, bytesPerPixel);
+      }
+    }
+  }
+
+  for (size_t n=0; n<map.fills.size(); n++) {
+    const SlsFillPixel &fill = map.fills[n];
+    if (fill.src == SLS_FILL_ZERO) {
+      std::memset(dst + fill.dst * bytesPerPixel, 0, bytesPerPixel);
+    } else if (fill.src < numPixels) {
+      std::memcpy(dst + fill.dst * bytesPerPixel, src + fill.src * bytesPerPixel, bytesPerPixel);
+    }
+  }
+}
+
+void SlsDetGeometry::splitFloat(float *image, size_t origin) const
+{
+  for (size_t n=0; n<_borders.size(); n++) {
+    const SlsBorderGroup &group = _borders[n];
+    float value = image[origin + group.pixel[0]] / group.count;
+    for (int pix=0; pix<group.count; pix++) {
+      image[origin + group.pixel[pix]] = value;
+    }
+  }
+}
+
+void SlsDetGeometry::splitInt16(epicsInt16 *image, size_t origin) const
+{
+  for (size_t n=0; n<_borders.size(); n++) {
+    const SlsBorderGroup &group = _borders[n];
+    int photons = image[origin + group.pixel[0]];
+    int share = photons / group.count;
+    int left = photons - share * group.count;
+    /* Hand out what does not divide evenly one photon at a time */
+    for (int pix=0; pix<group.count; pix++) {
+      int extra = 0;
+      if (left > 0) {
+        extra = 1;
+        left--;
+      } else if (left < 0) {
+        extra = -1;
+        left++;
+      }
+      image[origin + group.pixel[pix]] = (epicsInt16) (share + extra);
+    }
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef slsDetGeometry_H
+#define slsDetGeometry_H
+
+#include <epicsTypes.h>
+
+#include <stddef.h>
+#include <vector>
+
+/* How the pixels in the gaps between the chips are filled */
+typedef enum {
+  SlsGapNone,       /**< no gap pixels, the chips are packed side by side */
+  SlsGapZero,       /**< gap pixels are left at zero */
+  SlsGapDuplicate,  /**< gap pixels repeat the double sized border pixel next to them */
+  SlsGapSplit       /**< as duplicate, then converted values are shared out over the group */
+} SlsGapMode;
+
+/* Marks a fill that writes zero instead of copying a pixel */
+#define SLS_FILL_ZERO ((size_t) -1)
+
+/* A run of raw pixels copied to consecutive image pixels, in pixels */
+typedef struct {
+  size_t  src;      /**< first pixel in the raw module data */
+  size_t  dst;      /**< lowest image pixel written, from the module origin */
+  size_t  len;      /**< number of pixels */
+  bool    reverse;  /**< the run is written from the highest image pixel down */
+} SlsCopySpan;
+
+/* A single image pixel taken from a raw pixel or set to zero */
+typedef struct {
+  size_t  src;      /**< raw module pixel or SLS_FILL_ZERO */
+  size_t  dst;      /**< image pixel from the module origin */
+} SlsFillPixel;
+
+/* A border pixel and the gap pixels that share its area */
+typedef struct {
+  size_t  pixel[4]; /**< image pixels from the module origin, the border pixel first */
+  int     count;    /**< 2 next to one gap, 4 at a chip corner */
+} SlsBorderGroup;
+
+/* Everything needed to place the raw data of one module in the image */
+typedef struct {
+  std::vector<SlsCopySpan>  spans;
+  std::vector<SlsFillPixel> fills;
+} SlsModuleMap;
+
+/** Class definition for the SlsDetGeometry class
+  *
+  * Describes how the raw module data maps onto the detector image: the
+  * modules are laid out modulesX to a row, each module is split into chips
+  * that can have gap pixels between them, and a module can be flipped in x
+  * or y when it is mounted the other way round.
+  *
+  * The maps for the four flip combinations are compiled once, merging the
+  * pixels into the longest runs that stay contiguous in both the raw data and
+  * the image, so placing a module costs a few memcpy calls and a short list
+  * of gap pixels per frame whatever the geometry.
+  */
+class SlsDetGeometry {
+public:
+  SlsDetGeometry(int numModules, int modulesX, size_t moduleCols, size_t moduleRows,
+                 size_t chipCols, size_t chipRows, SlsGapMode gapMode);
+  virtual ~SlsDetGeometry();
+
+  int numModules() const;
+  int modulesX() const;
+  int modulesY() const;
+  SlsGapMode gapMode() const;
+  /* Size of the raw data of a module in pixels */
+  size_t moduleCols() const;
+  size_t moduleRows() const;
+  /* Size of a module in the image, including its gap pixels */
+  size_t moduleSizeX() const;
+  size_t moduleSizeY() const;
+  /* Size of the image */
+  size_t sizeX() const;
+  size_t sizeY() const;
+  /* Image pixel of the top left corner of the module at a row and column */
+  size_t origin(size_t row, size_t col) const;
+
+  const SlsModuleMap& map(bool flipX, bool flipY) const;
+  const std::vector<SlsBorderGroup>& borders() const;
+
+  /* Places raw module data using a map, stopping at numPixels of raw data */
+  static void place(const SlsModuleMap &map, void *image, const void *raw,
+                    size_t numPixels, size_t bytesPerPixel);
+  /* Shares the converted value of each border pixel out over its group */
+  virtual void splitFloat(float *image, size_t origin) const;
+  virtual void splitInt16(epicsInt16 *image, size_t origin) const;
+
+private:
+  size_t imageCol(size_t col) const;
+  size_t imageRow(size_t row) const;
+  void compile(SlsModuleMap &map, bool flipX, bool flipY);
+  void compileBorders();
+
+private:
+  const int                   _numModules;
+  const int                   _modulesX;
+  const int                   _modulesY;
+  const size_t                _moduleCols;
+  const size_t                _moduleRows;
+  const size_t                _chipCols;
+  const size_t                _chipRows;
+  const SlsGapMode            _gapMode;
+  const size_t                _gapX;
+  const size_t                _gapY;
+  SlsModuleMap                _maps[4];
+  std::vector<SlsBorderGroup> _borders;
+};
+
+#endif
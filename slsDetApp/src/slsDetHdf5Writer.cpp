@@ -0,0 +1,452 @@
+#include "slsDetHdf5Writer.h"
+#include "slsDetBitshuffle.h"
+
+#include <epicsStdio.h>
+
+#include <new>
+#include <cstring>
+
+/* How often the datasets are flushed for SWMR readers while frames come in */
+#define FLUSH_TIME 1.0
+/* Frames in a chunk of the header datasets */
+#define HEADER_CHUNK 1024
+
+SlsDetHdf5Writer::SlsDetHdf5Writer(unsigned queueDepth, int numThreads, unsigned framesPerChunk,
+                                   SlsCompressCodec codec, int level, const char *portName) :
+  SlsDetWriter(queueDepth, "h5", portName),
+  _framesPerChunk(framesPerChunk > 0 ? framesPerChunk : 1),
+  _compressor(numThreads, codec, level, portName),
+  _current(NULL),
+  _file(-1),
+  _data(-1),
+  _sizeX(0),
+  _sizeY(0),
+  _bytesPerPixel(0),
+  _photonEnergy(0.),
+  _numModules(0),
+  _framesWritten(0),
+  _failing(false)
+{
+  for (int n=0; n<SlsNumHeaders; n++) {
+    _headers[n] = -1;
+  }
+  epicsTimeGetCurrent(&_lastFlush);
+}
+
+SlsDetHdf5Writer::~SlsDetHdf5Writer()
+{
+  /* The writer thread closes the file with this class still in one piece */
+  shutdown();
+  for (unsigned n=0; n<_chunks.size(); n++) {
+    delete _chunks[n];
+  }
+}
+
+unsigned SlsDetHdf5Writer::framesPerChunk() const
+{
+  return _framesPerChunk;
+}
+
+int SlsDetHdf5Writer::numThreads() const
+{
+  return _compressor.numThreads();
+}
+
+SlsCompressCodec SlsDetHdf5Writer::codec() const
+{
+  return _compressor.codec();
+}
+
+SlsDetCompressor* SlsDetHdf5Writer::compressor()
+{
+  return &_compressor;
+}
+
+bool SlsDetHdf5Writer::openFile(const char *fileName, bool direct, bool *isDirect)
+{
+  hid_t fapl;
+
+  /* Errors are reported through the status instead of on the console */
+  H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+  /* SWMR needs the latest file format */
+  fapl = H5Pcreate(H5P_FILE_ACCESS);
+  H5Pset_libver_bounds(fapl, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+  _file = H5Fcreate(fileName, H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+  H5Pclose(fapl);
+  if (_file < 0) {
+    setStatus("Unable to create %s", fileName);
+    return false;
+  }
+
+  /* The datasets are made with the first frame, once its size is known */
+  *isDirect = false;
+  _data = -1;
+  _framesWritten = 0;
+  _failing = false;
+
+  return true;
+}
+
+hid_t SlsDetHdf5Writer::createHeader(hid_t group, const char *name, hid_t type, hsize_t columns)
+{
+  int rank = columns ? 2 : 1;
+  hsize_t dims[2] = { 0, columns };
+  hsize_t maxDims[2] = { H5S_UNLIMITED, columns };
+  hsize_t chunk[2] = { HEADER_CHUNK, columns };
+  hid_t space;
+  hid_t dcpl;
+  hid_t dataset;
+
+  space = H5Screate_simple(rank, dims, maxDims);
+  dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, rank, chunk);
+  dataset = H5Dcreate2(group, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  H5Pclose(dcpl);
+  H5Sclose(space);
+
+  return dataset;
+}
+
+bool SlsDetHdf5Writer::createDatasets(SlsDetFrame *frame)
+{
+  size_t frameSize = frame->sizeX * frame->sizeY * frame->bytesPerPixel;
+  hsize_t dims[3] = { 0, frame->sizeY, frame->sizeX };
+  hsize_t maxDims[3] = { H5S_UNLIMITED, frame->sizeY, frame->sizeX };
+  hsize_t chunk[3] = { _framesPerChunk, frame->sizeY, frame->sizeX };
+  hid_t type;
+  hid_t lcpl;
+  hid_t dcpl;
+  hid_t space;
+  hid_t group;
+  bool created;
+
+  switch (frame->bytesPerPixel) {
+  case 1:
+    type = H5T_NATIVE_UINT8;
+    break;
+  case 2:
+    type = H5T_NATIVE_UINT16;
+    break;
+  case 4:
+    type = H5T_NATIVE_UINT32;
+    break;
+  default:
+    setStatus("Unable to write %u byte pixels", (unsigned) frame->bytesPerPixel);
+    return false;
+  }
+
+  /* The chunk buffers follow the frame size */
+  if (_chunks.empty() || (_chunks[0]->frameSize != frameSize) ||
+      (_chunks[0]->elemSize != frame->bytesPerPixel)) {
+    for (unsigned n=0; n<_chunks.size(); n++) {
+      delete _chunks[n];
+    }
+    _chunks.clear();
+    _free.clear();
+    try {
+      /* Enough for every worker to have one chunk on the go and one waiting */
+      unsigned numChunks = 2 * _compressor.numThreads() + 2;
+      size_t bufferSize = SlsDetCompressor::bound(_compressor.codec(), frameSize * _framesPerChunk,
+                                                 frame->bytesPerPixel);
+      for (unsigned n=0; n<numChunks; n++) {
+        _chunks.push_back(new SlsDetChunk(frameSize, frame->bytesPerPixel, _framesPerChunk, bufferSize));
+        _free.push_back(_chunks.back());
+      }
+    } catch(...) {
+      setStatus("Unable to allocate the chunks of %u frames", _framesPerChunk);
+      return false;
+    }
+  }
+
+  _sizeX = frame->sizeX;
+  _sizeY = frame->sizeY;
+  _bytesPerPixel = frame->bytesPerPixel;
+  _numModules = frame->numModules > 0 ? frame->numModules : 1;
+  _photonEnergy = frame->photonEnergy;
+
+  lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+  dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl, 3, chunk);
+  if (_compressor.codec() == SlsCompressDeflate) {
+    H5Pset_deflate(dcpl, _compressor.level());
+  } else if (_compressor.codec() == SlsCompressBitshuffleLz4) {
+    /* Optional, so the dataset is created even without the filter plugin */
+    unsigned values[5] = { SLS_BSHUF_VERSION_MAJOR, SLS_BSHUF_VERSION_MINOR, (unsigned) frame->bytesPerPixel,
+                           (unsigned) slsDetBshufBlockSize(frame->bytesPerPixel), SLS_BSHUF_H5_COMPRESS_LZ4 };
+    H5Pset_filter(dcpl, SLS_BSHUF_H5_FILTER, H5Z_FLAG_OPTIONAL, 5, values);
+  }
+  space = H5Screate_simple(3, dims, maxDims);
+  _data = H5Dcreate2(_file, SLS_HDF5_DATA, type, space, lcpl, dcpl, H5P_DEFAULT);
+  H5Sclose(space);
+  H5Pclose(dcpl);
+
+  /* Photon counts only make sense with the energy they were counted at */
+  if ((_data >= 0) && (_photonEnergy > 0.)) {
+    hid_t attr;
+    space = H5Screate(H5S_SCALAR);
+    attr = H5Acreate2(_data, "photon_energy", H5T_NATIVE_DOUBLE, space, H5P_DEFAULT, H5P_DEFAULT);
+    if (attr >= 0) {
+      H5Awrite(attr, H5T_NATIVE_DOUBLE, &_photonEnergy);
+      H5Aclose(attr);
+    }
+    H5Sclose(space);
+  }
+
+  group = H5Gcreate2(_file, SLS_HDF5_HEADER_GROUP, lcpl, H5P_DEFAULT, H5P_DEFAULT);
+  H5Pclose(lcpl);
+  if (group >= 0) {
+    _headers[SlsHeaderFrameNumber] = createHeader(group, "frameNumber", H5T_NATIVE_UINT64, 0);
+    _headers[SlsHeaderTimestamp] = createHeader(group, "timestamp", H5T_NATIVE_UINT64, 0);
+    _headers[SlsHeaderBunchId] = createHeader(group, "bunchId", H5T_NATIVE_UINT64, 0);
+    _headers[SlsHeaderMissingMask] = createHeader(group, "missingMask", H5T_NATIVE_UINT64, 0);
+    _headers[SlsHeaderStorageCell] = createHeader(group, "storageCell", H5T_NATIVE_UINT64, 0);
+    _headers[SlsHeaderPacketsCaught] = createHeader(group, "packetsCaught", H5T_NATIVE_UINT32, _numModules);
+    if (_photonEnergy > 0.) {
+      _headers[SlsHeaderPhotonError] = createHeader(group, "photonError", H5T_NATIVE_DOUBLE, 0);
+    }
+    H5Gclose(group);
+  }
+
+  created = _data >= 0;
+  for (int n=0; n<SlsNumHeaders; n++) {
+    if ((_headers[n] < 0) && ((n != SlsHeaderPhotonError) || (_photonEnergy > 0.))) created = false;
+  }
+  /* Nothing can be added to the file once readers may be looking at it */
+  if (!created || (H5Fstart_swmr_write(_file) < 0)) {
+    setStatus("Unable to create the datasets for %lux%lu frames",
+              (unsigned long) _sizeX, (unsigned long) _sizeY);
+    closeDatasets();
+    return false;
+  }
+  epicsTimeGetCurrent(&_lastFlush);
+
+  return true;
+}
+
+void SlsDetHdf5Writer::closeDatasets()
+{
+  if (_data >= 0) {
+    H5Dclose(_data);
+    _data = -1;
+  }
+  for (int n=0; n<SlsNumHeaders; n++) {
+    if (_headers[n] >= 0) {
+      H5Dclose(_headers[n]);
+      _headers[n] = -1;
+    }
+  }
+}
+
+bool SlsDetHdf5Writer::appendHeader(hid_t dataset, hid_t type, hsize_t columns,
+                                    const void *values, hsize_t count)
+{
+  int rank = columns ? 2 : 1;
+  hsize_t dims[2] = { _framesWritten + count, columns };
+  hsize_t start[2] = { _framesWritten, 0 };
+  hsize_t size[2] = { count, columns };
+  hid_t fileSpace;
+  hid_t memSpace;
+  herr_t status;
+
+  if (H5Dset_extent(dataset, dims) < 0) return false;
+  fileSpace = H5Dget_space(dataset);
+  H5Sselect_hyperslab(fileSpace, H5S_SELECT_SET, start, NULL, size, NULL);
+  memSpace = H5Screate_simple(rank, size, NULL);
+  status = H5Dwrite(dataset, type, memSpace, fileSpace, H5P_DEFAULT, values);
+  H5Sclose(memSpace);
+  H5Sclose(fileSpace);
+
+  return status >= 0;
+}
+
+bool SlsDetHdf5Writer::writeChunk(SlsDetChunk *chunk)
+{
+  hsize_t count = chunk->frames.size();
+  hsize_t dims[3] = { _framesWritten + count, _sizeY, _sizeX };
+  hsize_t offset[3] = { _framesWritten, 0, 0 };
+  /* Bit 0 tells readers the chunk skipped the compression filter */
+  epicsUInt32 filterMask = (_compressor.codec() != SlsCompressNone) && !chunk->filtered ? 1 : 0;
+  size_t headerSize = count * (4 * sizeof(epicsUInt64) + _numModules * sizeof(epicsUInt32) +
+                               (_photonEnergy > 0. ? sizeof(double) : 0));
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  bool written;
+
+  _values.resize(count * _numModules);
+  epicsTimeGetCurrent(&start);
+  written = (H5Dset_extent(_data, dims) >= 0) &&
+            (H5Dwrite_chunk(_data, H5P_DEFAULT, filterMask, offset, chunk->outSize, chunk->out) >= 0);
+  for (int header=0; written && (header<SlsNumHeaders); header++) {
+    if (_headers[header] < 0) continue;
+    for (hsize_t n=0; n<count; n++) {
+      SlsDetFrame *frame = chunk->frames[n];
+      switch (header) {
+      case SlsHeaderFrameNumber:
+        _values[n] = frame->frameNumber;
+        break;
+      case SlsHeaderTimestamp:
+        _values[n] = frame->timestamp;
+        break;
+      case SlsHeaderBunchId:
+        _values[n] = frame->bunchId;
+        break;
+      case SlsHeaderMissingMask:
+        _values[n] = frame->missingMask;
+        break;
+      case SlsHeaderStorageCell:
+        _values[n] = frame->storageCell;
+        break;
+      case SlsHeaderPacketsCaught:
+        /* Packed as 32 bit rows of a column per module */
+        std::memcpy((epicsUInt32 *) &_values[0] + n * _numModules, frame->packetsCaught,
+                    _numModules * sizeof(epicsUInt32));
+        break;
+      case SlsHeaderPhotonError:
+        std::memcpy(&_values[n], &frame->photonError, sizeof(double));
+        break;
+      }
+    }
+    if (header == SlsHeaderPacketsCaught) {
+      written = appendHeader(_headers[header], H5T_NATIVE_UINT32, _numModules, &_values[0], count);
+    } else if (header == SlsHeaderPhotonError) {
+      written = appendHeader(_headers[header], H5T_NATIVE_DOUBLE, 0, &_values[0], count);
+    } else {
+      written = appendHeader(_headers[header], H5T_NATIVE_UINT64, 0, &_values[0], count);
+    }
+  }
+  epicsTimeGetCurrent(&end);
+
+  /* The next chunk keeps its place even if this one was lost */
+  _framesWritten += count;
+  if (!written) {
+    setStatus("Unable to write frames %llu to %llu",
+              (unsigned long long) chunk->frames.front()->frameNumber,
+              (unsigned long long) chunk->frames.back()->frameNumber);
+    framesFailed(count);
+    return false;
+  }
+  framesWritten(count, chunk->outSize + headerSize,
+                chunk->elapsed + epicsTimeDiffInSeconds(&end, &start));
+  /* Frames of a chunk share its size, they are found by their row */
+  for (hsize_t n=0; n<count; n++) {
+    indexFrame(chunk->frames[n], offset[0] + n, chunk->outSize);
+  }
+
+  if (epicsTimeDiffInSeconds(&end, &_lastFlush) >= FLUSH_TIME) {
+    flush();
+  }
+
+  return true;
+}
+
+SlsDetChunk* SlsDetHdf5Writer::takeChunk()
+{
+  SlsDetChunk *chunk;
+
+  if (_free.empty()) {
+    chunk = _pending.front();
+    _pending.pop_front();
+    chunk->done.wait();
+    writeChunk(chunk);
+    chunk->clear();
+    _free.push_back(chunk);
+  }
+  chunk = _free.back();
+  _free.pop_back();
+
+  return chunk;
+}
+
+void SlsDetHdf5Writer::writeChunks(bool wait)
+{
+  SlsDetChunk *chunk;
+
+  /* A chunk done out of turn waits for the ones before it */
+  while (!_pending.empty()) {
+    chunk = _pending.front();
+    if (wait) {
+      chunk->done.wait();
+    } else if (!chunk->done.tryWait()) {
+      break;
+    }
+    _pending.pop_front();
+    writeChunk(chunk);
+    chunk->clear();
+    _free.push_back(chunk);
+  }
+}
+
+bool SlsDetHdf5Writer::writeFrame(SlsDetFrame *frame)
+{
+  if (_data < 0) {
+    if (_failing || !createDatasets(frame)) {
+      _failing = true;
+      framesFailed(1);
+      return false;
+    }
+  }
+  if ((frame->sizeX != _sizeX) || (frame->sizeY != _sizeY) || (frame->bytesPerPixel != _bytesPerPixel) ||
+      (frame->photonEnergy != _photonEnergy)) {
+    setStatus("Frame %llu does not match the size of the file", (unsigned long long) frame->frameNumber);
+    framesFailed(1);
+    return false;
+  }
+
+  if (!_current) _current = takeChunk();
+  /* The chunk keeps the frame until it is in the file */
+  frame->reserve();
+  _current->add(frame);
+  if (_current->full()) {
+    _pending.push_back(_current);
+    _compressor.submit(_current);
+    _current = NULL;
+  }
+  writeChunks(false);
+
+  return true;
+}
+
+void SlsDetHdf5Writer::flush()
+{
+  if (_data >= 0) {
+    H5Dflush(_data);
+    for (int n=0; n<SlsNumHeaders; n++) {
+      if (_headers[n] >= 0) H5Dflush(_headers[n]);
+    }
+  }
+  epicsTimeGetCurrent(&_lastFlush);
+}
+
+int SlsDetHdf5Writer::fileFormat() const
+{
+  return slsReceiverDefs::HDF5;
+}
+
+void SlsDetHdf5Writer::idle()
+{
+  writeChunks(false);
+  flush();
+}
+
+void SlsDetHdf5Writer::closeFile()
+{
+  /* The last chunk goes out as it is, the dataset ends at its last frame */
+  if (_current) {
+    if (_current->frames.empty()) {
+      _free.push_back(_current);
+    } else {
+      _pending.push_back(_current);
+      _compressor.submit(_current);
+    }
+    _current = NULL;
+  }
+  writeChunks(true);
+
+  closeDatasets();
+  if (_file >= 0) {
+    H5Fclose(_file);
+    _file = -1;
+  }
+}
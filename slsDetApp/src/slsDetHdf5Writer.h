@@ -0,0 +1,100 @@
+#ifndef slsDetHdf5Writer_H
+#define slsDetHdf5Writer_H
+
+#include "slsDetWriter.h"
+#include "slsDetCompressor.h"
+
+#include <hdf5.h>
+
+#include <vector>
+#include <deque>
+
+/* Location of the images and the frame headers in the HDF5 files */
+#define SLS_HDF5_DATA         "/entry/data/data"
+#define SLS_HDF5_HEADER_GROUP "/entry/header"
+
+/** Class definition for the SlsDetHdf5Writer class
+  *
+  * Writes frames to HDF5 files, one 3D dataset of frames chunked framesPerChunk
+  * frames at a time. The chunks are compressed by a SlsDetCompressor in
+  * parallel and written in order with H5Dwrite_chunk, so the HDF5 library
+  * does no filtering or copying of its own. Bitshuffle/LZ4 chunks are stored
+  * for the HDF5 bitshuffle filter (id 32008), which readers need as a plugin.
+  * The frame number, timestamp, bunch id, missing modules and packets caught
+  * of every frame are written alongside as 1D datasets with one entry per
+  * frame. Files of photon counts also get the photon energy as an attribute
+  * of the data and the error of every frame.
+  *
+  * The files are written in SWMR mode: readers opening them with
+  * H5F_ACC_SWMR_READ see the frames appear while the file is still written.
+  * The datasets are flushed once a second and whenever the frames stop.
+  */
+class SlsDetHdf5Writer : public SlsDetWriter {
+public:
+  SlsDetHdf5Writer(unsigned queueDepth, int numThreads, unsigned framesPerChunk,
+                   SlsCompressCodec codec, int level, const char *portName=NULL);
+  virtual ~SlsDetHdf5Writer();
+
+  unsigned framesPerChunk() const;
+  int numThreads() const;
+  SlsCompressCodec codec() const;
+  SlsDetCompressor* compressor();
+
+protected:
+  virtual bool openFile(const char *fileName, bool direct, bool *isDirect);
+  virtual void closeFile();
+  virtual bool writeFrame(SlsDetFrame *frame);
+  virtual void idle();
+  virtual int fileFormat() const;
+
+  virtual bool createDatasets(SlsDetFrame *frame);
+  virtual bool writeChunk(SlsDetChunk *chunk);
+  virtual void flush();
+
+private:
+  /* Hands out a chunk, writing out the oldest one if they are all busy */
+  SlsDetChunk* takeChunk();
+  /* Writes the chunks that are compressed, in order, waiting for them if asked */
+  void writeChunks(bool wait);
+  void closeDatasets();
+  hid_t createHeader(hid_t group, const char *name, hid_t type, hsize_t columns);
+  bool appendHeader(hid_t dataset, hid_t type, hsize_t columns, const void *values, hsize_t count);
+
+private:
+  typedef std::vector<SlsDetChunk*> SlsChunkList;
+  typedef std::deque<SlsDetChunk*> SlsChunkQueue;
+
+  /* Datasets of the frame headers */
+  typedef enum {
+    SlsHeaderFrameNumber,
+    SlsHeaderTimestamp,
+    SlsHeaderBunchId,
+    SlsHeaderMissingMask,
+    SlsHeaderStorageCell,
+    SlsHeaderPacketsCaught,
+    SlsHeaderPhotonError,
+    SlsNumHeaders
+  } SlsHeaderDataset;
+
+private:
+  const unsigned    _framesPerChunk;
+  SlsDetCompressor  _compressor;
+  SlsChunkList      _chunks;
+  SlsChunkList      _free;
+  SlsChunkQueue     _pending;
+  SlsDetChunk       *_current;
+  hid_t             _file;
+  hid_t             _data;
+  hid_t             _headers[SlsNumHeaders];
+  size_t            _sizeX;
+  size_t            _sizeY;
+  size_t            _bytesPerPixel;
+  double            _photonEnergy;
+  int               _numModules;
+  hsize_t           _framesWritten;
+  bool              _failing;
+  epicsTimeStamp    _lastFlush;
+  std::vector<epicsUInt64> _values;
+};
+
+#endif
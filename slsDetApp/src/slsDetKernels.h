@@ -0,0 +1,85 @@
+#ifndef slsDetKernels_H
+#define slsDetKernels_H
+
+/*
+ * The vector kernels, each built in a source of its own with the -m flag of
+ * its instruction set (see slsDetCpu.h) and picked at run time by the module
+ * that uses it. A kernel source includes nothing but this header and the
+ * intrinsics, and this header only plain declarations: an inline function
+ * from another header would be compiled for the instruction set too, and the
+ * linker may keep that copy for the whole library, which then fails on hosts
+ * without it.
+ */
+
+#include "slsDetCalibration.h"
+
+#include <epicsTypes.h>
+
+#include <stddef.h>
+
+/* slsDetPacketLoss: the set bits of a packetsMask of words 64 bit words,
+ * words a multiple of 4 */
+extern unsigned slsDetPopcountPopcnt(const epicsUInt64 *mask, int words);
+extern unsigned slsDetPopcountAvx2(const epicsUInt64 *mask, int words);
+
+/* slsDetConverter: limits of the photon counts so the rounding saturates like the vector packs */
+#define SLS_PHOTONS_MIN -32768.0f
+#define SLS_PHOTONS_MAX 32767.0f
+
+/* Arguments of a conversion kernel for one block of pixels */
+typedef struct {
+  const epicsUInt16 *raw;
+  const float       *ped[SLS_NUM_GAINS];
+  const float       *gain[SLS_NUM_GAINS];
+  float             scale;
+  float             *energy;
+  epicsInt16        *photons;
+  size_t            n;
+} SlsConvertArgs;
+
+/* Converts the pixels from start on; the generic kernel also does the tail of the others */
+extern void slsDetConvertGeneric(const SlsConvertArgs &args, size_t start);
+extern void slsDetConvertSse41(const SlsConvertArgs &args, size_t start);
+extern void slsDetConvertAvx2(const SlsConvertArgs &args, size_t start);
+
+/* slsDetPedestal: adds the pixels of raw in the gain stage gain from start on
+ * to the Welford sums; the generic kernel also does the tail of the others */
+extern void slsDetWelfordGeneric(const epicsUInt16 *raw, int gain, float *count,
+                                 float *mean, float *m2, size_t start, size_t n);
+extern void slsDetWelfordAvx2(const epicsUInt16 *raw, int gain, float *count,
+                              float *mean, float *m2, size_t start, size_t n);
+
+/* slsDetDrift: moves the gain 0 pedestals from start on by alpha towards the
+ * raw values within threshold; the generic kernel also does the tail of the others */
+extern void slsDetEmaGeneric(const epicsUInt16 *raw, float *ped, const float *threshold,
+                             float alpha, size_t start, size_t n);
+extern void slsDetEmaAvx2(const epicsUInt16 *raw, float *ped, const float *threshold,
+                          float alpha, size_t start, size_t n);
+
+/* slsDetBitshuffle: writes bit n of the size elements of elemSize bytes to
+ * row n of out, size a multiple of SLS_SHUFFLE_MULT; the vector kernels only
+ * take 2 byte elements and hand the others to the generic one */
+#define SLS_SHUFFLE_MULT 8
+extern void slsDetShuffleGeneric(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize);
+extern void slsDetShuffleSse2(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize);
+extern void slsDetShuffleAvx2(const unsigned char *in, unsigned char *out, size_t size, size_t elemSize);
+
+/* slsDetQuantizer: what the error of a block of pixels adds up to */
+typedef struct {
+  double      sumSq;
+  double      maxError;
+  epicsUInt64 photons;
+} SlsQuantizeSums;
+
+/* Most photons a pixel can count */
+#define SLS_COUNTS_MAX 65535.0f
+
+/* Turns the energies from start on into counts of (energy * scale + offset)
+ * photons and adds their error to sums; the generic kernel also does the tail
+ * of the others */
+extern void slsDetQuantizeGeneric(const float *energy, epicsUInt16 *counts, size_t start, size_t n,
+                                  float scale, float offset, float photonEnergy, SlsQuantizeSums *sums);
+extern void slsDetQuantizeAvx2(const float *energy, epicsUInt16 *counts, size_t start, size_t n,
+                               float scale, float offset, float photonEnergy, SlsQuantizeSums *sums);
+
+#endif
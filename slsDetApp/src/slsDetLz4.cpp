@@ -0,0 +1,211 @@
+#include "slsDetLz4.h"
+
+#include <epicsTypes.h>
+
+#include <cstring>
+
+/* Limits of the block format */
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MF_LIMIT 12
+#define MAX_DISTANCE 65535
+#define RUN_MASK 15
+/* 4k entries of the match finder, small enough to stay in L1 */
+#define HASH_LOG 12
+/* Every 64 misses in a row the search skips one more byte */
+#define SKIP_SHIFT 6
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define FAST_MATCH 1
+#endif
+
+typedef unsigned char byte;
+
+static inline epicsUInt32 read32(const byte *p)
+{
+  epicsUInt32 value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline unsigned hash4(epicsUInt32 value)
+{
+  return (value * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* Length of the common run of two positions, stopping at limit */
+static inline size_t matchLength(const byte *p, const byte *ref, const byte *limit)
+{
+  const byte *start = p;
+#ifdef FAST_MATCH
+  while (p + 8 <= limit) {
+    epicsUInt64 a;
+    epicsUInt64 b;
+    std::memcpy(&a, p, sizeof(a));
+    std::memcpy(&b, ref, sizeof(b));
+    if (a != b) return p - start + (__builtin_ctzll(a ^ b) >> 3);
+    p += 8;
+    ref += 8;
+  }
+#endif
+  while ((p < limit) && (*p == *ref)) {
+    p++;
+    ref++;
+  }
+  return p - start;
+}
+
+/* Writes the remainder of a length that did not fit in its token nibble */
+static inline byte* writeLength(byte *op, size_t length)
+{
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (byte) length;
+  return op;
+}
+
+size_t slsDetLz4Compress(const void *src, void *dst, size_t size, size_t capacity)
+{
+  const byte *base = (const byte *) src;
+  const byte *ip = base;
+  const byte *anchor = base;
+  const byte *iend = base + size;
+  const byte *mflimit = iend - MF_LIMIT;
+  const byte *matchlimit = iend - LAST_LITERALS;
+  byte *op = (byte *) dst;
+  byte *oend = op + capacity;
+  epicsUInt32 table[1 << HASH_LOG];
+  size_t literals;
+  byte *token;
+
+  if (size > SLS_LZ4_MAX_INPUT) return 0;
+
+  /* Inputs too short for a match are all literals */
+  if (size > MF_LIMIT) {
+    std::memset(table, 0, sizeof(table));
+    size_t misses = 1 << SKIP_SHIFT;
+    ip++;
+    while (ip <= mflimit) {
+      const byte *ref;
+      size_t step = misses++ >> SKIP_SHIFT;
+      epicsUInt32 sequence = read32(ip);
+      unsigned h = hash4(sequence);
+
+      ref = base + table[h];
+      table[h] = (epicsUInt32) (ip - base);
+      if ((ref >= ip) || (ip - ref > MAX_DISTANCE) || (read32(ref) != sequence)) {
+        ip += step;
+        continue;
+      }
+
+      /* The match may start in the literals before it */
+      while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+        ip--;
+        ref--;
+      }
+      size_t match = matchLength(ip + MIN_MATCH, ref + MIN_MATCH, matchlimit);
+      literals = ip - anchor;
+
+      if (op + 1 + literals + literals / 255 + 1 + 2 + match / 255 + 1 > oend) return 0;
+      token = op++;
+      if (literals >= RUN_MASK) {
+        *token = RUN_MASK << 4;
+        op = writeLength(op, literals - RUN_MASK);
+      } else {
+        *token = (byte) (literals << 4);
+      }
+      std::memcpy(op, anchor, literals);
+      op += literals;
+
+      size_t offset = ip - ref;
+      *op++ = (byte) offset;
+      *op++ = (byte) (offset >> 8);
+      if (match >= RUN_MASK) {
+        *token |= RUN_MASK;
+        op = writeLength(op, match - RUN_MASK);
+      } else {
+        *token |= (byte) match;
+      }
+
+      ip += match + MIN_MATCH;
+      anchor = ip;
+      misses = 1 << SKIP_SHIFT;
+      /* Remember a position inside the match to find the next one sooner */
+      if (ip <= mflimit) table[hash4(read32(ip - 2))] = (epicsUInt32) (ip - 2 - base);
+    }
+  }
+
+  /* The block always ends with literals */
+  literals = iend - anchor;
+  if (op + 1 + literals + (literals + 255 - RUN_MASK) / 255 > oend) return 0;
+  token = op++;
+  if (literals >= RUN_MASK) {
+    *token = RUN_MASK << 4;
+    op = writeLength(op, literals - RUN_MASK);
+  } else {
+    *token = (byte) (literals << 4);
+  }
+  std::memcpy(op, anchor, literals);
+  op += literals;
+
+  return op - (byte *) dst;
+}
+
+long slsDetLz4Decompress(const void *src, void *dst, size_t size, size_t capacity)
+{
+  const byte *ip = (const byte *) src;
+  const byte *iend = ip + size;
+  byte *op = (byte *) dst;
+  byte *ostart = op;
+  byte *oend = op + capacity;
+  size_t length;
+  byte extra;
+
+  while (ip < iend) {
+    byte token = *ip++;
+
+    length = token >> 4;
+    if (length == RUN_MASK) {
+      do {
+        if (ip >= iend) return -1;
+        extra = *ip++;
+        length += extra;
+      } while (extra == 255);
+    }
+    if ((length > (size_t) (iend - ip)) || (length > (size_t) (oend - op))) return -1;
+    std::memcpy(op, ip, length);
+    op += length;
+    ip += length;
+    /* Only the last sequence has no match */
+    if (ip == iend) break;
+
+    if (iend - ip < 2) return -1;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if ((offset == 0) || (offset > (size_t) (op - ostart))) return -1;
+
+    length = token & RUN_MASK;
+    if (length == RUN_MASK) {
+      do {
+        if (ip >= iend) return -1;
+        extra = *ip++;
+        length += extra;
+      } while (extra == 255);
+    }
+    length += MIN_MATCH;
+    if (length > (size_t) (oend - op)) return -1;
+
+    /* Matches may overlap what they produce, so copy forwards a byte at a time */
+    const byte *match = op - offset;
+    if (offset >= length) {
+      std::memcpy(op, match, length);
+      op += length;
+    } else {
+      while (length--) *op++ = *match++;
+    }
+  }
+
+  return op - ostart;
+}
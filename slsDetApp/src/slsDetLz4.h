@@ -0,0 +1,23 @@
+#ifndef slsDetLz4_H
+#define slsDetLz4_H
+
+#include <stddef.h>
+
+/*
+ * A compact implementation of the LZ4 block format (not the frame format),
+ * the codec the HDF5 bitshuffle filter uses for each of its blocks. The
+ * output can be read by LZ4_decompress_safe() of the reference library and
+ * the decompressor reads anything the reference compressors write.
+ */
+
+/* Largest input the block format allows */
+#define SLS_LZ4_MAX_INPUT 0x7E000000
+/* Worst case size of a compressed block, when nothing matches */
+#define SLS_LZ4_BOUND(size) ((size) + (size) / 255 + 16)
+
+/* Returns the compressed size, or 0 if it does not fit in capacity */
+extern size_t slsDetLz4Compress(const void *src, void *dst, size_t size, size_t capacity);
+/* Returns the decompressed size, or -1 if the input is malformed or does not fit */
+extern long slsDetLz4Decompress(const void *src, void *dst, size_t size, size_t capacity);
+
+#endif
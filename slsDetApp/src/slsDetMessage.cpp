@@ -44,6 +44,10 @@ std::string SlsDetMessage::messageType(MessageType mtype)
   ENUM_TO_STR(WriteClockDivider);
   ENUM_TO_STR(ReadGainMode);
   ENUM_TO_STR(WriteGainMode);
+  ENUM_TO_STR(ReadStorageCells);
+  ENUM_TO_STR(WriteStorageCells);
+  ENUM_TO_STR(ReadStorageCellStart);
+  ENUM_TO_STR(WriteStorageCellStart);
   default:
     return std::string("Unknown");
   }
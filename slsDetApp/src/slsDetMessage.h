@@ -41,7 +41,11 @@ public:
     ReadClockDivider,
     WriteClockDivider,
     ReadGainMode,
-    WriteGainMode
+    WriteGainMode,
+    ReadStorageCells,
+    WriteStorageCells,
+    ReadStorageCellStart,
+    WriteStorageCellStart
   } MessageType;
 
   /** Data types used by SlsDetDriver**/
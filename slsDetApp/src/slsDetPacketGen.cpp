@@ -0,0 +1,449 @@
+/* Sends the UDP packets of Jungfrau modules to receivers, to load them
+ * without a detector, e.g.
+ *   slsDetPacketGen -m 2 -r 1000 -n 10000
+ *   slsDetPacketGen -H 10.0.0.2 -m 4 -x 2 -r 2000 -b 10 -d 0.001 -o 0.01 -c 2,3,4,5
+ * Module k goes to port+k of the host, each from its own thread, with the
+ * sls_detector_header in front of the data of every packet as the detector
+ * sends it. Packets can be dropped or swapped with the next one of the frame
+ * on purpose, and frames sent in bursts at the same mean rate. */
+
+#include <sls_receiver_defs.h>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* A Jungfrau module sends a frame as 128 packets of 8 kB */
+#define PACKETS_PER_FRAME 128
+#define PACKET_DATA 8192
+#define MODULE_COLS 1024
+
+#define THREAD_TMO 5.0
+/* Asked for, the kernel may give less */
+#define SOCKET_BUFFER (8 * 1024 * 1024)
+/* How long the clock is trusted to sleep, shorter waits spin */
+#define MIN_SLEEP 0.0005
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stopHandler(int sig)
+{
+  stopping = 1;
+}
+
+/** Counters kept by each module */
+typedef struct {
+  epicsUInt64 frames;     /**< frames sent, complete or not */
+  epicsUInt64 packets;    /**< packets sent */
+  epicsUInt64 bytes;      /**< bytes sent, headers included */
+  epicsUInt64 dropped;    /**< packets left out on purpose */
+  epicsUInt64 reordered;  /**< packets swapped with the next one */
+  epicsUInt64 failed;     /**< packets the socket refused */
+} PacketStats;
+
+typedef struct {
+  const char  *host;
+  int         port;
+  int         numModules;
+  int         numModulesX;
+  double      rate;
+  epicsUInt64 numFrames;
+  epicsUInt64 firstFrame;
+  unsigned    burst;
+  double      drop;
+  double      reorder;
+} PacketConfig;
+
+/** Sends the packets of one module from its own thread */
+class PacketSource : public epicsThreadRunable {
+public:
+  PacketSource(const PacketConfig &config, int module, int cpu) :
+    _config(config), _module(module), _cpu(cpu), _fd(-1), _random(0x9e3779b97f4a7c15ULL + module),
+    _data(PACKET_DATA * PACKETS_PER_FRAME),
+    _thread(*this, "slsDetPacketGen", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityHigh)
+  {
+    std::memset(&_stats, 0, sizeof(_stats));
+    /* Rows of a gradient that moves with the module, so its place can be checked */
+    epicsUInt16 *pixels = (epicsUInt16 *) &_data[0];
+    for (size_t pix=0; pix<_data.size() / 2; pix++) {
+      pixels[pix] = (epicsUInt16) ((pix % MODULE_COLS) + module * 100);
+    }
+  }
+
+  virtual ~PacketSource()
+  {
+    if (_fd >= 0) close(_fd);
+  }
+
+  bool connect(char *error, size_t size)
+  {
+    struct addrinfo hints;
+    struct addrinfo *addr;
+    char port[16];
+    int bufferSize = SOCKET_BUFFER;
+    int status;
+
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    epicsSnprintf(port, sizeof(port), "%d", _config.port + _module);
+    status = getaddrinfo(_config.host, port, &hints, &addr);
+    if (status) {
+      epicsSnprintf(error, size, "Unable to find %s: %s", _config.host, gai_strerror(status));
+      return false;
+    }
+    _fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    /* Connected, so every send goes to the same receiver without a lookup */
+    if ((_fd < 0) || ::connect(_fd, addr->ai_addr, addr->ai_addrlen)) {
+      epicsSnprintf(error, size, "Unable to connect to %s:%s: %s", _config.host, port, strerror(errno));
+      freeaddrinfo(addr);
+      return false;
+    }
+    freeaddrinfo(addr);
+    setsockopt(_fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+
+    return true;
+  }
+
+  void start()
+  {
+    _thread.start();
+  }
+
+  void wait()
+  {
+    _thread.exitWait(THREAD_TMO);
+  }
+
+  void getStats(PacketStats *stats)
+  {
+    _lock.lock();
+    *stats = _stats;
+    _lock.unlock();
+  }
+
+  virtual void run()
+  {
+    slsReceiverDefs::sls_detector_header headers[PACKETS_PER_FRAME];
+    struct iovec iov[PACKETS_PER_FRAME][2];
+    int order[PACKETS_PER_FRAME];
+    epicsTimeStamp start;
+    epicsTimeStamp now;
+    double period = _config.rate > 0. ? _config.burst / _config.rate : 0.;
+    double ahead;
+    epicsUInt64 bursts = 0;
+    PacketStats frame;
+
+#ifdef __linux__
+    if (_cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(_cpu, &cpus);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+        fprintf(stderr, "module %d: unable to pin to core %d\n", _module, _cpu);
+      }
+    }
+#endif
+
+    std::memset(headers, 0, sizeof(headers));
+    for (int packet=0; packet<PACKETS_PER_FRAME; packet++) {
+      headers[packet].packetNumber = packet;
+      headers[packet].modId = _module;
+      headers[packet].row = _module / _config.numModulesX;
+      headers[packet].column = _module % _config.numModulesX;
+      headers[packet].detType = slsReceiverDefs::JUNGFRAU;
+      headers[packet].version = SLS_DETECTOR_HEADER_VERSION;
+    }
+
+    epicsTimeGetCurrent(&start);
+    for (epicsUInt64 frameIndex=0; !stopping && (!_config.numFrames || (frameIndex < _config.numFrames));
+         frameIndex++) {
+      /* Bursts go out back to back on a fixed schedule so the mean rate does not drift */
+      if ((period > 0.) && (frameIndex % _config.burst == 0)) {
+        while (!stopping) {
+          epicsTimeGetCurrent(&now);
+          ahead = bursts * period - epicsTimeDiffInSeconds(&now, &start);
+          if (ahead <= 0.) break;
+          if (ahead > MIN_SLEEP) epicsThreadSleep(ahead - MIN_SLEEP);
+        }
+        bursts++;
+      }
+
+      epicsTimeGetCurrent(&now);
+      std::memset(&frame, 0, sizeof(frame));
+      int numPackets = 0;
+      for (int packet=0; packet<PACKETS_PER_FRAME; packet++) {
+        if ((_config.drop > 0.) && (uniform() < _config.drop)) {
+          frame.dropped++;
+          continue;
+        }
+        order[numPackets++] = packet;
+      }
+      for (int n=0; n+1<numPackets; n++) {
+        if ((_config.reorder > 0.) && (uniform() < _config.reorder)) {
+          int packet = order[n];
+          order[n] = order[n+1];
+          order[n+1] = packet;
+          frame.reordered++;
+          n++;
+        }
+      }
+
+      for (int n=0; n<numPackets; n++) {
+        slsReceiverDefs::sls_detector_header *header = &headers[order[n]];
+        header->frameNumber = _config.firstFrame + frameIndex;
+        header->bunchId = _config.firstFrame + frameIndex;
+        /* The detector clock runs at 10 MHz */
+        header->timestamp = (epicsUInt64) (epicsTimeDiffInSeconds(&now, &start) * 1.e7);
+        iov[n][0].iov_base = header;
+        iov[n][0].iov_len = sizeof(*header);
+        iov[n][1].iov_base = &_data[order[n] * PACKET_DATA];
+        iov[n][1].iov_len = PACKET_DATA;
+      }
+      send(iov, numPackets, &frame);
+      frame.frames = 1;
+
+      _lock.lock();
+      _stats.frames += frame.frames;
+      _stats.packets += frame.packets;
+      _stats.bytes += frame.bytes;
+      _stats.dropped += frame.dropped;
+      _stats.reordered += frame.reordered;
+      _stats.failed += frame.failed;
+      _lock.unlock();
+    }
+  }
+
+private:
+  /* xorshift64*, good enough to pick packets and cheap enough for every one */
+  double uniform()
+  {
+    _random ^= _random >> 12;
+    _random ^= _random << 25;
+    _random ^= _random >> 27;
+    return ((_random * 2685821657736338717ULL) >> 11) * (1. / 9007199254740992.);
+  }
+
+  void send(struct iovec (*iov)[2], int numPackets, PacketStats *frame)
+  {
+#ifdef __linux__
+    /* One system call for the whole frame */
+    struct mmsghdr msgs[PACKETS_PER_FRAME];
+    int sent = 0;
+    int status;
+
+    std::memset(msgs, 0, sizeof(msgs));
+    for (int n=0; n<numPackets; n++) {
+      msgs[n].msg_hdr.msg_iov = iov[n];
+      msgs[n].msg_hdr.msg_iovlen = 2;
+    }
+    while (sent < numPackets) {
+      status = sendmmsg(_fd, msgs + sent, numPackets - sent, 0);
+      if (status < 0) {
+        if (errno == EINTR) continue;
+        /* A receiver that is not listening yet refuses the packet, the rest still go */
+        frame->failed++;
+        sent++;
+        continue;
+      }
+      for (int n=sent; n<sent+status; n++) {
+        frame->packets++;
+        frame->bytes += msgs[n].msg_len;
+      }
+      sent += status;
+    }
+#else
+    struct msghdr msg;
+
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iovlen = 2;
+    for (int n=0; n<numPackets; n++) {
+      ssize_t status;
+      msg.msg_iov = iov[n];
+      status = sendmsg(_fd, &msg, 0);
+      if (status < 0) {
+        frame->failed++;
+      } else {
+        frame->packets++;
+        frame->bytes += status;
+      }
+    }
+#endif
+  }
+
+private:
+  const PacketConfig  &_config;
+  const int           _module;
+  const int           _cpu;
+  int                 _fd;
+  epicsUInt64         _random;
+  std::vector<char>   _data;
+  PacketStats         _stats;
+  epicsMutex          _lock;
+  epicsThread         _thread;
+};
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-H host=127.0.0.1] [-p port=%d] [-m modules=1] [-x modules per row=1]\n"
+          "          [-r frames/s=0 for no limit] [-n frames=0 until interrupted] [-f first frame=1]\n"
+          "          [-b frames per burst=1] [-d fraction dropped=0] [-o fraction reordered=0]\n"
+          "          [-c cores, one per module] [-t seconds between reports=1]\n",
+          prog, DEFAULT_UDP_PORTNO);
+}
+
+/* Core n of a list separated by commas, -1 past its end */
+static int listCore(const char *list, int n)
+{
+  for (int index=0; list && *list; index++) {
+    if (index == n) return std::atoi(list);
+    list = std::strchr(list, ',');
+    if (list) list++;
+  }
+  return -1;
+}
+
+static void sumStats(std::vector<PacketSource*> &sources, PacketStats *total)
+{
+  PacketStats stats;
+
+  std::memset(total, 0, sizeof(*total));
+  for (size_t n=0; n<sources.size(); n++) {
+    sources[n]->getStats(&stats);
+    total->frames += stats.frames;
+    total->packets += stats.packets;
+    total->bytes += stats.bytes;
+    total->dropped += stats.dropped;
+    total->reordered += stats.reordered;
+    total->failed += stats.failed;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  PacketConfig config;
+  const char *cores = NULL;
+  double interval = 1.0;
+  std::vector<PacketSource*> sources;
+  PacketStats last;
+  PacketStats total;
+  epicsTimeStamp start;
+  epicsTimeStamp lastReport;
+  epicsTimeStamp now;
+  char error[256];
+  double elapsed;
+  int opt;
+
+  config.host = "127.0.0.1";
+  config.port = DEFAULT_UDP_PORTNO;
+  config.numModules = 1;
+  config.numModulesX = 1;
+  config.rate = 0.;
+  config.numFrames = 0;
+  config.firstFrame = 1;
+  config.burst = 1;
+  config.drop = 0.;
+  config.reorder = 0.;
+
+  while ((opt = getopt(argc, argv, "H:p:m:x:r:n:f:b:d:o:c:t:")) != -1) {
+    switch (opt) {
+    case 'H': config.host = optarg; break;
+    case 'p': config.port = std::atoi(optarg); break;
+    case 'm': config.numModules = std::atoi(optarg); break;
+    case 'x': config.numModulesX = std::atoi(optarg); break;
+    case 'r': config.rate = std::atof(optarg); break;
+    case 'n': config.numFrames = std::strtoull(optarg, NULL, 10); break;
+    case 'f': config.firstFrame = std::strtoull(optarg, NULL, 10); break;
+    case 'b': config.burst = std::atoi(optarg); break;
+    case 'd': config.drop = std::atof(optarg); break;
+    case 'o': config.reorder = std::atof(optarg); break;
+    case 'c': cores = optarg; break;
+    case 't': interval = std::atof(optarg); break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if ((config.numModules < 1) || (config.numModulesX < 1) || (config.numModulesX > config.numModules) ||
+      (config.numModules % config.numModulesX) || (config.burst < 1) || (config.port < 1) ||
+      (config.drop < 0.) || (config.drop > 1.) || (config.reorder < 0.) || (config.reorder > 1.) ||
+      (interval <= 0.) || (optind < argc)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  for (int mod=0; mod<config.numModules; mod++) {
+    sources.push_back(new PacketSource(config, mod, listCore(cores, mod)));
+    if (!sources.back()->connect(error, sizeof(error))) {
+      fprintf(stderr, "%s\n", error);
+      return 1;
+    }
+  }
+
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+  printf("%d modules to %s:%d-%d, %s, %u frames per burst, %.3f%% dropped, %.3f%% reordered\n",
+         config.numModules, config.host, config.port, config.port + config.numModules - 1,
+         config.rate > 0. ? "paced" : "unpaced", config.burst, config.drop * 100., config.reorder * 100.);
+
+  epicsTimeGetCurrent(&start);
+  lastReport = start;
+  std::memset(&last, 0, sizeof(last));
+  for (size_t n=0; n<sources.size(); n++) {
+    sources[n]->start();
+  }
+
+  /* Report until every module has sent its frames */
+  while (true) {
+    epicsThreadSleep(interval);
+    epicsTimeGetCurrent(&now);
+    sumStats(sources, &total);
+    elapsed = epicsTimeDiffInSeconds(&now, &lastReport);
+    printf("%.0f frames/s, %.0f packets/s, %.1f MB/s, %llu dropped, %llu reordered, %llu failed\n",
+           (total.frames - last.frames) / elapsed / config.numModules,
+           (total.packets - last.packets) / elapsed, (total.bytes - last.bytes) / elapsed / 1.e6,
+           (unsigned long long) total.dropped, (unsigned long long) total.reordered,
+           (unsigned long long) total.failed);
+    fflush(stdout);
+    last = total;
+    lastReport = now;
+    if (stopping) break;
+    if (config.numFrames && (total.frames >= config.numFrames * config.numModules)) break;
+  }
+
+  stopping = 1;
+  for (size_t n=0; n<sources.size(); n++) {
+    sources[n]->wait();
+  }
+  epicsTimeGetCurrent(&now);
+  sumStats(sources, &total);
+  elapsed = epicsTimeDiffInSeconds(&now, &start);
+  printf("total: %llu frames of each module, %llu packets in %.2f s, %.0f packets/s, %.1f MB/s\n",
+         (unsigned long long) (total.frames / config.numModules), (unsigned long long) total.packets,
+         elapsed, total.packets / elapsed, total.bytes / elapsed / 1.e6);
+
+  for (size_t n=0; n<sources.size(); n++) {
+    delete sources[n];
+  }
+
+  return 0;
+}
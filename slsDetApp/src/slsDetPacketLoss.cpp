@@ -0,0 +1,207 @@
+#include "slsDetPacketLoss.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+
+#include <epicsThread.h>
+
+#include <cstring>
+
+#define MASK_WORDS (MAX_NUM_PACKETS / 64)
+
+/* The packetsMask is read as whole 64 bit words, as laid out by libstdc++ */
+typedef char packetsMaskSizeCheck[(sizeof(slsReceiverDefs::sls_bitset) == MASK_WORDS * sizeof(epicsUInt64)) ? 1 : -1];
+
+typedef unsigned (*popcountFunc)(const epicsUInt64 *mask, int words);
+
+static unsigned popcountGeneric(const epicsUInt64 *mask, int words)
+{
+  unsigned count = 0;
+  for (int n=0; n<words; n++) {
+    epicsUInt64 v = mask[n];
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    count += (unsigned) ((v * 0x0101010101010101ULL) >> 56);
+  }
+  return count;
+}
+
+static popcountFunc popcount = popcountGeneric;
+static const char *popcountName = "generic";
+static epicsThreadOnceId popcountOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectPopcount(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    popcount = slsDetPopcountAvx2;
+    popcountName = slsDetCpuFeatureName(SlsCpuAvx2);
+    return;
+  }
+#endif
+#ifdef SLS_CPU_POPCNT
+  if (slsDetCpuHas(SlsCpuPopcnt)) {
+    popcount = slsDetPopcountPopcnt;
+    popcountName = slsDetCpuFeatureName(SlsCpuPopcnt);
+  }
+#endif
+}
+
+static inline const epicsUInt64* maskWords(const slsReceiverDefs::sls_receiver_header *header)
+{
+  return (const epicsUInt64 *) &header->packetsMask;
+}
+
+SlsDetPacketLoss::SlsDetPacketLoss(unsigned packetsPerFrame, double updatePeriod) :
+  _packetsPerFrame(packetsPerFrame < MAX_NUM_PACKETS ? packetsPerFrame : MAX_NUM_PACKETS),
+  _updatePeriod(updatePeriod)
+{
+  epicsThreadOnce(&popcountOnce, selectPopcount, NULL);
+  reset();
+}
+
+SlsDetPacketLoss::~SlsDetPacketLoss() {}
+
+unsigned SlsDetPacketLoss::packetsPerFrame() const
+{
+  return _packetsPerFrame;
+}
+
+unsigned SlsDetPacketLoss::packetsCaught(const slsReceiverDefs::sls_receiver_header *header)
+{
+  /* The kernel is picked by the first accountant created, until then the
+   * generic one is used rather than taking the once lock for every frame */
+  return popcount(maskWords(header), MASK_WORDS);
+}
+
+const char* SlsDetPacketLoss::kernelName()
+{
+  epicsThreadOnce(&popcountOnce, selectPopcount, NULL);
+  return popcountName;
+}
+
+unsigned SlsDetPacketLoss::account(const slsReceiverDefs::sls_receiver_header *header)
+{
+  const epicsUInt64 *mask = maskWords(header);
+  epicsUInt64 frameNumber = header->detHeader.frameNumber;
+  unsigned caught = popcount(mask, MASK_WORDS);
+  unsigned lost = caught < _packetsPerFrame ? _packetsPerFrame - caught : 0;
+
+  _lock.lock();
+  _stats.frames++;
+  _stats.packetsCaught += caught;
+  /* Whole frames that never arrived only show up as a jump in the frame number */
+  if (_haveFrame && (frameNumber > _lastFrame + 1)) {
+    epicsUInt64 missed = frameNumber - _lastFrame - 1;
+    _stats.framesMissed += missed;
+    _stats.packetsLost += missed * _packetsPerFrame;
+  }
+  if (!_haveFrame || (frameNumber > _lastFrame)) {
+    _lastFrame = frameNumber;
+    _haveFrame = true;
+  }
+  if (lost) {
+    _stats.framesIncomplete++;
+    _stats.packetsLost += lost;
+    accountBursts(mask);
+    accountWorst(frameNumber, lost);
+  }
+  _lock.unlock();
+
+  return caught;
+}
+
+void SlsDetPacketLoss::accountBursts(const epicsUInt64 *mask)
+{
+  /* Must be called with the lock held, only runs for frames with losses */
+  unsigned burst = 0;
+  for (unsigned n=0; n<_packetsPerFrame; n++) {
+    if ((n % 64 == 0) && (burst == 0) && (n + 64 <= _packetsPerFrame) && (mask[n / 64] == ~0ULL)) {
+      n += 63;
+      continue;
+    }
+    if (mask[n / 64] & (1ULL << (n % 64))) {
+      if (burst) accountBurst(burst);
+      burst = 0;
+    } else {
+      burst++;
+    }
+  }
+  if (burst) accountBurst(burst);
+}
+
+void SlsDetPacketLoss::accountBurst(unsigned length)
+{
+  int bin = 0;
+  for (unsigned edge=1; (edge < length) && (bin < SLS_LOSS_BURST_BINS - 1); edge <<= 1) {
+    bin++;
+  }
+  _stats.burstHist[bin]++;
+}
+
+void SlsDetPacketLoss::accountWorst(epicsUInt64 frameNumber, unsigned lost)
+{
+  /* Keep the list sorted with the most packets lost first */
+  int pos = _stats.numWorst;
+  while ((pos > 0) && (_stats.worstLost[pos - 1] < (epicsInt32) lost)) {
+    pos--;
+  }
+  if (pos >= SLS_LOSS_WORST_FRAMES) return;
+
+  int last = _stats.numWorst < SLS_LOSS_WORST_FRAMES ? _stats.numWorst : SLS_LOSS_WORST_FRAMES - 1;
+  for (int n=last; n>pos; n--) {
+    _stats.worstFrame[n] = _stats.worstFrame[n - 1];
+    _stats.worstLost[n] = _stats.worstLost[n - 1];
+  }
+  _stats.worstFrame[pos] = frameNumber;
+  _stats.worstLost[pos] = lost;
+  if (_stats.numWorst < SLS_LOSS_WORST_FRAMES) _stats.numWorst++;
+}
+
+bool SlsDetPacketLoss::updateDue()
+{
+  epicsTimeStamp now;
+  double elapsed;
+  bool due = false;
+
+  epicsTimeGetCurrent(&now);
+  _lock.lock();
+  elapsed = epicsTimeDiffInSeconds(&now, &_lastUpdate);
+  if (elapsed >= _updatePeriod) {
+    _stats.lossRate = (_stats.packetsLost - _lastLost) / elapsed;
+    _lastLost = _stats.packetsLost;
+    _lastUpdate = now;
+    due = true;
+  }
+  _lock.unlock();
+
+  return due;
+}
+
+void SlsDetPacketLoss::idle()
+{
+  _lock.lock();
+  _stats.lossRate = 0.0;
+  _lastLost = _stats.packetsLost;
+  /* The next acquisition may restart the frame numbers */
+  _haveFrame = false;
+  _lock.unlock();
+}
+
+void SlsDetPacketLoss::reset()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _haveFrame = false;
+  _lastFrame = 0;
+  _lastLost = 0;
+  epicsTimeGetCurrent(&_lastUpdate);
+  _lock.unlock();
+}
+
+void SlsDetPacketLoss::getStats(SlsDetPacketLossStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
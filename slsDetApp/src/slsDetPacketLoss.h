@@ -0,0 +1,72 @@
+#ifndef slsDetPacketLoss_H
+#define slsDetPacketLoss_H
+
+#include <sls_receiver_defs.h>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+
+/* Burst length histogram bins: 1, 2, 3-4, 5-8, ..., 257-512 lost packets in a row */
+#define SLS_LOSS_BURST_BINS   10
+/* Number of the worst frames that are remembered */
+#define SLS_LOSS_WORST_FRAMES 8
+
+/** Counters kept by the SlsDetPacketLoss */
+typedef struct {
+  epicsUInt64 frames;           /**< frames seen */
+  epicsUInt64 framesIncomplete; /**< frames seen with packets missing */
+  epicsUInt64 framesMissed;     /**< frames never seen, from gaps in the frame number */
+  epicsUInt64 packetsCaught;    /**< packets set in the packetsMask */
+  epicsUInt64 packetsLost;      /**< packets missing, including those of missed frames */
+  double      lossRate;         /**< packets lost per second over the last update period */
+  epicsInt32  burstHist[SLS_LOSS_BURST_BINS];
+  int         numWorst;
+  epicsUInt64 worstFrame[SLS_LOSS_WORST_FRAMES];  /**< worst frames, most packets lost first */
+  epicsInt32  worstLost[SLS_LOSS_WORST_FRAMES];
+} SlsDetPacketLossStats;
+
+/** Class definition for the SlsDetPacketLoss class
+  *
+  * Packet loss accounting for one module, fed with the sls_receiver_header
+  * of every frame from the receiver callback thread of that module. The
+  * packetsMask is counted with the widest popcount the host supports.
+  */
+class SlsDetPacketLoss {
+public:
+  SlsDetPacketLoss(unsigned packetsPerFrame, double updatePeriod);
+  virtual ~SlsDetPacketLoss();
+
+  /* Accounts a frame and returns the number of packets caught */
+  virtual unsigned account(const slsReceiverDefs::sls_receiver_header *header);
+  /* True once every update period, when the loss rate has been refreshed */
+  virtual bool updateDue();
+  /* Called at the end of an acquisition to bring the loss rate back to zero */
+  virtual void idle();
+  virtual void reset();
+  virtual void getStats(SlsDetPacketLossStats *stats);
+
+  unsigned packetsPerFrame() const;
+
+  /* Number of packets set in the packetsMask of the header */
+  static unsigned packetsCaught(const slsReceiverDefs::sls_receiver_header *header);
+  /* Name of the popcount kernel in use */
+  static const char* kernelName();
+
+protected:
+  virtual void accountBursts(const epicsUInt64 *mask);
+  virtual void accountWorst(epicsUInt64 frameNumber, unsigned lost);
+  virtual void accountBurst(unsigned length);
+
+private:
+  const unsigned        _packetsPerFrame;
+  const double          _updatePeriod;
+  bool                  _haveFrame;
+  epicsUInt64           _lastFrame;
+  epicsUInt64           _lastLost;
+  epicsTimeStamp        _lastUpdate;
+  SlsDetPacketLossStats _stats;
+  epicsMutex            _lock;
+};
+
+#endif
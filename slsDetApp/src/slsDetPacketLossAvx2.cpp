@@ -0,0 +1,24 @@
+/* AVX2 kernels of slsDetPacketLoss, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+
+/* Nibble lookup popcount, the 512 bit mask is two AVX2 registers */
+unsigned slsDetPopcountAvx2(const epicsUInt64 *mask, int words)
+{
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  for (int n=0; n<words; n+=4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (mask + n));
+    __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+    __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+  }
+  return (unsigned) (_mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                     _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3));
+}
+#endif
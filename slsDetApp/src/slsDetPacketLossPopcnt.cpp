@@ -0,0 +1,16 @@
+/* POPCNT kernels of slsDetPacketLoss, built with -mpopcnt */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_POPCNT
+#include <nmmintrin.h>
+
+unsigned slsDetPopcountPopcnt(const epicsUInt64 *mask, int words)
+{
+  unsigned count = 0;
+  for (int n=0; n<words; n++) {
+    count += (unsigned) _mm_popcnt_u64(mask[n]);
+  }
+  return count;
+}
+#endif
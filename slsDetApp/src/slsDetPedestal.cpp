@@ -0,0 +1,198 @@
+#include "slsDetPedestal.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+
+/* Alignment of the accumulators, a cache line so the vector loads never split one */
+#define MAP_ALIGN 64
+
+typedef void (*welfordFunc)(const epicsUInt16 *raw, int gain, float *count,
+                            float *mean, float *m2, size_t start, size_t n);
+
+/* The tail of every kernel and the fallback when there are no vector units */
+void slsDetWelfordGeneric(const epicsUInt16 *raw, int gain, float *count,
+                          float *mean, float *m2, size_t start, size_t n)
+{
+  for (size_t i=start; i<n; i++) {
+    int g = raw[i] >> SLS_GAIN_SHIFT;
+    if (g > 2) g = 2;
+    if (g != gain) continue;
+    float x = (float) (raw[i] & SLS_ADC_MASK);
+    float c = count[i] + 1.0f;
+    float delta = x - mean[i];
+    count[i] = c;
+    mean[i] += delta / c;
+    m2[i] += delta * (x - mean[i]);
+  }
+}
+
+static welfordFunc welfordKernel = slsDetWelfordGeneric;
+static const char *welfordName = "generic";
+static epicsThreadOnceId welfordOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectKernel(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    welfordKernel = slsDetWelfordAvx2;
+    welfordName = slsDetCpuFeatureName(SlsCpuAvx2);
+  }
+#endif
+}
+
+SlsDetPedestal::SlsDetPedestal(size_t sizeX, size_t sizeY) :
+  _numPixels(sizeX * sizeY),
+  _gain(0),
+  _cell(-1),
+  _active(false),
+  _settleFrames(0),
+  _numFrames(0),
+  _framesDone(0),
+  _framesSkipped(0)
+{
+  epicsThreadOnce(&welfordOnce, selectKernel, NULL);
+
+  std::memset(_count, 0, sizeof(_count));
+  std::memset(_mean, 0, sizeof(_mean));
+  std::memset(_m2, 0, sizeof(_m2));
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    void *count = NULL;
+    void *mean = NULL;
+    void *m2 = NULL;
+    if (posix_memalign(&count, MAP_ALIGN, _numPixels * sizeof(float)) ||
+        posix_memalign(&mean, MAP_ALIGN, _numPixels * sizeof(float)) ||
+        posix_memalign(&m2, MAP_ALIGN, _numPixels * sizeof(float))) {
+      std::free(count);
+      std::free(mean);
+      for (int m=0; m<g; m++) {
+        std::free(_count[m]);
+        std::free(_mean[m]);
+        std::free(_m2[m]);
+      }
+      throw std::bad_alloc();
+    }
+    _count[g] = (float *) count;
+    _mean[g] = (float *) mean;
+    _m2[g] = (float *) m2;
+    _measured[g] = false;
+  }
+}
+
+SlsDetPedestal::~SlsDetPedestal()
+{
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    std::free(_count[g]);
+    std::free(_mean[g]);
+    std::free(_m2[g]);
+  }
+}
+
+const char* SlsDetPedestal::kernelName()
+{
+  epicsThreadOnce(&welfordOnce, selectKernel, NULL);
+  return welfordName;
+}
+
+void SlsDetPedestal::start(int gain, unsigned settleFrames, unsigned numFrames, int cell)
+{
+  if ((gain < 0) || (gain >= SLS_NUM_GAINS)) return;
+
+  _lock.lock();
+  std::memset(_count[gain], 0, _numPixels * sizeof(float));
+  std::memset(_mean[gain], 0, _numPixels * sizeof(float));
+  std::memset(_m2[gain], 0, _numPixels * sizeof(float));
+  _measured[gain] = false;
+  _gain = gain;
+  _cell = cell;
+  _settleFrames = settleFrames;
+  _numFrames = numFrames;
+  _framesDone = 0;
+  epicsAtomicSetSizeT(&_framesSkipped, 0);
+  _active = true;
+  _lock.unlock();
+}
+
+void SlsDetPedestal::stop()
+{
+  _lock.lock();
+  _active = false;
+  _lock.unlock();
+}
+
+bool SlsDetPedestal::accumulate(const epicsUInt16 *raw, int cell)
+{
+  bool done = false;
+
+  if (!_lock.tryLock()) {
+    epicsAtomicIncrSizeT(&_framesSkipped);
+    return false;
+  }
+
+  if (_active && ((_cell < 0) || (cell == _cell))) {
+    if (_settleFrames > 0) {
+      /* Frames taken while the gain settles are not used */
+      _settleFrames--;
+    } else {
+      welfordKernel(raw, _gain, _count[_gain], _mean[_gain], _m2[_gain], 0, _numPixels);
+      _framesDone++;
+      if (_framesDone >= _numFrames) {
+        _measured[_gain] = true;
+        _active = false;
+        done = true;
+      }
+    }
+  }
+  _lock.unlock();
+
+  return done;
+}
+
+void SlsDetPedestal::fill(SlsDetCalibration *cal, int gain)
+{
+  if (cal->numPixels() != _numPixels) return;
+
+  _lock.lock();
+  for (int g=0; g<SLS_NUM_GAINS; g++) {
+    if (!_measured[g] || ((gain >= 0) && (g != gain))) continue;
+    float *ped = cal->pedestal(g);
+    float *noise = cal->noise(g);
+    /* Pixels that never showed the gain stage keep what they had */
+    for (size_t pix=0; pix<_numPixels; pix++) {
+      if (_count[g][pix] > 0.0f) {
+        ped[pix] = _mean[g][pix];
+        noise[pix] = _count[g][pix] > 1.0f ? sqrtf(_m2[g][pix] / (_count[g][pix] - 1.0f)) : 0.0f;
+      }
+    }
+  }
+  _lock.unlock();
+}
+
+bool SlsDetPedestal::active()
+{
+  bool active;
+  _lock.lock();
+  active = _active;
+  _lock.unlock();
+  return active;
+}
+
+unsigned SlsDetPedestal::framesDone()
+{
+  unsigned framesDone;
+  _lock.lock();
+  framesDone = _framesDone;
+  _lock.unlock();
+  return framesDone;
+}
+
+size_t SlsDetPedestal::framesSkipped()
+{
+  return epicsAtomicGetSizeT(&_framesSkipped);
+}
@@ -0,0 +1,59 @@
+#ifndef slsDetPedestal_H
+#define slsDetPedestal_H
+
+#include "slsDetCalibration.h"
+
+#include <epicsMutex.h>
+
+/** Class definition for the SlsDetPedestal class
+  *
+  * Accumulates the per pixel mean and variance of dark frames for one gain
+  * stage at a time using Welford's update, vectorized over the pixels. Only
+  * pixels that report the gain stage being measured are counted, so each
+  * pixel keeps its own number of samples.
+  *
+  * In burst mode each storage cell is measured on its own: only the frames
+  * of the cell being measured are counted, settling frames included.
+  *
+  * Frames can come from several threads; a frame that arrives while another
+  * one is being accumulated is skipped rather than holding up its thread.
+  */
+class SlsDetPedestal {
+public:
+  SlsDetPedestal(size_t sizeX, size_t sizeY);
+  virtual ~SlsDetPedestal();
+
+  /* Clears the gain stage and accumulates numFrames after skipping settleFrames,
+   * of storage cell cell or of any cell if it is negative */
+  virtual void start(int gain, unsigned settleFrames, unsigned numFrames, int cell=-1);
+  virtual void stop();
+  /* Returns true for the frame that completes the gain stage */
+  virtual bool accumulate(const epicsUInt16 *raw, int cell=0);
+  /* Writes the mean and RMS of the measured gain stages, or of gain stage
+   * gain alone, into the calibration */
+  virtual void fill(SlsDetCalibration *cal, int gain=-1);
+
+  bool active();
+  unsigned framesDone();
+  size_t framesSkipped();
+
+  /* Name of the accumulation kernel in use */
+  static const char* kernelName();
+
+private:
+  const size_t  _numPixels;
+  float         *_count[SLS_NUM_GAINS];
+  float         *_mean[SLS_NUM_GAINS];
+  float         *_m2[SLS_NUM_GAINS];
+  bool          _measured[SLS_NUM_GAINS];
+  int           _gain;
+  int           _cell;
+  bool          _active;
+  unsigned      _settleFrames;
+  unsigned      _numFrames;
+  unsigned      _framesDone;
+  size_t        _framesSkipped;
+  epicsMutex    _lock;
+};
+
+#endif
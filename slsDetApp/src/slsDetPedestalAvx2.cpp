@@ -0,0 +1,36 @@
+/* AVX2 kernels of slsDetPedestal, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+
+void slsDetWelfordAvx2(const epicsUInt16 *raw, int gain, float *count,
+                       float *mean, float *m2, size_t start, size_t n)
+{
+  const __m256i adcMask = _mm256_set1_epi32(SLS_ADC_MASK);
+  const __m256i stage = _mm256_set1_epi32(gain);
+  const __m256i two = _mm256_set1_epi32(2);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  size_t i = start;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i r = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (raw + i)));
+    __m256i g = _mm256_min_epi32(_mm256_srli_epi32(r, SLS_GAIN_SHIFT), two);
+    __m256 use = _mm256_castsi256_ps(_mm256_cmpeq_epi32(g, stage));
+    if (_mm256_testz_ps(use, use)) continue;
+    __m256 x = _mm256_cvtepi32_ps(_mm256_and_si256(r, adcMask));
+    __m256 c = _mm256_add_ps(_mm256_loadu_ps(count + i), _mm256_and_ps(use, one));
+    __m256 m = _mm256_loadu_ps(mean + i);
+    __m256 delta = _mm256_sub_ps(x, m);
+    /* The pixels left out have nothing added, whatever the division gave */
+    m = _mm256_add_ps(m, _mm256_and_ps(use, _mm256_div_ps(delta, c)));
+    __m256 s = _mm256_add_ps(_mm256_loadu_ps(m2 + i),
+                             _mm256_and_ps(use, _mm256_mul_ps(delta, _mm256_sub_ps(x, m))));
+    _mm256_storeu_ps(count + i, c);
+    _mm256_storeu_ps(mean + i, m);
+    _mm256_storeu_ps(m2 + i, s);
+  }
+  slsDetWelfordGeneric(raw, gain, count, mean, m2, i, n);
+}
+#endif
@@ -0,0 +1,326 @@
+#include "slsDetPublisher.h"
+
+#include <sls_receiver_defs.h>
+#include <zmq.h>
+#include <epicsStdio.h>
+#include <epicsAtomic.h>
+
+#include <cstring>
+#include <cstdarg>
+
+/* Room for the JSON header of a frame */
+#define HEADER_SIZE 1024
+
+static const char *typeNames[] = { "uint16", "int16", "float32" };
+static const unsigned typeBits[] = { 16, 16, 32 };
+
+/* What the free function of the pixels needs to hand them back */
+typedef struct {
+  size_t          *inFlight;
+  SlsPubFreeFunc  freeFunc;
+  void            *hint;
+} SlsPubBuffer;
+
+SlsDetPublisher::SlsDetPublisher() :
+  _context(NULL),
+  _socket(NULL),
+  _highWaterMark(1),
+  _noDrop(false),
+  _inFlight(0),
+  _every(1),
+  _maxRate(0.),
+  _count(0),
+  _firstFrame(0),
+  _started(false)
+{
+  _lastSent.secPastEpoch = 0;
+  _lastSent.nsec = 0;
+  std::memset(&_stats, 0, sizeof(_stats));
+  _error[0] = '\0';
+}
+
+SlsDetPublisher::~SlsDetPublisher()
+{
+  close();
+}
+
+void SlsDetPublisher::setError(const char *fmt, ...)
+{
+  /* Must be called with the lock held */
+  va_list args;
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+}
+
+const char* SlsDetPublisher::error()
+{
+  return _error;
+}
+
+void SlsDetPublisher::freeData(void *data, void *hint)
+{
+  SlsPubBuffer *buffer = (SlsPubBuffer *) hint;
+
+  epicsAtomicDecrSizeT(buffer->inFlight);
+  buffer->freeFunc(data, buffer->hint);
+  delete buffer;
+}
+
+bool SlsDetPublisher::open(const char *endpoint, int highWaterMark)
+{
+  int linger = 0;
+  int noDrop = 1;
+  int sendHighWaterMark;
+  int major;
+  int minor;
+  int patch;
+
+  close();
+
+  _lock.lock();
+  _context = zmq_ctx_new();
+  if (!_context) {
+    setError("Unable to create the ZeroMQ context: %s", zmq_strerror(zmq_errno()));
+    _lock.unlock();
+    return false;
+  }
+  _socket = zmq_socket(_context, ZMQ_PUB);
+  if (!_socket) {
+    setError("Unable to create the ZeroMQ socket: %s", zmq_strerror(zmq_errno()));
+    zmq_ctx_term(_context);
+    _context = NULL;
+    _lock.unlock();
+    return false;
+  }
+
+  /* Frames still queued when the socket closes are dropped rather than waited for.
+   * The high water mark of the socket counts message parts, two for each frame
+   * and one for the end of an acquisition. */
+  _highWaterMark = highWaterMark > 0 ? highWaterMark : 1;
+  sendHighWaterMark = 2 * _highWaterMark + 1;
+  zmq_setsockopt(_socket, ZMQ_LINGER, &linger, sizeof(linger));
+  zmq_setsockopt(_socket, ZMQ_SNDHWM, &sendHighWaterMark, sizeof(sendHighWaterMark));
+
+  /* A full queue fails the send instead of silently dropping the frame, where
+   * the library knows how; otherwise publish() keeps count itself */
+  zmq_version(&major, &minor, &patch);
+  _noDrop = ((major > 4) || ((major == 4) && (minor >= 1))) &&
+            !zmq_setsockopt(_socket, ZMQ_XPUB_NODROP, &noDrop, sizeof(noDrop));
+
+  if (zmq_bind(_socket, endpoint)) {
+    setError("Unable to bind %s: %s", endpoint, zmq_strerror(zmq_errno()));
+    zmq_close(_socket);
+    zmq_ctx_term(_context);
+    _socket = NULL;
+    _context = NULL;
+    _lock.unlock();
+    return false;
+  }
+
+  _count = 0;
+  _started = false;
+  if (_noDrop) {
+    setError("Publishing on %s", endpoint);
+  } else {
+    setError("Publishing on %s, libzmq %d.%d.%d counts the frames in flight",
+             endpoint, major, minor, patch);
+  }
+  _lock.unlock();
+
+  return true;
+}
+
+void SlsDetPublisher::close()
+{
+  void *socket;
+  void *context;
+
+  _lock.lock();
+  socket = _socket;
+  context = _context;
+  _socket = NULL;
+  _context = NULL;
+  _lock.unlock();
+
+  /* Terminating the context hands back every buffer ZeroMQ still holds */
+  if (socket) zmq_close(socket);
+  if (context) zmq_ctx_term(context);
+}
+
+size_t SlsDetPublisher::inFlight()
+{
+  return epicsAtomicGetSizeT(&_inFlight);
+}
+
+bool SlsDetPublisher::isOpen()
+{
+  bool open;
+  _lock.lock();
+  open = _socket != NULL;
+  _lock.unlock();
+  return open;
+}
+
+void SlsDetPublisher::setDecimation(unsigned every, double maxRate)
+{
+  _lock.lock();
+  _every = every > 0 ? every : 1;
+  _maxRate = maxRate > 0. ? maxRate : 0.;
+  _count = 0;
+  _lock.unlock();
+}
+
+bool SlsDetPublisher::due()
+{
+  bool due = true;
+  epicsTimeStamp now;
+
+  _lock.lock();
+  if (!_socket) {
+    _lock.unlock();
+    return false;
+  }
+
+  if ((_every > 1) && ((_count++ % _every) != 0)) {
+    due = false;
+  } else if (_maxRate > 0.) {
+    epicsTimeGetCurrent(&now);
+    if (epicsTimeDiffInSeconds(&now, &_lastSent) < 1. / _maxRate) {
+      due = false;
+    } else {
+      _lastSent = now;
+    }
+  }
+  if (!due) _stats.decimated++;
+  _lock.unlock();
+
+  return due;
+}
+
+bool SlsDetPublisher::publish(const SlsDetFrame *frame, SlsPubDataType type,
+                              void *data, size_t size, SlsPubFreeFunc freeFunc, void *hint)
+{
+  char header[HEADER_SIZE];
+  zmq_msg_t msg;
+  SlsPubBuffer *buffer;
+  epicsUInt32 packets = 0;
+  int len;
+
+  for (int mod=0; mod<frame->numModules; mod++) {
+    packets += frame->packetsCaught[mod];
+  }
+
+  _lock.lock();
+  if (!_socket) {
+    _lock.unlock();
+    freeFunc(data, hint);
+    return false;
+  }
+
+  /* Without ZMQ_XPUB_NODROP a full queue drops the frame silently, so no more
+   * than the high water mark go to ZeroMQ until the slowest viewer has them */
+  if (!_noDrop && (epicsAtomicGetSizeT(&_inFlight) >= (size_t) _highWaterMark)) {
+    _stats.dropped++;
+    _lock.unlock();
+    freeFunc(data, hint);
+    return false;
+  }
+
+  if (!_started) {
+    _firstFrame = frame->frameNumber;
+    _started = true;
+  }
+
+  /* The keys of the slsReceiver streamer, then the ones only this module sends */
+  len = epicsSnprintf(header, sizeof(header),
+                      "{\"jsonversion\":%u, \"bitmode\":%u, \"fileIndex\":%llu, \"shape\":[%u, %u], "
+                      "\"acqIndex\":%llu, \"fIndex\":%llu, \"fname\":\"\", \"data\": 1, "
+                      "\"frameNumber\":%llu, \"expLength\":%u, \"packetNumber\":%u, "
+                      "\"bunchId\":%llu, \"timestamp\":%llu, \"modId\":%u, "
+                      "\"xCoord\":%u, \"yCoord\":%u, \"zCoord\":%u, \"debug\":%u, "
+                      "\"roundRNumber\":%u, \"detType\":%u, \"version\":%u, "
+                      "\"type\":\"%s\", \"numModules\":%d, \"missingModules\":%llu}",
+                      SLS_DETECTOR_JSON_HEADER_VERSION, typeBits[type], 0ULL,
+                      (unsigned) frame->sizeX, (unsigned) frame->sizeY,
+                      (unsigned long long) (frame->frameNumber - _firstFrame),
+                      (unsigned long long) (frame->frameNumber - _firstFrame),
+                      (unsigned long long) frame->frameNumber, frame->header[0].expLength, packets,
+                      (unsigned long long) frame->bunchId, (unsigned long long) frame->timestamp, 0U,
+                      0U, 0U, 0U, frame->header[0].debug,
+                      frame->header[0].roundRNumber, frame->header[0].detType, frame->header[0].version,
+                      typeNames[type], frame->numModules, (unsigned long long) frame->missingMask);
+  if ((len < 0) || (len >= (int) sizeof(header))) len = sizeof(header) - 1;
+
+  /* Only the first part can hit the high water mark, the rest of a message always follows */
+  if (zmq_send(_socket, header, len, ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0) {
+    if (zmq_errno() == EAGAIN) {
+      _stats.dropped++;
+    } else {
+      _stats.failed++;
+    }
+    _lock.unlock();
+    freeFunc(data, hint);
+    return false;
+  }
+
+  /* ZeroMQ calls the free function once the last subscriber has the pixels */
+  buffer = new SlsPubBuffer;
+  buffer->inFlight = &_inFlight;
+  buffer->freeFunc = freeFunc;
+  buffer->hint = hint;
+  epicsAtomicIncrSizeT(&_inFlight);
+  if (zmq_msg_init_data(&msg, data, size, freeData, buffer)) {
+    freeData(data, buffer);
+    zmq_send(_socket, "", 0, ZMQ_DONTWAIT);
+    _stats.failed++;
+    _lock.unlock();
+    return false;
+  }
+  if (zmq_msg_send(&msg, _socket, ZMQ_DONTWAIT) < 0) {
+    zmq_msg_close(&msg);
+    _stats.failed++;
+    _lock.unlock();
+    return false;
+  }
+  _stats.sent++;
+  _lock.unlock();
+
+  return true;
+}
+
+bool SlsDetPublisher::publishEnd()
+{
+  char header[HEADER_SIZE];
+  int len;
+  bool sent;
+
+  _lock.lock();
+  if (!_socket) {
+    _lock.unlock();
+    return false;
+  }
+  /* Like the slsReceiver streamer, a header without data closes the acquisition */
+  len = epicsSnprintf(header, sizeof(header), "{\"jsonversion\":%u, \"data\": 0}",
+                      SLS_DETECTOR_JSON_HEADER_VERSION);
+  sent = zmq_send(_socket, header, len, ZMQ_DONTWAIT) >= 0;
+  _started = false;
+  _count = 0;
+  _lock.unlock();
+
+  return sent;
+}
+
+void SlsDetPublisher::getStats(SlsDetPublisherStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+void SlsDetPublisher::resetStats()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _lock.unlock();
+}
@@ -0,0 +1,92 @@
+#ifndef slsDetPublisher_H
+#define slsDetPublisher_H
+
+#include "slsDetFrame.h"
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+/* Pixel types a SlsDetPublisher can send */
+typedef enum {
+  SlsPubUInt16,   /**< raw or assembled frames */
+  SlsPubInt16,    /**< photon counts */
+  SlsPubFloat32   /**< energy */
+} SlsPubDataType;
+
+/* Called once ZeroMQ no longer needs a buffer that was handed to it */
+typedef void (*SlsPubFreeFunc)(void *data, void *hint);
+
+/** Counters kept by the SlsDetPublisher */
+typedef struct {
+  epicsUInt64 sent;       /**< frames handed to ZeroMQ */
+  epicsUInt64 decimated;  /**< frames left out by the decimation */
+  epicsUInt64 dropped;    /**< frames dropped since a subscriber was at its high water mark */
+  epicsUInt64 failed;     /**< frames that could not be sent for any other reason */
+} SlsDetPublisherStats;
+
+/** Class definition for the SlsDetPublisher class
+  *
+  * Publishes frames for live viewers on a ZeroMQ PUB socket as two part
+  * messages: a JSON header in the format of the slsReceiver streamer
+  * (SLS_DETECTOR_JSON_HEADER_VERSION) followed by the pixels. The pixels are
+  * not copied, ZeroMQ owns the buffer until the free function hands it back.
+  *
+  * Frames can be decimated to every Nth frame and to a maximum rate. Sends
+  * never block: a subscriber at its high water mark makes the frame count
+  * as dropped, so a slow viewer cannot hold up the acquisition. With
+  * libzmq 4.1 the socket itself fails the send of a full queue
+  * (ZMQ_XPUB_NODROP). Older versions drop the frame without a word, so
+  * there the frames ZeroMQ still holds are counted instead and no more
+  * than the high water mark are handed to it.
+  */
+class SlsDetPublisher {
+public:
+  SlsDetPublisher();
+  virtual ~SlsDetPublisher();
+
+  /* Binds the socket, returning false on failure */
+  virtual bool open(const char *endpoint, int highWaterMark);
+  virtual void close();
+  bool isOpen();
+
+  /* 0 disables either limit */
+  virtual void setDecimation(unsigned every, double maxRate);
+  /* Counts a frame and returns true if it is to be published */
+  virtual bool due();
+
+  /* Always takes over the buffer, freeFunc is called when it is no longer needed */
+  virtual bool publish(const SlsDetFrame *frame, SlsPubDataType type,
+                       void *data, size_t size, SlsPubFreeFunc freeFunc, void *hint);
+  /* Tells the viewers the acquisition is over */
+  virtual bool publishEnd();
+
+  void getStats(SlsDetPublisherStats *stats);
+  void resetStats();
+  /* Description of what went wrong with the last open */
+  const char* error();
+  /* Frames ZeroMQ still holds the pixels of */
+  size_t inFlight();
+
+protected:
+  void setError(const char *fmt, ...);
+  /* The free function of the pixels, which hands them back to their owner */
+  static void freeData(void *data, void *hint);
+
+private:
+  void            *_context;
+  void            *_socket;
+  int             _highWaterMark;
+  bool            _noDrop;      /* the socket reports a full queue itself */
+  size_t          _inFlight;    /* counted with epicsAtomic, freed on the ZeroMQ thread */
+  unsigned        _every;
+  double          _maxRate;
+  unsigned        _count;
+  epicsTimeStamp  _lastSent;
+  epicsUInt64     _firstFrame;
+  bool            _started;
+  SlsDetPublisherStats _stats;
+  char            _error[256];
+  epicsMutex      _lock;
+};
+
+#endif
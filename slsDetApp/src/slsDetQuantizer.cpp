@@ -0,0 +1,169 @@
+#include "slsDetQuantizer.h"
+#include "slsDetConverter.h"
+#include "slsDetFramePool.h"
+#include "slsDetGeometry.h"
+#include "slsDetCpu.h"
+#include "slsDetKernels.h"
+
+#include <epicsThread.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+
+/* Alignment of the energy buffer, a cache line so the vector loads never split one */
+#define MAP_ALIGN 64
+
+typedef void (*quantizeFunc)(const float *energy, epicsUInt16 *counts, size_t start, size_t n,
+                             float scale, float offset, float photonEnergy, SlsQuantizeSums *sums);
+
+/* The tail of every kernel and the fallback when there are no vector units */
+void slsDetQuantizeGeneric(const float *energy, epicsUInt16 *counts, size_t start, size_t n,
+                           float scale, float offset, float photonEnergy, SlsQuantizeSums *sums)
+{
+  for (size_t i=start; i<n; i++) {
+    float x = energy[i] * scale + offset;
+    /* Written so a pixel without a value counts nothing */
+    if (!(x > 0.0f)) x = 0.0f;
+    if (x > SLS_COUNTS_MAX) x = SLS_COUNTS_MAX;
+    epicsUInt16 c = (epicsUInt16) x;
+    float error = energy[i] - (float) c * photonEnergy;
+    counts[i] = c;
+    sums->sumSq += error * error;
+    if (fabsf(error) > sums->maxError) sums->maxError = fabsf(error);
+    sums->photons += c;
+  }
+}
+
+
+static quantizeFunc quantizeKernel = slsDetQuantizeGeneric;
+static const char *quantizeName = "generic";
+static epicsThreadOnceId quantizeOnce = EPICS_THREAD_ONCE_INIT;
+
+static void selectKernel(void *arg)
+{
+#ifdef SLS_CPU_AVX2
+  if (slsDetCpuHas(SlsCpuAvx2)) {
+    quantizeKernel = slsDetQuantizeAvx2;
+    quantizeName = slsDetCpuFeatureName(SlsCpuAvx2);
+  }
+#endif
+}
+
+SlsDetQuantizer::SlsDetQuantizer(SlsDetConverter *converter, SlsDetFramePool *pool,
+                                 const SlsDetGeometry *geometry) :
+  _converter(converter),
+  _pool(pool),
+  _geometry(geometry),
+  _numPixels(converter->sizeX() * converter->sizeY()),
+  _energy(NULL)
+{
+  void *energy = NULL;
+
+  epicsThreadOnce(&quantizeOnce, selectKernel, NULL);
+
+  /* The counts are written over a frame of the same pool as the raw data */
+  if ((_numPixels * sizeof(epicsUInt16) > pool->frameSize()) ||
+      posix_memalign(&energy, MAP_ALIGN, _numPixels * sizeof(float))) {
+    throw std::bad_alloc();
+  }
+  _energy = (float *) energy;
+  resetStats();
+}
+
+SlsDetQuantizer::~SlsDetQuantizer()
+{
+  std::free(_energy);
+}
+
+const char* SlsDetQuantizer::kernelName()
+{
+  epicsThreadOnce(&quantizeOnce, selectKernel, NULL);
+  return quantizeName;
+}
+
+SlsDetFrame* SlsDetQuantizer::quantize(SlsDetFrame *frame, double photonEnergy, double threshold)
+{
+  SlsDetFrame *counts;
+  SlsQuantizeSums sums;
+  double rmsError;
+  const epicsUInt16 *raw = frame->uint16Pixels();
+
+  /* Only raw frames can be converted */
+  if ((photonEnergy <= 0.) || !raw) return NULL;
+  if (threshold < SLS_PHOTON_THRESHOLD_MIN) threshold = SLS_PHOTON_THRESHOLD_MIN;
+  if (threshold > 1.) threshold = 1.;
+
+  counts = _pool->alloc();
+  if (!counts) {
+    _statsLock.lock();
+    _stats.noBuffer++;
+    _statsLock.unlock();
+    return NULL;
+  }
+
+  counts->frameNumber = frame->frameNumber;
+  counts->timestamp = frame->timestamp;
+  counts->bunchId = frame->bunchId;
+  counts->modulesMask = frame->modulesMask;
+  counts->missingMask = frame->missingMask;
+  counts->arrival = frame->arrival;
+  counts->assembled = frame->assembled;
+  counts->eventTime = frame->eventTime;
+  counts->eventMatch = frame->eventMatch;
+  counts->storageCell = frame->storageCell;
+  counts->numModules = frame->numModules;
+  counts->sizeX = frame->sizeX;
+  counts->sizeY = frame->sizeY;
+  counts->setDataType(SlsFrameUInt16);
+  std::memcpy(counts->header, frame->header, sizeof(counts->header));
+  std::memcpy(counts->packetsCaught, frame->packetsCaught, sizeof(counts->packetsCaught));
+  std::memcpy(counts->origin, frame->origin, sizeof(counts->origin));
+
+  sums.sumSq = 0.;
+  sums.maxError = 0.;
+  sums.photons = 0;
+
+  _lock.lock();
+  _converter->convert(raw, _energy, SlsConvertEnergy, 0., frame->storageCell);
+  /* The gap pixels hold copies of their border pixel until they are shared out */
+  if (_geometry && (_geometry->gapMode() == SlsGapSplit)) {
+    for (int mod=0; mod<frame->numModules; mod++) {
+      _geometry->splitFloat(_energy, frame->origin[mod]);
+    }
+  }
+  quantizeKernel(_energy, counts->uint16Pixels(), 0, _numPixels,
+                 (float) (1. / photonEnergy), (float) (1. - threshold), (float) photonEnergy, &sums);
+  _lock.unlock();
+
+  rmsError = sqrt(sums.sumSq / _numPixels);
+  counts->photonEnergy = photonEnergy;
+  counts->photonError = rmsError;
+
+  _statsLock.lock();
+  _stats.frames++;
+  _stats.photons = (double) sums.photons;
+  _stats.rmsError = rmsError;
+  _stats.maxError = sums.maxError;
+  _sumRmsError += rmsError;
+  _stats.meanRmsError = _sumRmsError / _stats.frames;
+  _statsLock.unlock();
+
+  return counts;
+}
+
+void SlsDetQuantizer::getStats(SlsDetQuantizerStats *stats)
+{
+  _statsLock.lock();
+  *stats = _stats;
+  _statsLock.unlock();
+}
+
+void SlsDetQuantizer::resetStats()
+{
+  _statsLock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _sumRmsError = 0.;
+  _statsLock.unlock();
+}
@@ -0,0 +1,66 @@
+#ifndef slsDetQuantizer_H
+#define slsDetQuantizer_H
+
+#include "slsDetFrame.h"
+
+#include <epicsMutex.h>
+
+class SlsDetConverter;
+class SlsDetFramePool;
+class SlsDetGeometry;
+
+/** Counters kept by the SlsDetQuantizer */
+typedef struct {
+  epicsUInt64 frames;       /**< frames turned into photon counts */
+  epicsUInt64 noBuffer;     /**< frames left out since the pool was empty */
+  double      photons;      /**< photons counted in the last frame */
+  double      rmsError;     /**< RMS error of the last frame in keV */
+  double      maxError;     /**< largest error of a pixel of the last frame in keV */
+  double      meanRmsError; /**< RMS error averaged over the frames in keV */
+} SlsDetQuantizerStats;
+
+/* Smallest threshold, in photons, a pixel has to reach to count any. At 0 an
+ * empty pixel would already count one photon. */
+#define SLS_PHOTON_THRESHOLD_MIN 0.1
+
+/** Class definition for the SlsDetQuantizer class
+  *
+  * Turns raw frames into frames of photon counts for lossy storage. Each
+  * frame is converted to energy, then every pixel that reaches threshold
+  * times the photon energy counts floor(E / photonEnergy + 1 - threshold)
+  * photons and the rest count none, so a threshold of 0.5 rounds to the
+  * nearest photon. The threshold is kept from SLS_PHOTON_THRESHOLD_MIN to
+  * 1. The noise below a photon becomes runs of zeros that the writer
+  * compresses far better than the raw data.
+  *
+  * What is lost is measured on every frame: the RMS and largest difference
+  * between the converted energy and the photons times the photon energy,
+  * the RMS going out with the frame in photonError.
+  */
+class SlsDetQuantizer {
+public:
+  SlsDetQuantizer(SlsDetConverter *converter, SlsDetFramePool *pool, const SlsDetGeometry *geometry);
+  virtual ~SlsDetQuantizer();
+
+  /* Returns a new frame of photon counts with the headers of frame, NULL if
+   * there is no free frame. The caller gets the reference of the new frame. */
+  virtual SlsDetFrame* quantize(SlsDetFrame *frame, double photonEnergy, double threshold);
+  virtual void getStats(SlsDetQuantizerStats *stats);
+  virtual void resetStats();
+
+  /* Name of the quantization kernel in use */
+  static const char* kernelName();
+
+private:
+  SlsDetConverter       *_converter;
+  SlsDetFramePool       *_pool;
+  const SlsDetGeometry  *_geometry;
+  const size_t          _numPixels;
+  float                 *_energy;
+  double                _sumRmsError;
+  SlsDetQuantizerStats  _stats;
+  epicsMutex            _statsLock;
+  epicsMutex            _lock;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/* AVX2 kernels of slsDetQuantizer, built with -mavx2 */
+
+#include "slsDetKernels.h"
+
+#ifdef SLS_CPU_AVX2
+#include <immintrin.h>
+
+/* Pixels the vector kernel sums in single precision before adding them up */
+#define SUM_BLOCK 1024
+
+void slsDetQuantizeAvx2(const float *energy, epicsUInt16 *counts, size_t start, size_t n,
+                        float scale, float offset, float photonEnergy, SlsQuantizeSums *sums)
+{
+  const __m256 s = _mm256_set1_ps(scale);
+  const __m256 o = _mm256_set1_ps(offset);
+  const __m256 e = _mm256_set1_ps(photonEnergy);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 hi = _mm256_set1_ps(SLS_COUNTS_MAX);
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  float lanes[8];
+  epicsUInt32 photons[8];
+  size_t i = start;
+
+  while (i + 8 <= n) {
+    size_t end = i + SUM_BLOCK < n ? i + SUM_BLOCK : n;
+    __m256 sq = _mm256_setzero_ps();
+    __m256 max = _mm256_setzero_ps();
+    __m256i sum = _mm256_setzero_si256();
+    for (; i + 8 <= end; i += 8) {
+      __m256 v = _mm256_loadu_ps(energy + i);
+      /* max returns zero for a pixel without a value, like the generic kernel */
+      __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(v, s), o), zero), hi);
+      __m256i c = _mm256_cvttps_epi32(x);
+      __m256 error = _mm256_sub_ps(v, _mm256_mul_ps(_mm256_cvtepi32_ps(c), e));
+      sq = _mm256_add_ps(sq, _mm256_mul_ps(error, error));
+      max = _mm256_max_ps(max, _mm256_and_ps(error, absMask));
+      sum = _mm256_add_epi32(sum, c);
+      _mm_storeu_si128((__m128i *) (counts + i),
+                       _mm_packus_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1)));
+    }
+    _mm256_storeu_ps(lanes, sq);
+    for (int l=0; l<8; l++) sums->sumSq += lanes[l];
+    _mm256_storeu_ps(lanes, max);
+    for (int l=0; l<8; l++) {
+      if (lanes[l] > sums->maxError) sums->maxError = lanes[l];
+    }
+    _mm256_storeu_si256((__m256i *) photons, sum);
+    for (int l=0; l<8; l++) sums->photons += photons[l];
+  }
+  slsDetQuantizeGeneric(energy, counts, i, n, scale, offset, photonEnergy, sums);
+}
+#endif
@@ -0,0 +1,354 @@
+#include "slsDetReplay.h"
+#include "slsDetAffinity.h"
+#include "slsDetWriter.h"
+
+#include <epicsStdio.h>
+
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define THREAD_TMO 10.0
+/* How often the rate and throughput are worked out */
+#define WINDOW_TIME 1.0
+/* How far the sink can fall behind the rate before the replay stops catching up */
+#define BEHIND_TIME 1.0
+
+SlsDetReplay::SlsDetReplay(SlsDetStreamSink *sink, int numModules, size_t dataSize, const char *portName) :
+  _sink(sink),
+  _portName(portName),
+  _numModules(numModules),
+  _dataSize(dataSize),
+  _recordSize(sizeof(slsReceiverDefs::sls_receiver_header) + dataSize),
+  _records(numModules),
+  _fileIndex(0),
+  _numFrames(0),
+  _span(0),
+  _rate(0.),
+  _loops(1),
+  _running(false),
+  _active(false),
+  _stopping(false),
+  _quit(false),
+  _windowFrames(0),
+  _windowBytes(0),
+  _startEvent(epicsEventEmpty),
+  /* Plays the part of the receiver threads, so it runs at their priority */
+  _thread(*this, "slsDetReplay", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityHigh)
+{
+  _path[0] = '\0';
+  _name[0] = '\0';
+  std::memset(&_stats, 0, sizeof(_stats));
+  epicsTimeGetCurrent(&_windowStart);
+  epicsSnprintf(_status, sizeof(_status), "No files");
+  _thread.start();
+}
+
+SlsDetReplay::~SlsDetReplay()
+{
+  _lock.lock();
+  _stopping = true;
+  _quit = true;
+  _lock.unlock();
+  _startEvent.signal();
+  _thread.exitWait(THREAD_TMO);
+  close();
+}
+
+void SlsDetReplay::setStatus(const char *fmt, ...)
+{
+  va_list args;
+  _lock.lock();
+  va_start(args, fmt);
+  epicsVsnprintf(_status, sizeof(_status), fmt, args);
+  va_end(args);
+  _lock.unlock();
+}
+
+const char* SlsDetReplay::status()
+{
+  return _status;
+}
+
+bool SlsDetReplay::running()
+{
+  bool running;
+
+  _lock.lock();
+  running = _running;
+  _lock.unlock();
+
+  return running;
+}
+
+size_t SlsDetReplay::numFrames() const
+{
+  return _numFrames;
+}
+
+void SlsDetReplay::getStats(SlsDetReplayStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+void SlsDetReplay::resetStats()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _lock.unlock();
+}
+
+void SlsDetReplay::close()
+{
+  /* Only called while nothing is playing */
+  for (size_t n=0; n<_files.size(); n++) {
+    munmap(_files[n].map, _files[n].size);
+  }
+  _files.clear();
+  for (int mod=0; mod<_numModules; mod++) {
+    _records[mod].clear();
+  }
+  _numFrames = 0;
+  _span = 0;
+}
+
+bool SlsDetReplay::open(const char *path, const char *name, int fileIndex)
+{
+  char fileName[sizeof(_path) + sizeof(_name) + 64];
+  const slsReceiverDefs::sls_receiver_header *first;
+  const slsReceiverDefs::sls_receiver_header *last;
+  struct stat info;
+  SlsReplayFile file;
+  int fd;
+
+  _lock.lock();
+  if (_active) {
+    _lock.unlock();
+    setStatus("Stop the replay before opening other files");
+    return false;
+  }
+  _lock.unlock();
+
+  close();
+  epicsSnprintf(_path, sizeof(_path), "%s", path);
+  epicsSnprintf(_name, sizeof(_name), "%s", name);
+  _fileIndex = fileIndex;
+
+  for (int mod=0; mod<_numModules; mod++) {
+    for (unsigned subFile=0; ; subFile++) {
+      /* Named like the files of the slsReceiver, one set for each module */
+      epicsSnprintf(fileName, sizeof(fileName), "%s/%s_d%d_f%012u_%d.raw",
+                    path, name, mod, subFile, fileIndex);
+      fd = ::open(fileName, O_RDONLY);
+      if (fd < 0) {
+        if ((errno == ENOENT) && (subFile > 0)) break;
+        setStatus("Unable to open %s: %s", fileName, strerror(errno));
+        close();
+        return false;
+      }
+      if (fstat(fd, &info)) {
+        setStatus("Unable to read the size of %s: %s", fileName, strerror(errno));
+        ::close(fd);
+        close();
+        return false;
+      }
+      /* A receiver that was stopped short can leave part of a record at the end */
+      file.size = info.st_size - info.st_size % _recordSize;
+      if (file.size == 0) {
+        ::close(fd);
+        continue;
+      }
+      file.map = mmap(NULL, file.size, PROT_READ, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (file.map == MAP_FAILED) {
+        setStatus("Unable to map %s: %s", fileName, strerror(errno));
+        close();
+        return false;
+      }
+      madvise(file.map, file.size, MADV_SEQUENTIAL);
+      _files.push_back(file);
+      /* The raw files of the SlsDetWriter have the same names but hold whole
+       * frames, raw or photon counts, behind a header of their own */
+      if (!std::memcmp(file.map, SLS_RAW_MAGIC, sizeof(SLS_RAW_MAGIC))) {
+        setStatus("%s was written by the IOC, not the slsReceiver", fileName);
+        close();
+        return false;
+      }
+      for (size_t offset=0; offset<file.size; offset+=_recordSize) {
+        _records[mod].push_back((const char *) file.map + offset);
+      }
+    }
+  }
+
+  /* Every frame needs all the modules, so extra frames of one module are not played */
+  _numFrames = _records[0].size();
+  for (int mod=1; mod<_numModules; mod++) {
+    if (_records[mod].size() < _numFrames) _numFrames = _records[mod].size();
+  }
+  if (_numFrames == 0) {
+    setStatus("No frames in %s/%s_d*_%d.raw", path, name, fileIndex);
+    close();
+    return false;
+  }
+
+  /* Each pass moves the frame numbers on past the last one of the pass before */
+  first = (const slsReceiverDefs::sls_receiver_header *) _records[0].front();
+  last = (const slsReceiverDefs::sls_receiver_header *) _records[0][_numFrames - 1];
+  _span = last->detHeader.frameNumber >= first->detHeader.frameNumber ?
+          last->detHeader.frameNumber - first->detHeader.frameNumber + 1 : _numFrames;
+
+  setStatus("%lu frames in %lu files", (unsigned long) _numFrames, (unsigned long) _files.size());
+
+  return true;
+}
+
+bool SlsDetReplay::start(double rate, unsigned loops)
+{
+  _lock.lock();
+  if (_active) {
+    _lock.unlock();
+    setStatus("The replay is already running");
+    return false;
+  }
+  if (_numFrames == 0) {
+    _lock.unlock();
+    setStatus("No files to replay");
+    return false;
+  }
+  _rate = rate > 0. ? rate : 0.;
+  _loops = loops;
+  _running = true;
+  _active = true;
+  _stopping = false;
+  _lock.unlock();
+  _startEvent.signal();
+
+  return true;
+}
+
+void SlsDetReplay::stop()
+{
+  _lock.lock();
+  if (_active) _stopping = true;
+  _lock.unlock();
+}
+
+void SlsDetReplay::run()
+{
+  slsDetPinThread(_portName, SlsThreadReceive);
+
+  while (true) {
+    _startEvent.wait();
+    _lock.lock();
+    if (_quit) {
+      _lock.unlock();
+      break;
+    }
+    _lock.unlock();
+
+    play();
+
+    _lock.lock();
+    _active = false;
+    _stopping = false;
+    _stats.rate = 0.;
+    _stats.throughput = 0.;
+    _lock.unlock();
+  }
+
+  slsDetUnpinThread();
+}
+
+void SlsDetReplay::play()
+{
+  slsReceiverDefs::sls_receiver_header header;
+  epicsTimeStamp start;
+  epicsTimeStamp now;
+  double period = _rate > 0. ? 1. / _rate : 0.;
+  double ahead;
+  double window;
+  epicsUInt64 scheduled = 0;
+  epicsUInt64 played = 0;
+  bool stopping = false;
+
+  for (int mod=0; mod<_numModules; mod++) {
+    _sink->startAcquisition(mod, _path, _name, _fileIndex, _dataSize);
+  }
+  setStatus("Playing %s/%s_d*_%d.raw", _path, _name, _fileIndex);
+
+  epicsTimeGetCurrent(&start);
+  _lock.lock();
+  _windowStart = start;
+  _windowFrames = 0;
+  _windowBytes = 0;
+  _lock.unlock();
+
+  for (unsigned loop=0; !stopping && (!_loops || (loop < _loops)); loop++) {
+    for (size_t n=0; n<_numFrames; n++) {
+      /* Frames go out on a fixed schedule so the rate does not drift */
+      if (period > 0.) {
+        epicsTimeGetCurrent(&now);
+        ahead = scheduled * period - epicsTimeDiffInSeconds(&now, &start);
+        if (ahead > 0.) {
+          epicsThreadSleep(ahead);
+        } else if (ahead < -BEHIND_TIME) {
+          /* Start a new schedule rather than send a burst to catch up */
+          start = now;
+          scheduled = 0;
+          _lock.lock();
+          _stats.behind++;
+          _lock.unlock();
+        }
+      }
+
+      /* The records are handed over where they are mapped, only the header is copied */
+      for (int mod=0; mod<_numModules; mod++) {
+        std::memcpy(&header, _records[mod][n], sizeof(header));
+        header.detHeader.frameNumber += loop * _span;
+        _sink->rawDataReady(mod, (char *) &header,
+                            (char *) _records[mod][n] + sizeof(header), _dataSize);
+      }
+      scheduled++;
+      played++;
+
+      epicsTimeGetCurrent(&now);
+      _lock.lock();
+      _stats.frames++;
+      _stats.bytes += _numModules * _dataSize;
+      _windowFrames++;
+      _windowBytes += _numModules * _dataSize;
+      window = epicsTimeDiffInSeconds(&now, &_windowStart);
+      if (window >= WINDOW_TIME) {
+        _stats.rate = _windowFrames / window;
+        _stats.throughput = _windowBytes / window / 1.e6;
+        _windowStart = now;
+        _windowFrames = 0;
+        _windowBytes = 0;
+      }
+      stopping = _stopping;
+      _lock.unlock();
+      if (stopping) break;
+    }
+    if (!stopping) {
+      _lock.lock();
+      _stats.loops++;
+      _lock.unlock();
+    }
+  }
+
+  /* The sink sees the replay as finished before it is told the acquisition is */
+  _lock.lock();
+  _running = false;
+  _lock.unlock();
+  setStatus("%s after %llu frames", stopping ? "Stopped" : "Done", (unsigned long long) played);
+  for (int mod=0; mod<_numModules; mod++) {
+    _sink->acquisitionFinished(mod, played);
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef slsDetReplay_H
+#define slsDetReplay_H
+
+#include "slsDetSubscriber.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsTypes.h>
+
+#include <stddef.h>
+#include <vector>
+
+/** Counters kept by the SlsDetReplay */
+typedef struct {
+  epicsUInt64 frames;       /**< detector frames handed to the sink, a sub-frame from each module */
+  epicsUInt64 bytes;        /**< module data handed to the sink */
+  epicsUInt64 loops;        /**< passes through the files finished */
+  epicsUInt64 behind;       /**< times the sink fell more than a second behind the rate */
+  double      rate;         /**< frames/s over the last second */
+  double      throughput;   /**< MB/s over the last second */
+} SlsDetReplayStats;
+
+/** Class definition for the SlsDetReplay class
+  *
+  * Plays back the raw files of the slsReceiver, an sls_receiver_header and
+  * the data of a module for each frame, into the same SlsDetStreamSink calls
+  * as the embedded receivers and the stream subscribers, so the rest of the
+  * IOC can be loaded without a detector. The files of every module are
+  * mapped into memory and handed over in place, one frame of each module in
+  * turn, at a fixed rate or as fast as the sink takes them.
+  *
+  * The files can be played a number of times or until stopped; every pass
+  * moves the frame numbers on by the frames in the files so the sink sees
+  * one long acquisition.
+  */
+class SlsDetReplay : public epicsThreadRunable {
+public:
+  /* dataSize is the size of the data of a module in each record; portName is
+   * the port whose thread placement the replay follows */
+  SlsDetReplay(SlsDetStreamSink *sink, int numModules, size_t dataSize, const char *portName=NULL);
+  virtual ~SlsDetReplay();
+  virtual void run();
+
+  /* Maps the files <path>/<name>_d<module>_f<n>_<fileIndex>.raw of every module */
+  virtual bool open(const char *path, const char *name, int fileIndex);
+  virtual void close();
+  /* rate in frames/s, 0 for as fast as possible; loops 0 to play until stopped */
+  virtual bool start(double rate, unsigned loops);
+  /* Asks the replay to stop, the sink is told the acquisition finished as usual */
+  virtual void stop();
+
+  bool running();
+  /* Frames of each module in the files */
+  size_t numFrames() const;
+  void getStats(SlsDetReplayStats *stats);
+  void resetStats();
+  /* The files played or the last thing that went wrong */
+  const char* status();
+
+protected:
+  void setStatus(const char *fmt, ...);
+  virtual void play();
+
+private:
+  typedef struct {
+    void   *map;
+    size_t size;
+  } SlsReplayFile;
+
+private:
+  SlsDetStreamSink  *_sink;
+  const char        *_portName;
+  const int         _numModules;
+  const size_t      _dataSize;
+  const size_t      _recordSize;
+  std::vector<SlsReplayFile> _files;
+  /* Record n of module m is _records[m][n] */
+  std::vector<std::vector<const char*> > _records;
+  char              _path[256];
+  char              _name[256];
+  int               _fileIndex;
+  size_t            _numFrames;
+  epicsUInt64       _span;
+  double            _rate;
+  unsigned          _loops;
+  bool              _running;
+  bool              _active;
+  bool              _stopping;
+  bool              _quit;
+  epicsTimeStamp    _windowStart;
+  epicsUInt64       _windowFrames;
+  epicsUInt64       _windowBytes;
+  SlsDetReplayStats _stats;
+  char              _status[512];
+  epicsMutex        _lock;
+  epicsEvent        _startEvent;
+  epicsThread       _thread;
+};
+
+#endif
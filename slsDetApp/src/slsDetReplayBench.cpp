@@ -0,0 +1,267 @@
+/* Plays raw slsReceiver files through the assembler, and the raw writer if
+ * given a directory, and reports the throughput and latency of each stage, e.g.
+ *   slsDetReplayBench /data/run run 4 2 0 10
+ *   slsDetReplayBench /dev/shm bench 2 1 2000 1 1000 /dev/shm
+ * With a number of frames to generate the files are made up first, so it
+ * runs on any machine, and removed at the end. */
+
+#include "slsDetReplay.h"
+#include "slsDetAssembler.h"
+#include "slsDetGeometry.h"
+#include "slsDetFramePool.h"
+#include "slsDetWriter.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+/* A Jungfrau module */
+#define MODULE_COLS 1024
+#define MODULE_ROWS 512
+#define MODULE_BYTES (MODULE_COLS * MODULE_ROWS * 2)
+#define CHIP_COLS 256
+#define CHIP_ROWS 256
+#define PACKETS_PER_FRAME 128
+
+#define NUM_BUFFERS 64
+#define QUEUE_DEPTH 32
+#define REORDER_WINDOW 8
+#define ASM_TIMEOUT 1.0
+
+/** Takes the modules from the replay and the frames from the assembler */
+class BenchSink : public SlsDetStreamSink, public SlsDetFrameSink {
+public:
+  BenchSink(int numModules) :
+    assembler(NULL), writer(NULL), frames(0), latency(0.), maxLatency(0.), _finished(0),
+    _numModules(numModules) {}
+
+  virtual int startAcquisition(int module, const char *filePath, const char *fileName,
+                               uint64_t fileIndex, uint32_t dataSize)
+  {
+    if (module == 0) assembler->flush();
+    return 0;
+  }
+
+  virtual void acquisitionFinished(int module, uint64_t framesCaught)
+  {
+    _lock.lock();
+    _finished++;
+    _lock.unlock();
+  }
+
+  virtual void rawDataReady(int module, char *header, char *data, uint32_t dataSize)
+  {
+    assembler->push(module, (const slsReceiverDefs::sls_receiver_header *) header, data, dataSize);
+  }
+
+  virtual void frameReady(SlsDetFrame *frame)
+  {
+    epicsTimeStamp now;
+    double elapsed;
+
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &frame->arrival) * 1.e3;
+    _lock.lock();
+    frames++;
+    latency += elapsed;
+    if (elapsed > maxLatency) maxLatency = elapsed;
+    _lock.unlock();
+    if (writer) {
+      writer->write(frame);
+    } else {
+      frame->release();
+    }
+  }
+
+  bool finished()
+  {
+    bool finished;
+    _lock.lock();
+    finished = _finished >= _numModules;
+    _lock.unlock();
+    return finished;
+  }
+
+  SlsDetAssembler *assembler;
+  SlsDetWriter    *writer;
+  epicsUInt64     frames;
+  double          latency;
+  double          maxLatency;
+
+private:
+  int             _finished;
+  const int       _numModules;
+  epicsMutex      _lock;
+};
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s <directory> <name> [modules=1] [modules per row=1] [rate=0] "
+                  "[loops=1] [generate=0] [write directory]\n", prog);
+}
+
+/* Makes up files of the slsReceiver with a gradient on every module */
+static bool generate(const char *dir, const char *name, int numModules, int numModulesX,
+                     unsigned numFrames)
+{
+  std::vector<char> record(sizeof(slsReceiverDefs::sls_receiver_header) + MODULE_BYTES);
+  slsReceiverDefs::sls_receiver_header *header =
+    (slsReceiverDefs::sls_receiver_header *) &record[0];
+  epicsUInt16 *pixels = (epicsUInt16 *) &record[sizeof(*header)];
+  char fileName[512];
+  FILE *fp;
+
+  for (int mod=0; mod<numModules; mod++) {
+    epicsSnprintf(fileName, sizeof(fileName), "%s/%s_d%d_f%012u_0.raw", dir, name, mod, 0);
+    fp = fopen(fileName, "wb");
+    if (!fp) {
+      perror(fileName);
+      return false;
+    }
+    *header = slsReceiverDefs::sls_receiver_header();
+    header->detHeader.modId = mod;
+    header->detHeader.row = mod / numModulesX;
+    header->detHeader.column = mod % numModulesX;
+    header->detHeader.packetNumber = PACKETS_PER_FRAME;
+    for (int packet=0; packet<PACKETS_PER_FRAME; packet++) {
+      header->packetsMask.set(packet);
+    }
+    for (size_t pix=0; pix<MODULE_COLS * MODULE_ROWS; pix++) {
+      pixels[pix] = (epicsUInt16) ((pix % MODULE_COLS) + mod * 100);
+    }
+    for (unsigned n=0; n<numFrames; n++) {
+      header->detHeader.frameNumber = n + 1;
+      header->detHeader.timestamp = n * 1000;
+      header->detHeader.bunchId = n;
+      if (fwrite(&record[0], record.size(), 1, fp) != 1) {
+        perror(fileName);
+        fclose(fp);
+        return false;
+      }
+    }
+    fclose(fp);
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir;
+  const char *name;
+  const char *writeDir = NULL;
+  int numModules = 1;
+  int numModulesX = 1;
+  double rate = 0.;
+  unsigned loops = 1;
+  unsigned numGenerate = 0;
+  SlsDetReplayStats replayStats;
+  SlsDetAssemblerStats asmStats;
+  SlsDetWriterStats writeStats;
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  double elapsed;
+
+  if (argc < 3) {
+    usage(argv[0]);
+    return 1;
+  }
+  dir = argv[1];
+  name = argv[2];
+  if (argc > 3) numModules = std::atoi(argv[3]);
+  if (argc > 4) numModulesX = std::atoi(argv[4]);
+  if (argc > 5) rate = std::atof(argv[5]);
+  if (argc > 6) loops = std::atoi(argv[6]);
+  if (argc > 7) numGenerate = std::atoi(argv[7]);
+  if (argc > 8) writeDir = argv[8];
+  if ((numModules < 1) || (numModules > SLS_MAX_MODULES) || (numModulesX < 1) ||
+      (numModulesX > numModules) || (numModules % numModulesX)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (numGenerate && !generate(dir, name, numModules, numModulesX, numGenerate)) return 1;
+
+  BenchSink sink(numModules);
+  SlsDetGeometry *geometry = new SlsDetGeometry(numModules, numModulesX, MODULE_COLS, MODULE_ROWS,
+                                                CHIP_COLS, CHIP_ROWS, SlsGapNone);
+  SlsDetAssembler assembler(&sink, geometry, 2, NUM_BUFFERS, REORDER_WINDOW, ASM_TIMEOUT);
+  SlsDetReplay replay(&sink, numModules, MODULE_BYTES);
+  SlsDetWriter *writer = writeDir ? new SlsDetWriter(QUEUE_DEPTH) : NULL;
+
+  sink.assembler = &assembler;
+  sink.writer = writer;
+  if (!replay.open(dir, name, 0)) {
+    fprintf(stderr, "%s\n", replay.status());
+    return 1;
+  }
+  if (writer) {
+    writer->setPacketsPerModule(PACKETS_PER_FRAME);
+    writer->open(writeDir, "slsDetReplayBench", 0, 1000, true);
+  }
+
+  epicsTimeGetCurrent(&start);
+  replay.start(rate, loops);
+  do {
+    epicsThreadSleep(0.01);
+  } while (!sink.finished());
+  assembler.flush();
+  if (writer) {
+    writer->close();
+    do {
+      epicsThreadSleep(0.001);
+      writer->getStats(&writeStats);
+    } while (writeStats.frames + writeStats.failed + writeStats.dropped < sink.frames);
+  }
+  epicsTimeGetCurrent(&end);
+  elapsed = epicsTimeDiffInSeconds(&end, &start);
+
+  replay.getStats(&replayStats);
+  assembler.getStats(&asmStats);
+  printf("%s/%s: %d modules, %lu frames, %llu passes in %.2f s\n", dir, name, numModules,
+         (unsigned long) replay.numFrames(), (unsigned long long) replayStats.loops, elapsed);
+  printf("  replay:    %llu frames, %.0f frames/s, %.1f MB/s, %llu times behind\n",
+         (unsigned long long) replayStats.frames, replayStats.frames / elapsed,
+         replayStats.bytes / elapsed / 1.e6, (unsigned long long) replayStats.behind);
+  printf("  assembler: %llu complete, %llu incomplete, %llu late, %llu no buffer, "
+         "%.3f ms mean latency, %.3f ms longest\n",
+         (unsigned long long) asmStats.complete, (unsigned long long) asmStats.incomplete,
+         (unsigned long long) asmStats.late, (unsigned long long) asmStats.noBuffer,
+         sink.frames ? sink.latency / sink.frames : 0., sink.maxLatency);
+  if (writer) {
+    printf("  writer:    %llu written, %llu dropped, %llu failed, %.1f MB/s, "
+           "%.3f ms longest write, %s\n",
+           (unsigned long long) writeStats.frames, (unsigned long long) writeStats.dropped,
+           (unsigned long long) writeStats.failed, writeStats.bytes / elapsed / 1.e6,
+           writeStats.maxLatency, writeStats.direct ? "O_DIRECT" : "buffered");
+  }
+  printf("  end to end: %.0f frames/s, %.1f MB/s\n", sink.frames / elapsed,
+         sink.frames * numModules * (double) MODULE_BYTES / elapsed / 1.e6);
+
+  if (writer) {
+    char fileName[512];
+    delete writer;
+    for (unsigned n=0; n<writeStats.files; n++) {
+      epicsSnprintf(fileName, sizeof(fileName), "%s/slsDetReplayBench_d0_f%012u_0.raw", writeDir, n);
+      unlink(fileName);
+    }
+    epicsSnprintf(fileName, sizeof(fileName), "%s/slsDetReplayBench_d0_0.idx", writeDir);
+    unlink(fileName);
+  }
+  if (numGenerate) {
+    replay.close();
+    for (int mod=0; mod<numModules; mod++) {
+      char fileName[512];
+      epicsSnprintf(fileName, sizeof(fileName), "%s/%s_d%d_f%012u_0.raw", dir, name, mod, 0);
+      unlink(fileName);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,112 @@
+#ifndef slsDetShm_H
+#define slsDetShm_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory frame ring of the slsJungfrau driver, shared by
+ * the driver (SlsDetShmRing) and the readers (slsDetShmReader.h). It is plain
+ * C with fixed size fields so other languages can map it too, see
+ * slsDetShmMonitor.py.
+ *
+ * The ring is a POSIX shared memory object (/dev/shm/<name>): a SlsShmRing
+ * header followed by numSlots slots of slotSize bytes, each a SlsShmSlot
+ * followed by the pixels. Frame n of the ring (counting from 1) goes into
+ * slot (n - 1) % numSlots. Its seq is 2n - 1 while the frame is written and
+ * 2n once it is complete, and writeSeq is the last complete frame. The driver
+ * never waits for the readers: a reader that falls more than numSlots behind
+ * has frames overwritten and finds out from seq.
+ *
+ * The fields written while frames go in are only read and written with the
+ * SLS_SHM_LOAD and SLS_SHM_STORE macros, which need gcc or clang.
+ */
+
+#define SLS_SHM_MAGIC       0x474e495244534c53ULL  /* "SLSDRING" */
+#define SLS_SHM_VERSION     1
+#define SLS_SHM_ALIGN       4096
+#define SLS_SHM_MAX_MODULES 64
+/* Readers that can show up in the table, any number more can read unseen */
+#define SLS_SHM_MAX_READERS 16
+
+#define SLS_SHM_LOAD(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SLS_SHM_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Pixel types, the same as those of the preview publisher */
+typedef enum {
+  SlsShmUInt16,   /* raw or assembled frames */
+  SlsShmInt16,    /* photon counts */
+  SlsShmFloat32   /* energy */
+} SlsShmDataType;
+
+/* The sls_detector_header of a module, field for field */
+typedef struct {
+  uint64_t frameNumber;
+  uint32_t expLength;
+  uint32_t packetNumber;
+  uint64_t bunchId;
+  uint64_t timestamp;
+  uint16_t modId;
+  uint16_t row;
+  uint16_t column;
+  uint16_t reserved;
+  uint32_t debug;
+  uint16_t roundRNumber;
+  uint8_t  detType;
+  uint8_t  version;
+} SlsShmModuleHeader;
+
+/* A reader, kept up to date by the reader library for monitoring */
+typedef struct {
+  uint32_t pid;       /* process of the reader, 0 if the entry is free */
+  uint32_t reserved;
+  uint64_t cursor;    /* frame it reads next */
+  uint64_t read;      /* frames it has read */
+  uint64_t lost;      /* frames overwritten before it got to them */
+  uint8_t  pad[32];
+} SlsShmReaderInfo;
+
+/* The header at the start of the ring */
+typedef struct {
+  uint64_t magic;       /* SLS_SHM_MAGIC */
+  uint32_t version;     /* SLS_SHM_VERSION */
+  uint32_t headerSize;  /* offset of the first slot */
+  uint64_t slotSize;    /* bytes from one slot to the next */
+  uint64_t dataSize;    /* most pixel bytes a slot holds */
+  uint32_t numSlots;
+  uint32_t producerPid;
+  uint32_t closed;      /* set once the driver has let go of the ring */
+  uint8_t  pad0[20];
+  uint64_t writeSeq;    /* last complete frame, on a cache line of its own */
+  uint8_t  pad1[56];
+  SlsShmReaderInfo readers[SLS_SHM_MAX_READERS];
+  uint8_t  pad2[SLS_SHM_ALIGN - 128 - SLS_SHM_MAX_READERS * sizeof(SlsShmReaderInfo)];
+} SlsShmRing;
+
+/* The header of a frame, with the pixels following at SLS_SHM_ALIGN */
+typedef struct {
+  uint64_t seq;             /* 2n - 1 while frame n is written, 2n when it is complete */
+  uint64_t frameNumber;     /* frame number shared by all the modules */
+  uint64_t timestamp;       /* timestamp of the first module to arrive */
+  uint64_t bunchId;         /* bunch id of the first module to arrive */
+  uint64_t modulesMask;     /* bit n is set if module n arrived */
+  uint64_t missingMask;     /* bit n is set if module n is missing */
+  uint64_t arrival;         /* ns since 1970 the first module arrived */
+  uint64_t dataSize;        /* pixel bytes */
+  uint32_t sizeX;           /* image width in pixels */
+  uint32_t sizeY;           /* image height in pixels */
+  uint32_t bytesPerPixel;
+  uint32_t dataType;        /* SlsShmDataType */
+  uint32_t numModules;
+  uint32_t reserved;
+  double   photonEnergy;    /* keV of a photon if the pixels count photons, 0 otherwise */
+  SlsShmModuleHeader header[SLS_SHM_MAX_MODULES];
+  uint32_t packetsCaught[SLS_SHM_MAX_MODULES];
+  uint8_t  pad[SLS_SHM_ALIGN - 96 - SLS_SHM_MAX_MODULES * (sizeof(SlsShmModuleHeader) + 4)];
+} SlsShmSlot;
+
+/* Fails to compile if the layout is not what the readers expect */
+typedef char SlsShmModuleHeaderSize[(sizeof(SlsShmModuleHeader) == 48) ? 1 : -1];
+typedef char SlsShmRingSize[(sizeof(SlsShmRing) == SLS_SHM_ALIGN) ? 1 : -1];
+typedef char SlsShmSlotSize[(sizeof(SlsShmSlot) == SLS_SHM_ALIGN) ? 1 : -1];
+
+#endif
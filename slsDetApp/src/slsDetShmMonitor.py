@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Reads the frames the slsJungfrau driver shares with ShmEnable in place.
+
+An example of a local consumer of the shared memory ring: it maps the ring
+through the slsDetShmReader library with ctypes, looks at each frame through
+a numpy array on the shared memory itself, without copying it, and prints
+the frame rate, the frames it lost and a simple hit count once a second.
+
+    slsDetShmMonitor.py /slsJungfrau --threshold 5000
+
+LD_LIBRARY_PATH, or --library, has to find libslsDetShmReader.so.
+"""
+
+import argparse
+import ctypes
+import sys
+import time
+
+import numpy
+
+SLS_SHM_MAX_MODULES = 64
+
+SLS_SHM_OK = 0
+SLS_SHM_TIMEOUT = 1
+SLS_SHM_CLOSED = 2
+SLS_SHM_OVERWRITTEN = 3
+
+# SlsShmDataType
+DTYPES = {0: numpy.uint16, 1: numpy.int16, 2: numpy.float32}
+
+
+class ModuleHeader(ctypes.Structure):
+    """SlsShmModuleHeader, the sls_detector_header of a module"""
+    _fields_ = [
+        ("frameNumber", ctypes.c_uint64),
+        ("expLength", ctypes.c_uint32),
+        ("packetNumber", ctypes.c_uint32),
+        ("bunchId", ctypes.c_uint64),
+        ("timestamp", ctypes.c_uint64),
+        ("modId", ctypes.c_uint16),
+        ("row", ctypes.c_uint16),
+        ("column", ctypes.c_uint16),
+        ("reserved", ctypes.c_uint16),
+        ("debug", ctypes.c_uint32),
+        ("roundRNumber", ctypes.c_uint16),
+        ("detType", ctypes.c_uint8),
+        ("version", ctypes.c_uint8),
+    ]
+
+
+class Slot(ctypes.Structure):
+    """SlsShmSlot, the header of a frame in the ring"""
+    _fields_ = [
+        ("seq", ctypes.c_uint64),
+        ("frameNumber", ctypes.c_uint64),
+        ("timestamp", ctypes.c_uint64),
+        ("bunchId", ctypes.c_uint64),
+        ("modulesMask", ctypes.c_uint64),
+        ("missingMask", ctypes.c_uint64),
+        ("arrival", ctypes.c_uint64),
+        ("dataSize", ctypes.c_uint64),
+        ("sizeX", ctypes.c_uint32),
+        ("sizeY", ctypes.c_uint32),
+        ("bytesPerPixel", ctypes.c_uint32),
+        ("dataType", ctypes.c_uint32),
+        ("numModules", ctypes.c_uint32),
+        ("reserved", ctypes.c_uint32),
+        ("photonEnergy", ctypes.c_double),
+        ("header", ModuleHeader * SLS_SHM_MAX_MODULES),
+        ("packetsCaught", ctypes.c_uint32 * SLS_SHM_MAX_MODULES),
+    ]
+
+
+class Frame(ctypes.Structure):
+    """SlsShmFrame"""
+    _fields_ = [
+        ("seq", ctypes.c_uint64),
+        ("lost", ctypes.c_uint64),
+        ("slot", ctypes.POINTER(Slot)),
+        ("data", ctypes.c_void_p),
+    ]
+
+
+def load(library):
+    lib = ctypes.CDLL(library)
+    lib.slsShmOpen.argtypes = [ctypes.c_char_p]
+    lib.slsShmOpen.restype = ctypes.c_void_p
+    lib.slsShmClose.argtypes = [ctypes.c_void_p]
+    lib.slsShmClose.restype = None
+    lib.slsShmNext.argtypes = [ctypes.c_void_p, ctypes.POINTER(Frame), ctypes.c_int]
+    lib.slsShmNext.restype = ctypes.c_int
+    lib.slsShmDone.argtypes = [ctypes.c_void_p, ctypes.POINTER(Frame)]
+    lib.slsShmDone.restype = ctypes.c_int
+    lib.slsShmSkip.argtypes = [ctypes.c_void_p]
+    lib.slsShmSkip.restype = None
+    lib.slsShmLost.argtypes = [ctypes.c_void_p]
+    lib.slsShmLost.restype = ctypes.c_uint64
+    return lib
+
+
+def pixels(frame):
+    """The pixels of a frame as a numpy array on the shared memory"""
+    slot = frame.slot.contents
+    dtype = DTYPES.get(slot.dataType, numpy.uint16)
+    count = slot.sizeX * slot.sizeY
+    buffer = (ctypes.c_char * (count * numpy.dtype(dtype).itemsize)).from_address(frame.data)
+    return numpy.frombuffer(buffer, dtype=dtype, count=count).reshape(slot.sizeY, slot.sizeX)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("name", nargs="?", default="/slsJungfrau", help="name of the ring")
+    parser.add_argument("--library", default="libslsDetShmReader.so", help="reader library")
+    parser.add_argument("--threshold", type=float, default=0., help="count pixels above this as hits")
+    parser.add_argument("--latest", action="store_true", help="skip to the latest frame after each one")
+    args = parser.parse_args()
+
+    lib = load(args.library)
+    reader = None
+    frame = Frame()
+    frames = 0
+    overwritten = 0
+    hits = 0
+    last = time.time()
+
+    try:
+        while True:
+            if not reader:
+                reader = lib.slsShmOpen(args.name.encode())
+                if not reader:
+                    time.sleep(1.)
+                    continue
+            status = lib.slsShmNext(reader, ctypes.byref(frame), 1000)
+            if status == SLS_SHM_CLOSED:
+                # The IOC let go of the ring, wait for the next one
+                lib.slsShmClose(reader)
+                reader = None
+                continue
+            if status == SLS_SHM_OK:
+                image = pixels(frame)
+                found = int(numpy.count_nonzero(image > args.threshold)) if args.threshold else 0
+                # Anything worked out from an overwritten frame is thrown away
+                if lib.slsShmDone(reader, ctypes.byref(frame)) == SLS_SHM_OVERWRITTEN:
+                    overwritten += 1
+                else:
+                    frames += 1
+                    hits += found
+                if args.latest:
+                    lib.slsShmSkip(reader)
+
+            now = time.time()
+            if now - last >= 1.:
+                lost = lib.slsShmLost(reader) if reader else 0
+                print("%.1f frames/s, %d overwritten, %d lost, %.1f hits/frame" %
+                      (frames / (now - last), overwritten, lost, hits / frames if frames else 0.))
+                sys.stdout.flush()
+                frames = 0
+                hits = 0
+                last = now
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if reader:
+            lib.slsShmClose(reader)
+
+
+if __name__ == "__main__":
+    main()
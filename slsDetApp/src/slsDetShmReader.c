@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "slsDetShmReader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* How long to sleep between looks at the ring while waiting */
+#define POLL_NS 50000
+/* Looks at the ring before the first sleep */
+#define POLL_SPINS 100
+
+struct SlsShmReader {
+  SlsShmRing        *ring;
+  size_t            size;
+  uint64_t          cursor;   /* frame read next */
+  uint64_t          lost;
+  uint64_t          read;
+  SlsShmReaderInfo  *info;    /* entry in the table, NULL if there was none */
+};
+
+static const SlsShmSlot* slotOf(const SlsShmReader *reader, uint64_t seq)
+{
+  const SlsShmRing *ring = reader->ring;
+  return (const SlsShmSlot *) ((const char *) ring + ring->headerSize +
+                               ((seq - 1) % ring->numSlots) * ring->slotSize);
+}
+
+static void publish(SlsShmReader *reader)
+{
+  if (!reader->info) return;
+  SLS_SHM_STORE(&reader->info->cursor, reader->cursor);
+  SLS_SHM_STORE(&reader->info->read, reader->read);
+  SLS_SHM_STORE(&reader->info->lost, reader->lost);
+}
+
+SlsShmReader* slsShmOpen(const char *name)
+{
+  SlsShmReader *reader;
+  SlsShmRing *ring;
+  struct stat info;
+  int writable = 1;
+  int fd;
+  int n;
+
+  /* A reader with no write access still reads, it just does not show up */
+  fd = shm_open(name, O_RDWR, 0);
+  if ((fd < 0) && (errno == EACCES)) {
+    writable = 0;
+    fd = shm_open(name, O_RDONLY, 0);
+  }
+  if (fd < 0) return NULL;
+  if (fstat(fd, &info) || ((size_t) info.st_size < sizeof(SlsShmRing))) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  ring = (SlsShmRing *) mmap(NULL, info.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                             MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED) return NULL;
+  if ((SLS_SHM_LOAD(&ring->magic) != SLS_SHM_MAGIC) || (ring->version != SLS_SHM_VERSION) ||
+      (ring->headerSize + (size_t) ring->numSlots * ring->slotSize > (size_t) info.st_size)) {
+    munmap(ring, info.st_size);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  reader = (SlsShmReader *) calloc(1, sizeof(SlsShmReader));
+  if (!reader) {
+    munmap(ring, info.st_size);
+    return NULL;
+  }
+  reader->ring = ring;
+  reader->size = info.st_size;
+  reader->cursor = SLS_SHM_LOAD(&ring->writeSeq) + 1;
+
+  if (writable) {
+    for (n=0; n<SLS_SHM_MAX_READERS; n++) {
+      uint32_t pid = 0;
+      if (__atomic_compare_exchange_n(&ring->readers[n].pid, &pid, (uint32_t) getpid(), 0,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        reader->info = &ring->readers[n];
+        break;
+      }
+    }
+  }
+  publish(reader);
+
+  return reader;
+}
+
+void slsShmClose(SlsShmReader *reader)
+{
+  if (!reader) return;
+  if (reader->info) SLS_SHM_STORE(&reader->info->pid, 0);
+  munmap(reader->ring, reader->size);
+  free(reader);
+}
+
+int slsShmNext(SlsShmReader *reader, SlsShmFrame *frame, int timeoutMs)
+{
+  const SlsShmRing *ring = reader->ring;
+  struct timespec now;
+  struct timespec pause;
+  double deadline = 0.;
+  int spins = 0;
+
+  if (timeoutMs > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = now.tv_sec + now.tv_nsec * 1.e-9 + timeoutMs * 1.e-3;
+  }
+  frame->lost = 0;
+
+  while (1) {
+    uint64_t writeSeq;
+    uint64_t seq;
+
+    if (SLS_SHM_LOAD(&ring->closed)) return SLS_SHM_CLOSED;
+
+    writeSeq = SLS_SHM_LOAD(&ring->writeSeq);
+    if (writeSeq >= reader->cursor) {
+      /* The slot after the last complete frame may already be rewritten */
+      if (writeSeq - reader->cursor + 2 > ring->numSlots) {
+        uint64_t oldest = writeSeq + 2 > ring->numSlots ? writeSeq + 2 - ring->numSlots : 1;
+        if (oldest > writeSeq) oldest = writeSeq;
+        if (oldest > reader->cursor) {
+          frame->lost += oldest - reader->cursor;
+          reader->lost += oldest - reader->cursor;
+          reader->cursor = oldest;
+          publish(reader);
+        }
+      }
+      seq = SLS_SHM_LOAD(&slotOf(reader, reader->cursor)->seq);
+      if (seq == 2 * reader->cursor) {
+        frame->seq = reader->cursor;
+        frame->slot = slotOf(reader, reader->cursor);
+        frame->data = (const char *) frame->slot + sizeof(SlsShmSlot);
+        return SLS_SHM_OK;
+      }
+      /* Overwritten since writeSeq was read, have another look */
+      continue;
+    }
+
+    if (timeoutMs == 0) return SLS_SHM_TIMEOUT;
+    if (spins < POLL_SPINS) {
+      spins++;
+      continue;
+    }
+    if (timeoutMs > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (now.tv_sec + now.tv_nsec * 1.e-9 >= deadline) return SLS_SHM_TIMEOUT;
+    }
+    pause.tv_sec = 0;
+    pause.tv_nsec = POLL_NS;
+    nanosleep(&pause, NULL);
+  }
+}
+
+int slsShmDone(SlsShmReader *reader, const SlsShmFrame *frame)
+{
+  uint64_t seq;
+
+  /* Whatever was read of the frame comes before the second look at seq */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  seq = __atomic_load_n(&frame->slot->seq, __ATOMIC_RELAXED);
+
+  if (frame->seq >= reader->cursor) reader->cursor = frame->seq + 1;
+  if (seq != 2 * frame->seq) {
+    reader->lost++;
+    publish(reader);
+    return SLS_SHM_OVERWRITTEN;
+  }
+  reader->read++;
+  publish(reader);
+  return SLS_SHM_OK;
+}
+
+void slsShmSkip(SlsShmReader *reader)
+{
+  reader->cursor = SLS_SHM_LOAD(&reader->ring->writeSeq) + 1;
+  publish(reader);
+}
+
+uint64_t slsShmLost(const SlsShmReader *reader)
+{
+  return reader->lost;
+}
+
+const SlsShmRing* slsShmRingHeader(const SlsShmReader *reader)
+{
+  return reader->ring;
+}
@@ -0,0 +1,66 @@
+#ifndef slsDetShmReader_H
+#define slsDetShmReader_H
+
+#include "slsDetShm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reads the frames the slsJungfrau driver shares with ShmEnable in place,
+ * without copying them. Plain C with no EPICS dependency, to link into any
+ * local program or to load from Python with ctypes.
+ *
+ *   SlsShmReader *reader = slsShmOpen("/slsJungfrau");
+ *   SlsShmFrame frame;
+ *   while (slsShmNext(reader, &frame, 1000) != SLS_SHM_CLOSED) {
+ *     ... use frame.slot and frame.data ...
+ *     if (slsShmDone(reader, &frame) == SLS_SHM_OVERWRITTEN) ... drop the results ...
+ *   }
+ *   slsShmClose(reader);
+ *
+ * Each reader has its own cursor and starts at the next frame to come. The
+ * driver does not wait for it: when it falls behind by the whole ring the
+ * frames it missed are counted in frame.lost and slsShmLost(), and a frame
+ * overwritten while it was still being read makes slsShmDone() say so.
+ */
+
+/* What slsShmNext() and slsShmDone() return */
+#define SLS_SHM_OK           0
+#define SLS_SHM_TIMEOUT      1  /* no frame within the timeout */
+#define SLS_SHM_CLOSED       2  /* the driver closed the ring, open it again */
+#define SLS_SHM_OVERWRITTEN  3  /* the frame changed while it was read */
+
+typedef struct SlsShmReader SlsShmReader;
+
+/* A frame in the ring, only valid until slsShmDone() */
+typedef struct {
+  uint64_t          seq;    /* frame of the ring, counting from 1 */
+  uint64_t          lost;   /* frames overwritten since the previous one */
+  const SlsShmSlot  *slot;  /* the header */
+  const void        *data;  /* the pixels, slot->dataSize bytes */
+} SlsShmFrame;
+
+/* Opens a ring by name, e.g. "/slsJungfrau", returning NULL with errno set
+ * when there is no ring of that name or it is not a ring */
+SlsShmReader* slsShmOpen(const char *name);
+void slsShmClose(SlsShmReader *reader);
+
+/* Waits up to timeoutMs, -1 for ever and 0 not at all, for the next frame */
+int slsShmNext(SlsShmReader *reader, SlsShmFrame *frame, int timeoutMs);
+/* Moves on from the frame, returning SLS_SHM_OVERWRITTEN if it was not
+ * intact while it was read */
+int slsShmDone(SlsShmReader *reader, const SlsShmFrame *frame);
+/* Skips to the next frame to come, e.g. for a display that only wants the latest */
+void slsShmSkip(SlsShmReader *reader);
+
+/* Frames this reader has lost to the driver */
+uint64_t slsShmLost(const SlsShmReader *reader);
+const SlsShmRing* slsShmRingHeader(const SlsShmReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+#include "slsDetShmRing.h"
+
+#include <epicsStdio.h>
+#include <epicsTime.h>
+
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Size of a slot holding dataSize bytes of pixels */
+#define SLOT_SIZE(dataSize) (sizeof(SlsShmSlot) + (((dataSize) + SLS_SHM_ALIGN - 1) & ~((size_t) SLS_SHM_ALIGN - 1)))
+
+SlsDetShmRing::SlsDetShmRing() :
+  _ring(NULL),
+  _size(0),
+  _written(0),
+  _failed(0)
+{
+  _name[0] = '\0';
+  _error[0] = '\0';
+}
+
+SlsDetShmRing::~SlsDetShmRing()
+{
+  close();
+}
+
+void SlsDetShmRing::setError(const char *fmt, ...)
+{
+  /* Must be called with the lock held */
+  va_list args;
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+}
+
+const char* SlsDetShmRing::error()
+{
+  return _error;
+}
+
+bool SlsDetShmRing::open(const char *name, unsigned numSlots, size_t dataSize)
+{
+  size_t slotSize = SLOT_SIZE(dataSize);
+  size_t size = sizeof(SlsShmRing) + numSlots * slotSize;
+  SlsShmRing *ring;
+  int fd;
+
+  close();
+
+  _lock.lock();
+  /* POSIX wants the name to start with a slash and to have no other */
+  if (name[0] == '/') name++;
+  if (!name[0] || std::strchr(name, '/') || (std::strlen(name) + 2 > sizeof(_name)) || !numSlots) {
+    setError("Invalid ring /%s with %u slots", name, numSlots);
+    _lock.unlock();
+    return false;
+  }
+  epicsSnprintf(_name, sizeof(_name), "/%s", name);
+
+  /* Readers left on the ring of an earlier IOC are told it is gone */
+  fd = shm_open(_name, O_RDWR, 0);
+  if (fd >= 0) {
+    struct stat info;
+    if (!fstat(fd, &info) && ((size_t) info.st_size >= sizeof(SlsShmRing))) {
+      ring = (SlsShmRing *) mmap(NULL, sizeof(SlsShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (ring != (SlsShmRing *) MAP_FAILED) {
+        if (ring->magic == SLS_SHM_MAGIC) SLS_SHM_STORE(&ring->closed, 1);
+        munmap(ring, sizeof(SlsShmRing));
+      }
+    }
+    ::close(fd);
+    shm_unlink(_name);
+  }
+
+  fd = shm_open(_name, O_RDWR | O_CREAT | O_EXCL, 0664);
+  if (fd < 0) {
+    setError("Unable to create %s: %s", _name, strerror(errno));
+    _lock.unlock();
+    return false;
+  }
+  /* Readers of the same group can register themselves whatever the umask */
+  fchmod(fd, 0664);
+  if (ftruncate(fd, size)) {
+    setError("Unable to size %s to %lu MB: %s", _name, (unsigned long) (size >> 20), strerror(errno));
+    ::close(fd);
+    shm_unlink(_name);
+    _lock.unlock();
+    return false;
+  }
+  ring = (SlsShmRing *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (ring == (SlsShmRing *) MAP_FAILED) {
+    setError("Unable to map %s: %s", _name, strerror(errno));
+    shm_unlink(_name);
+    _lock.unlock();
+    return false;
+  }
+
+  /* Fault the pages in now rather than on the first frames */
+  for (size_t offset=0; offset<size; offset+=SLS_SHM_ALIGN) {
+    ((volatile char *) ring)[offset] = 0;
+  }
+
+  ring->version = SLS_SHM_VERSION;
+  ring->headerSize = sizeof(SlsShmRing);
+  ring->slotSize = slotSize;
+  ring->dataSize = slotSize - sizeof(SlsShmSlot);
+  ring->numSlots = numSlots;
+  ring->producerPid = getpid();
+  ring->closed = 0;
+  ring->writeSeq = 0;
+  /* Readers only trust the ring once the magic is there */
+  SLS_SHM_STORE(&ring->magic, SLS_SHM_MAGIC);
+
+  _ring = ring;
+  _size = size;
+  _written = 0;
+  _failed = 0;
+  setError("Sharing %u frames in %s", numSlots, _name);
+  _lock.unlock();
+
+  return true;
+}
+
+void SlsDetShmRing::close()
+{
+  _lock.lock();
+  if (_ring) {
+    SLS_SHM_STORE(&_ring->closed, 1);
+    munmap(_ring, _size);
+    /* Readers keep their mapping until they close it */
+    shm_unlink(_name);
+    _ring = NULL;
+    _size = 0;
+  }
+  _lock.unlock();
+}
+
+bool SlsDetShmRing::isOpen()
+{
+  bool open;
+  _lock.lock();
+  open = _ring != NULL;
+  _lock.unlock();
+  return open;
+}
+
+bool SlsDetShmRing::write(const SlsDetFrame *frame, SlsShmDataType type, const void *data, size_t size)
+{
+  SlsShmSlot *slot;
+  epicsUInt64 seq;
+  int numModules;
+
+  _lock.lock();
+  if (!_ring) {
+    _lock.unlock();
+    return false;
+  }
+  if (size > _ring->dataSize) {
+    _failed++;
+    _lock.unlock();
+    return false;
+  }
+
+  seq = _ring->writeSeq + 1;
+  slot = (SlsShmSlot *) ((char *) _ring + _ring->headerSize + ((seq - 1) % _ring->numSlots) * _ring->slotSize);
+
+  /* A reader that sees the odd sequence number, or a different one after
+   * reading, knows the slot changed under it */
+  __atomic_store_n(&slot->seq, 2 * seq - 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  numModules = frame->numModules < SLS_SHM_MAX_MODULES ? frame->numModules : SLS_SHM_MAX_MODULES;
+  slot->frameNumber = frame->frameNumber;
+  slot->timestamp = frame->timestamp;
+  slot->bunchId = frame->bunchId;
+  slot->modulesMask = frame->modulesMask;
+  slot->missingMask = frame->missingMask;
+  slot->arrival = ((epicsUInt64) frame->arrival.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH) * 1000000000ULL +
+                  frame->arrival.nsec;
+  slot->dataSize = size;
+  slot->sizeX = frame->sizeX;
+  slot->sizeY = frame->sizeY;
+  slot->bytesPerPixel = (frame->sizeX && frame->sizeY) ? size / (frame->sizeX * frame->sizeY) : 0;
+  slot->dataType = type;
+  slot->numModules = numModules;
+  slot->photonEnergy = frame->photonEnergy;
+  /* The module headers are sls_detector_header as they are */
+  std::memcpy(slot->header, frame->header, numModules * sizeof(SlsShmModuleHeader));
+  std::memcpy(slot->packetsCaught, frame->packetsCaught, numModules * sizeof(epicsUInt32));
+  std::memcpy((char *) slot + sizeof(SlsShmSlot), data, size);
+
+  SLS_SHM_STORE(&slot->seq, 2 * seq);
+  SLS_SHM_STORE(&_ring->writeSeq, seq);
+  _written++;
+  _lock.unlock();
+
+  return true;
+}
+
+void SlsDetShmRing::getStats(SlsDetShmRingStats *stats)
+{
+  epicsUInt64 writeSeq;
+
+  std::memset(stats, 0, sizeof(*stats));
+  _lock.lock();
+  stats->written = _written;
+  stats->failed = _failed;
+  if (_ring) {
+    writeSeq = SLS_SHM_LOAD(&_ring->writeSeq);
+    for (int n=0; n<SLS_SHM_MAX_READERS; n++) {
+      SlsShmReaderInfo *reader = &_ring->readers[n];
+      epicsUInt32 pid = SLS_SHM_LOAD(&reader->pid);
+      epicsUInt64 cursor;
+      if (!pid) continue;
+      if (kill(pid, 0) && (errno == ESRCH)) {
+        __atomic_compare_exchange_n(&reader->pid, &pid, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        continue;
+      }
+      cursor = SLS_SHM_LOAD(&reader->cursor);
+      stats->readers++;
+      if ((cursor <= writeSeq) && (writeSeq - cursor + 1 > stats->maxLag)) {
+        stats->maxLag = writeSeq - cursor + 1;
+      }
+      stats->lost += SLS_SHM_LOAD(&reader->lost);
+    }
+  }
+  _lock.unlock();
+}
+
+void SlsDetShmRing::resetStats()
+{
+  _lock.lock();
+  _written = 0;
+  _failed = 0;
+  _lock.unlock();
+}
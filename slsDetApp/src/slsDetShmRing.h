@@ -0,0 +1,62 @@
+#ifndef slsDetShmRing_H
+#define slsDetShmRing_H
+
+#include "slsDetFrame.h"
+#include "slsDetShm.h"
+
+#include <epicsMutex.h>
+
+/** Counters kept by the SlsDetShmRing */
+typedef struct {
+  epicsUInt64 written;    /**< frames put in the ring */
+  epicsUInt64 failed;     /**< frames too large for a slot */
+  unsigned    readers;    /**< readers in the table */
+  epicsUInt64 maxLag;     /**< most frames a reader has still to read */
+  epicsUInt64 lost;       /**< frames overwritten before the readers got to them */
+} SlsDetShmRingStats;
+
+/** Class definition for the SlsDetShmRing class
+  *
+  * Puts frames in a named POSIX shared memory ring (see slsDetShm.h) that any
+  * number of local processes can read in place with the slsDetShmReader
+  * library, each at its own pace. Writing a frame is one copy of the pixels
+  * and the module headers into the next slot; the ring never waits for its
+  * readers, a slow reader has frames overwritten and is told so by the
+  * sequence number of the slot.
+  *
+  * Opening the ring replaces any object of the same name. Readers still on
+  * a closed or replaced ring see it marked closed and can open it again.
+  */
+class SlsDetShmRing {
+public:
+  SlsDetShmRing();
+  virtual ~SlsDetShmRing();
+
+  /* Creates the ring, e.g. "/slsJungfrau", returning false on failure */
+  virtual bool open(const char *name, unsigned numSlots, size_t dataSize);
+  virtual void close();
+  bool isOpen();
+
+  /* Returns false if the ring is closed or the pixels do not fit a slot */
+  virtual bool write(const SlsDetFrame *frame, SlsShmDataType type, const void *data, size_t size);
+
+  /* Also frees the table entries of readers that exited without closing */
+  void getStats(SlsDetShmRingStats *stats);
+  void resetStats();
+  /* Description of what went wrong with the last open */
+  const char* error();
+
+protected:
+  void setError(const char *fmt, ...);
+
+private:
+  SlsShmRing      *_ring;
+  size_t          _size;
+  char            _name[256];
+  epicsUInt64     _written;
+  epicsUInt64     _failed;
+  char            _error[256];
+  epicsMutex      _lock;
+};
+
+#endif
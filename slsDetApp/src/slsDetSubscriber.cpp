@@ -0,0 +1,272 @@
+#include "slsDetSubscriber.h"
+#include "slsDetAffinity.h"
+
+#include <zmq.h>
+#include <epicsStdio.h>
+
+#include <cstring>
+#include <cstdlib>
+#include <cstdarg>
+
+/* How often a waiting thread looks at whether it should stop, in ms */
+#define RECV_TIMEOUT 100
+#define THREAD_TMO 2.0
+/* Room for the JSON header of a frame */
+#define HEADER_SIZE 1024
+
+/* Finds the number after "key": in a JSON object, returning false if it is missing */
+static bool jsonNumber(const char *json, const char *key, epicsUInt64 *value)
+{
+  char name[64];
+  const char *pos;
+  char *end;
+
+  epicsSnprintf(name, sizeof(name), "\"%s\"", key);
+  pos = std::strstr(json, name);
+  if (!pos) return false;
+  pos += std::strlen(name);
+  while ((*pos == ' ') || (*pos == '\t')) pos++;
+  if (*pos++ != ':') return false;
+  while ((*pos == ' ') || (*pos == '\t')) pos++;
+  *value = std::strtoull(pos, &end, 10);
+  return end != pos;
+}
+
+SlsDetSubscriber::SlsDetSubscriber(SlsDetStreamSink *sink, int module, const char *endpoint,
+                                   int cpu, int highWaterMark, const char *portName) :
+  _sink(sink),
+  _portName(portName),
+  _module(module),
+  _cpu(cpu),
+  _highWaterMark(highWaterMark),
+  _context(NULL),
+  _socket(NULL),
+  _running(false),
+  _acquiring(false),
+  _framesCaught(0),
+  _thread(*this, "slsDetStream", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityHigh)
+{
+  epicsSnprintf(_endpoint, sizeof(_endpoint), "%s", endpoint);
+  std::memset(&_stats, 0, sizeof(_stats));
+  _error[0] = '\0';
+}
+
+SlsDetSubscriber::~SlsDetSubscriber()
+{
+  stop();
+}
+
+int SlsDetSubscriber::module() const
+{
+  return _module;
+}
+
+const char* SlsDetSubscriber::endpoint() const
+{
+  return _endpoint;
+}
+
+int SlsDetSubscriber::cpu() const
+{
+  return _cpu;
+}
+
+void SlsDetSubscriber::setError(const char *fmt, ...)
+{
+  va_list args;
+  _lock.lock();
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+  _lock.unlock();
+}
+
+const char* SlsDetSubscriber::error()
+{
+  return _error;
+}
+
+void SlsDetSubscriber::getStats(SlsDetSubscriberStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+bool SlsDetSubscriber::start()
+{
+  int timeout = RECV_TIMEOUT;
+  int linger = 0;
+
+  if (_running) return true;
+
+  _context = zmq_ctx_new();
+  if (!_context) {
+    setError("Unable to create the ZeroMQ context: %s", zmq_strerror(zmq_errno()));
+    return false;
+  }
+  _socket = zmq_socket(_context, ZMQ_SUB);
+  if (!_socket) {
+    setError("Unable to create the ZeroMQ socket: %s", zmq_strerror(zmq_errno()));
+    zmq_ctx_term(_context);
+    _context = NULL;
+    return false;
+  }
+
+  zmq_setsockopt(_socket, ZMQ_SUBSCRIBE, "", 0);
+  zmq_setsockopt(_socket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+  zmq_setsockopt(_socket, ZMQ_LINGER, &linger, sizeof(linger));
+  if (_highWaterMark > 0) {
+    zmq_setsockopt(_socket, ZMQ_RCVHWM, &_highWaterMark, sizeof(_highWaterMark));
+  }
+
+  /* The connection is made in the background, the receiver does not have to be up yet */
+  if (zmq_connect(_socket, _endpoint)) {
+    setError("Unable to connect to %s: %s", _endpoint, zmq_strerror(zmq_errno()));
+    zmq_close(_socket);
+    zmq_ctx_term(_context);
+    _socket = NULL;
+    _context = NULL;
+    return false;
+  }
+
+  setError("Subscribed to %s", _endpoint);
+  _running = true;
+  _thread.start();
+
+  return true;
+}
+
+void SlsDetSubscriber::stop()
+{
+  if (_running) {
+    _running = false;
+    _thread.exitWait(THREAD_TMO);
+  }
+  if (_socket) {
+    zmq_close(_socket);
+    _socket = NULL;
+  }
+  if (_context) {
+    zmq_ctx_term(_context);
+    _context = NULL;
+  }
+}
+
+bool SlsDetSubscriber::parseHeader(const char *json, size_t size,
+                                   slsReceiverDefs::sls_receiver_header *header, bool *data)
+{
+  char buffer[HEADER_SIZE];
+  epicsUInt64 value;
+  epicsUInt64 packets;
+
+  if (!size || (size >= sizeof(buffer)) || (json[0] != '{')) return false;
+  std::memcpy(buffer, json, size);
+  buffer[size] = '\0';
+
+  if (!jsonNumber(buffer, "jsonversion", &value)) return false;
+  if (!jsonNumber(buffer, "data", &value)) return false;
+  *data = value != 0;
+  /* The header closing an acquisition carries nothing else */
+  if (!*data) return true;
+
+  std::memset(&header->detHeader, 0, sizeof(header->detHeader));
+  header->packetsMask.reset();
+  if (!jsonNumber(buffer, "frameNumber", &value)) return false;
+  header->detHeader.frameNumber = value;
+  if (jsonNumber(buffer, "expLength", &value)) header->detHeader.expLength = value;
+  if (jsonNumber(buffer, "bunchId", &value)) header->detHeader.bunchId = value;
+  if (jsonNumber(buffer, "timestamp", &value)) header->detHeader.timestamp = value;
+  if (jsonNumber(buffer, "modId", &value)) header->detHeader.modId = value;
+  /* The streamer sends the row and column of the module as x and y */
+  if (jsonNumber(buffer, "xCoord", &value)) header->detHeader.row = value;
+  if (jsonNumber(buffer, "yCoord", &value)) header->detHeader.column = value;
+  if (jsonNumber(buffer, "zCoord", &value)) header->detHeader.reserved = value;
+  if (jsonNumber(buffer, "debug", &value)) header->detHeader.debug = value;
+  if (jsonNumber(buffer, "roundRNumber", &value)) header->detHeader.roundRNumber = value;
+  if (jsonNumber(buffer, "detType", &value)) header->detHeader.detType = value;
+  if (jsonNumber(buffer, "version", &value)) header->detHeader.version = value;
+  /* The receiver counts the packets it caught in packetNumber */
+  if (jsonNumber(buffer, "packetNumber", &packets)) {
+    header->detHeader.packetNumber = packets;
+    if (packets > MAX_NUM_PACKETS) packets = MAX_NUM_PACKETS;
+    for (size_t bit=0; bit<packets; bit++) {
+      header->packetsMask.set(bit);
+    }
+  }
+
+  return true;
+}
+
+void SlsDetSubscriber::run()
+{
+  zmq_msg_t part;
+  slsReceiverDefs::sls_receiver_header header;
+  bool data;
+  bool valid;
+  int more;
+
+  if (!slsDetPinThread(_portName, SlsThreadReceive, _cpu)) {
+    setError("Subscribed to %s, unable to pin to its cores", _endpoint);
+  }
+
+  while (_running) {
+    zmq_msg_init(&part);
+    if (zmq_msg_recv(&part, _socket, 0) < 0) {
+      zmq_msg_close(&part);
+      if (zmq_errno() == ETERM) break;
+      continue;
+    }
+    valid = parseHeader((const char *) zmq_msg_data(&part), zmq_msg_size(&part), &header, &data);
+    more = zmq_msg_more(&part);
+    zmq_msg_close(&part);
+
+    if (valid && !data) {
+      if (_acquiring) {
+        _acquiring = false;
+        _sink->acquisitionFinished(_module, _framesCaught);
+      }
+    } else if (valid && more) {
+      /* The rest of a message is already here once its first part is */
+      zmq_msg_init(&part);
+      if (zmq_msg_recv(&part, _socket, 0) < 0) {
+        zmq_msg_close(&part);
+        continue;
+      }
+      more = zmq_msg_more(&part);
+      if (!_acquiring) {
+        _acquiring = true;
+        _framesCaught = 0;
+        _sink->startAcquisition(_module, "", "", 0, zmq_msg_size(&part));
+      }
+      /* The pixels stay in the ZeroMQ message until the sink is done with them */
+      _sink->rawDataReady(_module, (char *) &header, (char *) zmq_msg_data(&part), zmq_msg_size(&part));
+      zmq_msg_close(&part);
+      _framesCaught++;
+      _lock.lock();
+      _stats.frames++;
+      _lock.unlock();
+    } else {
+      valid = false;
+    }
+
+    if (!valid) {
+      _lock.lock();
+      _stats.bad++;
+      _lock.unlock();
+    }
+
+    /* Anything left over does not belong to a frame */
+    while (more) {
+      zmq_msg_init(&part);
+      if (zmq_msg_recv(&part, _socket, 0) < 0) {
+        more = 0;
+      } else {
+        more = zmq_msg_more(&part);
+      }
+      zmq_msg_close(&part);
+    }
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,89 @@
+#ifndef slsDetSubscriber_H
+#define slsDetSubscriber_H
+
+#include <sls_receiver_defs.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTypes.h>
+
+#include <stdint.h>
+
+/** Class definition for the SlsDetStreamSink class
+  *
+  * Interface for anything that takes the data of a module, with the same
+  * calls as the slsReceiverUsers callbacks so that streamed and embedded
+  * receivers feed the same code.
+  */
+class SlsDetStreamSink {
+public:
+  virtual ~SlsDetStreamSink() {}
+  virtual int startAcquisition(int module, const char *filePath, const char *fileName,
+                               uint64_t fileIndex, uint32_t dataSize) = 0;
+  virtual void acquisitionFinished(int module, uint64_t framesCaught) = 0;
+  virtual void rawDataReady(int module, char *header, char *data, uint32_t dataSize) = 0;
+};
+
+/** Counters kept by the SlsDetSubscriber */
+typedef struct {
+  epicsUInt64 frames;     /**< frames handed to the sink */
+  epicsUInt64 bad;        /**< messages that were not a header and its data */
+} SlsDetSubscriberStats;
+
+/** Class definition for the SlsDetSubscriber class
+  *
+  * Receives the data of one module from the ZeroMQ stream of an slsReceiver
+  * (enableDataStreamingFromReceiver) running on any host, so the receivers do
+  * not have to live in the IOC. Each subscriber has its own thread and
+  * ZeroMQ context and can be pinned to a core, so the IOC scales with the
+  * number of modules by giving each one a core.
+  *
+  * The JSON header of each frame is turned back into an sls_receiver_header
+  * and the pixels are handed to the sink straight from the ZeroMQ message,
+  * which is only closed once the sink returns. The stream carries the number
+  * of packets caught but not which ones, so the packetsMask has that many
+  * bits set from the first packet.
+  */
+class SlsDetSubscriber : public epicsThreadRunable {
+public:
+  /* cpu is the core to pin the thread to, -1 for the receive cores of the
+   * port portName */
+  SlsDetSubscriber(SlsDetStreamSink *sink, int module, const char *endpoint,
+                   int cpu, int highWaterMark, const char *portName=NULL);
+  virtual ~SlsDetSubscriber();
+  virtual void run();
+
+  /* Connects to the stream and starts the thread, returning false on failure */
+  virtual bool start();
+  virtual void stop();
+
+  int module() const;
+  const char* endpoint() const;
+  int cpu() const;
+  void getStats(SlsDetSubscriberStats *stats);
+  /* Description of what went wrong */
+  const char* error();
+
+protected:
+  void setError(const char *fmt, ...);
+  virtual bool parseHeader(const char *json, size_t size,
+                           slsReceiverDefs::sls_receiver_header *header, bool *data);
+
+private:
+  SlsDetStreamSink      *_sink;
+  const char            *_portName;
+  const int             _module;
+  char                  _endpoint[256];
+  const int             _cpu;
+  const int             _highWaterMark;
+  void                  *_context;
+  void                  *_socket;
+  bool                  _running;
+  bool                  _acquiring;
+  epicsUInt64           _framesCaught;
+  SlsDetSubscriberStats _stats;
+  char                  _error[256];
+  epicsMutex            _lock;
+  epicsThread           _thread;
+};
+
+#endif
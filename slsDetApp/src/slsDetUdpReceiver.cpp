@@ -0,0 +1,607 @@
+#include "slsDetUdpReceiver.h"
+#include "slsDetFramePool.h"
+#include "slsDetAffinity.h"
+
+#include <epicsStdio.h>
+
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+/* Packets read from the socket at once */
+#define BATCH_SIZE 64
+/* Frames kept open for packets that arrive out of order */
+#define OPEN_FRAMES 4
+/* How long a read waits before the thread looks at whether it should stop, in ms */
+#define RECV_TIMEOUT 100
+#define THREAD_TMO 2.0
+/* A frame number this far below the last one handed on means the detector counts from the start again */
+#define RESTART_FRAMES 1000
+
+/* The same as an mmsghdr, which not every system has */
+typedef struct {
+  struct msghdr hdr;
+  unsigned int  len;
+} SlsUdpMessage;
+
+#ifdef __linux__
+typedef char mmsghdrSizeCheck[(sizeof(SlsUdpMessage) == sizeof(struct mmsghdr)) ? 1 : -1];
+#endif
+
+/* What became of each packet of a batch */
+enum SlsUdpPacketState { SlsUdpBad, SlsUdpInPlace, SlsUdpMove };
+
+struct SlsUdpBatch {
+  SlsUdpBatch(size_t packetSize) : scratch(BATCH_SIZE * packetSize) {}
+
+  slsReceiverDefs::sls_detector_header headers[BATCH_SIZE];
+  struct iovec      iov[BATCH_SIZE][2];
+  SlsUdpMessage     msgs[BATCH_SIZE];
+  /* The frame and packet the data was read into, frame -1 for the scratch */
+  int               landing[BATCH_SIZE];
+  unsigned          landingPacket[BATCH_SIZE];
+  SlsUdpPacketState state[BATCH_SIZE];
+  std::vector<char> scratch;
+};
+
+SlsDetUdpReceiver::SlsDetUdpReceiver(const char *host, int port, int cpu, unsigned packetsPerFrame,
+                                     size_t packetSize, int socketBuffer, int busyPoll, double idleTime,
+                                     const char *portName) :
+  _portName(portName),
+  _port(port),
+  _cpu(cpu),
+  _packetsPerFrame(packetsPerFrame < MAX_NUM_PACKETS ? packetsPerFrame : MAX_NUM_PACKETS),
+  _packetSize(packetSize),
+  _dataSize(_packetsPerFrame * packetSize),
+  _socketBuffer(socketBuffer),
+  _busyPoll(busyPoll),
+  _idleTime(idleTime),
+  _socket(-1),
+  _running(false),
+  _ending(false),
+  _acquiring(false),
+  _handedOn(false),
+  _predicted(false),
+  _lastDone(0),
+  _nextFrame(0),
+  _nextPacket(0),
+  _framesCaught(0),
+  _pool(NULL),
+  _frames(OPEN_FRAMES),
+  _batch(NULL),
+  _startFunc(NULL),
+  _startArg(NULL),
+  _finishedFunc(NULL),
+  _finishedArg(NULL),
+  _rawDataFunc(NULL),
+  _rawDataArg(NULL),
+  _thread(*this, "slsDetUdp", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityHigh)
+{
+  epicsSnprintf(_host, sizeof(_host), "%s", host ? host : "");
+  /* A buffer holds the header the callback gets followed by the data of the frame */
+  _pool = new SlsDetFramePool(sizeof(slsReceiverDefs::sls_receiver_header) + _dataSize, OPEN_FRAMES,
+                              slsDetNumaNode(_portName));
+  _batch = new SlsUdpBatch(_packetSize);
+  for (int n=0; n<BATCH_SIZE; n++) {
+    std::memset(&_batch->msgs[n], 0, sizeof(_batch->msgs[n]));
+    _batch->iov[n][0].iov_base = &_batch->headers[n];
+    _batch->iov[n][0].iov_len = sizeof(_batch->headers[n]);
+    _batch->iov[n][1].iov_len = _packetSize;
+    _batch->msgs[n].hdr.msg_iov = _batch->iov[n];
+    _batch->msgs[n].hdr.msg_iovlen = 2;
+  }
+  for (unsigned n=0; n<_frames.size(); n++) {
+    _frames[n].buffer = NULL;
+    _frames[n].frameNumber = 0;
+    _frames[n].packets = 0;
+    _frames[n].used = false;
+  }
+  epicsTimeGetCurrent(&_lastPacket);
+  std::memset(&_pending, 0, sizeof(_pending));
+  std::memset(&_stats, 0, sizeof(_stats));
+  _error[0] = '\0';
+}
+
+SlsDetUdpReceiver::~SlsDetUdpReceiver()
+{
+  stop();
+  for (unsigned n=0; n<_frames.size(); n++) {
+    if (_frames[n].used) _frames[n].buffer->release();
+  }
+  delete _batch;
+  delete _pool;
+}
+
+void SlsDetUdpReceiver::registerCallBackStartAcquisition(int (*func)(char*, char*, uint64_t, uint32_t, void*),
+                                                         void *arg)
+{
+  _startFunc = func;
+  _startArg = arg;
+}
+
+void SlsDetUdpReceiver::registerCallBackAcquisitionFinished(void (*func)(uint64_t, void*), void *arg)
+{
+  _finishedFunc = func;
+  _finishedArg = arg;
+}
+
+void SlsDetUdpReceiver::registerCallBackRawDataReady(void (*func)(char*, char*, uint32_t, void*), void *arg)
+{
+  _rawDataFunc = func;
+  _rawDataArg = arg;
+}
+
+const char* SlsDetUdpReceiver::host() const
+{
+  return _host;
+}
+
+int SlsDetUdpReceiver::port() const
+{
+  return _port;
+}
+
+int SlsDetUdpReceiver::cpu() const
+{
+  return _cpu;
+}
+
+size_t SlsDetUdpReceiver::dataSize() const
+{
+  return _dataSize;
+}
+
+void SlsDetUdpReceiver::setError(const char *fmt, ...)
+{
+  va_list args;
+  _lock.lock();
+  va_start(args, fmt);
+  epicsVsnprintf(_error, sizeof(_error), fmt, args);
+  va_end(args);
+  _lock.unlock();
+}
+
+const char* SlsDetUdpReceiver::error()
+{
+  return _error;
+}
+
+void SlsDetUdpReceiver::getStats(SlsDetUdpReceiverStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+}
+
+void SlsDetUdpReceiver::resetStats()
+{
+  int socketBuffer;
+
+  _lock.lock();
+  socketBuffer = _stats.socketBuffer;
+  std::memset(&_stats, 0, sizeof(_stats));
+  _stats.socketBuffer = socketBuffer;
+  _lock.unlock();
+}
+
+bool SlsDetUdpReceiver::start()
+{
+  struct addrinfo hints;
+  struct addrinfo *addr = NULL;
+  struct timeval timeout;
+  char service[16];
+  int size = _socketBuffer;
+  socklen_t length = sizeof(size);
+  int one = 1;
+  int ret;
+
+  if (_running) return true;
+
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  epicsSnprintf(service, sizeof(service), "%d", _port);
+  ret = getaddrinfo(_host[0] ? _host : NULL, service, &hints, &addr);
+  if (ret) {
+    setError("Unable to resolve %s: %s", _host, gai_strerror(ret));
+    return false;
+  }
+
+  _socket = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  if (_socket < 0) {
+    setError("Unable to create the socket for port %d: %s", _port, strerror(errno));
+    freeaddrinfo(addr);
+    return false;
+  }
+  setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  /* Past net.core.rmem_max only a privileged process gets the buffer it asks for */
+  if (_socketBuffer > 0) {
+#ifdef SO_RCVBUFFORCE
+    if (setsockopt(_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)))
+#endif
+      setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  size = 0;
+  getsockopt(_socket, SOL_SOCKET, SO_RCVBUF, &size, &length);
+#ifdef SO_BUSY_POLL
+  if (_busyPoll > 0) {
+    setsockopt(_socket, SOL_SOCKET, SO_BUSY_POLL, &_busyPoll, sizeof(_busyPoll));
+  }
+#endif
+  timeout.tv_sec = 0;
+  timeout.tv_usec = RECV_TIMEOUT * 1000;
+  setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (bind(_socket, addr->ai_addr, addr->ai_addrlen)) {
+    setError("Unable to listen on %s:%d: %s", _host[0] ? _host : "*", _port, strerror(errno));
+    freeaddrinfo(addr);
+    ::close(_socket);
+    _socket = -1;
+    return false;
+  }
+  freeaddrinfo(addr);
+
+  _lock.lock();
+  _stats.socketBuffer = size;
+  _lock.unlock();
+  /* Linux reports twice the buffer asked for, the rest is for its bookkeeping */
+  if (size < _socketBuffer) {
+    setError("Listening on %s:%d with a receive buffer of only %d bytes",
+             _host[0] ? _host : "*", _port, size);
+  } else {
+    setError("Listening on %s:%d", _host[0] ? _host : "*", _port);
+  }
+  _running = true;
+  _thread.start();
+
+  return true;
+}
+
+void SlsDetUdpReceiver::stop()
+{
+  if (_running) {
+    _running = false;
+    _thread.exitWait(THREAD_TMO);
+  }
+  if (_socket >= 0) {
+    ::close(_socket);
+    _socket = -1;
+  }
+}
+
+void SlsDetUdpReceiver::endAcquisition()
+{
+  _lock.lock();
+  _ending = true;
+  _lock.unlock();
+}
+
+slsReceiverDefs::sls_receiver_header* SlsDetUdpReceiver::frameHeader(int slot)
+{
+  return (slsReceiverDefs::sls_receiver_header *) _frames[slot].buffer->data;
+}
+
+char* SlsDetUdpReceiver::packetData(int slot, unsigned packet)
+{
+  return (char *) _frames[slot].buffer->data + sizeof(slsReceiverDefs::sls_receiver_header) +
+         packet * _packetSize;
+}
+
+int SlsDetUdpReceiver::findFrame(epicsUInt64 frameNumber)
+{
+  for (unsigned n=0; n<_frames.size(); n++) {
+    if (_frames[n].used && (_frames[n].frameNumber == frameNumber)) return n;
+  }
+  return -1;
+}
+
+int SlsDetUdpReceiver::openFrame(epicsUInt64 frameNumber, bool evict)
+{
+  int slot = -1;
+  int oldest = -1;
+
+  for (unsigned n=0; n<_frames.size(); n++) {
+    if (!_frames[n].used) {
+      slot = n;
+      break;
+    }
+    if ((oldest < 0) || (_frames[n].frameNumber < _frames[oldest].frameNumber)) oldest = n;
+  }
+
+  if (slot < 0) {
+    if (!evict) return -1;
+    /* The frames go out in order, so nothing older than those open can be let in */
+    if (frameNumber < _frames[oldest].frameNumber) {
+      _pending.late++;
+      return -1;
+    }
+    handOn(oldest);
+    slot = oldest;
+  }
+
+  _frames[slot].buffer = _pool->alloc();
+  if (!_frames[slot].buffer) {
+    if (evict) _pending.noBuffer++;
+    return -1;
+  }
+  *frameHeader(slot) = slsReceiverDefs::sls_receiver_header();
+  _frames[slot].frameNumber = frameNumber;
+  _frames[slot].packets = 0;
+  _frames[slot].used = true;
+
+  return slot;
+}
+
+void SlsDetUdpReceiver::addPacket(int slot, int n)
+{
+  slsReceiverDefs::sls_receiver_header *header = frameHeader(slot);
+
+  /* The header of the frame is that of the first packet to arrive */
+  if (_frames[slot].packets == 0) header->detHeader = _batch->headers[n];
+  header->packetsMask.set(_batch->headers[n].packetNumber);
+  _frames[slot].packets++;
+  _pending.packets++;
+}
+
+void SlsDetUdpReceiver::placeBatch()
+{
+  epicsUInt64 frameNumber = _nextFrame;
+  unsigned packet = _nextPacket;
+  int slot = _predicted ? findFrame(frameNumber) : -1;
+
+  /* The packets are expected to follow the last one in order and on into the next frame */
+  for (int n=0; n<BATCH_SIZE; n++) {
+    if (_predicted && (packet >= _packetsPerFrame)) {
+      frameNumber++;
+      packet = 0;
+      slot = findFrame(frameNumber);
+      if (slot < 0) slot = openFrame(frameNumber, false);
+    }
+    if ((slot >= 0) && (packet < _packetsPerFrame) && !frameHeader(slot)->packetsMask.test(packet)) {
+      _batch->landing[n] = slot;
+      _batch->landingPacket[n] = packet;
+      _batch->iov[n][1].iov_base = packetData(slot, packet);
+    } else {
+      _batch->landing[n] = -1;
+      _batch->iov[n][1].iov_base = &_batch->scratch[n * _packetSize];
+    }
+    packet++;
+  }
+}
+
+int SlsDetUdpReceiver::receive(int count)
+{
+  int ret;
+
+#ifdef __linux__
+  /* Waits for the first packet, then takes what else is already there */
+  ret = recvmmsg(_socket, (struct mmsghdr *) _batch->msgs, count, MSG_WAITFORONE, NULL);
+  return ret > 0 ? ret : 0;
+#else
+  ret = recvmsg(_socket, &_batch->msgs[0].hdr, 0);
+  if (ret < 0) return 0;
+  _batch->msgs[0].len = ret;
+  return 1;
+#endif
+}
+
+void SlsDetUdpReceiver::sortBatch(int count)
+{
+  slsReceiverDefs::sls_detector_header *packet;
+  epicsUInt64 frameNumber;
+  int slot;
+  int last = -1;
+
+  /* Anything that landed in the place of another packet is moved out of the way first */
+  for (int n=0; n<count; n++) {
+    packet = &_batch->headers[n];
+    if ((_batch->msgs[n].len != sizeof(*packet) + _packetSize) ||
+        (_batch->msgs[n].hdr.msg_flags & MSG_TRUNC) || (packet->packetNumber >= _packetsPerFrame)) {
+      _batch->state[n] = SlsUdpBad;
+      _pending.bad++;
+      continue;
+    }
+    slot = _batch->landing[n];
+    if ((slot >= 0) && (_frames[slot].frameNumber == packet->frameNumber) &&
+        (_batch->landingPacket[n] == packet->packetNumber)) {
+      _batch->state[n] = SlsUdpInPlace;
+    } else {
+      if (slot >= 0) {
+        std::memcpy(&_batch->scratch[n * _packetSize], _batch->iov[n][1].iov_base, _packetSize);
+      }
+      _batch->state[n] = SlsUdpMove;
+    }
+  }
+
+  /* The frames of the packets in place are all open */
+  for (int n=0; n<count; n++) {
+    if (_batch->state[n] != SlsUdpInPlace) continue;
+    addPacket(_batch->landing[n], n);
+    if (n > last) last = n;
+  }
+
+  /* The rest are copied to their frames, opening new ones as they come */
+  for (int n=0; n<count; n++) {
+    if (_batch->state[n] != SlsUdpMove) continue;
+    packet = &_batch->headers[n];
+    frameNumber = packet->frameNumber;
+    if (_acquiring && _handedOn && (frameNumber <= _lastDone)) {
+      if (_lastDone - frameNumber < RESTART_FRAMES) {
+        _pending.late++;
+        continue;
+      }
+      handOnAll();
+      finish();
+    }
+    if (!_acquiring) startAcquisition();
+    slot = findFrame(frameNumber);
+    if (slot < 0) slot = openFrame(frameNumber, true);
+    if (slot < 0) continue;
+    if (frameHeader(slot)->packetsMask.test(packet->packetNumber)) {
+      _pending.bad++;
+      continue;
+    }
+    std::memcpy(packetData(slot, packet->packetNumber), &_batch->scratch[n * _packetSize], _packetSize);
+    _pending.moved++;
+    addPacket(slot, n);
+    if (n > last) last = n;
+  }
+
+  if (last >= 0) {
+    _predicted = true;
+    _nextFrame = _batch->headers[last].frameNumber;
+    _nextPacket = _batch->headers[last].packetNumber + 1;
+  }
+
+  /* A complete frame goes out at once, along with any older ones still waiting */
+  while (true) {
+    slot = -1;
+    for (unsigned n=0; n<_frames.size(); n++) {
+      if (_frames[n].used && (_frames[n].packets == _packetsPerFrame) &&
+          ((slot < 0) || (_frames[n].frameNumber < _frames[slot].frameNumber))) {
+        slot = n;
+      }
+    }
+    if (slot < 0) break;
+    handOnOlder(_frames[slot].frameNumber);
+    handOn(slot);
+  }
+}
+
+void SlsDetUdpReceiver::handOn(int slot)
+{
+  SlsUdpFrame *frame = &_frames[slot];
+  slsReceiverDefs::sls_receiver_header *header = frameHeader(slot);
+
+  /* A frame opened for packets that never came is not a frame */
+  if (frame->packets) {
+    header->detHeader.packetNumber = frame->packets;
+    if (frame->packets < _packetsPerFrame) {
+      /* Missing packets are set to all ones so they cannot pass for pixels */
+      for (unsigned packet=0; packet<_packetsPerFrame; packet++) {
+        if (!header->packetsMask.test(packet)) std::memset(packetData(slot, packet), 0xff, _packetSize);
+      }
+      _pending.incomplete++;
+    }
+    if (_rawDataFunc) {
+      _rawDataFunc((char *) header, packetData(slot, 0), _dataSize, _rawDataArg);
+    }
+    _pending.frames++;
+    _framesCaught++;
+    _lastDone = frame->frameNumber;
+    _handedOn = true;
+  }
+  frame->buffer->release();
+  frame->buffer = NULL;
+  frame->used = false;
+}
+
+void SlsDetUdpReceiver::handOnOlder(epicsUInt64 frameNumber)
+{
+  int slot;
+
+  while (true) {
+    slot = -1;
+    for (unsigned n=0; n<_frames.size(); n++) {
+      if (_frames[n].used && (_frames[n].frameNumber < frameNumber) &&
+          ((slot < 0) || (_frames[n].frameNumber < _frames[slot].frameNumber))) {
+        slot = n;
+      }
+    }
+    if (slot < 0) break;
+    handOn(slot);
+  }
+}
+
+void SlsDetUdpReceiver::handOnAll()
+{
+  for (unsigned n=0; n<_frames.size(); n++) {
+    if (_frames[n].used) {
+      handOnOlder(_frames[n].frameNumber);
+      handOn(n);
+    }
+  }
+}
+
+void SlsDetUdpReceiver::startAcquisition()
+{
+  char none[] = "";
+
+  _acquiring = true;
+  _handedOn = false;
+  _lastDone = 0;
+  _framesCaught = 0;
+  /* The files are written elsewhere, so there is no file to name */
+  if (_startFunc) _startFunc(none, none, 0, _dataSize, _startArg);
+}
+
+void SlsDetUdpReceiver::finish()
+{
+  _acquiring = false;
+  _handedOn = false;
+  _predicted = false;
+  _lastDone = 0;
+  if (_finishedFunc) _finishedFunc(_framesCaught, _finishedArg);
+}
+
+void SlsDetUdpReceiver::run()
+{
+  epicsTimeStamp now;
+  bool ending;
+  int count;
+
+  if (!slsDetPinThread(_portName, SlsThreadReceive, _cpu)) {
+    setError("Listening on %s:%d, unable to pin to its cores", _host[0] ? _host : "*", _port);
+  }
+
+  while (_running) {
+    placeBatch();
+    count = receive(BATCH_SIZE);
+
+    _lock.lock();
+    ending = _ending;
+    _ending = false;
+    _lock.unlock();
+
+    if (count > 0) {
+      epicsTimeGetCurrent(&_lastPacket);
+      _pending.reads++;
+      sortBatch(count);
+    } else {
+      /* The frames in hand will not get any more packets */
+      handOnAll();
+      if (_acquiring && (_idleTime > 0.)) {
+        epicsTimeGetCurrent(&now);
+        if (epicsTimeDiffInSeconds(&now, &_lastPacket) >= _idleTime) ending = true;
+      }
+    }
+    if (ending && _acquiring) {
+      handOnAll();
+      finish();
+    }
+
+    _lock.lock();
+    _stats.packets += _pending.packets;
+    _stats.frames += _pending.frames;
+    _stats.incomplete += _pending.incomplete;
+    _stats.late += _pending.late;
+    _stats.bad += _pending.bad;
+    _stats.moved += _pending.moved;
+    _stats.noBuffer += _pending.noBuffer;
+    _stats.reads += _pending.reads;
+    _lock.unlock();
+    std::memset(&_pending, 0, sizeof(_pending));
+  }
+
+  handOnAll();
+  if (_acquiring) finish();
+  slsDetUnpinThread();
+}
@@ -0,0 +1,160 @@
+#ifndef slsDetUdpReceiver_H
+#define slsDetUdpReceiver_H
+
+#include <sls_receiver_defs.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsTypes.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class SlsDetFrame;
+class SlsDetFramePool;
+struct SlsUdpBatch;
+
+/** Counters kept by the SlsDetUdpReceiver */
+typedef struct {
+  epicsUInt64 packets;      /**< packets put in a frame */
+  epicsUInt64 frames;       /**< frames handed to the callback */
+  epicsUInt64 incomplete;   /**< frames handed on with packets missing */
+  epicsUInt64 late;         /**< packets of frames already handed on */
+  epicsUInt64 bad;          /**< packets of the wrong size or number, or a second copy */
+  epicsUInt64 moved;        /**< packets that did not land where they were expected */
+  epicsUInt64 noBuffer;     /**< packets dropped with no buffer free for their frame */
+  epicsUInt64 reads;        /**< reads of the socket that returned packets */
+  int         socketBuffer; /**< receive buffer the kernel gave the socket in bytes */
+} SlsDetUdpReceiverStats;
+
+/** Class definition for the SlsDetUdpReceiver class
+  *
+  * Receives the UDP packets of one module straight from the detector, in
+  * place of an slsReceiverUsers, and hands each frame to the same callbacks
+  * with an sls_receiver_header in front of the data, so the driver can use
+  * either. There is one thread per UDP port which reads the packets in
+  * batches, with recvmmsg where there is one, from a socket with a large
+  * receive buffer and optionally busy polling.
+  *
+  * The packets are read straight into the place in a pooled frame buffer
+  * where the next packets of the frame belong, so in order packets are never
+  * copied; those that land somewhere else are moved to their place on
+  * packetNumber. A few frames are kept open at once for packets that arrive
+  * out of order. A frame is handed on when all its packets are in, when a
+  * later frame completes, when there is no buffer left for a new frame or
+  * when the packets stop. The packetsMask has a bit set for every packet
+  * caught and packetNumber of the header holds how many there were, as the
+  * slsReceiver fills them.
+  *
+  * Nothing tells the receiver when the detector starts or stops, so an
+  * acquisition starts with the first packet and ends after the packets stop
+  * for the idle time, when endAcquisition() is called or when the frame
+  * numbers start again from a lower number.
+  */
+class SlsDetUdpReceiver : public epicsThreadRunable {
+public:
+  /* host is the address to listen on, NULL or empty for all of them; cpu is
+   * the core to pin the thread to, -1 for the receive cores of the port
+   * portName, whose NUMA node the frame buffers are also bound to;
+   * socketBuffer the receive buffer to ask for in bytes; busyPoll the time to
+   * busy poll the device for in us, 0 not to; idleTime the seconds without a
+   * packet that end an acquisition, 0 to wait for endAcquisition() */
+  SlsDetUdpReceiver(const char *host, int port, int cpu, unsigned packetsPerFrame,
+                    size_t packetSize, int socketBuffer, int busyPoll, double idleTime,
+                    const char *portName=NULL);
+  virtual ~SlsDetUdpReceiver();
+  virtual void run();
+
+  /* The callbacks of slsReceiverUsers, registered before start() */
+  void registerCallBackStartAcquisition(int (*func)(char *filePath, char *fileName, uint64_t fileIndex,
+                                                    uint32_t dataSize, void *arg), void *arg);
+  void registerCallBackAcquisitionFinished(void (*func)(uint64_t framesCaught, void *arg), void *arg);
+  void registerCallBackRawDataReady(void (*func)(char *header, char *data, uint32_t dataSize,
+                                                 void *arg), void *arg);
+
+  /* Binds the socket and starts the thread, returning false on failure */
+  virtual bool start();
+  virtual void stop();
+  /* Hands on the frames in hand and ends the acquisition, packets that come
+   * after start a new one */
+  virtual void endAcquisition();
+
+  const char* host() const;
+  int port() const;
+  int cpu() const;
+  size_t dataSize() const;
+  void getStats(SlsDetUdpReceiverStats *stats);
+  void resetStats();
+  /* Description of what went wrong */
+  const char* error();
+
+protected:
+  void setError(const char *fmt, ...);
+  /* Reads up to count packets, returning how many or 0 after the timeout */
+  virtual int receive(int count);
+  virtual void placeBatch();
+  virtual void sortBatch(int count);
+  virtual void handOn(int slot);
+  virtual void handOnOlder(epicsUInt64 frameNumber);
+  virtual void handOnAll();
+  virtual void finish();
+
+private:
+  /* A frame being put together */
+  typedef struct {
+    SlsDetFrame *buffer;
+    epicsUInt64 frameNumber;
+    unsigned    packets;
+    bool        used;
+  } SlsUdpFrame;
+
+private:
+  int findFrame(epicsUInt64 frameNumber);
+  int openFrame(epicsUInt64 frameNumber, bool evict);
+  void addPacket(int slot, int n);
+  void startAcquisition();
+  slsReceiverDefs::sls_receiver_header* frameHeader(int slot);
+  char* packetData(int slot, unsigned packet);
+
+private:
+  char                  _host[64];
+  const char            *_portName;
+  const int             _port;
+  const int             _cpu;
+  const unsigned        _packetsPerFrame;
+  const size_t          _packetSize;
+  const size_t          _dataSize;
+  const int             _socketBuffer;
+  const int             _busyPoll;
+  const double          _idleTime;
+  int                   _socket;
+  bool                  _running;
+  bool                  _ending;
+  bool                  _acquiring;
+  bool                  _handedOn;
+  bool                  _predicted;
+  epicsUInt64           _lastDone;
+  /* The frame and packet the next packet is expected to be */
+  epicsUInt64           _nextFrame;
+  unsigned              _nextPacket;
+  epicsUInt64           _framesCaught;
+  epicsTimeStamp        _lastPacket;
+  SlsDetFramePool       *_pool;
+  std::vector<SlsUdpFrame> _frames;
+  /* Where the packets of a batch are read to */
+  SlsUdpBatch           *_batch;
+  int                   (*_startFunc)(char*, char*, uint64_t, uint32_t, void*);
+  void                  *_startArg;
+  void                  (*_finishedFunc)(uint64_t, void*);
+  void                  *_finishedArg;
+  void                  (*_rawDataFunc)(char*, char*, uint32_t, void*);
+  void                  *_rawDataArg;
+  SlsDetUdpReceiverStats _pending;
+  SlsDetUdpReceiverStats _stats;
+  char                  _error[256];
+  epicsMutex            _lock;
+  epicsThread           _thread;
+};
+
+#endif
@@ -0,0 +1,412 @@
+#include "slsDetWriter.h"
+#include "slsDetFramePool.h"
+#include "slsDetAffinity.h"
+
+#include <epicsStdio.h>
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdarg>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define THREAD_TMO 10.0
+/* How often the rate and latency are worked out */
+#define WINDOW_TIME 1.0
+/* How long the writer waits for a frame before it calls idle() */
+#define IDLE_TIME 0.5
+
+SlsDetWriter::SlsDetWriter(unsigned queueDepth, const char *extension, const char *portName) :
+  _queueDepth(queueDepth > 0 ? queueDepth : 1),
+  _extension(extension),
+  _portName(portName),
+  _configured(false),
+  _open(false),
+  _stopped(false),
+  _fd(-1),
+  _failed(false),
+  _subFile(0),
+  _framesInFile(0),
+  _header(NULL),
+  _offset(0),
+  _windowBytes(0),
+  _windowFrames(0),
+  _windowTime(0.),
+  _queue(_queueDepth),
+  _thread(*this, "slsDetWriter", epicsThreadGetStackSize(epicsThreadStackMedium), epicsThreadPriorityMedium)
+{
+  void *header = NULL;
+
+  /* The header block goes out with the pixels so it has to suit O_DIRECT too */
+  if (posix_memalign(&header, SLS_FRAME_ALIGN, SLS_RAW_HEADER_SIZE)) {
+    throw std::bad_alloc();
+  }
+  std::memset(header, 0, SLS_RAW_HEADER_SIZE);
+  _header = (SlsDetRawHeader *) header;
+
+  std::memset(&_next, 0, sizeof(_next));
+  std::memset(&_config, 0, sizeof(_config));
+  std::memset(&_stats, 0, sizeof(_stats));
+  epicsTimeGetCurrent(&_windowStart);
+  epicsSnprintf(_status, sizeof(_status), "Idle");
+  _thread.start();
+}
+
+SlsDetWriter::~SlsDetWriter()
+{
+  shutdown();
+  std::free(_header);
+}
+
+void SlsDetWriter::shutdown()
+{
+  if (_stopped) return;
+  _stopped = true;
+  _queue.pushMarker(SlsWriteQuit);
+  _thread.exitWait(THREAD_TMO);
+}
+
+unsigned SlsDetWriter::queueDepth() const
+{
+  return _queueDepth;
+}
+
+void SlsDetWriter::open(const char *path, const char *name, int fileIndex,
+                        unsigned framesPerFile, bool direct)
+{
+  _lock.lock();
+  epicsSnprintf(_next.path, sizeof(_next.path), "%s", path);
+  epicsSnprintf(_next.name, sizeof(_next.name), "%s", name);
+  _next.fileIndex = fileIndex;
+  _next.framesPerFile = framesPerFile;
+  _next.direct = direct;
+  _lock.unlock();
+  _queueLock.lock();
+  _configured = true;
+  _queueLock.unlock();
+}
+
+void SlsDetWriter::setPacketsPerModule(unsigned packets)
+{
+  _lock.lock();
+  _next.packetsPerModule = packets;
+  _lock.unlock();
+}
+
+bool SlsDetWriter::write(SlsDetFrame *frame)
+{
+  bool queued;
+
+  /* The writer thread never takes this lock, so a blocked push cannot hold it up */
+  _queueLock.lock();
+  if (!_configured) {
+    _queueLock.unlock();
+    _lock.lock();
+    _stats.dropped++;
+    _lock.unlock();
+    frame->release();
+    return false;
+  }
+  queued = _queue.push(frame);
+  _queueLock.unlock();
+
+  return queued;
+}
+
+void SlsDetWriter::close()
+{
+  _queueLock.lock();
+  _configured = false;
+  _queue.pushMarker(SlsWriteClose);
+  _queueLock.unlock();
+}
+
+void SlsDetWriter::setPolicy(SlsQueuePolicy policy, unsigned decimation)
+{
+  _queue.setPolicy(policy, decimation);
+}
+
+void SlsDetWriter::getStats(SlsDetWriterStats *stats)
+{
+  _lock.lock();
+  *stats = _stats;
+  _lock.unlock();
+  _queue.getStats(&stats->queue);
+  stats->dropped += stats->queue.dropped + stats->queue.decimated;
+}
+
+void SlsDetWriter::resetStats()
+{
+  _lock.lock();
+  std::memset(&_stats, 0, sizeof(_stats));
+  _lock.unlock();
+  _queue.resetStats();
+}
+
+const char* SlsDetWriter::status()
+{
+  return _status;
+}
+
+void SlsDetWriter::setStatus(const char *fmt, ...)
+{
+  va_list args;
+  _lock.lock();
+  va_start(args, fmt);
+  epicsVsnprintf(_status, sizeof(_status), fmt, args);
+  va_end(args);
+  _lock.unlock();
+}
+
+void SlsDetWriter::framesWritten(unsigned count, size_t bytes, double elapsed)
+{
+  epicsTimeStamp now;
+  double window;
+
+  epicsTimeGetCurrent(&now);
+  _lock.lock();
+  _stats.frames += count;
+  _stats.bytes += bytes;
+  if (elapsed * 1.e3 > _stats.maxLatency) _stats.maxLatency = elapsed * 1.e3;
+  _windowBytes += bytes;
+  _windowFrames++;
+  _windowTime += elapsed;
+  window = epicsTimeDiffInSeconds(&now, &_windowStart);
+  if (window >= WINDOW_TIME) {
+    _stats.rate = _windowBytes / window / 1.e6;
+    _stats.latency = _windowTime / _windowFrames * 1.e3;
+    _windowStart = now;
+    _windowBytes = 0;
+    _windowFrames = 0;
+    _windowTime = 0.;
+  }
+  _lock.unlock();
+}
+
+void SlsDetWriter::framesFailed(unsigned count)
+{
+  _lock.lock();
+  _stats.failed += count;
+  _lock.unlock();
+}
+
+bool SlsDetWriter::newFile()
+{
+  /* Only called from the writer thread */
+  char fileName[sizeof(_config.path) + sizeof(_config.name) + 64];
+  bool direct = false;
+
+  /* Named like the files of the slsReceiver so the same tools find them */
+  epicsSnprintf(fileName, sizeof(fileName), "%s/%s_d0_f%012u_%d.%s",
+                _config.path, _config.name, _subFile, _config.fileIndex, _extension);
+
+  _open = openFile(fileName, _config.direct, &direct);
+  if (_open) {
+    _lock.lock();
+    epicsSnprintf(_status, sizeof(_status), "%s", fileName);
+    _stats.files++;
+    _stats.direct = direct;
+    _lock.unlock();
+  }
+  _framesInFile = 0;
+
+  return _open;
+}
+
+void SlsDetWriter::openIndex()
+{
+  /* Only called from the writer thread */
+  char fileName[sizeof(_config.path) + sizeof(_config.name) + 64];
+
+  /* One index for all the files of the acquisition */
+  epicsSnprintf(fileName, sizeof(fileName), "%s/%s_d0_%d.idx",
+                _config.path, _config.name, _config.fileIndex);
+  if (!_index.open(fileName, fileFormat(), _config.fileIndex)) {
+    setStatus("%s", _index.error());
+  }
+}
+
+void SlsDetWriter::closeIndex()
+{
+  /* Only called from the writer thread */
+  if (_index.isOpen() && !_index.close()) {
+    setStatus("%s", _index.error());
+  }
+}
+
+void SlsDetWriter::indexFrame(SlsDetFrame *frame, epicsUInt64 offset, size_t size)
+{
+  SlsDetIndexEntry entry;
+  epicsUInt32 packetsCaught = 0;
+  epicsUInt32 missing = 0;
+
+  for (int mod=0; mod<frame->numModules; mod++) {
+    packetsCaught += frame->packetsCaught[mod];
+    if (frame->missingMask & (1ULL << mod)) missing++;
+  }
+  std::memset(&entry, 0, sizeof(entry));
+  entry.frameNumber = frame->frameNumber;
+  entry.timestamp = frame->timestamp;
+  entry.bunchId = frame->bunchId;
+  entry.offset = offset;
+  entry.fileId = _subFile;
+  entry.size = size;
+  if (_config.packetsPerModule * frame->numModules > packetsCaught) {
+    entry.packetsLost = _config.packetsPerModule * frame->numModules - packetsCaught;
+  }
+  entry.missingModules = missing;
+  _index.add(entry);
+}
+
+int SlsDetWriter::fileFormat() const
+{
+  return slsReceiverDefs::BINARY;
+}
+
+bool SlsDetWriter::openFile(const char *fileName, bool direct, bool *isDirect)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  _fd = -1;
+  _offset = 0;
+#ifdef O_DIRECT
+  if (direct) {
+    _fd = ::open(fileName, flags | O_DIRECT, 0664);
+    *isDirect = _fd >= 0;
+  }
+#endif
+  /* Older tmpfs and some network file systems refuse O_DIRECT with EINVAL */
+  if (_fd < 0) {
+    _fd = ::open(fileName, flags, 0664);
+  }
+  if (_fd < 0) {
+    setStatus("Unable to open %s: %s", fileName, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+void SlsDetWriter::closeFile()
+{
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+void SlsDetWriter::idle()
+{
+}
+
+bool SlsDetWriter::writeFrame(SlsDetFrame *frame)
+{
+  struct iovec iov[2];
+  size_t recordSize;
+  ssize_t written;
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+
+  _header->frameNumber = frame->frameNumber;
+  _header->timestamp = frame->timestamp;
+  _header->bunchId = frame->bunchId;
+  _header->missingMask = frame->missingMask;
+  _header->dataSize = frame->sizeX * frame->sizeY * frame->bytesPerPixel;
+  _header->photonEnergy = frame->photonEnergy;
+  _header->photonError = frame->photonError;
+  _header->sizeX = frame->sizeX;
+  _header->sizeY = frame->sizeY;
+  _header->bytesPerPixel = frame->bytesPerPixel;
+  _header->numModules = frame->numModules;
+  _header->dataType = frame->dataType;
+  std::memcpy(_header->packetsCaught, frame->packetsCaught, sizeof(_header->packetsCaught));
+  std::memcpy(_header->module, frame->header, sizeof(_header->module));
+
+  /* The pool pads every buffer to whole blocks */
+  iov[0].iov_base = _header;
+  iov[0].iov_len = SLS_RAW_HEADER_SIZE;
+  iov[1].iov_base = frame->data;
+  iov[1].iov_len = SLS_FRAME_PADDED(_header->dataSize);
+  recordSize = iov[0].iov_len + iov[1].iov_len;
+
+  epicsTimeGetCurrent(&start);
+  written = ::writev(_fd, iov, 2);
+  epicsTimeGetCurrent(&end);
+
+  if (written != (ssize_t) recordSize) {
+    setStatus("Unable to write frame %llu: %s", (unsigned long long) frame->frameNumber,
+              written < 0 ? strerror(errno) : "disk full");
+    framesFailed(1);
+    return false;
+  }
+  framesWritten(1, recordSize, epicsTimeDiffInSeconds(&end, &start));
+  indexFrame(frame, _offset, recordSize);
+  _offset += recordSize;
+
+  return true;
+}
+
+void SlsDetWriter::run()
+{
+  SlsDetFrame *frame;
+  int command;
+
+  slsDetPinThread(_portName, SlsThreadWrite);
+
+  std::memcpy(_header->magic, SLS_RAW_MAGIC, sizeof(SLS_RAW_MAGIC));
+  _header->version = SLS_RAW_VERSION;
+  _header->headerSize = SLS_RAW_HEADER_SIZE;
+
+  while (true) {
+    if (!_queue.pop(&frame, &command, IDLE_TIME)) {
+      if (_open) {
+        idle();
+        _index.flush(true);
+      }
+      continue;
+    }
+
+    if (frame) {
+      /* The first frame of an acquisition picks up its settings */
+      if (!_open && !_failed) {
+        _lock.lock();
+        _config = _next;
+        _lock.unlock();
+        _subFile = 0;
+        epicsTimeGetCurrent(&_windowStart);
+        openIndex();
+        _failed = !newFile();
+      } else if (_open && _config.framesPerFile && (_framesInFile >= _config.framesPerFile)) {
+        closeFile();
+        _open = false;
+        _subFile++;
+        _failed = !newFile();
+      }
+
+      if (_open) {
+        if (writeFrame(frame)) _framesInFile++;
+      } else {
+        framesFailed(1);
+      }
+      frame->release();
+    } else {
+      if (_open) {
+        closeFile();
+        _open = false;
+      }
+      closeIndex();
+      _failed = false;
+      _lock.lock();
+      _stats.rate = 0.;
+      _stats.latency = 0.;
+      _lock.unlock();
+      if (command == SlsWriteQuit) break;
+    }
+  }
+
+  slsDetUnpinThread();
+}
@@ -0,0 +1,165 @@
+#ifndef slsDetWriter_H
+#define slsDetWriter_H
+
+#include "slsDetFrame.h"
+#include "slsDetFrameIndex.h"
+#include "slsDetFrameQueue.h"
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+/* Magic and version at the start of every frame record of a raw file */
+#define SLS_RAW_MAGIC "SLSDRAW"
+#define SLS_RAW_VERSION 2
+/* Size of the header in front of the pixels of each frame record */
+#define SLS_RAW_HEADER_SIZE 4096
+
+/** Header of each frame record in a raw file, followed by the pixels padded
+  * to a multiple of SLS_RAW_HEADER_SIZE */
+typedef struct {
+  char        magic[8];               /**< SLS_RAW_MAGIC */
+  epicsUInt32 version;                /**< SLS_RAW_VERSION */
+  epicsUInt32 headerSize;             /**< SLS_RAW_HEADER_SIZE */
+  epicsUInt64 frameNumber;            /**< frame number shared by all the modules */
+  epicsUInt64 timestamp;              /**< timestamp of the first module to arrive */
+  epicsUInt64 bunchId;                /**< bunch id of the first module to arrive */
+  epicsUInt64 missingMask;            /**< bit n is set if module n is missing */
+  epicsUInt64 dataSize;               /**< size of the pixels in bytes, without padding */
+  double      photonEnergy;           /**< keV of a photon if the pixels count photons, 0 for raw data */
+  double      photonError;            /**< RMS error of the photon counts against the energy in keV */
+  epicsUInt32 sizeX;                  /**< image width in pixels */
+  epicsUInt32 sizeY;                  /**< image height in pixels */
+  epicsUInt32 bytesPerPixel;          /**< size of a pixel in bytes */
+  epicsUInt32 numModules;             /**< number of modules in the detector */
+  epicsUInt32 dataType;               /**< SlsFrameDataType of the pixels */
+  epicsUInt32 packetsCaught[SLS_MAX_MODULES];                    /**< packets in each packetsMask */
+  slsReceiverDefs::sls_detector_header module[SLS_MAX_MODULES];  /**< module headers */
+} SlsDetRawHeader;
+
+/** Counters kept by the SlsDetWriter */
+typedef struct {
+  epicsUInt64 frames;       /**< frames written */
+  epicsUInt64 dropped;      /**< frames dropped or decimated by the queue, or while closed */
+  epicsUInt64 failed;       /**< frames lost to a file that could not be opened or written */
+  epicsUInt64 files;        /**< files opened */
+  epicsUInt64 bytes;        /**< bytes written, headers and padding included */
+  double      rate;         /**< MB/s over the last second of writing */
+  double      latency;      /**< mean time of a frame write over the last second in ms */
+  double      maxLatency;   /**< longest frame write since the files were opened in ms */
+  bool        direct;       /**< the current file bypasses the page cache */
+  SlsDetFrameQueueStats queue;  /**< the frames waiting to be written */
+} SlsDetWriterStats;
+
+/** Class definition for the SlsDetWriter class
+  *
+  * Writes frames from a SlsDetFramePool to raw files on its own thread. Each
+  * frame is a record of a SlsDetRawHeader block followed by the pooled buffer
+  * as it is, so with O_DIRECT the pixels go from the pool to the disk without
+  * a copy or a trip through the page cache. File systems that do not support
+  * O_DIRECT (tmpfs before Linux 6.6 for one) get buffered writes instead.
+  *
+  * Up to queueDepth frames wait to be written; what happens to frames that
+  * find the queue full is set by its policy, by default they are dropped
+  * rather than holding up the acquisition. The files are named
+  * like those of the slsReceiver, <name>_d0_f<n>_<index>.raw, and roll over
+  * to the next n every framesPerFile frames. Every acquisition also gets
+  * an index, <name>_d0_<index>.idx, of where each of its frames went.
+  *
+  * Other file formats derive from it and replace how files are opened,
+  * written and closed, keeping the queue, the rollover and the counters.
+  */
+class SlsDetWriter : public epicsThreadRunable {
+public:
+  /* portName is the port whose thread placement the writer follows */
+  SlsDetWriter(unsigned queueDepth, const char *extension="raw", const char *portName=NULL);
+  virtual ~SlsDetWriter();
+  virtual void run();
+
+  /* Sets up the files of an acquisition, the first is created with its first frame */
+  virtual void open(const char *path, const char *name, int fileIndex,
+                    unsigned framesPerFile, bool direct);
+  /* Takes over a reference to the frame, returning false if it was dropped */
+  virtual bool write(SlsDetFrame *frame);
+  /* Closes the file once the frames before it are written */
+  virtual void close();
+
+  /* Packets a complete module sends, to count the packets lost in the index */
+  void setPacketsPerModule(unsigned packets);
+  /* What to do with frames when the queue is full */
+  void setPolicy(SlsQueuePolicy policy, unsigned decimation);
+
+  unsigned queueDepth() const;
+  void getStats(SlsDetWriterStats *stats);
+  void resetStats();
+  /* The file being written or the last thing that went wrong */
+  const char* status();
+
+protected:
+  /* These are only called from the writer thread */
+  virtual bool openFile(const char *fileName, bool direct, bool *isDirect);
+  virtual void closeFile();
+  /* Returns false if the frame was lost, the writer releases it afterwards */
+  virtual bool writeFrame(SlsDetFrame *frame);
+  /* Called while a file is open and no frame came for a while */
+  virtual void idle();
+  /* slsReceiverDefs::fileFormat of the files, for the index */
+  virtual int fileFormat() const;
+
+  /* Counts frames once they are in the file or lost */
+  void framesWritten(unsigned count, size_t bytes, double elapsed);
+  void framesFailed(unsigned count);
+  /* Adds a frame written to the current file to the index */
+  void indexFrame(SlsDetFrame *frame, epicsUInt64 offset, size_t size);
+  void setStatus(const char *fmt, ...);
+  /* Stops the writer thread, derived classes call it first in their destructor */
+  void shutdown();
+
+private:
+  bool newFile();
+  void openIndex();
+  void closeIndex();
+
+private:
+  /* Markers queued behind the frames */
+  typedef enum { SlsWriteClose, SlsWriteQuit } SlsWriteCommand;
+
+  typedef struct {
+    char      path[256];
+    char      name[256];
+    int       fileIndex;
+    unsigned  framesPerFile;
+    unsigned  packetsPerModule;
+    bool      direct;
+  } SlsWriteConfig;
+
+private:
+  const unsigned    _queueDepth;
+  const char        *_extension;
+  const char        *_portName;
+  SlsWriteConfig    _next;
+  SlsWriteConfig    _config;
+  bool              _configured;
+  bool              _open;
+  bool              _stopped;
+  int               _fd;
+  bool              _failed;
+  unsigned          _subFile;
+  unsigned          _framesInFile;
+  SlsDetRawHeader   *_header;
+  epicsUInt64       _offset;
+  SlsDetIndexWriter _index;
+  epicsTimeStamp    _windowStart;
+  epicsUInt64       _windowBytes;
+  epicsUInt64       _windowFrames;
+  double            _windowTime;
+  SlsDetWriterStats _stats;
+  char              _status[512];
+  epicsMutex        _lock;
+  /* Keeps the frames of an acquisition in front of its close */
+  epicsMutex        _queueLock;
+  SlsDetFrameQueue  _queue;
+  epicsThread       _thread;
+};
+
+#endif
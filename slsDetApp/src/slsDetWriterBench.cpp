@@ -0,0 +1,105 @@
+/* Measures the sustained rate of the raw writer into a directory, e.g.
+ *   slsDetWriterBench /dev/shm 2000 1
+ *   slsDetWriterBench /data/bench 2000 1
+ * to compare tmpfs, where older kernels fall back to buffered writes, with a
+ * local disk. The files written are removed at the end. */
+
+#include "slsDetWriter.h"
+#include "slsDetFramePool.h"
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+/* A Jungfrau module */
+#define MODULE_COLS 1024
+#define MODULE_ROWS 512
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s <directory> [frames=2000] [direct=1] [queue depth=16] "
+                  "[frames per file=1000] [modules=1]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dir;
+  unsigned numFrames = 2000;
+  bool direct = true;
+  unsigned queueDepth = 16;
+  unsigned framesPerFile = 1000;
+  int numModules = 1;
+  SlsDetWriterStats stats;
+  epicsTimeStamp start;
+  epicsTimeStamp end;
+  double elapsed;
+  char fileName[512];
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  dir = argv[1];
+  if (argc > 2) numFrames = std::atoi(argv[2]);
+  if (argc > 3) direct = std::atoi(argv[3]) != 0;
+  if (argc > 4) queueDepth = std::atoi(argv[4]);
+  if (argc > 5) framesPerFile = std::atoi(argv[5]);
+  if (argc > 6) numModules = std::atoi(argv[6]);
+  if ((numFrames < 1) || (queueDepth < 1) || (numModules < 1) || (numModules > SLS_MAX_MODULES)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* With no more buffers than queue places the writer never has to drop a frame */
+  size_t frameSize = (size_t) numModules * MODULE_COLS * MODULE_ROWS * 2;
+  SlsDetFramePool pool(frameSize, queueDepth);
+  SlsDetWriter writer(queueDepth);
+
+  writer.open(dir, "slsDetWriterBench", 0, framesPerFile, direct);
+  epicsTimeGetCurrent(&start);
+  for (unsigned n=0; n<numFrames; n++) {
+    SlsDetFrame *frame;
+    while (!(frame = pool.alloc())) {
+      epicsThreadSleep(0.0001);
+    }
+    frame->frameNumber = n + 1;
+    frame->numModules = numModules;
+    frame->sizeX = MODULE_COLS;
+    frame->sizeY = MODULE_ROWS * numModules;
+    frame->setDataType(SlsFrameUInt16);
+    /* Touch the pixels like the assembler would */
+    std::memset(frame->data, n & 0xff, frameSize);
+    writer.write(frame);
+  }
+  writer.close();
+  do {
+    epicsThreadSleep(0.001);
+    writer.getStats(&stats);
+  } while (stats.frames + stats.failed + stats.dropped < numFrames);
+  epicsTimeGetCurrent(&end);
+  elapsed = epicsTimeDiffInSeconds(&end, &start);
+
+  printf("%s: %s writes, %u frames of %.2f MB, queue depth %u\n", dir,
+         stats.direct ? "O_DIRECT" : "buffered", numFrames, frameSize / 1.e6, queueDepth);
+  printf("  %.1f MB/s, %.0f frames/s, %.3f ms per frame, longest write %.3f ms\n",
+         stats.bytes / elapsed / 1.e6, numFrames / elapsed,
+         stats.frames ? elapsed * 1.e3 / stats.frames : 0., stats.maxLatency);
+  printf("  %llu written, %llu dropped, %llu failed, %llu files\n",
+         (unsigned long long) stats.frames, (unsigned long long) stats.dropped,
+         (unsigned long long) stats.failed, (unsigned long long) stats.files);
+  if (stats.failed) printf("  %s\n", writer.status());
+
+  for (unsigned n=0; n<stats.files; n++) {
+    epicsSnprintf(fileName, sizeof(fileName), "%s/slsDetWriterBench_d0_f%012u_0.raw", dir, n);
+    unlink(fileName);
+  }
+  /* The writer keeps the index open until it is deleted, unlinking it first is fine */
+  epicsSnprintf(fileName, sizeof(fileName), "%s/slsDetWriterBench_d0_0.idx", dir);
+  unlink(fileName);
+
+  return stats.failed ? 1 : 0;
+}
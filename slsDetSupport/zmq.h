@@ -0,0 +1,125 @@
+/*
+    The part of the libzmq API used by the slsDet module, declared to match
+    the libzmq.a 4.0.8 shipped with the slsDetectorPackage, which does not
+    install the zmq.h it was built with. See http://zeromq.org for the full
+    header, the constants below keep the values they have there. Options
+    marked as newer than 4.0 are refused by that library, check
+    zmq_version() or the return of zmq_setsockopt() before relying on them.
+*/
+
+#ifndef __ZMQ_H_INCLUDED__
+#define __ZMQ_H_INCLUDED__
+
+#include <errno.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  Version of the library actually linked */
+void zmq_version (int *major, int *minor, int *patch);
+
+/*  Errors */
+#define ZMQ_HAUSNUMBER 156384712
+#define EFSM (ZMQ_HAUSNUMBER + 51)
+#define ENOCOMPATPROTO (ZMQ_HAUSNUMBER + 52)
+#define ETERM (ZMQ_HAUSNUMBER + 53)
+#define EMTHREAD (ZMQ_HAUSNUMBER + 54)
+
+int zmq_errno (void);
+const char *zmq_strerror (int errnum);
+
+/*  Contexts */
+#define ZMQ_IO_THREADS  1
+#define ZMQ_MAX_SOCKETS 2
+
+void *zmq_ctx_new (void);
+int zmq_ctx_term (void *context);
+int zmq_ctx_shutdown (void *ctx_);
+int zmq_ctx_set (void *context, int option, int optval);
+int zmq_ctx_get (void *context, int option);
+
+/*  Messages */
+typedef struct zmq_msg_t {unsigned char _ [64];} zmq_msg_t;
+
+typedef void (zmq_free_fn) (void *data, void *hint);
+
+int zmq_msg_init (zmq_msg_t *msg);
+int zmq_msg_init_size (zmq_msg_t *msg, size_t size);
+int zmq_msg_init_data (zmq_msg_t *msg, void *data,
+    size_t size, zmq_free_fn *ffn, void *hint);
+int zmq_msg_send (zmq_msg_t *msg, void *s, int flags);
+int zmq_msg_recv (zmq_msg_t *msg, void *s, int flags);
+int zmq_msg_close (zmq_msg_t *msg);
+int zmq_msg_move (zmq_msg_t *dest, zmq_msg_t *src);
+int zmq_msg_copy (zmq_msg_t *dest, zmq_msg_t *src);
+void *zmq_msg_data (zmq_msg_t *msg);
+size_t zmq_msg_size (zmq_msg_t *msg);
+int zmq_msg_more (zmq_msg_t *msg);
+
+/*  Socket types */
+#define ZMQ_PAIR 0
+#define ZMQ_PUB 1
+#define ZMQ_SUB 2
+#define ZMQ_REQ 3
+#define ZMQ_REP 4
+#define ZMQ_DEALER 5
+#define ZMQ_ROUTER 6
+#define ZMQ_PULL 7
+#define ZMQ_PUSH 8
+#define ZMQ_XPUB 9
+#define ZMQ_XSUB 10
+
+/*  Socket options */
+#define ZMQ_SUBSCRIBE 6
+#define ZMQ_UNSUBSCRIBE 7
+#define ZMQ_SNDBUF 11
+#define ZMQ_RCVBUF 12
+#define ZMQ_RCVMORE 13
+#define ZMQ_LINGER 17
+#define ZMQ_SNDHWM 23
+#define ZMQ_RCVHWM 24
+#define ZMQ_RCVTIMEO 27
+#define ZMQ_SNDTIMEO 28
+#define ZMQ_LAST_ENDPOINT 32
+#define ZMQ_CONFLATE 54
+#define ZMQ_XPUB_NODROP 69  /* libzmq 4.1 */
+
+/*  Send/recv options */
+#define ZMQ_DONTWAIT 1
+#define ZMQ_SNDMORE 2
+
+void *zmq_socket (void *, int type);
+int zmq_close (void *s);
+int zmq_setsockopt (void *s, int option, const void *optval,
+    size_t optvallen);
+int zmq_getsockopt (void *s, int option, void *optval,
+    size_t *optvallen);
+int zmq_bind (void *s, const char *addr);
+int zmq_connect (void *s, const char *addr);
+int zmq_unbind (void *s, const char *addr);
+int zmq_disconnect (void *s, const char *addr);
+int zmq_send (void *s, const void *buf, size_t len, int flags);
+int zmq_recv (void *s, void *buf, size_t len, int flags);
+
+/*  I/O multiplexing */
+#define ZMQ_POLLIN 1
+#define ZMQ_POLLOUT 2
+#define ZMQ_POLLERR 4
+
+typedef struct zmq_pollitem_t
+{
+    void *socket;
+    int fd;
+    short events;
+    short revents;
+} zmq_pollitem_t;
+
+int zmq_poll (zmq_pollitem_t *items, int nitems, long timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif